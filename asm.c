@@ -0,0 +1,893 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: asm.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "linkedlist.h"
+#include "bst.h"
+#include "instructions.h"
+#include "util.h"
+
+struct instruction {
+    inst_t inst;
+    char *immediate;
+    char *str;
+    char *label;  /* a label definition rather than an instruction */
+};
+
+/* words and labels of the .data section, placed after the code */
+struct data_section {
+    int *words;
+    size_t len;
+    size_t capacity;
+    struct BST *labels; /* label -> offset into words */
+};
+
+static struct instruction *lookup_instruction(const char *str) {
+    inst_t inst;
+    struct instruction *instruction;
+    int i;
+    for (i = 0; inst_names[i] != NULL; i++) {
+        if (strcmp(inst_names[i], str) == 0) {
+            inst = i;
+            goto inst_found;
+        }
+    }
+    return NULL;
+inst_found:
+    instruction = malloc(sizeof(struct instruction));
+    if (instruction == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    instruction->inst = inst;
+    instruction->str = make_str(str);
+    instruction->immediate = NULL;
+    instruction->label = NULL;
+    return instruction;
+}
+
+static struct instruction *make_inst(char *inst_str) {
+    struct instruction *instruction = lookup_instruction(inst_str);
+    return instruction;
+}
+
+/* labels stay in the instruction list until place_labels gives addresses */
+static struct instruction *make_label(const char *label) {
+    struct instruction *instruction = make_inst("NOP");
+    instruction->label = make_str(label);
+    return instruction;
+}
+
+static void destroy_instruction(struct instruction *inst) {
+    free((char*)inst->immediate);
+    free((char*)inst->str);
+    free(inst->label);
+    free(inst);
+}
+
+/*
+ * Peephole optimization
+ *
+ * Runs over the instruction list before labels are given addresses, so
+ * removing or replacing instructions needs no fixups. A pattern only
+ * matches instructions with no label between them, since a jump to that
+ * label would skip the start of the pattern. Each rule is tried at every
+ * position until none applies anywhere.
+ */
+
+/* give up following a chain of jumps after this many, it may be a cycle */
+#define MAX_JUMP_CHAIN 32
+
+#define MAX_PATTERN 2
+
+struct peephole;
+
+struct peephole_rule {
+    const char *name;
+    int length;
+    inst_t pattern[MAX_PATTERN];
+    const char *immediate; /* required immediate of pattern[0], or NULL */
+    /* rewrite the match after prev, returns false to leave it alone */
+    bool (*rewrite)(struct peephole *peephole, linkedlist *prev);
+};
+
+struct peephole {
+    struct BST *label_index;  /* label -> index into label_nodes */
+    linkedlist **label_nodes;
+    size_t removed;
+};
+
+static bool is_label(linkedlist *node) {
+    return ((struct instruction *)node->value)->label != NULL;
+}
+
+/* first instruction at or after node, skipping labels */
+static linkedlist *skip_labels(linkedlist *node) {
+    while (node != NULL && is_label(node)) {
+        node = node->next;
+    }
+    return node;
+}
+
+/* first instruction at label, NULL if there is none or no such label */
+static linkedlist *label_target(struct peephole *peephole, char *label) {
+    struct BST *index = bst_find(peephole->label_index, label);
+    if (index == NULL) {
+        return NULL;
+    }
+    return skip_labels(peephole->label_nodes[index->value]->next);
+}
+
+static void delete_after(struct peephole *peephole, linkedlist *prev, int n) {
+    while (n-- > 0) {
+        linkedlist *node = prev->next;
+        prev->next = node->next;
+        destroy_instruction(node->value);
+        free(node);
+        peephole->removed++;
+    }
+}
+
+/* PUSH x; POP, PUSH 0; ADD and PUSH 1; MUL do nothing */
+static bool delete_match(struct peephole *peephole, linkedlist *prev) {
+    delete_after(peephole, prev, 2);
+    return true;
+}
+
+/*
+ * The J instructions after JTAB are its table, where removing one would
+ * move the others. Any J right after another J is left alone for that.
+ */
+static bool in_jump_table(linkedlist *prev) {
+    struct instruction *before = prev->value;
+    return !is_label(prev) && (before->inst == JTAB || before->inst == J);
+}
+
+/* J L straight to L, with nothing but labels in between */
+static bool delete_jump_to_next(struct peephole *peephole, linkedlist *prev) {
+    struct instruction *jump = prev->next->value;
+    linkedlist *node;
+    if (in_jump_table(prev)) {
+        return false;
+    }
+    for (node = prev->next->next; node && is_label(node); node = node->next) {
+        if (strcmp(((struct instruction *)node->value)->label,
+                   jump->immediate) == 0) {
+            delete_after(peephole, prev, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* a jump to J M goes to M instead */
+static bool thread_jump(struct peephole *peephole, linkedlist *prev) {
+    struct instruction *jump = prev->next->value;
+    char *target = jump->immediate;
+    int hops;
+    for (hops = 0; hops < MAX_JUMP_CHAIN; hops++) {
+        linkedlist *node = label_target(peephole, target);
+        struct instruction *inst;
+        if (node == NULL) {
+            break;
+        }
+        inst = node->value;
+        if (inst->inst != J || strcmp(inst->immediate, target) == 0) {
+            break;
+        }
+        target = inst->immediate;
+    }
+    if (hops == 0 || hops == MAX_JUMP_CHAIN) {
+        return false;
+    }
+    free(jump->immediate);
+    jump->immediate = make_str(target);
+    return true;
+}
+
+/*
+ * NOT; JZ L is JNZ L and NOT; JNZ L is JZ L, but only when the value
+ * tested is popped straight away on both paths, as neither pops it
+ */
+static bool fold_not_branch(struct peephole *peephole, linkedlist *prev) {
+    struct instruction *branch = prev->next->next->value;
+    linkedlist *fall_through = skip_labels(prev->next->next->next);
+    linkedlist *taken = label_target(peephole, branch->immediate);
+    if (fall_through == NULL || taken == NULL ||
+        ((struct instruction *)fall_through->value)->inst != POP ||
+        ((struct instruction *)taken->value)->inst != POP) {
+        return false;
+    }
+    branch->inst = branch->inst == JZ ? JNZ : JZ;
+    free(branch->str);
+    branch->str = make_str(inst_names[branch->inst]);
+    delete_after(peephole, prev, 1);
+    return true;
+}
+
+static const struct peephole_rule peephole_rules[] = {
+    {"push-pop",       2, {PUSH, POP},  NULL, delete_match},
+    {"add-zero",       2, {PUSH, ADD},  "0",  delete_match},
+    {"multiply-one",   2, {PUSH, MUL},  "1",  delete_match},
+    {"jump-to-next",   1, {J},          NULL, delete_jump_to_next},
+    {"jump-to-next",   1, {JZ},         NULL, delete_jump_to_next},
+    {"jump-to-next",   1, {JNZ},        NULL, delete_jump_to_next},
+    {"jump-to-next",   1, {JLEZ},       NULL, delete_jump_to_next},
+    {"thread-jump",    1, {J},          NULL, thread_jump},
+    {"thread-jump",    1, {JZ},         NULL, thread_jump},
+    {"thread-jump",    1, {JNZ},        NULL, thread_jump},
+    {"thread-jump",    1, {JLEZ},       NULL, thread_jump},
+    {"thread-jump",    1, {CALL},       NULL, thread_jump},
+    {"thread-jump",    1, {TCALL},      NULL, thread_jump},
+    {"not-branch",     2, {NOT, JZ},    NULL, fold_not_branch},
+    {"not-branch",     2, {NOT, JNZ},   NULL, fold_not_branch},
+    {NULL,             0, {NOP},        NULL, NULL}
+};
+
+static bool rule_matches(const struct peephole_rule *rule, linkedlist *node) {
+    int i;
+    for (i = 0; i < rule->length; i++, node = node->next) {
+        struct instruction *inst;
+        if (node == NULL || is_label(node)) {
+            return false;
+        }
+        inst = node->value;
+        if (inst->inst != rule->pattern[i]) {
+            return false;
+        }
+        if (i == 0 && rule->immediate != NULL &&
+            strcmp(inst->immediate, rule->immediate) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* returns the number of instructions removed */
+static size_t peephole_optimize(linkedlist *instructions) {
+    struct peephole peephole = {NULL, NULL, 0};
+    linkedlist *node;
+    size_t num_labels = 0;
+    bool changed = true;
+
+    for (node = instructions->next; node; node = node->next) {
+        num_labels += is_label(node);
+    }
+    peephole.label_nodes = minic_malloc((num_labels + 1) *
+                                        sizeof(linkedlist *));
+    num_labels = 0;
+    for (node = instructions->next; node; node = node->next) {
+        if (is_label(node)) {
+            struct instruction *label = node->value;
+            peephole.label_index = bst_insert(peephole.label_index,
+                                              make_str(label->label),
+                                              num_labels);
+            peephole.label_nodes[num_labels++] = node;
+        }
+    }
+
+    while (changed) {
+        linkedlist *prev = instructions;
+        changed = false;
+        while (prev->next != NULL) {
+            const struct peephole_rule *rule;
+            bool applied = false;
+            for (rule = peephole_rules; rule->name != NULL; rule++) {
+                if (rule_matches(rule, prev->next) &&
+                    rule->rewrite(&peephole, prev)) {
+                    applied = true;
+                    break;
+                }
+            }
+            if (applied) {
+                changed = true;
+            } else {
+                prev = prev->next;
+            }
+        }
+    }
+    bst_destroy(peephole.label_index);
+    free(peephole.label_nodes);
+    return peephole.removed;
+}
+
+/*
+ * give each label the address of the instruction after it and drop it
+ * from the list, returns the number of words of code
+ */
+static int place_labels(linkedlist *instructions, struct BST **labels) {
+    linkedlist *prev = instructions;
+    /* code is loaded at address 1, address 0 holds HALT */
+    int address = 1;
+    while (prev->next != NULL) {
+        linkedlist *node = prev->next;
+        struct instruction *inst = node->value;
+        if (inst->label != NULL) {
+            *labels = bst_insert(*labels, inst->label, address);
+            inst->label = NULL;
+            prev->next = node->next;
+            destroy_instruction(inst);
+            free(node);
+        } else {
+            address += inst->immediate != NULL ? 2 : 1;
+            prev = node;
+        }
+    }
+    return address - 1;
+}
+
+static void populate_labels(linkedlist *instructions,
+                            struct BST *labels,
+                            const char *source_name) {
+    linkedlist *cursor = instructions->next;
+    while (cursor) {
+        struct instruction *inst = cursor->value;
+        if (takes_label(inst->inst)) {
+            char *label = (char *)inst->immediate;
+            struct BST *label_node = bst_find(labels, label);
+            int label_location;
+            char str[11];
+            if (label_node == NULL) {
+                fprintf(stderr, "%s: undefined label: %s\n",
+                        source_name, label);
+                exit(EXIT_FAILURE);
+            }
+            label_location = label_node->value;
+            sprintf(str, "%d", label_location);
+            free(inst->immediate);
+            inst->immediate = make_str(str);
+        }
+        cursor = cursor->next;
+    }
+}
+
+static bool is_ignored_char(const char c) {
+    return c == ' ' || c == ';' || c == '\n';
+}
+
+static void remove_trailing_chars(char *instruction) {
+    while (*instruction) {
+        if (is_ignored_char(*instruction)) {
+            *instruction = '\0';
+            return;
+        } else {
+            instruction++;
+        }
+    }
+}
+
+/*
+ * copy the next line of source into buffer, always ending it with a
+ * newline, returns a pointer to the line after it or NULL at the end
+ */
+static const char *next_line(const char *source, char *buffer, int size) {
+    int n = 0;
+    if (*source == '\0') {
+        return NULL;
+    }
+    while (*source != '\0' && *source != '\n') {
+        if (n < size - 2) {
+            buffer[n++] = *source;
+        }
+        source++;
+    }
+    if (*source == '\n') {
+        source++;
+    }
+    buffer[n++] = '\n';
+    buffer[n] = '\0';
+    return source;
+}
+
+static void append_word(struct data_section *data, int word) {
+    if (data->len == data->capacity) {
+        data->capacity = data->capacity ? data->capacity * 2 : 64;
+        data->words = realloc(data->words, data->capacity * sizeof(int));
+        if (data->words == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    data->words[data->len++] = word;
+}
+
+/*
+ * .string "text" stores the length of text and then one character per
+ * word, str points just past the directive
+ */
+static void append_string(struct data_section *data,
+                          const char *str,
+                          const char *source_name,
+                          int line) {
+    size_t length_at;
+    int len = 0;
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+    if (*str != '"') {
+        fprintf(stderr, "%s:%d: .string expects a quoted string\n",
+                source_name, line);
+        exit(EXIT_FAILURE);
+    }
+    length_at = data->len;
+    append_word(data, 0);
+    for (str++; *str != '"'; str++) {
+        int c = *str;
+        if (c == '\n' || c == '\0') {
+            fprintf(stderr, "%s:%d: unterminated string\n",
+                    source_name, line);
+            exit(EXIT_FAILURE);
+        }
+        if (c == '\\') {
+            str++;
+            switch (*str) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case '0': c = '\0'; break;
+                case '\\': c = '\\'; break;
+                case '"': c = '"'; break;
+                default:
+                    fprintf(stderr, "%s:%d: unknown escape in string\n",
+                            source_name, line);
+                    exit(EXIT_FAILURE);
+            }
+        }
+        append_word(data, c);
+        len++;
+    }
+    data->words[length_at] = len;
+}
+
+/*
+ * the .data section goes after the code, behind a DATA instruction that
+ * steps over it should control ever fall through
+ */
+static void place_data(struct BST *data_labels,
+                       int data_start,
+                       struct BST **labels) {
+    if (data_labels != NULL) {
+        place_data(data_labels->left, data_start, labels);
+        *labels = bst_insert(*labels,
+                             make_str(data_labels->key),
+                             data_start + data_labels->value);
+        place_data(data_labels->right, data_start, labels);
+    }
+}
+
+/* everything assemble() collects from the source */
+struct assembly {
+    linkedlist *instructions;
+    struct data_section data;
+    struct BST *globals; /* labels named by .global */
+    int storage;         /* from .storage, -1 if not given */
+    int max_slot;        /* highest PUSH @slot, -1 if none */
+    size_t removed;      /* by the peephole optimizer */
+};
+
+/* .global NAME and .storage N, str points just past the directive */
+static void global_directive(struct assembly *out,
+                             char *str,
+                             const char *source_name,
+                             int line) {
+    char *name = str;
+    while (*name == ' ' || *name == '\t') {
+        name++;
+    }
+    remove_trailing_chars(name);
+    if (str == name || *name == '\0') {
+        fprintf(stderr, "%s:%d: .global expects a label\n",
+                source_name, line);
+        exit(EXIT_FAILURE);
+    }
+    out->globals = bst_insert(out->globals, make_str(name), 0);
+}
+
+static void storage_directive(struct assembly *out,
+                              const char *str,
+                              const char *source_name,
+                              int line) {
+    char *end;
+    long storage = strtol(str, &end, 10);
+    if (end == str || storage < 0 || !is_ignored_char(*end)) {
+        fprintf(stderr, "%s:%d: .storage expects a number of slots\n",
+                source_name, line);
+        exit(EXIT_FAILURE);
+    }
+    out->storage = (int)storage;
+}
+
+/*
+ * PUSH @N pushes storage slot N, which minild moves up past the slots of
+ * the objects linked before this one
+ */
+static void check_slot(struct assembly *out,
+                       const struct instruction *inst,
+                       const char *source_name,
+                       int line) {
+    char *end;
+    long slot = strtol(inst->immediate + 1, &end, 10);
+    if (inst->inst != PUSH) {
+        fprintf(stderr, "%s:%d: a storage slot can only be pushed\n",
+                source_name, line);
+        exit(EXIT_FAILURE);
+    }
+    if (end == inst->immediate + 1 || *end != '\0' || slot < 0) {
+        fprintf(stderr, "%s:%d: not a storage slot: %s\n",
+                source_name, line, inst->immediate);
+        exit(EXIT_FAILURE);
+    }
+    if (slot > out->max_slot) {
+        out->max_slot = (int)slot;
+    }
+}
+
+static void assemble(const char *source,
+                     const char *source_name,
+                     struct assembly *out,
+                     bool optimize) {
+    char input_buffer[255] = {0};
+    struct linkedlist *cursor;
+    struct data_section *data = &out->data;
+    bool in_data = false;
+    int line = 0;
+
+    out->instructions = ll_new(make_inst("NOP"));
+    out->data.words = NULL;
+    out->data.len = 0;
+    out->data.capacity = 0;
+    out->data.labels = NULL;
+    out->globals = NULL;
+    out->storage = -1;
+    out->max_slot = -1;
+    out->removed = 0;
+    cursor = out->instructions;
+
+    while ((source = next_line(source, input_buffer, 255)) != NULL) {
+        struct instruction *inst;
+        int len;
+        int j;
+        char *immediate = NULL;
+        char *instruction = input_buffer;
+
+        line++;
+        while (*instruction == ' ' || *instruction == '\t') {
+            instruction++;
+        }
+
+        if (*instruction == '\n' || *instruction == ';') {
+            /* blank line or comment */
+            continue;
+        }
+
+        if (strncmp(instruction, ".data", 5) == 0 &&
+            is_ignored_char(instruction[5])) {
+            in_data = true;
+            continue;
+        } else if (strncmp(instruction, ".text", 5) == 0 &&
+                   is_ignored_char(instruction[5])) {
+            in_data = false;
+            continue;
+        } else if (strncmp(instruction, ".string", 7) == 0) {
+            if (!in_data) {
+                fprintf(stderr, "%s:%d: .string outside of .data\n",
+                        source_name, line);
+                exit(EXIT_FAILURE);
+            }
+            append_string(data, instruction + 7, source_name, line);
+            continue;
+        } else if (strncmp(instruction, ".global", 7) == 0) {
+            global_directive(out, instruction + 7, source_name, line);
+            continue;
+        } else if (strncmp(instruction, ".storage", 8) == 0) {
+            storage_directive(out, instruction + 8, source_name, line);
+            continue;
+        }
+
+        len = strlen(instruction) - 1;
+        for (j = 0; j <= len; j++) {
+            if (instruction[j] == ' ') {
+                instruction[j] = '\0';
+                j++;
+                immediate = instruction + j;
+                remove_trailing_chars(immediate);
+                break;
+            }
+
+            if (instruction[j] == '\n' || instruction[j] == ';') {
+                instruction[j] = '\0';
+                break;
+            }
+        }
+
+        if (immediate != NULL && *immediate == '\0') {
+            immediate = NULL;
+        }
+#ifdef DEBUG
+        if (immediate) {
+            printf("instruction = '%s', immediate = '%s'\n",
+                    instruction, immediate);
+        } else {
+            printf("instruction = '%s'\n", instruction);
+        }
+#endif
+        if (instruction[len-1] == ':') {
+            instruction[len-1] = '\0';
+            if (in_data) {
+                data->labels = bst_insert(data->labels,
+                                          make_str(instruction),
+                                          data->len);
+            } else {
+                cursor = ll_append(cursor, make_label(instruction));
+            }
+        } else if (in_data) {
+            fprintf(stderr, "%s:%d: instruction in .data: %s\n",
+                    source_name, line, instruction);
+            exit(EXIT_FAILURE);
+        } else {
+            inst = make_inst(instruction);
+            if (inst == NULL) {
+                fprintf(stderr, "%s:%d: not a valid instruction: %s\n",
+                        source_name, line, instruction);
+                exit(EXIT_FAILURE);
+            } else if (requires_immediate(inst->inst)) {
+                if (immediate == NULL) {
+                    fprintf(stderr,
+                            "%s:%d: syntax error: expecting immediate "
+                            "value after %s\n",
+                            source_name, line, inst->str);
+                    exit(EXIT_FAILURE);
+                } else {
+                    inst->immediate = make_str(immediate);
+                    if (*immediate == '@') {
+                        check_slot(out, inst, source_name, line);
+                    }
+                }
+            } else if (immediate != NULL) {
+                fprintf(stderr,
+                        "%s:%d: %s does not take an immediate, found %s\n",
+                        source_name,
+                        line,
+                        instruction,
+                        immediate);
+                exit(EXIT_FAILURE);
+            }
+            cursor = ll_append(cursor, inst);
+        }
+    }
+    if (out->storage >= 0 && out->max_slot >= out->storage) {
+        fprintf(stderr, "%s: slot @%d is past .storage %d\n",
+                source_name, out->max_slot, out->storage);
+        exit(EXIT_FAILURE);
+    }
+    if (optimize) {
+        out->removed = peephole_optimize(out->instructions);
+    }
+}
+
+static void destroy_instructions(linkedlist *ll) {
+    linkedlist *prev = ll;
+    while (ll) {
+        prev = ll;
+        destroy_instruction(ll->value);
+        ll = ll->next;
+        free(prev);
+    }
+}
+
+/* the value of a resolved immediate, @N is slot N when not relocating */
+static int immediate_value(const char *immediate) {
+    return atoi(*immediate == '@' ? immediate + 1 : immediate);
+}
+
+static struct asm_program *assemble_program(const char *source,
+                                            const char *source_name,
+                                            bool optimize) {
+    struct asm_program *program = minic_malloc(sizeof(struct asm_program));
+    struct assembly assembly;
+    struct data_section *data = &assembly.data;
+    linkedlist *head;
+    int code_len;
+    size_t n = 0;
+
+    assemble(source, source_name, &assembly, optimize);
+    program->labels = NULL;
+    program->removed = assembly.removed;
+    program->storage = assembly.storage;
+    if (data->len > 0) {
+        char size[32];
+        struct instruction *inst = make_inst("DATA");
+        sprintf(size, "%lu", (unsigned long)data->len);
+        inst->immediate = make_str(size);
+        ll_append(assembly.instructions, inst);
+    }
+    code_len = place_labels(assembly.instructions, &program->labels);
+    if (data->len > 0) {
+        place_data(data->labels, code_len + 1, &program->labels);
+    }
+    populate_labels(assembly.instructions, program->labels, source_name);
+
+    program->code = minic_malloc((code_len + data->len + 1) * sizeof(int));
+    program->len = code_len + data->len;
+    for (head = assembly.instructions->next; head; head = head->next) {
+        struct instruction *instruction = head->value;
+        program->code[n++] = instruction->inst;
+        if (instruction->immediate) {
+            program->code[n++] = immediate_value(instruction->immediate);
+        }
+    }
+    if (data->len > 0) {
+        memcpy(program->code + n, data->words, data->len * sizeof(int));
+    }
+    free(data->words);
+    bst_destroy(data->labels);
+    bst_destroy(assembly.globals);
+    destroy_instructions(assembly.instructions);
+    return program;
+}
+
+struct asm_program *asm_assemble(const char *source,
+                                 const char *source_name) {
+    return assemble_program(source, source_name, false);
+}
+
+struct asm_program *asm_assemble_optimized(const char *source,
+                                           const char *source_name) {
+    return assemble_program(source, source_name, true);
+}
+
+static void add_symbol(struct object *object,
+                       const char *name,
+                       object_section section,
+                       int offset,
+                       struct BST *globals) {
+    struct object_symbol *symbol = &object->symbols[object->num_symbols++];
+    struct BST *global = bst_find(globals, (char *)name);
+    symbol->name = make_str(name);
+    symbol->section = section;
+    symbol->offset = offset;
+    symbol->global = global != NULL;
+    if (global != NULL) {
+        global->value = 1; /* defined */
+    }
+}
+
+static size_t count_labels(const struct BST *labels) {
+    if (labels == NULL) {
+        return 0;
+    }
+    return 1 + count_labels(labels->left) + count_labels(labels->right);
+}
+
+static void add_data_symbols(struct object *object,
+                             const struct BST *labels,
+                             struct BST *globals) {
+    if (labels != NULL) {
+        add_data_symbols(object, labels->left, globals);
+        add_symbol(object, labels->key, OBJECT_DATA, labels->value,
+                   globals);
+        add_data_symbols(object, labels->right, globals);
+    }
+}
+
+/* every .global must be defined here, minild resolves the rest */
+static void check_globals(const struct BST *globals,
+                          const char *source_name) {
+    if (globals != NULL) {
+        check_globals(globals->left, source_name);
+        if (globals->value == 0) {
+            fprintf(stderr, "%s: .global %s is not defined\n",
+                    source_name, globals->key);
+            exit(EXIT_FAILURE);
+        }
+        check_globals(globals->right, source_name);
+    }
+}
+
+struct object *asm_assemble_object(const char *source,
+                                   const char *source_name,
+                                   bool optimize,
+                                   size_t *removed) {
+    struct object *object = minic_malloc(sizeof(struct object));
+    struct assembly assembly;
+    linkedlist *head;
+    size_t num_labels = 0;
+    size_t n = 0;
+
+    assemble(source, source_name, &assembly, optimize);
+    if (removed != NULL) {
+        *removed = assembly.removed;
+    }
+
+    object->code_len = 0;
+    object->num_relocations = 0;
+    object->num_slots = 0;
+    for (head = assembly.instructions->next; head; head = head->next) {
+        struct instruction *instruction = head->value;
+        if (instruction->label != NULL) {
+            num_labels++;
+        } else if (instruction->immediate != NULL) {
+            object->code_len += 2;
+            object->num_relocations += takes_label(instruction->inst);
+            object->num_slots += *instruction->immediate == '@';
+        } else {
+            object->code_len++;
+        }
+    }
+    num_labels += count_labels(assembly.data.labels);
+
+    object->code = minic_malloc((object->code_len + 1) * sizeof(int));
+    object->symbols = minic_malloc((num_labels + 1) *
+                                   sizeof(struct object_symbol));
+    object->relocations = minic_malloc((object->num_relocations + 1) *
+                                       sizeof(struct object_relocation));
+    object->slots = minic_malloc((object->num_slots + 1) * sizeof(int));
+    object->num_symbols = 0;
+    object->num_relocations = 0;
+    object->num_slots = 0;
+
+    for (head = assembly.instructions->next; head; head = head->next) {
+        struct instruction *instruction = head->value;
+        if (instruction->label != NULL) {
+            add_symbol(object, instruction->label, OBJECT_CODE, n,
+                       assembly.globals);
+            continue;
+        }
+        object->code[n++] = instruction->inst;
+        if (instruction->immediate == NULL) {
+            continue;
+        }
+        if (takes_label(instruction->inst)) {
+            struct object_relocation *relocation =
+                &object->relocations[object->num_relocations++];
+            relocation->offset = n;
+            relocation->symbol = make_str(instruction->immediate);
+            object->code[n++] = 0;
+        } else {
+            if (*instruction->immediate == '@') {
+                object->slots[object->num_slots++] = n;
+            }
+            object->code[n++] = immediate_value(instruction->immediate);
+        }
+    }
+    add_data_symbols(object, assembly.data.labels, assembly.globals);
+    check_globals(assembly.globals, source_name);
+
+    object->data = assembly.data.words;
+    object->data_len = assembly.data.len;
+    object->storage = assembly.storage;
+    bst_destroy(assembly.data.labels);
+    bst_destroy(assembly.globals);
+    destroy_instructions(assembly.instructions);
+    return object;
+}
+
+void asm_free(struct asm_program *program) {
+    if (program != NULL) {
+        free(program->code);
+        bst_destroy(program->labels);
+        free(program);
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: asm.h
+ */
+
+#ifndef ASM_H
+#define ASM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "bst.h"
+#include "object.h"
+
+/* an assembled program, in the format stackmachine loads */
+struct asm_program {
+    int *code;          /* code[0] is loaded at address 1 */
+    size_t len;
+    struct BST *labels; /* label -> address */
+    size_t removed;     /* instructions removed by the peephole optimizer */
+    int storage;        /* from .storage, -1 if not given */
+};
+
+/*
+ * Assemble source text. source_name is only used in error messages.
+ * Exits with a message on a syntax error, like the rest of the toolchain.
+ */
+struct asm_program *asm_assemble(const char *source, const char *source_name);
+
+/*
+ * asm_assemble with peephole optimization of the code, which removes
+ * instructions that do nothing, jumps to the next instruction and jumps
+ * to jumps, see peephole_rules in asm.c
+ */
+struct asm_program *asm_assemble_optimized(const char *source,
+                                           const char *source_name);
+
+/*
+ * Assemble source into a relocatable object for minild. Labels are left
+ * for the linker to resolve and must be named by .global to be visible
+ * to other objects, PUSH @N operands are relocated as storage slots.
+ * removed, if not NULL, gets the count from the peephole optimizer.
+ */
+struct object *asm_assemble_object(const char *source,
+                                   const char *source_name,
+                                   bool optimize,
+                                   size_t *removed);
+
+void asm_free(struct asm_program *program);
+
+#endif /* ASM_H */
@@ -19,239 +19,181 @@
  * File: assembler.c
  */
 
+/*
+ * minias: assemble a .s file into the .o format loaded by stackmachine
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 
-#include "linkedlist.h"
+#include "asm.h"
 #include "bst.h"
-#include "instructions.h"
+#include "encoding.h"
 #include "util.h"
 
 static char *PROGRAM_NAME = NULL;
 
-struct instruction {
-    inst_t inst;
-    char *immediate;
-    char *str;
-};
-
 void print_usage() {
     fprintf(stderr,
-            "usage: %s INPUT.s\n",
+            "usage: %s [-m | -c] [-O] [--compact] [--time] INPUT.s\n"
+            "  -m         also write a label map to INPUT.map "
+            "(used for profiling)\n"
+            "  -c         write a relocatable object INPUT.ro for minild "
+            "instead\n"
+            "  -O         peephole optimize, reporting instructions removed\n"
+            "  --compact  write a compact image, see encoding.h\n"
+            "  --time     report the time spent in each stage\n",
             PROGRAM_NAME);
 }
 
-static struct instruction *lookup_instruction(const char *str) {
-    inst_t inst;
-    struct instruction *instruction;
-    int i;
-    for (i = 0; inst_names[i] != NULL; i++) {
-        if (strcmp(inst_names[i], str) == 0) {
-            inst = i;
-            goto inst_found;
-        }
-    }
-    return NULL;
-inst_found:
-    instruction = malloc(sizeof(struct instruction));
-    if (instruction == NULL) {
-        fprintf(stderr, "out of memory\n");
-        exit(EXIT_FAILURE);
+static void write_labels(FILE *output_file, struct BST *labels) {
+    if (labels != NULL) {
+        write_labels(output_file, labels->left);
+        fprintf(output_file, "%s %d\n", labels->key, labels->value);
+        write_labels(output_file, labels->right);
     }
-
-    instruction->inst = inst;
-    instruction->str = make_str(str);
-    instruction->immediate = NULL;
-    return instruction;
-}
-
-static struct instruction *make_inst(char *inst_str) {
-    struct instruction *instruction = lookup_instruction(inst_str);
-    return instruction;
 }
 
-static void populate_labels(linkedlist *instructions, struct BST *labels) {
-    linkedlist *cursor = instructions->next;
-    while (cursor) {
-        struct instruction *inst = cursor->value;
-        if (is_jump(inst->inst)) {
-            char *label = (char *)inst->immediate;
-            struct BST *label_node = bst_find(labels, label);
-            int label_location = label_node->value;
-            char str[11];
-            sprintf(str, "%d", label_location);
-            free(inst->immediate);
-            inst->immediate = make_str(str);
-        }
-        cursor = cursor->next;
+static void emit_map(struct BST *labels, char *map_filename) {
+    FILE *map_file = fopen(map_filename, "w");
+    if (map_file == NULL) {
+        fprintf(stderr, "could not open for writing: %s\n", map_filename);
+        exit(EXIT_FAILURE);
     }
+    write_labels(map_file, labels);
+    fclose(map_file);
 }
 
-static bool is_ignored_char(const char c) {
-    return c == ' ' || c == ';' || c == '\n';
-}
-
-static void remove_trailing_chars(char *instruction) {
-    while (*instruction) {
-        if (is_ignored_char(*instruction)) {
-            *instruction = '\0';
-            return;
-        } else {
-            instruction++;
-        }
+static void emit_assembly(char *input_filename,
+                          char *output_filename,
+                          char *map_filename,
+                          bool optimize,
+                          bool compact,
+                          bool show_time) {
+    double start = get_time();
+    char *source = read_file(input_filename);
+    struct asm_program *program;
+    FILE *output_file;
+
+    if (show_time) {
+        report_stage("read", &start);
     }
-}
-
-static linkedlist *assemble(const char *input_filename) {
-    char input_buffer[255] = {0};
-    linkedlist *instructions = ll_new(make_inst("NOP"));
-    struct linkedlist *cursor = instructions;
-    struct BST *labels = NULL;
-    int i = 0;
-    FILE *input_file = fopen(input_filename, "r");
-    if (input_file == NULL) {
-        fprintf(stderr, "not a file: %s\n", input_filename);
+    if (optimize) {
+        program = asm_assemble_optimized(source, input_filename);
+        fprintf(stderr, "%s: peephole removed %lu instructions\n",
+                input_filename, (unsigned long)program->removed);
+    } else {
+        program = asm_assemble(source, input_filename);
+    }
+    if (show_time) {
+        report_stage("assemble", &start);
+    }
+    output_file = fopen(output_filename, "wb");
+    if (output_file == NULL) {
+        fprintf(stderr, "could not open for writing: %s\n", output_filename);
         exit(EXIT_FAILURE);
     }
-
-    while (fgets(input_buffer, 255, input_file)) {
-        struct instruction *inst;
-        int len;
-        int j;
-        char *immediate = NULL;
-        char *instruction = input_buffer;
-
-        while (*instruction == ' ' || *instruction == '\t') {
-            instruction++;
-        }
-
-        if (*instruction == '\n') {
-            /* blank line */
-            continue;
-        }
-
-        len = strlen(instruction) - 1;
-        for (j = 0; j <= len; j++) {
-            if (instruction[j] == ' ') {
-                instruction[j] = '\0';
-                j++;
-                immediate = instruction + j;
-                remove_trailing_chars(immediate);
-                break;
-            }
-
-            if (instruction[j] == '\n' || instruction[j] == ';') {
-                instruction[j] = '\0';
-                break;
-            }
-        }
-
-        if (immediate != NULL && *immediate == '\0') {
-            immediate = NULL;
-        }
-#ifdef DEBUG
-        if (immediate) {
-            printf("instruction = '%s', immediate = '%s'\n",
-                    instruction, immediate);
-        } else {
-            printf("instruction = '%s'\n", instruction);
-        }
-#endif
-        if (instruction[len-1] == ':') {
-            instruction[len-1] = '\0';
-            labels = bst_insert(labels, make_str(instruction), i);
-        } else {
-            inst = make_inst(instruction);
-            if (inst == NULL) {
-                fprintf(stderr, "not a valid instruction: %s\n", instruction);
-                exit(EXIT_FAILURE);
-            } else if (requires_immediate(inst->inst)) {
-                if (immediate == NULL) {
-                    fprintf(stderr,
-                            "%s: syntax error: expecting immediate "
-                            "value after %s on line %s:%d\n",
-                            PROGRAM_NAME, inst->str, input_filename, i + 1);
-                    exit(EXIT_FAILURE);
-                } else {
-                    inst->immediate = make_str(immediate);
-                    i++;
-                }
-            } else if (immediate != NULL) {
-                fprintf(stderr,
-                        "%s does not take an immediate, found %s\n",
-                        instruction,
-                        immediate);
-                exit(EXIT_FAILURE);
-            }
-            cursor = ll_append(cursor, inst);
-            i++;
-        }
+    write_program(output_file, program->code, program->len, program->storage,
+                  compact);
+    fclose(output_file);
+    if (map_filename != NULL) {
+        emit_map(program->labels, map_filename);
     }
-    populate_labels(instructions, labels);
-    bst_destroy(labels);
-    fclose(input_file);
-    return instructions;
-}
-
-static void destroy_instruction(struct instruction *inst) {
-    free((char*)inst->immediate);
-    free((char*)inst->str);
-    free(inst);
-}
-
-static void destroy_instructions(linkedlist *ll) {
-    linkedlist *prev = ll;
-    while (ll) {
-        prev = ll;
-        destroy_instruction(ll->value);
-        ll = ll->next;
-        free(prev);
+    if (show_time) {
+        report_stage("write", &start);
     }
+    asm_free(program);
+    free(source);
 }
 
-static void emit_assembly(char *input_filename, char *output_filename) {
-    linkedlist *instructions = assemble(input_filename);
-    linkedlist *head = instructions->next;
-    struct instruction *instruction;
-    inst_t inst;
-    FILE *output_file = fopen(output_filename, "w");
+static void emit_object(char *input_filename,
+                        char *output_filename,
+                        bool optimize,
+                        bool show_time) {
+    double start = get_time();
+    char *source = read_file(input_filename);
+    struct object *object;
+    size_t removed;
+    FILE *output_file;
+
+    if (show_time) {
+        report_stage("read", &start);
+    }
+    object = asm_assemble_object(source, input_filename, optimize, &removed);
+    if (optimize) {
+        fprintf(stderr, "%s: peephole removed %lu instructions\n",
+                input_filename, (unsigned long)removed);
+    }
+    if (show_time) {
+        report_stage("assemble", &start);
+    }
+    output_file = fopen(output_filename, "w");
     if (output_file == NULL) {
         fprintf(stderr, "could not open for writing: %s\n", output_filename);
         exit(EXIT_FAILURE);
     }
-    while (head) {
-        instruction = (struct instruction *)head->value;
-        inst = instruction->inst;
-        fprintf(output_file, "%d\n", inst);
-        if (instruction->immediate) {
-            fprintf(output_file, "%s\n", instruction->immediate);
-        }
-        head = head->next;
-    }
+    object_write(output_file, object);
     fclose(output_file);
-    destroy_instructions(instructions);
+    if (show_time) {
+        report_stage("write", &start);
+    }
+    object_free(object);
+    free(source);
 }
 
 int main(int argc, char **argv) {
-    char *input_filename;
+    char *input_filename = NULL;
     char *output_filename;
-    int len;
+    char *map_filename = NULL;
+    bool write_map = false;
+    bool relocatable = false;
+    bool optimize = false;
+    bool compact = false;
+    bool show_time = false;
+    int i;
     PROGRAM_NAME = argv[0];
 
-    if (argc != 2) {
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0) {
+            write_map = true;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            relocatable = true;
+        } else if (strcmp(argv[i], "-O") == 0) {
+            optimize = true;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact = true;
+        } else if (strcmp(argv[i], "--time") == 0) {
+            show_time = true;
+        } else if (input_filename == NULL && argv[i][0] != '-') {
+            input_filename = argv[i];
+        } else {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (input_filename == NULL || (write_map && relocatable) ||
+        (compact && relocatable)) {
         print_usage();
         exit(EXIT_FAILURE);
     }
+    if (relocatable) {
+        output_filename = replace_extension(input_filename, ".ro");
+        emit_object(input_filename, output_filename, optimize, show_time);
+        free(output_filename);
+        return 0;
+    }
+    if (write_map) {
+        map_filename = replace_extension(input_filename, ".map");
+    }
 
-    input_filename = argv[1];
-
-    len = strlen(input_filename) - 1;
-    output_filename = make_str(input_filename);
-    output_filename[len] = 'o';
+    output_filename = replace_extension(input_filename, ".o");
 
-    emit_assembly(input_filename, output_filename);
+    emit_assembly(input_filename, output_filename, map_filename, optimize,
+                  compact, show_time);
     free(output_filename);
+    free(map_filename);
 
     return 0;
 }
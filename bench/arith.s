@@ -0,0 +1,20 @@
+; tight arithmetic loop, the counter stays on the stack
+;
+; 13 instructions per iteration, 2000000 iterations
+
+    PUSH 2000000
+_loop:
+    PICK 0              ; c c
+    PUSH 3
+    MUL                 ; c 3c
+    PUSH 7
+    ADD                 ; c 3c+7
+    PUSH 5
+    SUB                 ; c 5-(3c+7)
+    PUSH 3
+    DIV                 ; c 3/(5-(3c+7))
+    POP
+    PUSH -1
+    ADD                 ; c-1
+    JNZ _loop
+    HALT
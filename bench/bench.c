@@ -0,0 +1,384 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: bench/bench.c
+ */
+
+/*
+ * minibench: time the interpreter on the programs in bench/
+ *
+ * Each program is assembled with minias, loaded once into libminivm and run
+ * a few times to warm up, then timed over several repetitions with vm_reset
+ * in between, so process startup and parsing are not part of the numbers.
+ * PRINT output goes to /dev/null while timing. The size of each image, as
+ * ints and compact, and the time to load it are reported separately. The
+ * VM runs the compact encoding whichever form it loads, so -z only changes
+ * the load time.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../vm.h"
+#include "../util.h"
+#include "../encoding.h"
+
+#define MAX_REPETITIONS 100
+#define MAX_NAME 64
+
+/* straight-line code: blocks of this many instructions, run in a loop */
+#define STRAIGHTLINE_BLOCKS 4000
+#define STRAIGHTLINE_ITERATIONS 1500
+
+static char *PROGRAM_NAME = NULL;
+
+static void print_usage() {
+    fprintf(stderr,
+            "usage: %s [-a MINIAS] [-w WARMUP] [-r REPETITIONS] "
+            "[-o RESULTS.json] [-c BASELINE.json] [-z] PROGRAM.s...\n"
+            "       %s --generate PROGRAM.s\n"
+            "  -a MINIAS         assembler to use, default ./minias\n"
+            "  -w WARMUP         untimed runs of each program, default 1\n"
+            "  -r REPETITIONS    timed runs of each program, default 5\n"
+            "  -o RESULTS.json   write the results as JSON\n"
+            "  -c BASELINE.json  compare against an earlier -o file\n",
+            PROGRAM_NAME, PROGRAM_NAME);
+    fprintf(stderr,
+            "  -z                load compact images, minias --compact\n"
+            "  --generate FILE   write the straight-line benchmark to FILE\n");
+}
+
+struct result {
+    char name[MAX_NAME];
+    unsigned long instructions;
+    double median_ns;
+    double min_ns;
+    double max_ns;
+    size_t words;
+    size_t compact_bytes;
+    double load_ns;      /* parsing or decoding the image file */
+};
+
+/*
+ * Blocks of PUSH PUSH op POP with a counter loop around them, far bigger than
+ * the other programs, so the code does not stay in the L1 cache and the
+ * dispatch branch sees a long irregular sequence of opcodes.
+ */
+static void generate_straightline(const char *filename) {
+    static const char *ops[] = {"ADD", "SUB", "MUL", "LT", "GT", "EQ", "NE"};
+    unsigned long seed = 12345;
+    FILE *out = fopen(filename, "w");
+    int i;
+
+    if (out == NULL) {
+        fprintf(stderr, "could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "; generated by minibench --generate, do not edit\n"
+                 ";\n"
+                 "; %d blocks of 4 instructions, %d iterations\n\n"
+                 "    PUSH %d\n"
+                 "_loop:\n",
+            STRAIGHTLINE_BLOCKS, STRAIGHTLINE_ITERATIONS,
+            STRAIGHTLINE_ITERATIONS);
+    for (i = 0; i < STRAIGHTLINE_BLOCKS; i++) {
+        int a, b;
+        seed = seed * 1103515245 + 12345;
+        a = (int)((seed >> 16) % 1000);
+        seed = seed * 1103515245 + 12345;
+        b = (int)((seed >> 16) % 1000);
+        fprintf(out, "    PUSH %d\n    PUSH %d\n    %s\n    POP\n", a, b,
+                ops[(seed >> 8) % (sizeof(ops) / sizeof(ops[0]))]);
+    }
+    fprintf(out, "    PUSH -1\n    ADD\n    JNZ _loop\n    HALT\n");
+    fclose(out);
+}
+
+static int *assemble(const char *minias, const char *filename, int compact,
+                     size_t *len, int *storage, double *load_ns) {
+    char *command = malloc(strlen(minias) + strlen(filename) + 12);
+    char *object_filename;
+    char *text;
+    size_t size;
+    double start;
+    int *code;
+
+    sprintf(command, "%s %s%s", minias, compact ? "--compact " : "",
+            filename);
+    if (system(command) != 0) {
+        fprintf(stderr, "could not assemble %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    free(command);
+
+    object_filename = replace_extension(filename, ".o");
+    text = read_file_size(object_filename, &size);
+    start = get_time();
+    code = parse_program(text, size, len, storage);
+    *load_ns = (get_time() - start) * 1e9;
+    if (code == NULL) {
+        fprintf(stderr, "malformed object file: %s\n", object_filename);
+        exit(EXIT_FAILURE);
+    }
+    free(text);
+    free(object_filename);
+    return code;
+}
+
+/* bench/arith.s -> arith */
+static void benchmark_name(const char *filename, char *name) {
+    const char *base = strrchr(filename, '/');
+    size_t len;
+
+    base = base == NULL ? filename : base + 1;
+    len = strcspn(base, ".");
+    if (len >= MAX_NAME) {
+        len = MAX_NAME - 1;
+    }
+    memcpy(name, base, len);
+    name[len] = '\0';
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* run once from a fresh state, returns the time taken in ns */
+static double run_once(struct minivm *vm, const char *name) {
+    double start, elapsed;
+    vm_status status;
+
+    vm_reset(vm);
+    start = get_time();
+    status = vm_run(vm, 0);
+    elapsed = get_time() - start;
+    if (status != VM_HALTED) {
+        fprintf(stderr, "%s did not halt: %s\n", name,
+                status == VM_ERROR ? vm_error(vm) : "suspended");
+        exit(EXIT_FAILURE);
+    }
+    return elapsed * 1e9;
+}
+
+static void run_benchmark(const char *minias, const char *filename,
+                          int compact, int warmup, int repetitions,
+                          struct result *result) {
+    double times[MAX_REPETITIONS];
+    size_t len;
+    int storage;
+    int *code = assemble(minias, filename, compact, &len, &storage,
+                         &result->load_ns);
+    struct minivm *vm = vm_new_storage(code, len,
+                                       storage >= 0 ? storage :
+                                                      VM_STORAGE_SIZE);
+    int saved_stdout;
+    int devnull;
+    int i;
+
+    benchmark_name(filename, result->name);
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    devnull = open("/dev/null", O_WRONLY);
+    if (vm == NULL || saved_stdout < 0 || devnull < 0) {
+        fprintf(stderr, "could not set up %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    for (i = 0; i < warmup; i++) {
+        run_once(vm, result->name);
+    }
+    for (i = 0; i < repetitions; i++) {
+        times[i] = run_once(vm, result->name);
+    }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    qsort(times, repetitions, sizeof(double), compare_doubles);
+    result->instructions = vm_instruction_count(vm);
+    result->min_ns = times[0];
+    result->max_ns = times[repetitions - 1];
+    result->median_ns = repetitions % 2 ? times[repetitions / 2] :
+        (times[repetitions / 2 - 1] + times[repetitions / 2]) / 2;
+
+    result->words = len;
+    free(encode_program(code, len, storage, &result->compact_bytes));
+
+    vm_destroy(vm);
+    free(code);
+}
+
+static double ns_per_instruction(const struct result *result) {
+    return result->median_ns / result->instructions;
+}
+
+/*
+ * Read back the ns_per_instruction of a benchmark from a file written by
+ * write_json, which puts each benchmark on one line. Returns 0 if missing.
+ */
+static double baseline_ns(const char *baseline, const char *name) {
+    char key[MAX_NAME + 16];
+    const char *line;
+
+    sprintf(key, "\"name\": \"%s\"", name);
+    for (line = baseline; line != NULL && *line != '\0';
+         line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        const char *end = strchr(line, '\n');
+        const char *found = strstr(line, key);
+        const char *value;
+        if (found == NULL || (end != NULL && found > end)) {
+            continue;
+        }
+        value = strstr(found, "\"ns_per_instruction\": ");
+        if (value == NULL || (end != NULL && value > end)) {
+            return 0;
+        }
+        return atof(value + strlen("\"ns_per_instruction\": "));
+    }
+    return 0;
+}
+
+static void print_results(const struct result *results, int n,
+                          const char *baseline) {
+    int i;
+
+    printf("%-18s %12s %10s %10s %8s %12s", "benchmark", "instructions",
+           "median ms", "spread ms", "ns/inst", "Minst/s");
+    printf(baseline != NULL ? " %8s\n" : "\n", "speedup");
+    for (i = 0; i < n; i++) {
+        const struct result *r = &results[i];
+        printf("%-18s %12lu %10.2f %10.2f %8.3f %12.1f", r->name,
+               r->instructions, r->median_ns / 1e6,
+               (r->max_ns - r->min_ns) / 1e6, ns_per_instruction(r),
+               r->instructions / (r->median_ns / 1e3));
+        if (baseline != NULL) {
+            double old = baseline_ns(baseline, r->name);
+            if (old > 0) {
+                printf(" %7.2fx", old / ns_per_instruction(r));
+            } else {
+                printf(" %8s", "-");
+            }
+        }
+        printf("\n");
+    }
+
+    printf("\n%-18s %10s %10s %11s %10s %9s\n", "image", "words",
+           "int KB", "compact KB", "bytes/word", "load ms");
+    for (i = 0; i < n; i++) {
+        const struct result *r = &results[i];
+        printf("%-18s %10lu %10.1f %11.1f %10.2f %9.3f\n", r->name,
+               (unsigned long)r->words, r->words * sizeof(int) / 1024.0,
+               r->compact_bytes / 1024.0,
+               (double)r->compact_bytes / (r->words ? r->words : 1),
+               r->load_ns / 1e6);
+    }
+}
+
+static void write_json(const char *filename, const struct result *results,
+                       int n, int repetitions) {
+    FILE *out = fopen(filename, "w");
+    int i;
+
+    if (out == NULL) {
+        fprintf(stderr, "could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "{\n  \"repetitions\": %d,\n  \"benchmarks\": [\n",
+            repetitions);
+    for (i = 0; i < n; i++) {
+        const struct result *r = &results[i];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"instructions\": %lu, "
+                "\"median_ns\": %.0f, \"min_ns\": %.0f, \"max_ns\": %.0f, "
+                "\"ns_per_instruction\": %.4f, \"words\": %lu, "
+                "\"compact_bytes\": %lu, \"load_ns\": %.0f}%s\n",
+                r->name, r->instructions, r->median_ns, r->min_ns,
+                r->max_ns, ns_per_instruction(r), (unsigned long)r->words,
+                (unsigned long)r->compact_bytes, r->load_ns,
+                i + 1 < n ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+}
+
+int main(int argc, char **argv) {
+    const char *minias = "./minias";
+    const char *results_filename = NULL;
+    char *baseline = NULL;
+    struct result *results;
+    int warmup = 1;
+    int repetitions = 5;
+    int compact = 0;
+    int num_programs = 0;
+    int first_program = argc;
+    int i;
+    PROGRAM_NAME = argv[0];
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            generate_straightline(argv[i + 1]);
+            return 0;
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            minias = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            results_filename = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            baseline = read_file(argv[++i]);
+        } else if (strcmp(argv[i], "-z") == 0) {
+            compact = 1;
+        } else if (argv[i][0] != '-') {
+            first_program = i;
+            num_programs = argc - i;
+            break;
+        } else {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num_programs == 0 || warmup < 0 || repetitions < 1 ||
+        repetitions > MAX_REPETITIONS) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    results = malloc(num_programs * sizeof(struct result));
+    for (i = 0; i < num_programs; i++) {
+        run_benchmark(minias, argv[first_program + i], compact, warmup,
+                      repetitions, &results[i]);
+    }
+    print_results(results, num_programs, baseline);
+    if (results_filename != NULL) {
+        write_json(results_filename, results, num_programs, repetitions);
+    }
+    free(results);
+    free(baseline);
+    return 0;
+}
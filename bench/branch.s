@@ -0,0 +1,44 @@
+; branch heavy: x = (75x + 74) % 65537 picks one of four paths through
+; two levels of unpredictable branches
+;
+; about 27 instructions per iteration, 1000000 iterations
+
+    PUSH 1
+    PUSH 0
+    SAVE                ; x = 1
+    PUSH 1000000
+_loop:
+    PUSH 65537
+    PUSH 0
+    LOAD
+    PUSH 75
+    MUL
+    PUSH 74
+    ADD
+    MOD                 ; c x
+    PICK 0
+    PUSH 0
+    SAVE
+    PICK 0
+    PUSH 32768
+    GT                  ; c x (x < 32768)
+    JZ _high
+    POP
+    PICK 0
+    PUSH 16384
+    GT                  ; c x (x < 16384)
+    JZ _next
+    J _next
+_high:
+    POP
+    PICK 0
+    PUSH 49152
+    GT                  ; c x (x < 49152)
+    JZ _next
+_next:
+    POP
+    POP                 ; c
+    PUSH -1
+    ADD
+    JNZ _loop
+    HALT
@@ -0,0 +1,29 @@
+; deep CALL/RET recursion: naive fib(29), arguments on the stack
+;
+; 1664079 calls, about 14 instructions each
+
+    PUSH 29
+    CALL _fib
+    HALT
+
+; n -> fib(n)
+_fib:
+    PICK 0
+    PUSH 2
+    GT                  ; n (n < 2)
+    JZ _recurse
+    POP
+    RET
+_recurse:
+    POP
+    PICK 0
+    PUSH -1
+    ADD
+    CALL _fib           ; n fib(n-1)
+    PICK 1
+    PUSH -2
+    ADD
+    CALL _fib           ; n fib(n-1) fib(n-2)
+    ADD
+    PUT 0               ; fib(n)
+    RET
@@ -0,0 +1,499 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: bench/compile_bench.c
+ */
+
+/*
+ * minicbench: generate miniC programs of a given size and shape, and measure
+ * how the time and peak memory of each compiler stage grow with the size
+ *
+ * For each size the program is written to bench/gen_scale.c and compiled
+ * with minic --time and minias --time, whose per-stage reports are collected
+ * into a table and a CSV file. The growth column is the exponent k in
+ * time ~ n^k between consecutive sizes: about 1 is linear, 2 quadratic.
+ *
+ * dispatch runs miniC programs on both targets, minic --run and minic
+ * --registers --run, and compares the instructions each executed.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_SIZES 16
+#define MAX_STAGES 8
+#define MAX_STAGE_NAME 24
+#define SCALE_SOURCE "bench/gen_scale.c"
+#define SCALE_ASSEMBLY "bench/gen_scale.s"
+
+static char *PROGRAM_NAME = NULL;
+
+static void print_usage() {
+    fprintf(stderr,
+            "usage: %s [SHAPE] generate FILE.c\n"
+            "       %s [SHAPE] [--sizes N,N,...] [--budget SECONDS] "
+            "[-o RESULTS.csv] scale\n"
+            "       %s [--minic PATH] dispatch FILE.c...\n",
+            PROGRAM_NAME, PROGRAM_NAME, PROGRAM_NAME);
+    fprintf(stderr,
+            "shape of the generated program:\n"
+            "  -n STATEMENTS   statements in total, default 1000\n"
+            "  -d DEPTH        depth of each expression tree, default 3\n"
+            "  -v VARIABLES    global variables, default 50\n"
+            "  -i DEPTH        deepest nesting of if statements, default 3\n"
+            "  -f FUNCTIONS    functions the statements are spread over, "
+            "default 10\n"
+            "  -s SEED         random seed, default 1\n");
+    fprintf(stderr,
+            "scale:\n"
+            "  --sizes N,...   statement counts, default "
+            "1000,10000,100000,1000000\n"
+            "  --budget S      skip sizes predicted to take longer than S "
+            "seconds, default 120\n"
+            "  --minic PATH    compiler to measure, default ./minic\n"
+            "  --minias PATH   assembler to measure, default ./minias\n"
+            "  -o RESULTS.csv  also write the measurements as CSV\n");
+}
+
+struct shape {
+    long statements;
+    int depth;
+    int variables;
+    int if_depth;
+    int functions;
+    unsigned long seed;
+};
+
+/* a small LCG so the same seed gives the same program everywhere */
+static unsigned long random_state = 1;
+
+static int random_below(int n) {
+    random_state = random_state * 1103515245 + 12345;
+    return (int)((random_state >> 16) % (unsigned long)n);
+}
+
+/* identifiers are letters only, so number n is spelled in base 26 */
+static void put_name(FILE *out, char prefix, int n) {
+    fputc(prefix, out);
+    do {
+        fputc('a' + n % 26, out);
+        n /= 26;
+    } while (n > 0);
+}
+
+static void indent(FILE *out, int level) {
+    int i;
+    for (i = 0; i < level; i++) {
+        fputs("    ", out);
+    }
+}
+
+/*
+ * A full binary tree of depth operators on its leftmost spine, the right
+ * subtrees are of random depth so expressions are not all the same shape.
+ */
+static void generate_expr(FILE *out, const struct shape *shape, int depth) {
+    static const char *ops[] = {"+", "-", "*", "<", ">", "==", "!=", "<="};
+
+    if (depth == 0) {
+        if (random_below(2) == 0) {
+            fprintf(out, "%d", random_below(100));
+        } else {
+            put_name(out, 'v', random_below(shape->variables));
+        }
+        return;
+    }
+    fputc('(', out);
+    generate_expr(out, shape, depth - 1);
+    fprintf(out, " %s ", ops[random_below(sizeof(ops) / sizeof(ops[0]))]);
+    generate_expr(out, shape, random_below(depth));
+    fputc(')', out);
+}
+
+/*
+ * exactly count statements, an if and each statement in it count as one,
+ * calls only go to functions defined earlier so the program terminates
+ */
+static void generate_stmts(FILE *out, const struct shape *shape, long count,
+                           int level, int if_level, int callable) {
+    while (count > 0) {
+        if (count >= 3 && if_level < shape->if_depth &&
+            random_below(8) == 0) {
+            long body = 1 + random_below((int)(count - 1 < 16 ?
+                                               count - 1 : 16));
+            long then_count = (body + 1) / 2;
+            long else_count = body - then_count;
+
+            indent(out, level);
+            fputs("if (", out);
+            generate_expr(out, shape, shape->depth);
+            fputs(") {\n", out);
+            generate_stmts(out, shape, then_count, level + 1, if_level + 1,
+                           callable);
+            indent(out, level);
+            if (else_count > 0) {
+                fputs("} else {\n", out);
+                generate_stmts(out, shape, else_count, level + 1,
+                               if_level + 1, callable);
+                indent(out, level);
+            }
+            fputs("}\n", out);
+            count -= 1 + body;
+        } else if (callable > 0 && random_below(16) == 0) {
+            indent(out, level);
+            put_name(out, 'f', random_below(callable));
+            fputs("();\n", out);
+            count--;
+        } else {
+            indent(out, level);
+            put_name(out, 'v', random_below(shape->variables));
+            fputs(" = ", out);
+            generate_expr(out, shape, shape->depth);
+            fputs(";\n", out);
+            count--;
+        }
+    }
+}
+
+/*
+ * Globals first, then the functions, then top level code, with the
+ * statements spread evenly between each function and the top level.
+ * miniC has no comments, so the shape is not recorded in the file.
+ */
+static void generate(const struct shape *shape, const char *filename) {
+    FILE *out = fopen(filename, "w");
+    long share = shape->statements / (shape->functions + 1);
+    int i;
+
+    if (out == NULL) {
+        fprintf(stderr, "could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    random_state = shape->seed;
+    for (i = 0; i < shape->variables; i++) {
+        fputs("int ", out);
+        put_name(out, 'v', i);
+        fputs(";\n", out);
+    }
+    for (i = 0; i < shape->functions; i++) {
+        fputs("int ", out);
+        put_name(out, 'f', i);
+        fputs("() {\n", out);
+        generate_stmts(out, shape, share > 0 ? share : 1, 1, 0, i);
+        fputs("}\n", out);
+    }
+    generate_stmts(out, shape,
+                   shape->statements - share * shape->functions, 0, 0,
+                   shape->functions);
+    fclose(out);
+}
+
+struct stage {
+    char name[MAX_STAGE_NAME];
+    double ms[MAX_SIZES];
+    long peak_kb[MAX_SIZES];
+};
+
+struct measurements {
+    long sizes[MAX_SIZES];
+    int num_sizes;
+    int num_measured;
+    struct stage stages[MAX_STAGES];
+    int num_stages;
+};
+
+static struct stage *find_stage(struct measurements *m, const char *tool,
+                                const char *name) {
+    char full_name[MAX_STAGE_NAME];
+    int i;
+
+    sprintf(full_name, "%.7s:%.15s", tool, name);
+    for (i = 0; i < m->num_stages; i++) {
+        if (strcmp(m->stages[i].name, full_name) == 0) {
+            return &m->stages[i];
+        }
+    }
+    if (m->num_stages == MAX_STAGES) {
+        fprintf(stderr, "too many stages reported\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(m->stages[m->num_stages].name, full_name);
+    return &m->stages[m->num_stages++];
+}
+
+/* run "PATH --time FILE" and record the stage lines it prints */
+static void measure_tool(struct measurements *m, const char *tool,
+                         const char *path, const char *filename) {
+    char *command = malloc(strlen(path) + strlen(filename) + 32);
+    char line[256];
+    FILE *report;
+
+    sprintf(command, "%s --time %s 2>&1 >/dev/null", path, filename);
+    report = popen(command, "r");
+    if (report == NULL) {
+        fprintf(stderr, "could not run %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), report) != NULL) {
+        char name[16];
+        double ms;
+        long peak_kb;
+        if (sscanf(line, "%15s %lf ms %ld KB peak", name, &ms,
+                   &peak_kb) == 3) {
+            struct stage *stage = find_stage(m, tool, name);
+            stage->ms[m->num_measured] = ms;
+            stage->peak_kb[m->num_measured] = peak_kb;
+        } else {
+            fputs(line, stderr);
+        }
+    }
+    if (pclose(report) != 0) {
+        fprintf(stderr, "%s failed on %s\n", path, filename);
+        exit(EXIT_FAILURE);
+    }
+    free(command);
+}
+
+static double total_ms(const struct measurements *m, int size) {
+    double total = 0;
+    int i;
+    for (i = 0; i < m->num_stages; i++) {
+        total += m->stages[i].ms[size];
+    }
+    return total;
+}
+
+/* exponent k with y ~ n^k between sizes a and b, 0 if unknown */
+static double growth(double y_a, double y_b, long n_a, long n_b) {
+    if (y_a <= 0 || y_b <= 0 || n_a == n_b) {
+        return 0;
+    }
+    return log(y_b / y_a) / log((double)n_b / n_a);
+}
+
+static void print_measurements(const struct measurements *m) {
+    int i;
+    int s;
+
+    printf("%-16s %10s %12s %7s %12s %7s\n", "stage", "statements",
+           "ms", "growth", "peak KB", "growth");
+    for (i = 0; i < m->num_stages; i++) {
+        const struct stage *stage = &m->stages[i];
+        for (s = 0; s < m->num_measured; s++) {
+            printf("%-16s %10ld %12.2f", s == 0 ? stage->name : "",
+                   m->sizes[s], stage->ms[s]);
+            if (s > 0) {
+                printf(" %7.2f %12ld %7.2f\n",
+                       growth(stage->ms[s - 1], stage->ms[s],
+                              m->sizes[s - 1], m->sizes[s]),
+                       stage->peak_kb[s],
+                       growth(stage->peak_kb[s - 1], stage->peak_kb[s],
+                              m->sizes[s - 1], m->sizes[s]));
+            } else {
+                printf(" %7s %12ld %7s\n", "", stage->peak_kb[s], "");
+            }
+        }
+    }
+}
+
+static void write_csv(const struct measurements *m, const char *filename) {
+    FILE *out = fopen(filename, "w");
+    int i;
+    int s;
+
+    if (out == NULL) {
+        fprintf(stderr, "could not open %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "stage,statements,ms,peak_kb\n");
+    for (i = 0; i < m->num_stages; i++) {
+        for (s = 0; s < m->num_measured; s++) {
+            fprintf(out, "%s,%ld,%.3f,%ld\n", m->stages[i].name,
+                    m->sizes[s], m->stages[i].ms[s],
+                    m->stages[i].peak_kb[s]);
+        }
+    }
+    fclose(out);
+}
+
+static void scale(struct shape *shape, struct measurements *m,
+                  const char *minic, const char *minias, double budget) {
+    int s;
+
+    for (s = 0; s < m->num_sizes; s++) {
+        double ms;
+        if (s >= 2) {
+            /* extrapolate from the last two sizes before committing */
+            double k = growth(total_ms(m, s - 2), total_ms(m, s - 1),
+                              m->sizes[s - 2], m->sizes[s - 1]);
+            double predicted = total_ms(m, s - 1) *
+                pow((double)m->sizes[s] / m->sizes[s - 1], k) / 1e3;
+            if (predicted > budget) {
+                fprintf(stderr, "skipping %ld statements and up, predicted "
+                        "%.0f s with growth %.2f, over the %.0f s budget\n",
+                        m->sizes[s], predicted, k, budget);
+                break;
+            }
+        }
+        shape->statements = m->sizes[s];
+        generate(shape, SCALE_SOURCE);
+        measure_tool(m, "minic", minic, SCALE_SOURCE);
+        measure_tool(m, "minias", minias, SCALE_ASSEMBLY);
+        m->num_measured++;
+        ms = total_ms(m, s);
+        fprintf(stderr, "%ld statements: %.0f ms\n", m->sizes[s], ms);
+    }
+}
+
+/* "minic [--registers] --run --time FILE": instructions executed, run ms */
+static unsigned long run_minic(const char *minic, const char *flags,
+                               const char *filename, double *run_ms) {
+    char *command = malloc(strlen(minic) + strlen(filename) + 64);
+    char line[256];
+    unsigned long executed = 0;
+    FILE *report;
+
+    sprintf(command, "%s %s --run --time %s 2>&1 >/dev/null", minic, flags,
+            filename);
+    report = popen(command, "r");
+    if (report == NULL) {
+        fprintf(stderr, "could not run %s\n", minic);
+        exit(EXIT_FAILURE);
+    }
+    *run_ms = 0;
+    while (fgets(line, sizeof(line), report) != NULL) {
+        if (sscanf(line, "executed %lu", &executed) != 1 &&
+            sscanf(line, "run %lf ms", run_ms) != 1 &&
+            strstr(line, " ms ") == NULL) {
+            fputs(line, stderr);
+        }
+    }
+    if (pclose(report) != 0) {
+        fprintf(stderr, "%s failed on %s\n", minic, filename);
+        exit(EXIT_FAILURE);
+    }
+    free(command);
+    return executed;
+}
+
+static void dispatch(const char *minic, char **files, int num_files) {
+    int i;
+
+    printf("%-28s %12s %12s %7s %10s %10s\n", "program", "stack",
+           "registers", "fewer", "stack ms", "reg ms");
+    for (i = 0; i < num_files; i++) {
+        double stack_ms;
+        double register_ms;
+        unsigned long stack = run_minic(minic, "", files[i], &stack_ms);
+        unsigned long registers = run_minic(minic, "--registers", files[i],
+                                            &register_ms);
+        printf("%-28s %12lu %12lu %6.1f%% %10.2f %10.2f\n", files[i],
+               stack, registers,
+               stack == 0 ? 0.0 : 100.0 * (1.0 - (double)registers / stack),
+               stack_ms, register_ms);
+    }
+}
+
+static int parse_sizes(const char *list, long *sizes) {
+    int n = 0;
+    while (*list != '\0' && n < MAX_SIZES) {
+        char *end;
+        sizes[n] = strtol(list, &end, 10);
+        if (end == list || sizes[n] <= 0 || (*end != ',' && *end != '\0')) {
+            return 0;
+        }
+        n++;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return *list == '\0' ? n : 0;
+}
+
+int main(int argc, char **argv) {
+    struct shape shape = {1000, 3, 50, 3, 10, 1};
+    static struct measurements m;
+    const char *minic = "./minic";
+    const char *minias = "./minias";
+    const char *results_filename = NULL;
+    const char *command = NULL;
+    char **files = malloc(argc * sizeof(char *));
+    int num_files = 0;
+    double budget = 120;
+    int i;
+    PROGRAM_NAME = argv[0];
+
+    m.num_sizes = parse_sizes("1000,10000,100000,1000000", m.sizes);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            shape.statements = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            shape.depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            shape.variables = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            shape.if_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            shape.functions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            shape.seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            m.num_sizes = parse_sizes(argv[++i], m.sizes);
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--minic") == 0 && i + 1 < argc) {
+            minic = argv[++i];
+        } else if (strcmp(argv[i], "--minias") == 0 && i + 1 < argc) {
+            minias = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            results_filename = argv[++i];
+        } else if (command == NULL && argv[i][0] != '-') {
+            command = argv[i];
+        } else if (argv[i][0] != '-') {
+            files[num_files++] = argv[i];
+        } else {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (command == NULL || shape.statements < 1 || shape.depth < 0 ||
+        shape.variables < 1 || shape.if_depth < 0 || shape.functions < 0 ||
+        m.num_sizes == 0) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(command, "generate") == 0 && num_files == 1) {
+        generate(&shape, files[0]);
+    } else if (strcmp(command, "dispatch") == 0 && num_files > 0) {
+        dispatch(minic, files, num_files);
+    } else if (strcmp(command, "scale") == 0 && num_files == 0) {
+        scale(&shape, &m, minic, minias, budget);
+        print_measurements(&m);
+        if (results_filename != NULL) {
+            write_csv(&m, results_filename);
+        }
+    } else {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    free(files);
+    return 0;
+}
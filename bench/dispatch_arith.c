@@ -0,0 +1,21 @@
+int n = 200000;
+int a = 1;
+int b = 2;
+int c = 3;
+int total = 0;
+
+int step() {
+    if (n > 0) {
+        c = (a * 3 + b * 5 + n) / 9 - (a - b) / 2;
+        a = (b + c) / 2 + n / 4;
+        b = c - a / 3 + (n - c) / 5;
+        total = total + (a + b + c) / 1000;
+        n = n - 1;
+        step();
+    }
+}
+
+int main() {
+    step();
+    total;
+}
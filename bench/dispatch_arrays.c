@@ -0,0 +1,36 @@
+int v[256];
+int i = 0;
+int rounds = 400;
+int total = 0;
+
+int fill() {
+    if (i < 256) {
+        v[i] = i * 7 / 3;
+        i = i + 1;
+        fill();
+    }
+}
+
+int smooth() {
+    if (i < 255) {
+        v[i] = (v[i - 1] + v[i] * 2 + v[i + 1]) / 4;
+        i = i + 1;
+        smooth();
+    }
+}
+
+int repeat() {
+    if (rounds > 0) {
+        i = 1;
+        smooth();
+        total = total + v[128];
+        rounds = rounds - 1;
+        repeat();
+    }
+}
+
+int main() {
+    fill();
+    repeat();
+    total;
+}
@@ -0,0 +1,25 @@
+int n = 200000;
+int w = 7;
+int i = 0;
+int total = 0;
+int wraps = 0;
+int a[64];
+
+int step() {
+    if (i < n) {
+        a[i * 8 - i * 8 / 64 * 64] = i * 8 + w * 3;
+        total = total + (w + 1) * (w - 1) + a[i * 8 / 64 - i * 8 / 512 * 8];
+        if (total > w * 100000) {
+            total = total - w * 100000;
+            wraps = wraps + 1;
+        }
+        i = i + 1;
+        step();
+    }
+}
+
+int main() {
+    step();
+    total;
+    wraps;
+}
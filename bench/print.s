@@ -0,0 +1,19 @@
+; print heavy: a number, a character and a string per iteration
+;
+; 8 instructions per iteration, 500000 iterations
+
+    PUSH 500000
+_loop:
+    PRINTI
+    PUSH 32
+    PRINTC
+    POP
+    PRINTS _line
+    PUSH -1
+    ADD
+    JNZ _loop
+    HALT
+
+.data
+_line:
+    .string "lines of output\n"
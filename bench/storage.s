@@ -0,0 +1,37 @@
+; LOAD/SAVE traffic: storage[i] = (storage[i] + storage[i-1]) % 1000 + 1
+; for i in 1..399, over and over
+;
+; 22 instructions per cell, 2800 passes over 399 cells
+
+    PUSH 2800
+_pass:
+    PUSH 1              ; c i
+_cell:
+    PUSH 1000
+    PICK 1
+    LOAD                ; c i 1000 s[i]
+    PICK 2
+    PUSH -1
+    ADD
+    LOAD                ; c i 1000 s[i] s[i-1]
+    ADD
+    MOD
+    PUSH 1
+    ADD                 ; c i v
+    PICK 1
+    SAVE                ; c i
+    PUSH 1
+    ADD
+    PICK 0
+    PUSH 400
+    GT                  ; c i+1 (i+1 < 400)
+    JZ _end_pass
+    POP
+    J _cell
+_end_pass:
+    POP
+    POP                 ; c
+    PUSH -1
+    ADD
+    JNZ _pass
+    HALT
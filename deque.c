@@ -0,0 +1,94 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: deque.c
+ */
+
+/*
+ * Chase and Lev, "Dynamic Circular Work-Stealing Deque", with the memory
+ * orders from Le et al., "Correct and Efficient Work-Stealing for Weak
+ * Memory Models". The GCC __atomic builtins stand in for C11 atomics.
+ */
+
+#include <stddef.h>
+
+#include "deque.h"
+
+#define MASK (DEQUE_SIZE - 1)
+
+void deque_init(struct deque *deque) {
+    deque->top = 0;
+    deque->bottom = 0;
+}
+
+int deque_push(struct deque *deque, void *item) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= DEQUE_SIZE) {
+        return -1;
+    }
+    __atomic_store_n(&deque->buffer[bottom & MASK], item, __ATOMIC_RELAXED);
+    /* a release store rather than the paper's fence, same ordering, and
+     * one that ThreadSanitizer understands */
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *deque_pop(struct deque *deque) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    long top;
+    void *item = NULL;
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top <= bottom) {
+        item = __atomic_load_n(&deque->buffer[bottom & MASK],
+                               __ATOMIC_RELAXED);
+        if (top == bottom) {
+            /* the last item, race the thieves for it */
+            if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED)) {
+                item = NULL;
+            }
+            __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return item;
+}
+
+void *deque_steal(struct deque *deque) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    long bottom;
+    void *item;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return NULL;
+    }
+    item = __atomic_load_n(&deque->buffer[top & MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return item;
+}
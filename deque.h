@@ -0,0 +1,52 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: deque.h
+ */
+
+/*
+ * Chase-Lev work-stealing deque of pointers with a fixed capacity.
+ *
+ * The owner pushes and pops at the bottom, any other thread may steal from
+ * the top. Only the owner may call deque_push and deque_pop.
+ */
+
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#define DEQUE_SIZE 4096 /* power of two */
+
+struct deque {
+    long top;
+    char pad[64 - sizeof(long)]; /* keep thieves off the owner's line */
+    long bottom;
+    void *buffer[DEQUE_SIZE];
+};
+
+void deque_init(struct deque *deque);
+
+/* returns -1 when the deque is full */
+int deque_push(struct deque *deque, void *item);
+
+/* NULL when empty, or when a thief took the last item */
+void *deque_pop(struct deque *deque);
+
+/* NULL when empty, or when the steal lost a race, try again elsewhere */
+void *deque_steal(struct deque *deque);
+
+#endif /* DEQUE_H */
@@ -0,0 +1,377 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: encoding.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encoding.h"
+#include "instructions.h"
+
+/*
+ * Part of libminivm, so running out of memory is returned rather than
+ * exiting like the rest of the toolchain
+ */
+
+#define HEADER_SIZE 13
+#define FORM_SHIFT  6
+#define STORAGE_HEADER "storage"
+
+struct buffer {
+    unsigned char *bytes; /* NULL once out of memory */
+    size_t len;
+    size_t capacity;
+};
+
+static void put_byte(struct buffer *buffer, int byte) {
+    if (buffer->bytes == NULL) {
+        return;
+    }
+    if (buffer->len == buffer->capacity) {
+        unsigned char *bigger;
+        buffer->capacity *= 2;
+        bigger = realloc(buffer->bytes, buffer->capacity);
+        if (bigger == NULL) {
+            free(buffer->bytes);
+            buffer->bytes = NULL;
+            return;
+        }
+        buffer->bytes = bigger;
+    }
+    buffer->bytes[buffer->len++] = (unsigned char)byte;
+}
+
+/* little endian, the low width bytes of value */
+static void put_word(struct buffer *buffer, int value, int width) {
+    unsigned long bits = (unsigned long)value;
+    int i;
+    for (i = 0; i < width; i++) {
+        put_byte(buffer, (int)(bits & 0xff));
+        bits >>= 8;
+    }
+}
+
+static int get_word(const unsigned char *bytes, int width) {
+    long value = (signed char)bytes[width - 1];
+    int i;
+    for (i = width - 2; i >= 0; i--) {
+        value = value * 256 + bytes[i];
+    }
+    return (int)value;
+}
+
+/* the smallest immediate form holding value, as the top bits of the byte */
+static int form_of(int value) {
+    if (value >= -128 && value <= 127) {
+        return 0;
+    }
+    if (value >= -32768 && value <= 32767) {
+        return 1;
+    }
+    return 2;
+}
+
+static int is_byte_data(const int *words, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (words[i] < 0 || words[i] > 255) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+bool is_compact_program(const char *data, size_t size) {
+    return size >= HEADER_SIZE &&
+           memcmp(data, ENCODING_MAGIC, strlen(ENCODING_MAGIC)) == 0;
+}
+
+unsigned char *encode_program(const int *code,
+                              size_t len,
+                              int storage,
+                              size_t *size) {
+    return encode_program_indexed(code, len, storage, size, NULL);
+}
+
+unsigned char *encode_program_indexed(const int *code,
+                                      size_t len,
+                                      int storage,
+                                      size_t *size,
+                                      int *offsets) {
+    struct buffer buffer;
+    const char *magic;
+    size_t pc = 0;
+
+    buffer.capacity = 64;
+    buffer.len = 0;
+    buffer.bytes = malloc(buffer.capacity);
+
+    for (magic = ENCODING_MAGIC; *magic != '\0'; magic++) {
+        put_byte(&buffer, *magic);
+    }
+    put_byte(&buffer, ENCODING_VERSION);
+    put_word(&buffer, (int)len, 4);
+    put_word(&buffer, storage, 4);
+
+    if (offsets != NULL) {
+        for (pc = 0; pc < len; pc++) {
+            offsets[pc] = -1;
+        }
+        pc = 0;
+    }
+    while (pc < len) {
+        int inst = code[pc];
+        int form;
+        if (inst < 0 || inst >= num_opcodes ||
+            (requires_immediate(inst) && pc + 1 == len) ||
+            (inst == DATA &&
+             (code[pc+1] < 0 || (size_t)code[pc+1] > len - pc - 2))) {
+            put_byte(&buffer, ENCODING_RAW);
+            put_word(&buffer, inst, 4);
+            pc++;
+            continue;
+        }
+        if (offsets != NULL) {
+            offsets[pc] = (int)buffer.len;
+        }
+        if (!requires_immediate(inst)) {
+            put_byte(&buffer, inst);
+            pc++;
+            continue;
+        }
+        form = form_of(code[pc+1]);
+        put_byte(&buffer, inst | form << FORM_SHIFT);
+        put_word(&buffer, code[pc+1], 1 << form);
+        if (inst == DATA) {
+            int n = code[pc+1];
+            int width = is_byte_data(code + pc + 2, n) ? 1 : 4;
+            int i;
+            put_byte(&buffer, width);
+            for (i = 0; i < n; i++) {
+                put_word(&buffer, code[pc + 2 + i], width);
+            }
+            pc += n;
+        }
+        pc += 2;
+    }
+    *size = buffer.len;
+    return buffer.bytes;
+}
+
+int *decode_program(const unsigned char *bytes,
+                    size_t size,
+                    size_t *len,
+                    int *storage) {
+    size_t pos = HEADER_SIZE;
+    size_t words;
+    size_t n = 0;
+    int *code;
+
+    if (!is_compact_program((const char *)bytes, size) ||
+        bytes[4] != ENCODING_VERSION) {
+        return NULL;
+    }
+    words = (unsigned int)get_word(bytes + 5, 4);
+    *storage = get_word(bytes + 9, 4);
+    /* every word takes at least a byte */
+    if (words > size - pos || *storage < ENCODING_NO_STORAGE) {
+        return NULL;
+    }
+    code = malloc(words * sizeof(int) + 1);
+    if (code == NULL) {
+        return NULL;
+    }
+
+    while (n < words) {
+        int byte;
+        int inst;
+        int width;
+        if (pos == size) {
+            goto malformed;
+        }
+        byte = bytes[pos++];
+        if (byte == ENCODING_RAW) {
+            if (size - pos < 4) {
+                goto malformed;
+            }
+            code[n++] = get_word(bytes + pos, 4);
+            pos += 4;
+            continue;
+        }
+        inst = ENCODING_OPCODE(byte);
+        if (inst >= num_opcodes) {
+            goto malformed;
+        }
+        if (!requires_immediate(inst)) {
+            if (byte >> FORM_SHIFT != 0) {
+                goto malformed;
+            }
+            code[n++] = inst;
+            continue;
+        }
+        width = ENCODING_IMMEDIATE_SIZE(byte);
+        if (width > 4 || size - pos < (size_t)width || words - n < 2) {
+            goto malformed;
+        }
+        code[n++] = inst;
+        code[n++] = get_word(bytes + pos, width);
+        pos += width;
+        if (inst == DATA) {
+            int count = code[n-1];
+            int i;
+            if (count < 0 || (size_t)count > words - n || pos == size) {
+                goto malformed;
+            }
+            width = bytes[pos++];
+            if ((width != 1 && width != 4) ||
+                (size_t)count > (size - pos) / width) {
+                goto malformed;
+            }
+            for (i = 0; i < count; i++) {
+                code[n++] = width == 1 ? bytes[pos] : get_word(bytes + pos, 4);
+                pos += width;
+            }
+        }
+    }
+    if (pos != size) {
+        goto malformed;
+    }
+    *len = words;
+    return code;
+
+malformed:
+    free(code);
+    return NULL;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* the number at *pos, moving past it, false if there is none */
+static bool parse_int(const char *text, size_t size, size_t *pos, int *value) {
+    size_t i = *pos;
+    bool negative = false;
+    unsigned long n = 0;
+
+    if (i < size && (text[i] == '-' || text[i] == '+')) {
+        negative = text[i] == '-';
+        i++;
+    }
+    if (i == size || text[i] < '0' || text[i] > '9') {
+        return false;
+    }
+    while (i < size && text[i] >= '0' && text[i] <= '9') {
+        n = n * 10 + (unsigned long)(text[i] - '0');
+        i++;
+    }
+    *value = negative ? (int)-(long)n : (int)n;
+    *pos = i;
+    return true;
+}
+
+static int *parse_text_program(const char *text,
+                               size_t size,
+                               size_t *len,
+                               int *storage) {
+    size_t capacity = 64;
+    size_t pos = 0;
+    int *code = malloc(capacity * sizeof(int));
+
+    if (code == NULL) {
+        return NULL;
+    }
+    *len = 0;
+    *storage = ENCODING_NO_STORAGE;
+    while (pos < size && is_space(text[pos])) {
+        pos++;
+    }
+    if (size - pos > strlen(STORAGE_HEADER) &&
+        memcmp(text + pos, STORAGE_HEADER, strlen(STORAGE_HEADER)) == 0) {
+        pos += strlen(STORAGE_HEADER);
+        while (pos < size && (text[pos] == ' ' || text[pos] == '\t')) {
+            pos++;
+        }
+        if (!parse_int(text, size, &pos, storage) || *storage < 0) {
+            free(code);
+            return NULL;
+        }
+    }
+    for (;;) {
+        int value;
+        while (pos < size && is_space(text[pos])) {
+            pos++;
+        }
+        if (pos == size || text[pos] == '\0') {
+            break;
+        }
+        if (!parse_int(text, size, &pos, &value)) {
+            free(code);
+            return NULL;
+        }
+        if (*len == capacity) {
+            int *bigger;
+            capacity *= 2;
+            bigger = realloc(code, capacity * sizeof(int));
+            if (bigger == NULL) {
+                free(code);
+                return NULL;
+            }
+            code = bigger;
+        }
+        code[(*len)++] = value;
+    }
+    return code;
+}
+
+int *parse_program(const char *image, size_t size, size_t *len, int *storage) {
+    if (is_compact_program(image, size)) {
+        return decode_program((const unsigned char *)image, size, len,
+                              storage);
+    }
+    return parse_text_program(image, size, len, storage);
+}
+
+void write_program(FILE *output,
+                   const int *code,
+                   size_t len,
+                   int storage,
+                   bool compact) {
+    size_t i;
+
+    if (compact) {
+        size_t size;
+        unsigned char *bytes = encode_program(code, len, storage, &size);
+        if (bytes == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        fwrite(bytes, 1, size, output);
+        free(bytes);
+        return;
+    }
+    if (storage != ENCODING_NO_STORAGE) {
+        fprintf(output, "%s %d\n", STORAGE_HEADER, storage);
+    }
+    for (i = 0; i < len; i++) {
+        fprintf(output, "%d\n", code[i]);
+    }
+}
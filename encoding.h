@@ -0,0 +1,112 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: encoding.h
+ */
+
+/*
+ * Program images, written by minias and minild and loaded by stackmachine
+ *
+ * A text image is one word per line, after an optional header line
+ *
+ *     storage N          the program uses storage slots 0 to N-1
+ *
+ * which the VM allocates exactly, rather than VM_STORAGE_SIZE slots. It
+ * is there when every piece of the program declared its slots with
+ * .storage, minic output always does.
+ *
+ * A compact image, written by minias --compact and minild --compact, packs
+ * the same words instead of one per line:
+ *
+ *     "MVMZ" VERSION     4 bytes of magic, 1 byte of version
+ *     WORDS              4 bytes, words the image decodes to
+ *     STORAGE            4 bytes, N from the header above or -1 for none
+ *     instructions       until WORDS words have been decoded
+ *
+ * An instruction is one byte, the opcode in the low 6 bits and the size of
+ * its immediate in the top 2: 0 for 1 byte, 1 for 2 bytes, 2 for 4 bytes,
+ * little endian and sign extended. Instructions without an immediate have
+ * 0 there. DATA N is followed by a byte giving the width of each of the N
+ * words, 1 when they all fit in an unsigned byte, else 4. ENCODING_RAW is
+ * followed by any 4 byte word that is not an instruction, so every image
+ * round trips.
+ *
+ * The VM runs this encoding whichever form it loaded, see
+ * encode_program_indexed. Addresses stay word addresses in both forms, so
+ * jump targets, snapshots, traces and profiles do not change.
+ */
+
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ENCODING_MAGIC "MVMZ"
+#define ENCODING_VERSION 2
+#define ENCODING_RAW 0xff
+
+/* the opcode of an instruction byte, and the bytes of its immediate */
+#define ENCODING_OPCODE(byte)         ((byte) & 0x3f)
+#define ENCODING_IMMEDIATE_SIZE(byte) (1 << ((byte) >> 6))
+
+/* storage of an image without a storage header */
+#define ENCODING_NO_STORAGE -1
+
+/* true if the size bytes at data start like a compact image */
+bool is_compact_program(const char *data, size_t size);
+
+/*
+ * len words as a newly allocated compact image of *size bytes, NULL if out
+ * of memory. storage is the header's slot count or ENCODING_NO_STORAGE.
+ */
+unsigned char *encode_program(const int *code,
+                              size_t len,
+                              int storage,
+                              size_t *size);
+
+/*
+ * encode_program for an interpreter running the image's bytes. offsets,
+ * len ints, gets the byte offset in the image of the instruction starting
+ * at each word, or -1 for immediates, DATA words and ENCODING_RAW words,
+ * which have to be run from the words instead.
+ */
+unsigned char *encode_program_indexed(const int *code,
+                                      size_t len,
+                                      int storage,
+                                      size_t *size,
+                                      int *offsets);
+
+/* the words of a compact image, newly allocated, NULL if malformed */
+int *decode_program(const unsigned char *bytes,
+                    size_t size,
+                    size_t *len,
+                    int *storage);
+
+/* the words of a text or compact image, like decode_program */
+int *parse_program(const char *image, size_t size, size_t *len, int *storage);
+
+/* a loadable image, one word per line or compact */
+void write_program(FILE *output,
+                   const int *code,
+                   size_t len,
+                   int storage,
+                   bool compact);
+
+#endif /* ENCODING_H */
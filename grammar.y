@@ -49,10 +49,14 @@ static FILE *source_file = NULL;
 %token IF
 %token THEN
 %token ELSE
+%token SWITCH
+%token CASE
+%token DEFAULT
 %token PRINT
 %token INT
 %token ID
 %token NUMBER
+%token STRING
 %token ASSIGN
 %token EQ
 %token NE
@@ -69,40 +73,54 @@ static FILE *source_file = NULL;
 %token RPAREN
 %token LBRACE
 %token RBRACE
+%token LBRACKET
+%token RBRACKET
 %token SEMICOLON
 %token COMMA
+%token COLON
+%token AND
+%token OR
+%token BANG
 
 
+%left OR
+%left AND
+%nonassoc EQ NE LT LE GT GE
 %left MINUS PLUS
 %left TIMES OVER
 %right EXPONENT        /* exponentiation */
+%right BANG
 
 %%
 prog        : stmts                 { tree = $1 ; }
             ;
 
-stmts       : stmt                  { $$ = $1 ; }
-            | stmts stmt            {
-                                        YYSTYPE ast = $1;
-                                        if (ast) {
-                                            while (ast->sibling) {
-                                                ast = ast->sibling;
-                                            }
-                                            ast->sibling = $2;
-                                            $$ = $1;
-                                        } else {
+/* built newest first, so adding a statement does not walk the list */
+stmts       : rev_stmts             { $$ = reverse_siblings($1) ; }
+            ;
+
+rev_stmts   : stmt                  { $$ = $1 ; }
+            | rev_stmts stmt        {
+                                        if ($2) {
+                                            $2->sibling = $1;
                                             $$ = $2;
+                                        } else {
+                                            $$ = $1;
                                         }
                                     }
-
             ;
 
 stmt        : expr SEMICOLON        { $$ = $1 ; }
             | if_stmt               { $$ = $1 ; }
+            | switch_stmt           { $$ = $1 ; }
             | assign_expr SEMICOLON { $$ = $1 ; }
             | declare SEMICOLON     { $$ = $1 ; }
             | decl_assign SEMICOLON { $$ = $1 ; }
             | decl_func             { $$ = $1 ; }
+            | print_stmt SEMICOLON  { $$ = $1 ; }
+            ;
+
+print_stmt  : PRINT string          { $$ = make_print_node($2) ; }
             ;
 
 decl_func   : INT id LPAREN RPAREN
@@ -112,9 +130,13 @@ decl_func   : INT id LPAREN RPAREN
             ;
 
 declare     : INT id                { $$ = make_declare_node($2) ; }
+            | INT id LBRACKET number RBRACKET
+                                    { $$ = make_array_declare_node($2, $4) ; }
             ;
 
 assign_expr : id ASSIGN expr        { $$ = make_assign_node($1, $3); }
+            | id LBRACKET expr RBRACKET ASSIGN expr
+                                    { $$ = make_index_assign_node($1, $3, $6); }
             ;
 
 decl_assign : INT id ASSIGN expr    {
@@ -125,24 +147,55 @@ decl_assign : INT id ASSIGN expr    {
             ;
 
 if_stmt     : IF LPAREN expr RPAREN LBRACE
-                  stmt
+                  stmts
               RBRACE ELSE LBRACE
-                  stmt
+                  stmts
               RBRACE                { $$ = make_conditional_node($3, $6, $10) ; }
             | IF LPAREN expr RPAREN LBRACE
-                  stmt
+                  stmts
               RBRACE                { $$ = make_conditional_node($3, $6, NULL) ; }
             ;
 
+/* no fall through, each arm leaves the switch when it is done */
+switch_stmt : SWITCH LPAREN expr RPAREN LBRACE
+                  rev_arms
+              RBRACE                { $$ = make_switch_node($3, reverse_siblings($6)) ; }
+            ;
+
+rev_arms    : arm                   { $$ = $1 ; }
+            | rev_arms arm          {
+                                        $2->sibling = $1;
+                                        $$ = $2;
+                                    }
+            ;
+
+arm         : cases stmts           { $$ = make_case_node(reverse_siblings($1), $2) ; }
+            | DEFAULT COLON stmts   { $$ = make_case_node(NULL, $3) ; }
+            ;
+
+/* the values of an arm, built newest first */
+cases       : CASE number COLON     { $$ = $2 ; }
+            | cases CASE number COLON
+                                    {
+                                        $3->sibling = $1;
+                                        $$ = $3;
+                                    }
+            ;
+
 expr        : expr PLUS expr        { $$ = make_operator_node(OP_PLUS, $1, $3) ; }
             | expr MINUS expr       { $$ = make_operator_node(OP_MINUS, $1, $3) ; }
             | expr TIMES expr       { $$ = make_operator_node(OP_TIMES, $1, $3) ; }
             | expr OVER expr        { $$ = make_operator_node(OP_DIVIDE, $1, $3) ; }
+            | expr AND expr         { $$ = make_operator_node(OP_AND, $1, $3) ; }
+            | expr OR expr          { $$ = make_operator_node(OP_OR, $1, $3) ; }
+            | BANG expr             { $$ = make_operator_node(OP_NOT, $2, NULL) ; }
             | bool_expr             { $$ = $1 ; }
             | call_func             { $$ = $1 ; }
             | LPAREN expr RPAREN    { $$ = $2 ; }
             | NUMBER                { $$ = make_leaf_node(make_number_obj(token_string)) ; }
             | id                    { $$ = make_load_node($1) ; }
+            | id LBRACKET expr RBRACKET
+                                    { $$ = make_index_node($1, $3) ; }
             ;
 
 bool_expr   : expr EQ expr          { $$ = make_operator_node(OP_EQ, $1, $3) ; }
@@ -169,17 +222,28 @@ args        : expr                  { $$ = $1 ; }
             ;
 
 call_func   : id LPAREN args RPAREN { $$ = make_func_call_node($1, $3) ; }
+            | id LPAREN RPAREN      { $$ = make_func_call_node($1, NULL) ; }
             ;
 
 id          : ID                    { $$ = make_leaf_node(make_id_obj(token_string)) ; }
             ;
 
+number      : NUMBER                { $$ = make_leaf_node(make_number_obj(token_string)) ; }
+            ;
+
+string      : STRING                { $$ = make_leaf_node(make_string_obj(token_string)) ; }
+            ;
+
 %%
 
 
 ASTNode *parse(FILE *src_file) {
     source_file = src_file;
-    yyparse();
+    tree = NULL;
+    lexer_reset(src_file);
+    if (yyparse() != 0) {
+        return NULL;
+    }
     return tree;
 }
 
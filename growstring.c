@@ -47,6 +47,29 @@ growstring *gs_append(growstring *dest, const char letter) {
 }
 
 
+growstring *gs_append_str(growstring *dest, const char *str) {
+    size_t len = strlen(str);
+    if (dest->size + len > dest->capacity) {
+        char *new_data;
+        size_t new_capacity = 1 + dest->capacity * 2;
+        if (new_capacity < dest->size + len) {
+            new_capacity = dest->size + len;
+        }
+        new_data = (char *)realloc(dest->data,
+                                   sizeof(char) * new_capacity + 1);
+        if (new_data == NULL) {
+            fprintf(stderr, "%s\n", "out of memory when allocating string");
+            exit(EXIT_FAILURE);
+        }
+        dest->data = new_data;
+        dest->capacity = new_capacity;
+    }
+    memcpy(dest->data + dest->size, str, len + 1);
+    dest->size += len;
+    return dest;
+}
+
+
 void gs_free(growstring *gs) {
     free(gs->data);
     gs->data = NULL;
@@ -14,6 +14,7 @@ typedef struct growstring {
 
 growstring *gs_new(void);
 growstring *gs_append(growstring *dest, const char letter);
+growstring *gs_append_str(growstring *dest, const char *str);
 void gs_free(growstring *gs);
 char *gs_get_str(const growstring *gs);
 growstring *gs_write(growstring *dest, const char *data);
@@ -49,10 +49,29 @@ const char *inst_names[] = {
     "CALL",
     "RET",
     "POPC",
-    "HALT"
+    "HALT",
+    "TCALL",
+    "SNAPSHOT",
+    "COCREATE",
+    "YIELD",
+    "RESUME",
+    "SPAWN",
+    "JOIN",
+    "PICK",
+    "PUT",
+    "ALOAD",
+    "ASTORE",
+    "AADD",
+    "BCOPY",
+    "BFILL",
+    "BCMP",
+    "PRINTS",
+    "DATA",
+    "JTAB",
+    NULL
 };
 
-const int num_opcodes = sizeof(inst_names) / sizeof(char *);
+const int num_opcodes = sizeof(inst_names) / sizeof(char *) - 1;
 
 bool requires_immediate(inst_t inst) {
     switch (inst) {
@@ -62,6 +81,14 @@ bool requires_immediate(inst_t inst) {
         case JNZ:
         case JLEZ:
         case CALL:
+        case TCALL:
+        case COCREATE:
+        case SPAWN:
+        case PICK:
+        case PUT:
+        case PRINTS:
+        case DATA:
+        case JTAB:
             return true;
         default:
             return false;
@@ -75,8 +102,15 @@ bool is_jump(inst_t inst) {
         case JNZ:
         case JLEZ:
         case CALL:
+        case TCALL:
+        case COCREATE:
+        case SPAWN:
             return true;
         default:
             return false;
     }
 }
+
+bool takes_label(inst_t inst) {
+    return is_jump(inst) || inst == PRINTS;
+}
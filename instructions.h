@@ -53,13 +53,35 @@ typedef enum {
     CALL,
     RET,
     POPC,
-    HALT
+    HALT,
+    TCALL,
+    SNAPSHOT,
+    COCREATE,
+    YIELD,
+    RESUME,
+    SPAWN,
+    JOIN,
+    PICK,
+    PUT,
+    ALOAD,
+    ASTORE,
+    AADD,
+    BCOPY,
+    BFILL,
+    BCMP,
+    PRINTS,
+    DATA,
+    JTAB
 } inst_t;
 
 extern const char *inst_names[];
+extern const int num_opcodes;
 
 bool requires_immediate(inst_t inst);
 
 bool is_jump(inst_t inst);
 
+/* the immediate is a label: jumps, and PRINTS naming a string */
+bool takes_label(inst_t inst);
+
 #endif /* INSTRUCTIONS_H */
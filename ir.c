@@ -7,12 +7,13 @@
 #include "linkedlist.h"
 #include "instructions.h"
 #include "util.h"
+#include "growstring.h"
 
 
 void ir_print_program(FILE *output, const linkedlist *program) {
     while (program) {
         Ir *ir = (Ir *)program->value;
-        if (ir->value.op == PUSH) {
+        if (ir->kind == IR_OP && ir->value.op == PUSH) {
             fprintf(output, "%s ", ir->repr);
         } else {
             fprintf(output, "%s\n", ir->repr);
@@ -22,6 +23,17 @@ void ir_print_program(FILE *output, const linkedlist *program) {
 }
 
 
+void ir_render_program(growstring *output, const linkedlist *program) {
+    while (program) {
+        Ir *ir = (Ir *)program->value;
+        gs_append_str(output, ir->repr);
+        gs_append(output,
+                  ir->kind == IR_OP && ir->value.op == PUSH ? ' ' : '\n');
+        program = program->next;
+    }
+}
+
+
 struct Ir *ir_call_main() {
     Ir *ir = (Ir *)minic_malloc(sizeof(Ir));
     ir->kind = IR_CALL;
@@ -36,6 +48,9 @@ linkedlist *ir_halt_program(linkedlist* program) {
     ir->kind = IR_END;
     ir->repr = make_str("\tHALT");
     ir->value.op = HALT;
+    if (program == NULL) {
+        return ll_new(ir);
+    }
     ll_append(program, ir);
     return program;
 }
@@ -56,13 +71,13 @@ struct Ir *ir_new_jump_inst(inst_t instruction, const char *label) {
     struct Ir *ir = minic_malloc(sizeof(struct Ir));
     inst_name = inst_names[instruction];
 
-    /* allocate enough memory for \0 and a space between the two strings */
-    tmp_str = minic_malloc(strlen(inst_name) + strlen(label) + 2);
+    /* allocate enough memory for the tab, the space and \0 */
+    tmp_str = minic_malloc(strlen(inst_name) + strlen(label) + 3);
 
     sprintf(tmp_str, "\t%s %s", inst_name, label);
     ir->kind = IR_JMP;
     ir->repr = tmp_str;
-    ir->value.number = NULL;
+    ir->value.op = instruction;
     return ir;
 }
 
@@ -96,6 +111,28 @@ struct Ir *ir_new_push_immediate(int immediate) {
 }
 
 
+struct Ir *ir_new_push_slot(int slot, int size, slot_access access) {
+    struct Ir *ir = minic_malloc(sizeof(struct Ir));
+    char *repr = calloc(255, sizeof(char));
+    sprintf(repr, "\tPUSH @%d", slot);
+    ir->kind = IR_SLOT;
+    ir->repr = repr;
+    ir->value.storage.slot = slot;
+    ir->value.storage.size = size;
+    ir->value.storage.access = access;
+    return ir;
+}
+
+
+struct Ir *ir_new_pop() {
+    struct Ir *ir = minic_malloc(sizeof(struct Ir));
+    ir->kind = IR_POP;
+    ir->repr = make_str("\tPOP");
+    ir->value.number = NULL;
+    return ir;
+}
+
+
 struct Ir *ir_new_ret() {
     struct Ir *ir = minic_malloc(sizeof(struct Ir));
     ir->kind = IR_RET;
@@ -105,6 +142,57 @@ struct Ir *ir_new_ret() {
 }
 
 
+struct Ir *ir_new_inst(inst_t instruction) {
+    struct Ir *ir = minic_malloc(sizeof(struct Ir));
+    const char *inst_name = inst_names[instruction];
+    ir->kind = IR_INST;
+    ir->repr = minic_malloc(strlen(inst_name) + 2);
+    sprintf(ir->repr, "\t%s", inst_name);
+    ir->value.op = instruction;
+    return ir;
+}
+
+
+struct Ir *ir_new_jump_table(int entries) {
+    struct Ir *ir = minic_malloc(sizeof(struct Ir));
+    ir->kind = IR_JMP;
+    ir->repr = minic_malloc(32);
+    sprintf(ir->repr, "\tJTAB %d", entries);
+    ir->value.op = JTAB;
+    return ir;
+}
+
+
+struct Ir *ir_new_global(const char *label) {
+    struct Ir *ir = minic_malloc(sizeof(struct Ir));
+    ir->kind = IR_DIRECTIVE;
+    ir->repr = minic_malloc(strlen(label) + 9);
+    sprintf(ir->repr, ".global %s", label);
+    ir->value.number = NULL;
+    return ir;
+}
+
+
+struct Ir *ir_new_storage(int slots) {
+    struct Ir *ir = minic_malloc(sizeof(struct Ir));
+    ir->kind = IR_DIRECTIVE;
+    ir->repr = minic_malloc(32);
+    sprintf(ir->repr, ".storage %d", slots);
+    ir->value.number = NULL;
+    return ir;
+}
+
+
+struct Ir *ir_new_string(const char *label, const char *literal) {
+    struct Ir *ir = minic_malloc(sizeof(struct Ir));
+    ir->kind = IR_DATA;
+    ir->repr = minic_malloc(strlen(label) + strlen(literal) + 32);
+    sprintf(ir->repr, ".data\n%s:\n\t.string %s\n.text", label, literal);
+    ir->value.number = NULL;
+    return ir;
+}
+
+
 void ir_free_list(linkedlist *ll) {
     linkedlist *free_me = NULL;
     while (ll) {
@@ -116,7 +204,13 @@ void ir_free_list(linkedlist *ll) {
             case IR_SAVE:
             case IR_LOAD:
             case IR_PUSH:
+            case IR_POP:
             case IR_RET:
+            case IR_CALL:
+            case IR_INST:
+            case IR_DATA:
+            case IR_DIRECTIVE:
+            case IR_SLOT:
                 free(ir->repr);
                 ir->repr = NULL;
                 break;
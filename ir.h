@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "linkedlist.h"
 #include "instructions.h"
+#include "growstring.h"
 
 
 typedef enum ir_kind {
@@ -17,22 +18,41 @@ typedef enum ir_kind {
     IR_LOAD,
     IR_PUSH,
     IR_RET,
-    IR_CALL
+    IR_POP,
+    IR_CALL,
+    IR_INST,
+    IR_DATA,
+    IR_DIRECTIVE,
+    IR_SLOT
 } ir_kind;
 
 
+/* what the code after a PUSH @slot does with the slot, see liveness.c */
+typedef enum slot_access {
+    SLOT_READ,   /* LOAD, or an array read by BCMP or BCOPY */
+    SLOT_WRITE,  /* SAVE, or an array set whole by BFILL or BCOPY */
+    SLOT_UPDATE  /* SAVE to one element, the rest of the array is kept */
+} slot_access;
+
+
 typedef struct Ir {
     ir_kind kind;
     char *repr;
     union {
         inst_t op;
         char *number;
+        struct {
+            int slot;
+            int size; /* slots from slot on, 1 for an int */
+            slot_access access;
+        } storage;    /* IR_SLOT */
     } value;
 } Ir;
 
 
 struct Ir *ir_call_main();
 void ir_print_program(FILE *output, const linkedlist *program);
+void ir_render_program(growstring *output, const linkedlist *program);
 linkedlist *ir_halt_program(linkedlist* program);
 struct Ir *ir_new_jump_inst(inst_t instruction, const char *label);
 Ir *ir_new_label(const char *label);
@@ -40,6 +60,26 @@ void ir_free_list(linkedlist *ll);
 struct Ir *ir_new_save();
 struct Ir *ir_new_load();
 struct Ir *ir_new_push_immediate(int immediate);
+
+/*
+ * PUSH @slot, the address of a storage slot, which minild relocates, for a
+ * variable of size slots used the way access says
+ */
+struct Ir *ir_new_push_slot(int slot, int size, slot_access access);
+struct Ir *ir_new_pop();
 struct Ir *ir_new_ret();
+struct Ir *ir_new_inst(inst_t instruction); /* any without an immediate */
+
+/* JTAB entries, to be followed by entries + 1 jumps, see switch in minic.c */
+struct Ir *ir_new_jump_table(int entries);
+
+/* .global label, so other objects can call it once linked by minild */
+struct Ir *ir_new_global(const char *label);
+
+/* .storage slots, the number of storage slots the program uses */
+struct Ir *ir_new_storage(int slots);
+
+/* a .data section holding the quoted, escaped literal under label */
+struct Ir *ir_new_string(const char *label, const char *literal);
 
 #endif /* IR_H */
@@ -0,0 +1,669 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: liveness.c
+ */
+
+/*
+ * Storage slot allocation from liveness
+ *
+ * miniC variables are all global and codegen gives every declaration its
+ * own slots, but most variables only hold a value for a short stretch of
+ * the program. A variable is live at an instruction when some path from
+ * it reaches a read of the variable without passing a write of it. This
+ * works that out on the IR of the whole program, one variable at a time,
+ * by walking backwards from its reads until writes stop the walk, then
+ * treats the first to last instruction where it is live or written as its
+ * interval. Variables whose intervals do not overlap are never live at
+ * the same time and can share a slot, so intervals are partitioned with
+ * the usual greedy sweep by start, reusing any slot whose interval has
+ * ended.
+ *
+ * Calls follow the supergraph: a CALL goes to the function, and the
+ * function's return node goes back to every place it is called from, or
+ * to where its caller returns for a TCALL. Only with a main that calls no
+ * undefined function is the file taken to be the whole program. Otherwise
+ * an outside node stands for the code in other objects: it may call any
+ * function, and any call of an undefined function goes through it.
+ * Variables live there keep their slot for the whole program.
+ *
+ * Slots are then handed out most used first, counting each use once, or
+ * once per call of its function when a profile is loaded, so the hottest
+ * variables get the smallest slot numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "liveness.h"
+#include "ir.h"
+#include "profile.h"
+#include "util.h"
+
+struct variable {
+    int slot;            /* first slot codegen gave it */
+    int size;
+    int start;           /* interval, instructions it is live or set at */
+    int end;
+    bool pinned;         /* live outside, the interval is everything */
+    unsigned long uses;  /* weighted number of uses */
+    int color;           /* group of variables sharing slots */
+};
+
+struct color {
+    int size;
+    unsigned long uses;
+    int slot;            /* new first slot */
+    int next_free;       /* next color of this size free for reuse, or -1 */
+};
+
+struct function {
+    int entry;           /* the function's label */
+    unsigned long weight;
+};
+
+/* a label or jump target, name points into the IR */
+struct label {
+    const char *name;
+    size_t len;
+    int node;
+};
+
+struct liveness {
+    Ir **code;
+    int n;               /* instructions, nodes 0 to n - 1 */
+    int *function_of;    /* function of each instruction, -1 at top level */
+    struct function *functions;
+    int num_functions;   /* return nodes n up to n + num_functions - 1 */
+    int outside;         /* the outside node, last */
+    int nodes;
+
+    struct label *labels;
+    size_t labels_capacity;
+
+    int *edge_from;
+    int *edge_to;
+    int num_edges;
+    int edges_capacity;
+
+    int *block_of;       /* basic block of each node */
+    int *first;          /* first and last instruction of each block, */
+    int *last;           /* -1 for the return and outside nodes */
+    int num_blocks;
+    int *pred_start;     /* predecessors of block b are preds[pred_start[b]] */
+    int *preds;          /* up to preds[pred_start[b + 1]] */
+
+    struct variable *vars;
+    int num_vars;
+    int *access_start;   /* instructions using variable v, like preds */
+    int *accesses;
+};
+
+
+static unsigned long hash_name(const char *name, size_t len) {
+    unsigned long hash = 5381;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash = hash * 33 + (unsigned char)name[i];
+    }
+    return hash;
+}
+
+
+/* the entry for name, empty if it is not there */
+static struct label *find_label(struct liveness *l,
+                                const char *name,
+                                size_t len) {
+    size_t mask = l->labels_capacity - 1;
+    size_t i = hash_name(name, len) & mask;
+    while (l->labels[i].name != NULL &&
+           (l->labels[i].len != len ||
+            strncmp(l->labels[i].name, name, len) != 0)) {
+        i = (i + 1) & mask;
+    }
+    return &l->labels[i];
+}
+
+
+/* node of the label a jump or call goes to, -1 if it is not in program */
+static int jump_target(struct liveness *l, const Ir *ir) {
+    const char *name = strchr(ir->repr, ' ') + 1;
+    return find_label(l, name, strlen(name))->node;
+}
+
+
+/* function whose label is at node, -1 for any other node */
+static int function_at(const struct liveness *l, int node) {
+    int f = node < 0 ? -1 : l->function_of[node];
+    return f >= 0 && l->functions[f].entry == node ? f : -1;
+}
+
+
+static void add_edge(struct liveness *l, int from, int to) {
+    if (from < 0 || to < 0 || to >= l->nodes) {
+        return;
+    }
+    if (l->num_edges == l->edges_capacity) {
+        l->edges_capacity = l->edges_capacity * 2 + 64;
+        l->edge_from = minic_realloc(l->edge_from,
+                                     l->edges_capacity * sizeof(int));
+        l->edge_to = minic_realloc(l->edge_to,
+                                   l->edges_capacity * sizeof(int));
+    }
+    l->edge_from[l->num_edges] = from;
+    l->edge_to[l->num_edges] = to;
+    l->num_edges++;
+}
+
+
+/* the instructions in order, their functions and the label table */
+static void read_program(struct liveness *l, linkedlist *program) {
+    linkedlist *node;
+    int function = -1;
+    bool global = false;
+    int i;
+    int num_labels = 0;
+    char name[256];
+
+    l->n = 0;
+    for (node = program; node != NULL; node = node->next) {
+        if (((Ir *)node->value)->kind == IR_LABEL) {
+            num_labels++;
+        }
+        l->n++;
+    }
+    l->code = minic_malloc((l->n + 1) * sizeof(Ir *));
+    l->function_of = minic_malloc((l->n + 1) * sizeof(int));
+    l->functions = minic_malloc((num_labels + 1) * sizeof(struct function));
+    l->labels_capacity = 16;
+    while (l->labels_capacity < 2 * (size_t)num_labels) {
+        l->labels_capacity *= 2;
+    }
+    l->labels = minic_malloc(l->labels_capacity * sizeof(struct label));
+    for (i = 0; i < (int)l->labels_capacity; i++) {
+        l->labels[i].name = NULL;
+        l->labels[i].node = -1;
+    }
+    l->num_functions = 0;
+
+    /* a function is the label after .global up to the next function */
+    for (i = 0, node = program; node != NULL; i++, node = node->next) {
+        Ir *ir = node->value;
+        l->code[i] = ir;
+        if (ir->kind == IR_DIRECTIVE &&
+            strncmp(ir->repr, ".global ", 8) == 0) {
+            global = true;
+        } else if (ir->kind == IR_LABEL) {
+            size_t len = strlen(ir->repr) - 1; /* without the ':' */
+            struct label *label = find_label(l, ir->repr, len);
+            label->name = ir->repr;
+            label->len = len;
+            label->node = i;
+            if (global) {
+                struct function *f = &l->functions[l->num_functions];
+                function = l->num_functions++;
+                f->entry = i;
+                f->weight = 1;
+                if (profile_loaded() && len < sizeof(name)) {
+                    memcpy(name, ir->repr, len);
+                    name[len] = '\0';
+                    f->weight += profile_call_count(name);
+                }
+                global = false;
+            }
+        }
+        l->function_of[i] = function;
+    }
+    l->outside = l->n + l->num_functions;
+    l->nodes = l->outside + 1;
+}
+
+
+/*
+ * Basic blocks, a block starts at a label, after a jump, call or return,
+ * and each return and the outside node are blocks of their own. Then the
+ * predecessors of each block, from the edges going to its start.
+ */
+static void find_blocks(struct liveness *l) {
+    int i;
+    int b = -1;
+    int from;
+    int to;
+
+    l->block_of = minic_malloc((l->nodes + 1) * sizeof(int));
+    l->first = minic_malloc((l->nodes + 1) * sizeof(int));
+    l->last = minic_malloc((l->nodes + 1) * sizeof(int));
+    for (i = 0; i < l->nodes; i++) {
+        ir_kind before = i > 0 && i < l->n ? l->code[i - 1]->kind : IR_END;
+        if (i >= l->n || l->code[i]->kind == IR_LABEL ||
+            before == IR_JMP || before == IR_CALL || before == IR_RET ||
+            before == IR_END) {
+            b++;
+            l->first[b] = i < l->n ? i : -1;
+        }
+        l->block_of[i] = b;
+        l->last[b] = i < l->n ? i : -1;
+    }
+    l->num_blocks = b + 1;
+
+    l->pred_start = minic_malloc((l->num_blocks + 1) * sizeof(int));
+    l->preds = minic_malloc((l->num_edges + 1) * sizeof(int));
+    memset(l->pred_start, 0, (l->num_blocks + 1) * sizeof(int));
+    for (i = 0; i < l->num_edges; i++) {
+        to = l->block_of[l->edge_to[i]];
+        if (l->first[to] == l->edge_to[i] || l->first[to] < 0) {
+            l->pred_start[to + 1]++;
+        }
+    }
+    for (i = 0; i < l->num_blocks; i++) {
+        l->pred_start[i + 1] += l->pred_start[i];
+    }
+    for (i = 0; i < l->num_edges; i++) {
+        from = l->block_of[l->edge_from[i]];
+        to = l->block_of[l->edge_to[i]];
+        if (l->first[to] == l->edge_to[i] || l->first[to] < 0) {
+            l->preds[l->pred_start[to]++] = from;
+        }
+    }
+    /* filling moved each start up to the start of the next block */
+    for (i = l->num_blocks; i > 0; i--) {
+        l->pred_start[i] = l->pred_start[i - 1];
+    }
+    l->pred_start[0] = 0;
+}
+
+
+/* edges of the supergraph between instructions, then the blocks */
+static void build_graph(struct liveness *l) {
+    int i;
+    int n = l->n;
+    bool open = function_at(l, find_label(l, "main", 4)->node) < 0;
+
+    for (i = 0; i < n; i++) {
+        Ir *ir = l->code[i];
+        int function = l->function_of[i];
+        int next = i + 1 < n ? i + 1 : -1;
+
+        if (ir->kind == IR_END) {
+            continue;
+        } else if (ir->kind == IR_RET) {
+            add_edge(l, i, function >= 0 ? n + function : -1);
+            continue;
+        } else if (ir->kind != IR_JMP && ir->kind != IR_CALL) {
+            add_edge(l, i, next);
+            continue;
+        }
+        switch (ir->value.op) {
+            case J:
+                add_edge(l, i, jump_target(l, ir));
+                break;
+
+            case JZ:
+            case JNZ:
+            case JLEZ:
+                add_edge(l, i, jump_target(l, ir));
+                add_edge(l, i, next);
+                break;
+
+            /* to each of the jumps of its table */
+            case JTAB:
+            {
+                int entries = atoi(strchr(ir->repr, ' ') + 1);
+                int k;
+                for (k = 1; k <= entries + 1 && i + k < n; k++) {
+                    add_edge(l, i, i + k);
+                }
+                break;
+            }
+
+            case CALL:
+            case TCALL:
+            {
+                int callee = function_at(l, jump_target(l, ir));
+                /* where the callee returns to */
+                int back = ir->value.op == TCALL && function >= 0 ?
+                           n + function : next;
+                if (callee >= 0) {
+                    add_edge(l, i, l->functions[callee].entry);
+                    add_edge(l, n + callee, back);
+                } else {
+                    add_edge(l, i, l->outside);
+                    add_edge(l, l->outside, back);
+                    open = true;
+                }
+                break;
+            }
+
+            default:
+                add_edge(l, i, next);
+                break;
+        }
+    }
+    if (open) {
+        for (i = 0; i < l->num_functions; i++) {
+            add_edge(l, l->outside, l->functions[i].entry);
+            add_edge(l, n + i, l->outside);
+        }
+    }
+
+    find_blocks(l);
+}
+
+
+/* the variables, one per first slot, and the instructions using each */
+static void find_variables(struct liveness *l) {
+    int *var_at;
+    int slots = 0;
+    int i;
+
+    for (i = 0; i < l->n; i++) {
+        if (l->code[i]->kind == IR_SLOT &&
+            l->code[i]->value.storage.slot >= slots) {
+            slots = l->code[i]->value.storage.slot + 1;
+        }
+    }
+    var_at = minic_malloc((slots + 1) * sizeof(int));
+    for (i = 0; i < slots; i++) {
+        var_at[i] = -1;
+    }
+    l->vars = minic_malloc((slots + 1) * sizeof(struct variable));
+    l->access_start = minic_malloc((slots + 2) * sizeof(int));
+    memset(l->access_start, 0, (slots + 2) * sizeof(int));
+    l->num_vars = 0;
+
+    for (i = 0; i < l->n; i++) {
+        Ir *ir = l->code[i];
+        int function = l->function_of[i];
+        int v;
+        if (ir->kind != IR_SLOT) {
+            continue;
+        }
+        v = var_at[ir->value.storage.slot];
+        if (v < 0) {
+            v = l->num_vars++;
+            var_at[ir->value.storage.slot] = v;
+            l->vars[v].slot = ir->value.storage.slot;
+            l->vars[v].size = ir->value.storage.size;
+            l->vars[v].start = i;
+            l->vars[v].end = i;
+            l->vars[v].pinned = false;
+            l->vars[v].uses = 0;
+        }
+        l->vars[v].uses += function >= 0 ? l->functions[function].weight : 1;
+        l->access_start[v + 1]++;
+    }
+
+    for (i = 0; i < l->num_vars; i++) {
+        l->access_start[i + 1] += l->access_start[i];
+    }
+    l->accesses = minic_malloc((l->access_start[l->num_vars] + 1) *
+                               sizeof(int));
+    for (i = 0; i < l->n; i++) {
+        if (l->code[i]->kind == IR_SLOT) {
+            int v = var_at[l->code[i]->value.storage.slot];
+            l->accesses[l->access_start[v]++] = i;
+        }
+    }
+    for (i = l->num_vars; i > 0; i--) {
+        l->access_start[i] = l->access_start[i - 1];
+    }
+    l->access_start[0] = 0;
+    free(var_at);
+}
+
+
+static void widen(struct variable *var, int node) {
+    if (node < 0) {
+        return;
+    }
+    if (node < var->start) {
+        var->start = node;
+    }
+    if (node > var->end) {
+        var->end = node;
+    }
+}
+
+
+/*
+ * The interval of variable v. Blocks that read v before any write of it
+ * have v live at their start, and so does any block before one of those
+ * that does not write v. Marks live[] and writes[] with v + 1.
+ */
+static void find_interval(struct liveness *l, int v,
+                          int *live, int *writes, int *work) {
+    struct variable *var = &l->vars[v];
+    int mark = v + 1;
+    int top = 0;
+    int block = -1;
+    int i;
+
+    /* the accesses are in program order */
+    for (i = l->access_start[v]; i < l->access_start[v + 1]; i++) {
+        int node = l->accesses[i];
+        bool write = l->code[node]->value.storage.access == SLOT_WRITE;
+        widen(var, node);
+        if (l->block_of[node] != block) {
+            block = l->block_of[node];
+            if (!write) {
+                live[block] = mark;
+                work[top++] = block;
+            }
+        }
+        if (write) {
+            writes[block] = mark;
+        }
+    }
+    while (top > 0) {
+        block = work[--top];
+        widen(var, l->first[block]);
+        if (l->first[block] < 0 && l->block_of[l->outside] == block) {
+            var->pinned = true;
+        }
+        for (i = l->pred_start[block]; i < l->pred_start[block + 1]; i++) {
+            int pred = l->preds[i];
+            /* live at the end of pred */
+            widen(var, l->last[pred]);
+            if (live[pred] == mark || writes[pred] == mark) {
+                continue;
+            }
+            live[pred] = mark;
+            work[top++] = pred;
+        }
+    }
+    if (var->pinned) {
+        var->start = 0;
+        var->end = l->n - 1;
+    }
+}
+
+
+static struct variable *sort_vars;
+
+static int by_start(const void *a, const void *b) {
+    const struct variable *x = &sort_vars[*(const int *)a];
+    const struct variable *y = &sort_vars[*(const int *)b];
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+    return *(const int *)a - *(const int *)b;
+}
+
+static int by_end(const void *a, const void *b) {
+    const struct variable *x = &sort_vars[*(const int *)a];
+    const struct variable *y = &sort_vars[*(const int *)b];
+    if (x->end != y->end) {
+        return x->end < y->end ? -1 : 1;
+    }
+    return *(const int *)a - *(const int *)b;
+}
+
+
+static struct color *sort_colors;
+
+/* most used first, then in the order they were made */
+static int by_uses(const void *a, const void *b) {
+    const struct color *x = &sort_colors[*(const int *)a];
+    const struct color *y = &sort_colors[*(const int *)b];
+    if (x->uses != y->uses) {
+        return x->uses > y->uses ? -1 : 1;
+    }
+    return *(const int *)a - *(const int *)b;
+}
+
+
+/* index of size in sizes, added with an empty free list if it is new */
+static int size_index(int *sizes, int *free_head, int *num_sizes, int size) {
+    int i;
+    for (i = 0; i < *num_sizes; i++) {
+        if (sizes[i] == size) {
+            return i;
+        }
+    }
+    sizes[i] = size;
+    free_head[i] = -1;
+    (*num_sizes)++;
+    return i;
+}
+
+
+/*
+ * Sweep the intervals by start, a color is free again once the interval
+ * of its last variable has ended. Free colors are kept on a list for each
+ * size, so an array only shares with arrays of its own size. Returns the
+ * number of colors, with the variables' colors set.
+ */
+static int color_intervals(struct liveness *l, struct color *colors) {
+    int *starts = minic_malloc((l->num_vars + 1) * sizeof(int));
+    int *ends = minic_malloc((l->num_vars + 1) * sizeof(int));
+    int *sizes = minic_malloc((l->num_vars + 1) * sizeof(int));
+    int *free_head = minic_malloc((l->num_vars + 1) * sizeof(int));
+    int num_sizes = 0;
+    int num_colors = 0;
+    int ended = 0;
+    int i;
+
+    for (i = 0; i < l->num_vars; i++) {
+        starts[i] = i;
+        ends[i] = i;
+    }
+    sort_vars = l->vars;
+    qsort(starts, l->num_vars, sizeof(int), by_start);
+    qsort(ends, l->num_vars, sizeof(int), by_end);
+
+    for (i = 0; i < l->num_vars; i++) {
+        struct variable *var = &l->vars[starts[i]];
+        int size;
+        /* anything ending before var starts has been given a color */
+        while (l->vars[ends[ended]].end < var->start) {
+            struct variable *done = &l->vars[ends[ended++]];
+            size = size_index(sizes, free_head, &num_sizes, done->size);
+            colors[done->color].next_free = free_head[size];
+            free_head[size] = done->color;
+        }
+        size = size_index(sizes, free_head, &num_sizes, var->size);
+        if (free_head[size] >= 0) {
+            var->color = free_head[size];
+            free_head[size] = colors[var->color].next_free;
+        } else {
+            var->color = num_colors++;
+            colors[var->color].size = var->size;
+            colors[var->color].uses = 0;
+        }
+        colors[var->color].uses += var->uses;
+    }
+    free(starts);
+    free(ends);
+    free(sizes);
+    free(free_head);
+    return num_colors;
+}
+
+
+int allocate_slots(linkedlist *program) {
+    struct liveness l;
+    struct color *colors;
+    int *order;
+    int *live;
+    int *writes;
+    int *work;
+    int num_colors;
+    int slots = 0;
+    int i;
+    int j;
+
+    memset(&l, 0, sizeof(l));
+    read_program(&l, program);
+    build_graph(&l);
+    find_variables(&l);
+
+    live = minic_malloc((l.num_blocks + 1) * sizeof(int));
+    writes = minic_malloc((l.num_blocks + 1) * sizeof(int));
+    work = minic_malloc((l.num_blocks + 1) * sizeof(int));
+    memset(live, 0, (l.num_blocks + 1) * sizeof(int));
+    memset(writes, 0, (l.num_blocks + 1) * sizeof(int));
+    for (i = 0; i < l.num_vars; i++) {
+        find_interval(&l, i, live, writes, work);
+    }
+    free(live);
+    free(writes);
+    free(work);
+
+    colors = minic_malloc((l.num_vars + 1) * sizeof(struct color));
+    num_colors = color_intervals(&l, colors);
+    order = minic_malloc((num_colors + 1) * sizeof(int));
+    for (i = 0; i < num_colors; i++) {
+        order[i] = i;
+    }
+    sort_colors = colors;
+    qsort(order, num_colors, sizeof(int), by_uses);
+    for (i = 0; i < num_colors; i++) {
+        colors[order[i]].slot = slots;
+        slots += colors[order[i]].size;
+    }
+
+    /* the repr has room for any slot, see ir_new_push_slot() */
+    for (i = 0; i < l.num_vars; i++) {
+        int slot = colors[l.vars[i].color].slot;
+        for (j = l.access_start[i]; j < l.access_start[i + 1]; j++) {
+            Ir *ir = l.code[l.accesses[j]];
+            ir->value.storage.slot = slot;
+            sprintf(ir->repr, "\tPUSH @%d", slot);
+        }
+    }
+
+    free(order);
+    free(colors);
+    free(l.code);
+    free(l.function_of);
+    free(l.functions);
+    free(l.labels);
+    free(l.edge_from);
+    free(l.edge_to);
+    free(l.pred_start);
+    free(l.preds);
+    free(l.vars);
+    free(l.access_start);
+    free(l.accesses);
+    free(l.block_of);
+    free(l.first);
+    free(l.last);
+    return slots;
+}
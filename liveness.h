@@ -0,0 +1,35 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: liveness.h
+ */
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include "linkedlist.h"
+
+/*
+ * Number the storage slots of the variables in program, the IR of a whole
+ * program, again. Variables that are never live at the same time share
+ * slots, the most used ones get the lowest slots, and variables the code
+ * never touches get none. Returns the number of slots the program needs.
+ */
+int allocate_slots(linkedlist *program);
+
+#endif /* LIVENESS_H */
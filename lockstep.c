@@ -0,0 +1,753 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: lockstep.c
+ */
+
+/*
+ * Lockstep execution: one program over many inputs, VM_LANES at a time.
+ *
+ * Every stack slot, call stack slot and storage cell is a vector holding
+ * one value per lane. Each step picks a leader lane, and every running
+ * lane at the leader's pc, sp and call depth executes the instruction
+ * together: the mask selects those lanes and a single vector operation
+ * updates all of them. Since they share sp, the operands are the same
+ * rows for every lane. Loads, stores, input and output are per lane.
+ *
+ * The leader is the deepest lane on the call stack, then the one with the
+ * lowest pc, so lanes that branched apart catch up with each other at the
+ * first pc they have in common, usually right after a loop or an if.
+ *
+ * The vectors use GCC's vector extension. Built with -mavx2 (see
+ * SIMD_FLAGS in the Makefile) a vector is one AVX2 register and most
+ * instructions are a handful of AVX2 instructions for all lanes.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "instructions.h"
+
+typedef int lanes_t __attribute__((vector_size(VM_LANES * sizeof(int))));
+
+/* lanes of m take a, the others b; a macro so vectors are not arguments */
+#define BLEND(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+/* the result of one instance, kept after its lane is reused */
+struct instance {
+    vm_status status;
+    char *error;
+    char *output;
+    size_t output_len;
+    size_t output_capacity;
+    int pc;
+    int sp;
+    int *stack; /* stack[0..sp] */
+};
+
+/* VM_LANES instances running in lockstep */
+struct lanes {
+    /* row s + 1 holds stack slot s, so a pop below the bottom stays in
+     * bounds until the next bounds check */
+    lanes_t stack[VM_STACK_SIZE + 2];
+    lanes_t call_stack[VM_CALL_STACK_SIZE];
+    lanes_t storage[VM_STORAGE_SIZE];
+    lanes_t pc;
+    lanes_t sp;
+    lanes_t cp;
+    lanes_t running; /* -1 for lanes still running, 0 otherwise */
+    int storage_used; /* rows below this may be non zero */
+    int instance[VM_LANES];
+    int input_pos[VM_LANES];
+};
+
+struct minivm_batch {
+    struct lanes lanes; /* first, for its alignment */
+    int *program;
+    size_t program_len;
+    int storage_size; /* rows of lanes.storage in bounds */
+    struct instance *instances;
+    int count;
+    const int *columns;
+    int num_columns;
+    int out_of_memory;
+};
+
+#define ROW(s) lanes->stack[(s) + 1]
+
+struct minivm_batch *vm_batch_new(const int *code, size_t len, int count) {
+    return vm_batch_new_storage(code, len, count, VM_STORAGE_SIZE);
+}
+
+struct minivm_batch *vm_batch_new_storage(const int *code,
+                                          size_t len,
+                                          int count,
+                                          int storage) {
+    struct minivm_batch *batch;
+    void *memory;
+
+    if (count < 0 || storage < 0 || storage > VM_STORAGE_SIZE ||
+        posix_memalign(&memory, sizeof(lanes_t),
+                       sizeof(struct minivm_batch)) != 0) {
+        return NULL;
+    }
+    batch = memory;
+    memset(batch, 0, sizeof(struct minivm_batch));
+    batch->program = malloc((len + 1) * sizeof(int));
+    batch->instances = calloc(count > 0 ? count : 1, sizeof(struct instance));
+    if (batch->program == NULL || batch->instances == NULL) {
+        vm_batch_destroy(batch);
+        return NULL;
+    }
+    batch->program[0] = HALT;
+    memcpy(batch->program + 1, code, len * sizeof(int));
+    batch->program_len = len;
+    batch->storage_size = storage;
+    batch->count = count;
+    return batch;
+}
+
+static void clear_results(struct minivm_batch *batch) {
+    int i;
+    for (i = 0; i < batch->count; i++) {
+        free(batch->instances[i].error);
+        free(batch->instances[i].output);
+        free(batch->instances[i].stack);
+    }
+    memset(batch->instances, 0, batch->count * sizeof(struct instance));
+}
+
+void vm_batch_destroy(struct minivm_batch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    if (batch->instances != NULL) {
+        clear_results(batch);
+    }
+    free(batch->instances);
+    free(batch->program);
+    free(batch);
+}
+
+void vm_batch_set_input(struct minivm_batch *batch,
+                        const int *columns,
+                        int num_columns) {
+    batch->columns = columns;
+    batch->num_columns = num_columns;
+}
+
+static int input_char(struct minivm_batch *batch,
+                      struct lanes *lanes,
+                      int lane) {
+    int pos = lanes->input_pos[lane];
+    if (batch->columns == NULL || pos >= batch->num_columns) {
+        return EOF;
+    }
+    lanes->input_pos[lane]++;
+    return batch->columns[(size_t)pos * batch->count +
+                          lanes->instance[lane]];
+}
+
+static void output_str(struct minivm_batch *batch,
+                       struct instance *instance,
+                       const char *str,
+                       size_t len) {
+    if (instance->output_len + len > instance->output_capacity) {
+        size_t capacity = instance->output_capacity * 2 + len + 16;
+        char *output = realloc(instance->output, capacity);
+        if (output == NULL) {
+            batch->out_of_memory = 1;
+            return;
+        }
+        instance->output = output;
+        instance->output_capacity = capacity;
+    }
+    memcpy(instance->output + instance->output_len, str, len);
+    instance->output_len += len;
+}
+
+/* stop the lanes in m, saving what vm_print_stack shows */
+static void finish(struct minivm_batch *batch,
+                   struct lanes *lanes,
+                   const lanes_t *m,
+                   vm_status status,
+                   const char *error) {
+    int lane;
+    for (lane = 0; lane < VM_LANES; lane++) {
+        struct instance *instance;
+        int sp;
+        int i;
+        if (!(*m)[lane]) {
+            continue;
+        }
+        instance = &batch->instances[lanes->instance[lane]];
+        sp = lanes->sp[lane];
+        instance->status = status;
+        instance->pc = lanes->pc[lane];
+        instance->sp = sp;
+        if (sp > VM_STACK_SIZE) {
+            sp = VM_STACK_SIZE;
+        }
+        if (sp >= 0) {
+            instance->stack = malloc((sp + 1) * sizeof(int));
+            if (instance->stack == NULL) {
+                batch->out_of_memory = 1;
+            } else {
+                for (i = 0; i <= sp; i++) {
+                    instance->stack[i] = ROW(i)[lane];
+                }
+            }
+        }
+        if (error != NULL) {
+            instance->error = malloc(strlen(error) + 1);
+            if (instance->error == NULL) {
+                batch->out_of_memory = 1;
+            } else {
+                strcpy(instance->error, error);
+            }
+        }
+    }
+    lanes->running &= ~*m;
+}
+
+static void fail(struct minivm_batch *batch,
+                 struct lanes *lanes,
+                 const lanes_t *m,
+                 const char *error) {
+    int lane;
+    for (lane = 0; lane < VM_LANES; lane++) {
+        if ((*m)[lane]) {
+            finish(batch, lanes, m, VM_ERROR, error);
+            return;
+        }
+    }
+}
+
+/* the lane the next step follows, -1 when all are done */
+static int leader(const struct lanes *lanes) {
+    int best = -1;
+    int lane;
+    for (lane = 0; lane < VM_LANES; lane++) {
+        if (!lanes->running[lane]) {
+            continue;
+        }
+        if (best < 0 ||
+            lanes->cp[lane] > lanes->cp[best] ||
+            (lanes->cp[lane] == lanes->cp[best] &&
+             lanes->pc[lane] < lanes->pc[best])) {
+            best = lane;
+        }
+    }
+    return best;
+}
+
+/* pop b into a, the right operand, for the lanes in m */
+#define BINARY(expr) do { \
+    lanes_t a = ROW(S); \
+    lanes_t b = ROW(S - 1); \
+    lanes_t r = (expr); \
+    ROW(S - 1) = BLEND(m, r, b); \
+    lanes->sp += m; \
+    } while (0)
+
+/* execute the instruction at pc for every lane at the leader's pc, sp, cp */
+static void step(struct minivm_batch *batch, struct lanes *lanes, int lead) {
+    const int *program = batch->program;
+    int P = lanes->pc[lead];
+    int S = lanes->sp[lead];
+    int C = lanes->cp[lead];
+    lanes_t zero = {0};
+    lanes_t m = lanes->running &
+                (lanes->pc == P) & (lanes->sp == S) & (lanes->cp == C);
+    lanes_t next;
+    int inst;
+    int immediate;
+    char buff[64];
+    int lane;
+
+    if (P < 0 || (size_t)P > batch->program_len) {
+        fail(batch, lanes, &m, "PC out of bounds");
+        return;
+    }
+    if (S >= VM_STACK_SIZE) {
+        fail(batch, lanes, &m, "SP out of bounds");
+        return;
+    }
+    if (S < 0) {
+        fail(batch, lanes, &m, "SP less than zero");
+        return;
+    }
+    inst = program[P];
+    if (inst >= 0 && inst < num_opcodes && requires_immediate(inst) &&
+        (size_t)P + 1 > batch->program_len) {
+        fail(batch, lanes, &m, "missing immediate");
+        return;
+    }
+    immediate = (size_t)P + 1 <= batch->program_len ? program[P+1] : 0;
+    next = zero + (P + 1);
+
+    switch (inst) {
+        case NOP:
+        case SNAPSHOT: /* nothing to save, run on */
+            break;
+
+        case PUSH:
+            ROW(S + 1) = BLEND(m, zero + immediate, ROW(S + 1));
+            lanes->sp -= m;
+            next = zero + (P + 2);
+            break;
+
+        case PICK:
+            if (immediate < 0 || immediate > S) {
+                fail(batch, lanes, &m, "PICK out of bounds");
+                return;
+            }
+            ROW(S + 1) = BLEND(m, ROW(S - immediate), ROW(S + 1));
+            lanes->sp -= m;
+            next = zero + (P + 2);
+            break;
+
+        case PUT:
+            if (immediate < 0 || immediate >= S) {
+                fail(batch, lanes, &m, "PUT out of bounds");
+                return;
+            }
+            ROW(S - 1 - immediate) = BLEND(m, ROW(S), ROW(S - 1 - immediate));
+            lanes->sp += m;
+            next = zero + (P + 2);
+            break;
+
+        case POP:
+            lanes->sp += m;
+            break;
+
+        case ADD:
+            BINARY(a + b);
+            break;
+
+        case SUB:
+            BINARY(a - b);
+            break;
+
+        case MUL:
+            BINARY(a * b);
+            break;
+
+        /* comparisons give -1 for true, the VM pushes 1 */
+        case EQ:
+            BINARY(-(a == b));
+            break;
+
+        case NE:
+            BINARY(-(a != b));
+            break;
+
+        case LT:
+            BINARY(-(a < b));
+            break;
+
+        case LE:
+            BINARY(-(a <= b));
+            break;
+
+        case GT:
+            BINARY(-(a > b));
+            break;
+
+        case GE:
+            BINARY(-(a >= b));
+            break;
+
+        case NOT:
+            ROW(S) = BLEND(m, -(ROW(S) == 0), ROW(S));
+            break;
+
+        case DIV:
+        case MOD:
+            {
+            lanes_t a = ROW(S);
+            lanes_t b = ROW(S - 1);
+            lanes_t bad = m & (b == 0);
+            /* divide masked off and failing lanes by 1, INT_MIN / -1 too */
+            lanes_t safe = m & ~bad & ~((a == -(int)(~0U >> 1) - 1) &
+                                        (b == -1));
+            lanes_t divisor = BLEND(safe, b, zero + 1);
+            lanes->sp += m;
+            fail(batch, lanes, &bad, "division by zero");
+            m &= ~bad;
+            if (inst == DIV) {
+                ROW(S - 1) = BLEND(m, a / divisor, b);
+            } else {
+                ROW(S - 1) = BLEND(m, a % divisor, b);
+            }
+            }
+            break;
+
+        case PRINTI:
+        case PRINTC:
+            for (lane = 0; lane < VM_LANES; lane++) {
+                struct instance *instance;
+                if (!m[lane]) {
+                    continue;
+                }
+                instance = &batch->instances[lanes->instance[lane]];
+                if (inst == PRINTI) {
+                    sprintf(buff, "%d", ROW(S)[lane]);
+                    output_str(batch, instance, buff, strlen(buff));
+                } else {
+                    buff[0] = (char)ROW(S)[lane];
+                    output_str(batch, instance, buff, 1);
+                }
+            }
+            break;
+
+        case PRINTS:
+            {
+            int len;
+            int i;
+            if (immediate < 1 || (size_t)immediate > batch->program_len ||
+                (len = program[immediate]) < 0 ||
+                (size_t)len > batch->program_len - immediate) {
+                fail(batch, lanes, &m, "PRINTS address out of bounds");
+                return;
+            }
+            for (lane = 0; lane < VM_LANES; lane++) {
+                struct instance *instance;
+                if (!m[lane]) {
+                    continue;
+                }
+                instance = &batch->instances[lanes->instance[lane]];
+                for (i = 0; i < len; i++) {
+                    buff[i % sizeof(buff)] = (char)program[immediate + 1 + i];
+                    if ((i + 1) % sizeof(buff) == 0 || i + 1 == len) {
+                        output_str(batch, instance, buff,
+                                   i % sizeof(buff) + 1);
+                    }
+                }
+            }
+            next = zero + (P + 2);
+            }
+            break;
+
+        case DATA:
+            if (immediate < 0 ||
+                (size_t)immediate > batch->program_len - P - 1) {
+                fail(batch, lanes, &m, "DATA size out of bounds");
+                return;
+            }
+            next = zero + (P + 2 + immediate);
+            break;
+
+        case READC:
+            for (lane = 0; lane < VM_LANES; lane++) {
+                if (m[lane]) {
+                    int c = input_char(batch, lanes, lane);
+                    /* String is done being read once RETURN is pressed */
+                    ROW(S + 1)[lane] = c == '\n' ? '\0' : c;
+                }
+            }
+            lanes->sp -= m;
+            break;
+
+        case LOAD:
+        case ALOAD:
+        case SAVE:
+        case ASTORE:
+        case AADD:
+            {
+            lanes_t address = ROW(S);
+            lanes_t bad = m & ((address < 0) |
+                                (address >= batch->storage_size));
+            if (inst == SAVE || inst == ASTORE) {
+                lanes->sp += m + m;
+            } else if (inst == AADD) {
+                lanes->sp += m;
+            }
+            fail(batch, lanes, &bad, "storage address out of bounds");
+            m &= ~bad;
+            for (lane = 0; lane < VM_LANES; lane++) {
+                int *cell;
+                if (!m[lane]) {
+                    continue;
+                }
+                cell = &lanes->storage[address[lane]][lane];
+                if (inst == LOAD || inst == ALOAD) {
+                    ROW(S)[lane] = *cell;
+                    continue;
+                }
+                if (address[lane] >= lanes->storage_used) {
+                    lanes->storage_used = address[lane] + 1;
+                }
+                if (inst == AADD) {
+                    int old = *cell;
+                    *cell += ROW(S - 1)[lane];
+                    ROW(S - 1)[lane] = old;
+                } else {
+                    *cell = ROW(S - 1)[lane];
+                }
+            }
+            }
+            break;
+
+        case BCOPY:
+        case BFILL:
+        case BCMP:
+            {
+            lanes_t n;
+            lanes_t b;
+            lanes_t a;
+            lanes_t bad;
+            if (S < 2) {
+                fail(batch, lanes, &m, "SP less than zero");
+                return;
+            }
+            n = ROW(S);
+            b = ROW(S - 1);
+            a = ROW(S - 2);
+            bad = (n < 0) | (n > batch->storage_size) |
+                  (b < 0) | (b > batch->storage_size - n);
+            if (inst != BFILL) {
+                bad |= (a < 0) | (a > batch->storage_size - n);
+            }
+            bad &= m;
+            lanes->sp += m + m + m;
+            fail(batch, lanes, &bad, "storage address out of bounds");
+            m &= ~bad;
+            if (inst == BCMP) {
+                lanes->sp -= m;
+            }
+            for (lane = 0; lane < VM_LANES; lane++) {
+                int i;
+                if (!m[lane]) {
+                    continue;
+                }
+                if (inst == BCMP) {
+                    for (i = 0; i < n[lane] &&
+                         lanes->storage[a[lane] + i][lane] ==
+                         lanes->storage[b[lane] + i][lane]; i++) {
+                    }
+                    ROW(S - 2)[lane] = i == n[lane] ? 0 :
+                        lanes->storage[a[lane] + i][lane] <
+                        lanes->storage[b[lane] + i][lane] ? -1 : 1;
+                    continue;
+                }
+                if (inst == BFILL) {
+                    for (i = 0; i < n[lane]; i++) {
+                        lanes->storage[b[lane] + i][lane] = a[lane];
+                    }
+                } else if (a[lane] <= b[lane]) {
+                    for (i = 0; i < n[lane]; i++) {
+                        lanes->storage[a[lane] + i][lane] =
+                            lanes->storage[b[lane] + i][lane];
+                    }
+                } else {
+                    for (i = n[lane] - 1; i >= 0; i--) {
+                        lanes->storage[a[lane] + i][lane] =
+                            lanes->storage[b[lane] + i][lane];
+                    }
+                }
+                i = (inst == BFILL ? b[lane] : a[lane]) + n[lane];
+                if (i > lanes->storage_used) {
+                    lanes->storage_used = i;
+                }
+            }
+            }
+            break;
+
+        case J:
+        case TCALL:
+            next = zero + immediate;
+            break;
+
+        case CALL:
+            if (C >= VM_CALL_STACK_SIZE) {
+                fail(batch, lanes, &m, "call stack overflow");
+                return;
+            }
+            lanes->call_stack[C] = BLEND(m, zero + (P + 2),
+                                         lanes->call_stack[C]);
+            lanes->cp -= m;
+            next = zero + immediate;
+            break;
+
+        case RET:
+            if (C <= 0) {
+                fail(batch, lanes, &m, "call stack underflow");
+                return;
+            }
+            lanes->cp += m;
+            next = lanes->call_stack[C - 1];
+            break;
+
+        case POPC:
+            lanes->cp += m;
+            break;
+
+        /* the lanes part ways here */
+        case JZ:
+            {
+            lanes_t taken = ROW(S) == 0;
+            next = BLEND(taken, zero + immediate, zero + (P + 2));
+            }
+            break;
+
+        case JLEZ:
+            {
+            lanes_t taken = ROW(S) <= 0;
+            next = BLEND(taken, zero + immediate, zero + (P + 2));
+            }
+            break;
+
+        case JNZ:
+            {
+            lanes_t taken = ROW(S) != 0;
+            next = BLEND(taken, zero + immediate, zero + (P + 2));
+            }
+            break;
+
+        /* each lane goes to its own entry of the table */
+        case JTAB:
+            {
+            lanes_t i = ROW(S);
+            lanes_t in_range = (i >= 0) & (i < immediate);
+            if (immediate < 0) {
+                fail(batch, lanes, &m, "JTAB size out of bounds");
+                return;
+            }
+            next = zero + (P + 2) + 2 * BLEND(in_range, i, zero + immediate);
+            }
+            break;
+
+        case HALT:
+            finish(batch, lanes, &m, VM_HALTED, NULL);
+            return;
+
+        case COCREATE:
+        case YIELD:
+        case RESUME:
+        case SPAWN:
+        case JOIN:
+            sprintf(buff, "%s is not supported in lockstep mode",
+                    inst_names[inst]);
+            fail(batch, lanes, &m, buff);
+            return;
+
+        default:
+            sprintf(buff, "unknown instruction: %d", inst);
+            fail(batch, lanes, &m, buff);
+            return;
+    }
+    lanes->pc = BLEND(m, next, lanes->pc);
+}
+
+/* run instances first..first+n-1, n <= VM_LANES */
+static void run_lanes(struct minivm_batch *batch, int first, int n) {
+    struct lanes *lanes = &batch->lanes;
+    lanes_t zero = {0};
+    int lane;
+    int lead;
+
+    /* only rows that can be read before they are written need clearing */
+    memset(lanes->storage, 0, lanes->storage_used * sizeof(lanes_t));
+    lanes->storage_used = 0;
+    ROW(-1) = zero;
+    ROW(0) = zero;
+    lanes->call_stack[0] = zero; /* returning from main goes to HALT */
+    lanes->pc = zero + 1;
+    lanes->sp = zero;
+    lanes->cp = zero + 1;
+    lanes->running = zero;
+    for (lane = 0; lane < VM_LANES; lane++) {
+        lanes->instance[lane] = first + lane;
+        lanes->input_pos[lane] = 0;
+        if (lane < n) {
+            lanes->running[lane] = -1;
+        }
+    }
+    while ((lead = leader(lanes)) >= 0) {
+        step(batch, lanes, lead);
+    }
+}
+
+int vm_batch_run(struct minivm_batch *batch) {
+    int first;
+    clear_results(batch);
+    batch->out_of_memory = 0;
+    batch->lanes.storage_used = VM_STORAGE_SIZE;
+    for (first = 0; first < batch->count; first += VM_LANES) {
+        int n = batch->count - first;
+        run_lanes(batch, first, n < VM_LANES ? n : VM_LANES);
+    }
+    return batch->out_of_memory ? -1 : 0;
+}
+
+int vm_batch_count(const struct minivm_batch *batch) {
+    return batch->count;
+}
+
+vm_status vm_batch_status(const struct minivm_batch *batch, int instance) {
+    return batch->instances[instance].status;
+}
+
+const char *vm_batch_error(const struct minivm_batch *batch, int instance) {
+    return batch->instances[instance].error;
+}
+
+const char *vm_batch_output(const struct minivm_batch *batch,
+                            int instance,
+                            size_t *len) {
+    *len = batch->instances[instance].output_len;
+    return batch->instances[instance].output;
+}
+
+int vm_batch_sp(const struct minivm_batch *batch, int instance) {
+    return batch->instances[instance].sp;
+}
+
+int vm_batch_stack_at(const struct minivm_batch *batch,
+                      int instance,
+                      int index) {
+    const struct instance *result = &batch->instances[instance];
+    if (result->stack == NULL || index < 0 || index > result->sp ||
+        index > VM_STACK_SIZE) {
+        return 0;
+    }
+    return result->stack[index];
+}
+
+void vm_batch_print_stack(const struct minivm_batch *batch,
+                          int instance,
+                          FILE *out) {
+    const struct instance *result = &batch->instances[instance];
+    int i;
+    fprintf(out, "*** PRINTING STACK ***\n");
+    fprintf(out, "SP: %d\n", result->sp);
+    fprintf(out, "PC: %d\n", result->pc);
+    for (i = 0; i <= result->sp && i <= VM_STACK_SIZE; ++i) {
+        if (i == result->sp) {
+            fprintf(out, "%2d: %d*\n", i, vm_batch_stack_at(batch, instance, i));
+        } else {
+            fprintf(out, "%2d: %d\n", i, vm_batch_stack_at(batch, instance, i));
+        }
+    }
+    fprintf(out, "*** DONE PRINTING ***\n");
+}
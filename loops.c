@@ -0,0 +1,785 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: loops.c
+ */
+
+/*
+ * Loop optimization
+ *
+ * miniC has no loop statement, a loop is a function calling itself in
+ * tail position. That call is a TCALL back to the function label, so the
+ * label is the header of a natural loop made of the whole body, and every
+ * pass runs the body from the top. Whatever the body computes from
+ * variables that neither it nor any function it calls ever stores has the
+ * same value on every pass.
+ *
+ * To compute those values once, a loop gets a preheader by splitting its
+ * function in two. The function keeps its name, so its callers still
+ * enter through it, and computes each invariant expression into a new
+ * variable before tail calling _loop_ and its name, which holds the old
+ * body with the expressions replaced by the variables and the calls that
+ * loop back going to itself:
+ *
+ *     int step() {                   int step() {
+ *         if (i < n) {                   int _inv_0 = w * 3;
+ *             a[i * 4] = w * 3;          int _iv_1 = i * 4;
+ *             ...                        _loop_step();
+ *             i = i + 1;             }
+ *             step();
+ *         }                          int _loop_step() {
+ *     }                                  if (i < n) {
+ *                                            a[_iv_1] = _inv_0;
+ *                                            ...
+ *                                            i = i + 1;
+ *                                            _iv_1 = _iv_1 + 4;
+ *                                            _loop_step();
+ *                                        }
+ *                                    }
+ *
+ * Invariant expressions of constants alone are folded instead. Division is
+ * left where it is, since it traps on zero, and a preheader runs whether
+ * or not the body would have reached the expression.
+ *
+ * An induction variable i is one whose every store in the loop is a
+ * statement i = i + c or i = i - c for constants c, and no function the
+ * loop calls stores it. i * k for a constant k then becomes a variable the
+ * preheader sets to i * k and that is stepped by c * k right after each of
+ * those statements, so it equals i * k everywhere else. That is only done
+ * when the instructions saved where i * k was computed outweigh the steps.
+ *
+ * The new variables are ordinary miniC variables, so both code generators
+ * handle them like any other: the stack machine reads them from storage,
+ * where liveness.c gives them a slot, and the register machine keeps them
+ * in registers. Their names start with an underscore, which identifiers
+ * in a program cannot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "loops.h"
+#include "bst.h"
+#include "util.h"
+
+/* stack machine instructions, for deciding when stepping i * k pays */
+#define USE_SAVING 2 /* PUSH k PUSH i LOAD MUL becomes PUSH _iv LOAD */
+#define STEP_COST 6  /* PUSH s PUSH _iv LOAD ADD PUSH _iv SAVE */
+
+struct loop {
+    ASTNode *def;          /* the function */
+    struct BST *stores;    /* variables its body stores, how many times */
+    struct BST *clobbered; /* variables the functions it calls store */
+    bool clobbers_all;     /* it calls a function from another object */
+    ASTNode *preheader;    /* declarations of the new variables */
+    ASTNode *preheader_tail;
+};
+
+/* a statement i = i + step in a statement list of the loop body */
+struct induction {
+    ASTNode *stmt;
+    int step;
+};
+
+static struct BST *functions = NULL; /* index into function_defs, by name */
+static ASTNode **function_defs = NULL; /* room for a _loop_ of each one */
+static int num_functions = 0;
+static struct BST *arrays = NULL;
+static ASTNode *garbage = NULL; /* nodes taken out of the tree */
+static int next_variable = 0;
+
+
+static char *symbol(ASTNode *node) {
+    return node->obj->value.symbol;
+}
+
+
+static void add_store(struct BST **set, char *id) {
+    struct BST *found = bst_find(*set, id);
+    if (found != NULL) {
+        found->value++;
+    } else {
+        *set = bst_insert(*set, make_str(id), 1);
+    }
+}
+
+
+static int times_stored(struct BST *set, char *id) {
+    struct BST *found = bst_find(set, id);
+    return found == NULL ? 0 : found->value;
+}
+
+
+static bool is_stored(const struct loop *loop, char *id) {
+    return loop->clobbers_all ||
+           times_stored(loop->stores, id) > 0 ||
+           times_stored(loop->clobbered, id) > 0;
+}
+
+
+static bool is_number(ASTNode *node) {
+    return node != NULL && node->kind == LEAF &&
+           node->obj->type == NUMBER_TYPE;
+}
+
+
+static bool is_load_of(ASTNode *node, char *id) {
+    return node != NULL && node->kind == LOAD_STMT &&
+           strcmp(symbol(node), id) == 0;
+}
+
+
+static bool loops_back(const struct loop *loop, ASTNode *node) {
+    return node->kind == FUNC_CALL && node->tail &&
+           strcmp(symbol(node), symbol(loop->def)) == 0;
+}
+
+
+static void discard(ASTNode *node) {
+    if (node != NULL) {
+        node->sibling = garbage;
+        garbage = node;
+    }
+}
+
+
+static ASTNode *new_number(int value) {
+    char buffer[16];
+    sprintf(buffer, "%d", value);
+    return make_leaf_node(make_number_obj(buffer));
+}
+
+
+static ASTNode *new_load(char *id) {
+    return make_ast_node(LOAD_STMT, make_id_obj(id), OP_NIL, NULL, NULL, NULL);
+}
+
+
+/* node becomes a read of id, in place, so its parent needs no change */
+static void make_load(ASTNode *node, char *id) {
+    discard(node->left);
+    discard(node->right);
+    node->kind = LOAD_STMT;
+    node->op = OP_NIL;
+    node->obj = make_id_obj(id);
+    node->left = NULL;
+    node->right = NULL;
+}
+
+
+static void make_number(ASTNode *node, int value) {
+    char buffer[16];
+    discard(node->left);
+    discard(node->right);
+    sprintf(buffer, "%d", value);
+    node->kind = LEAF;
+    node->op = OP_NIL;
+    node->obj = make_number_obj(buffer);
+    node->left = NULL;
+    node->right = NULL;
+}
+
+
+/* a new variable the preheader sets to value, returns its name */
+static char *new_variable(struct loop *loop, const char *prefix,
+                          ASTNode *value) {
+    char name[32];
+    MinicObject *obj;
+    ASTNode *decl;
+
+    sprintf(name, "_%s_%d", prefix, next_variable++);
+    obj = make_id_obj(name);
+    decl = make_ast_node(DECLARE_STMT, obj, OP_NIL, NULL, NULL, NULL);
+    decl->right = make_ast_node(ASSIGN_EXPR, obj, OP_NIL, NULL, NULL, value);
+    if (loop->preheader == NULL) {
+        loop->preheader = decl;
+    } else {
+        loop->preheader_tail->sibling = decl;
+    }
+    loop->preheader_tail = decl;
+    return obj->value.symbol;
+}
+
+
+/* the same operators on the same leaves, in the same shape */
+static bool same_expression(ASTNode *a, ASTNode *b) {
+    size_t count_a;
+    size_t count_b;
+    size_t i;
+    ASTNode **nodes_a = ast_postorder(a, false, &count_a);
+    ASTNode **nodes_b = ast_postorder(b, false, &count_b);
+    bool same = count_a == count_b;
+
+    for (i = 0; same && i < count_a; i++) {
+        ASTNode *x = nodes_a[i];
+        ASTNode *y = nodes_b[i];
+        same = x->kind == y->kind && x->op == y->op &&
+               (x->left == NULL) == (y->left == NULL) &&
+               (x->right == NULL) == (y->right == NULL) &&
+               (x->obj == NULL) == (y->obj == NULL) &&
+               (x->obj == NULL ||
+                strcmp(x->obj->value.symbol, y->obj->value.symbol) == 0);
+    }
+    free(nodes_a);
+    free(nodes_b);
+    return same;
+}
+
+
+/* the variable the preheader already sets to value, or NULL */
+static char *find_variable(struct loop *loop, ASTNode *value) {
+    ASTNode *decl;
+    for (decl = loop->preheader; decl != NULL; decl = decl->sibling) {
+        if (same_expression(decl->right->right, value)) {
+            return symbol(decl);
+        }
+    }
+    return NULL;
+}
+
+
+/* a + b and a * b as the machines compute them, unless they overflow */
+static bool add(int a, int b, int *sum) {
+    if ((b > 0 && a > INT_MAX - b) || (b < 0 && a < INT_MIN - b)) {
+        return false;
+    }
+    *sum = a + b;
+    return true;
+}
+
+
+static bool multiply(int a, int b, int *product) {
+    double exact = (double)a * b;
+    if (exact > INT_MAX || exact < INT_MIN) {
+        return false;
+    }
+    *product = a * b;
+    return true;
+}
+
+
+/* an operator on numbers, false when it is left to run */
+static bool fold(ASTNode *node, int *value) {
+    int a = atoi(node->left->obj->value.number_value);
+    int b = node->right != NULL ? atoi(node->right->obj->value.number_value)
+                                : 0;
+    switch (node->op) {
+        case OP_PLUS:
+            return add(a, b, value);
+
+        case OP_MINUS:
+            return b != INT_MIN && add(a, -b, value);
+
+        case OP_TIMES:
+            return multiply(a, b, value);
+
+        case OP_EQ:
+            *value = a == b;
+            return true;
+
+        case OP_NE:
+            *value = a != b;
+            return true;
+
+        case OP_LT:
+            *value = a < b;
+            return true;
+
+        case OP_LE:
+            *value = a <= b;
+            return true;
+
+        case OP_GT:
+            *value = a > b;
+            return true;
+
+        case OP_GE:
+            *value = a >= b;
+            return true;
+
+        case OP_NOT:
+            *value = !a;
+            return true;
+
+        case OP_AND:
+            *value = a && b;
+            return true;
+
+        case OP_OR:
+            *value = a || b;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+/*
+ * the variables the loop stores, in its body and in every function it may
+ * call from there, other than by looping back
+ */
+static void find_stores(struct loop *loop) {
+    ASTNode **bodies = minic_malloc((num_functions + 1) * sizeof(*bodies));
+    bool *queued = minic_malloc((num_functions + 1) * sizeof(*queued));
+    int num_bodies = 0;
+    int i;
+
+    for (i = 0; i < num_functions; i++) {
+        queued[i] = false;
+    }
+    bodies[num_bodies++] = loop->def->right;
+    for (i = 0; i < num_bodies; i++) {
+        struct BST **stores = i == 0 ? &loop->stores : &loop->clobbered;
+        size_t count;
+        size_t j;
+        ASTNode **nodes = ast_postorder(bodies[i], true, &count);
+
+        for (j = 0; j < count; j++) {
+            ASTNode *node = nodes[j];
+            struct BST *callee;
+            switch (node->kind) {
+                case ASSIGN_EXPR:
+                case DECLARE_STMT:
+                case INDEX_ASSIGN:
+                    add_store(stores, symbol(node));
+                    break;
+
+                case FUNC_CALL:
+                    if (i == 0 && loops_back(loop, node)) {
+                        break;
+                    }
+                    callee = bst_find(functions, symbol(node));
+                    if (callee == NULL) {
+                        loop->clobbers_all = true;
+                    } else if (!queued[callee->value]) {
+                        queued[callee->value] = true;
+                        bodies[num_bodies++] =
+                            function_defs[callee->value]->right;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        free(nodes);
+    }
+    free(queued);
+    free(bodies);
+}
+
+
+static bool is_invariant(const struct loop *loop, ASTNode *node) {
+    switch (node->kind) {
+        case LEAF:
+            return is_number(node);
+
+        case LOAD_STMT:
+            return !is_stored(loop, symbol(node)) &&
+                   bst_find(arrays, symbol(node)) == NULL;
+
+        case OPERATOR:
+            if (node->op == OP_NIL || node->op == OP_DIVIDE) {
+                return false;
+            }
+            return node->left->invariant &&
+                   (node->right == NULL || node->right->invariant);
+
+        default:
+            return false;
+    }
+}
+
+
+/*
+ * Children come before their parents in the walk, and an invariant node
+ * clears the flag of its children, so only the largest invariant
+ * expressions are left flagged for hoisting. Constant ones were folded
+ * into numbers on the way up.
+ */
+static void hoist_invariants(struct loop *loop) {
+    size_t count;
+    size_t i;
+    ASTNode **nodes = ast_postorder(loop->def->right, true, &count);
+
+    for (i = 0; i < count; i++) {
+        ASTNode *node = nodes[i];
+        int value;
+        node->invariant = is_invariant(loop, node);
+        if (!node->invariant || node->kind != OPERATOR) {
+            continue;
+        }
+        node->left->invariant = false;
+        if (node->right != NULL) {
+            node->right->invariant = false;
+        }
+        if (is_number(node->left) &&
+            (node->right == NULL || is_number(node->right)) &&
+            fold(node, &value)) {
+            make_number(node, value);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        ASTNode *node = nodes[i];
+        if (node->invariant && node->kind == OPERATOR) {
+            char *id = find_variable(loop, node);
+            if (id == NULL) {
+                id = new_variable(loop, "inv",
+                                  make_operator_node(node->op, node->left,
+                                                     node->right));
+                node->left = NULL;
+                node->right = NULL;
+            }
+            make_load(node, id);
+        }
+        node->invariant = false;
+    }
+    free(nodes);
+}
+
+
+/* i = i + step, i = step + i or i = i - step */
+static bool is_induction(ASTNode *stmt, int *step) {
+    ASTNode *value = stmt->right;
+    ASTNode *constant;
+    ASTNode *var;
+
+    if (stmt->kind != ASSIGN_EXPR || value->kind != OPERATOR) {
+        return false;
+    }
+    if (value->op == OP_PLUS && is_number(value->left)) {
+        constant = value->left;
+        var = value->right;
+    } else if (value->op == OP_PLUS || value->op == OP_MINUS) {
+        var = value->left;
+        constant = value->right;
+    } else {
+        return false;
+    }
+    if (!is_load_of(var, symbol(stmt)) || !is_number(constant)) {
+        return false;
+    }
+    *step = atoi(constant->obj->value.number_value);
+    if (value->op == OP_MINUS) {
+        if (*step == INT_MIN) {
+            return false;
+        }
+        *step = -*step;
+    }
+    return true;
+}
+
+
+struct inductions {
+    struct induction *items;
+    int count;
+    int capacity;
+};
+
+
+static void collect_inductions(struct inductions *found, ASTNode *list) {
+    int step;
+    for (; list != NULL; list = list->sibling) {
+        if (!is_induction(list, &step)) {
+            continue;
+        }
+        if (found->count == found->capacity) {
+            found->capacity = found->capacity == 0 ? 8 : found->capacity * 2;
+            found->items = minic_realloc(found->items,
+                                         found->capacity *
+                                         sizeof(*found->items));
+        }
+        found->items[found->count].stmt = list;
+        found->items[found->count].step = step;
+        found->count++;
+    }
+}
+
+
+/*
+ * the statements stepping an induction variable, from every statement
+ * list of the body, leaving out variables also stored some other way
+ */
+static struct inductions find_inductions(const struct loop *loop,
+                                         ASTNode **nodes,
+                                         size_t count) {
+    struct inductions found = {NULL, 0, 0};
+    bool *keep;
+    int kept = 0;
+    size_t i;
+    int j;
+
+    collect_inductions(&found, loop->def->right);
+    for (i = 0; i < count; i++) {
+        if (nodes[i]->kind == CONDITIONAL) {
+            collect_inductions(&found, nodes[i]->left);
+            collect_inductions(&found, nodes[i]->right);
+        } else if (nodes[i]->kind == CASE_ARM) {
+            collect_inductions(&found, nodes[i]->right);
+        }
+    }
+
+    keep = minic_malloc((found.count + 1) * sizeof(*keep));
+    for (j = 0; j < found.count; j++) {
+        char *id = symbol(found.items[j].stmt);
+        int stepped = 0;
+        int k;
+        for (k = 0; k < found.count; k++) {
+            stepped += strcmp(symbol(found.items[k].stmt), id) == 0;
+        }
+        keep[j] = stepped == times_stored(loop->stores, id) &&
+                  times_stored(loop->clobbered, id) == 0 &&
+                  !loop->clobbers_all &&
+                  bst_find(arrays, id) == NULL;
+    }
+    for (j = 0; j < found.count; j++) {
+        if (keep[j]) {
+            found.items[kept++] = found.items[j];
+        }
+    }
+    found.count = kept;
+    free(keep);
+    return found;
+}
+
+
+/* the k of i * k or k * i, for a number k */
+static bool is_multiple_of(ASTNode *node, char *id, int *factor) {
+    ASTNode *constant;
+    if (node->kind != OPERATOR || node->op != OP_TIMES) {
+        return false;
+    }
+    if (is_load_of(node->left, id) && is_number(node->right)) {
+        constant = node->right;
+    } else if (is_number(node->left) && is_load_of(node->right, id)) {
+        constant = node->left;
+    } else {
+        return false;
+    }
+    *factor = atoi(constant->obj->value.number_value);
+    return true;
+}
+
+
+/*
+ * step the multiples of one induction variable, one variable per factor,
+ * when the uses outweigh the steps
+ */
+static void reduce_variable(struct loop *loop, struct inductions *found,
+                            char *id, ASTNode **nodes, size_t count) {
+    size_t i;
+    size_t j;
+    int steps = 0;
+    int k;
+
+    for (k = 0; k < found->count; k++) {
+        steps += strcmp(symbol(found->items[k].stmt), id) == 0;
+    }
+    for (i = 0; i < count; i++) {
+        int factor;
+        int uses = 0;
+        int other;
+        bool fits = true;
+        char *stepped;
+
+        if (!is_multiple_of(nodes[i], id, &factor)) {
+            continue;
+        }
+        for (j = i; j < count; j++) {
+            uses += is_multiple_of(nodes[j], id, &other) && other == factor;
+        }
+        for (k = 0; k < found->count; k++) {
+            fits = fits && multiply(found->items[k].step, factor, &other);
+        }
+        if (uses * USE_SAVING <= steps * STEP_COST || !fits) {
+            continue;
+        }
+
+        stepped = new_variable(loop, "iv",
+                               make_operator_node(OP_TIMES, new_load(id),
+                                                  new_number(factor)));
+        for (j = i; j < count; j++) {
+            if (is_multiple_of(nodes[j], id, &other) && other == factor) {
+                make_load(nodes[j], stepped);
+            }
+        }
+        for (k = 0; k < found->count; k++) {
+            ASTNode *stmt = found->items[k].stmt;
+            ASTNode *update;
+            if (strcmp(symbol(stmt), id) != 0) {
+                continue;
+            }
+            multiply(found->items[k].step, factor, &other);
+            update = make_ast_node(ASSIGN_EXPR, make_id_obj(stepped), OP_NIL,
+                                   NULL, NULL,
+                                   make_operator_node(OP_PLUS,
+                                                      new_load(stepped),
+                                                      new_number(other)));
+            update->sibling = stmt->sibling;
+            stmt->sibling = update;
+        }
+    }
+}
+
+
+static void reduce_strength(struct loop *loop) {
+    size_t count;
+    int k;
+    ASTNode **nodes = ast_postorder(loop->def->right, true, &count);
+    struct inductions found = find_inductions(loop, nodes, count);
+
+    for (k = 0; k < found.count; k++) {
+        char *id = symbol(found.items[k].stmt);
+        int earlier;
+        bool seen = false;
+        for (earlier = 0; earlier < k; earlier++) {
+            seen = seen || strcmp(symbol(found.items[earlier].stmt), id) == 0;
+        }
+        if (!seen) {
+            reduce_variable(loop, &found, id, nodes, count);
+        }
+    }
+    free(found.items);
+    free(nodes);
+}
+
+
+/*
+ * the function becomes the preheader, tail calling _loop_ and its name
+ * with the body, whose calls looping back go there too
+ */
+static void split(struct loop *loop) {
+    ASTNode *def = loop->def;
+    ASTNode *body = def->right;
+    ASTNode *loop_def;
+    ASTNode *call;
+    char *name = minic_malloc(strlen(symbol(def)) + sizeof("_loop_"));
+    size_t count;
+    size_t i;
+    ASTNode **nodes = ast_postorder(body, true, &count);
+
+    sprintf(name, "_loop_%s", symbol(def));
+    functions = bst_insert(functions, make_str(name), num_functions);
+    for (i = 0; i < count; i++) {
+        if (loops_back(loop, nodes[i])) {
+            free(nodes[i]->obj->value.symbol);
+            nodes[i]->obj->value.symbol = make_str(name);
+        }
+    }
+    free(nodes);
+
+    loop_def = make_ast_node(FUNC_DEF, make_id_obj(name), OP_NIL,
+                             NULL, NULL, body);
+    call = make_ast_node(FUNC_CALL, make_id_obj(name), OP_NIL,
+                         NULL, NULL, NULL);
+    loop->preheader_tail->sibling = call;
+    def->right = loop->preheader;
+    function_defs[num_functions++] = loop_def;
+    loop_def->sibling = def->sibling;
+    def->sibling = loop_def;
+    free(name);
+}
+
+
+static bool optimize_loop(ASTNode *def) {
+    struct loop loop;
+    size_t count;
+    size_t i;
+    bool is_loop = false;
+    ASTNode **nodes;
+
+    mark_tail_calls(def->right);
+    loop.def = def;
+    nodes = ast_postorder(def->right, true, &count);
+    for (i = 0; i < count; i++) {
+        is_loop = is_loop || loops_back(&loop, nodes[i]);
+    }
+    free(nodes);
+    if (!is_loop) {
+        return false;
+    }
+
+    loop.stores = NULL;
+    loop.clobbered = NULL;
+    loop.clobbers_all = false;
+    loop.preheader = NULL;
+    loop.preheader_tail = NULL;
+    find_stores(&loop);
+    hoist_invariants(&loop);
+    reduce_strength(&loop);
+    if (loop.preheader != NULL) {
+        split(&loop);
+    }
+    bst_destroy(loop.stores);
+    bst_destroy(loop.clobbered);
+    return loop.preheader != NULL;
+}
+
+
+int optimize_loops(ASTNode *program) {
+    size_t count;
+    size_t i;
+    int optimized = 0;
+    ASTNode *node;
+    ASTNode **nodes = ast_postorder(program, true, &count);
+
+    for (i = 0; i < count; i++) {
+        node = nodes[i];
+        if (node->kind == DECLARE_STMT && node->left != NULL &&
+            bst_find(arrays, symbol(node)) == NULL) {
+            arrays = bst_insert(arrays, make_str(symbol(node)), 0);
+        }
+    }
+    free(nodes);
+
+    for (node = program; node != NULL; node = node->sibling) {
+        num_functions += node->kind == FUNC_DEF;
+    }
+    function_defs = minic_malloc((2 * num_functions + 1) *
+                                 sizeof(*function_defs));
+    num_functions = 0;
+    for (node = program; node != NULL; node = node->sibling) {
+        if (node->kind == FUNC_DEF &&
+            bst_find(functions, symbol(node)) == NULL) {
+            functions = bst_insert(functions, make_str(symbol(node)),
+                                   num_functions);
+            function_defs[num_functions++] = node;
+        }
+    }
+
+    for (node = program; node != NULL; node = node->sibling) {
+        if (node->kind == FUNC_DEF && optimize_loop(node)) {
+            optimized++;
+            node = node->sibling; /* past the new _loop_ function */
+        }
+    }
+
+    destroy_ast_node(garbage);
+    bst_destroy(functions);
+    bst_destroy(arrays);
+    free(function_defs);
+    garbage = NULL;
+    functions = NULL;
+    arrays = NULL;
+    function_defs = NULL;
+    num_functions = 0;
+    return optimized;
+}
@@ -0,0 +1,37 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: loops.h
+ */
+
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include "minic.h"
+
+/*
+ * Optimize the loops of program, a whole parsed program, before code
+ * generation for either target. A loop is a function that calls itself in
+ * tail position. Loop invariant expressions are computed once per entry
+ * to the loop rather than on every pass, constant ones are folded, and
+ * multiples of an induction variable are stepped along with it. Returns
+ * the number of loops it changed.
+ */
+int optimize_loops(ASTNode *program);
+
+#endif /* LOOPS_H */
@@ -26,6 +26,12 @@
 
 #include "minic.h"
 #include "util.h"
+#include "profile.h"
+#include "asm.h"
+#include "vm.h"
+#include "regvm.h"
+#include "server.h"
+#include "loops.h"
 
 
 bool is_c_src_file(char *filename, int len) {
@@ -33,53 +39,206 @@ bool is_c_src_file(char *filename, int len) {
 }
 
 
+static void print_usage(char *program_name) {
+    fprintf(stderr,
+            "usage: %s [--profile-use PROFILE] [-O] [--registers] [--run] "
+            "[--time] FILENAME\n"
+            "       %s [--profile-use PROFILE] --server SOCKET\n"
+            "  --profile-use PROFILE  optimize using stackmachine --profile\n"
+            "  -O                     optimize loops, see loops.c\n"
+            "  --registers            target the register machine, FILE.rs\n"
+            "  --run                  compile and run in process, no .s or .o\n"
+            "  --time                 report the time spent in each stage\n"
+            "  --server SOCKET        compile requests on a Unix socket\n",
+            program_name, program_name);
+}
+
+
+static void report_time(bool show_time, const char *stage, double *start) {
+    if (show_time) {
+        report_stage(stage, start);
+    } else {
+        *start = get_time();
+    }
+}
+
+
+/* assemble and execute inside this process, output like stackmachine */
+static int compile_and_run(ASTNode *tree, char *source_filename,
+                           bool show_time, double *start) {
+    char *assembly;
+    struct asm_program *program;
+    struct minivm *vm;
+    vm_status status;
+
+    assembly = emit_string(tree);
+    report_time(show_time, "codegen", start);
+
+    program = asm_assemble(assembly, source_filename);
+    free(assembly);
+    vm = vm_new_storage(program->code, program->len,
+                        program->storage >= 0 ? program->storage :
+                                                VM_STORAGE_SIZE);
+    asm_free(program);
+    if (vm == NULL) {
+        fprintf(stderr, "%s\n", "out of memory");
+        exit(EXIT_FAILURE);
+    }
+    report_time(show_time, "assemble", start);
+
+    status = vm_run(vm, 0);
+    fflush(stdout);
+    if (status == VM_ERROR) {
+        fprintf(stderr, "ERROR: %s\n", vm_error(vm));
+    }
+    vm_print_stack(vm, stdout);
+    fflush(stdout);
+    report_time(show_time, "run", start);
+    if (show_time) {
+        fprintf(stderr, "%-10s %10lu\n",
+                "executed", vm_instruction_count(vm));
+    }
+    vm_destroy(vm);
+    return status == VM_ERROR ? EXIT_FAILURE : 0;
+}
+
+
+/* compile_and_run for the register machine */
+static int compile_and_run_registers(ASTNode *tree, char *source_filename,
+                                     bool show_time, double *start) {
+    char *assembly;
+    int *code;
+    size_t len;
+    struct regvm *vm;
+    vm_status status;
+
+    assembly = emit_registers_string(tree);
+    report_time(show_time, "codegen", start);
+
+    code = regvm_assemble(assembly, source_filename, &len);
+    free(assembly);
+    vm = regvm_new(code, len);
+    free(code);
+    if (vm == NULL) {
+        fprintf(stderr, "%s\n", "invalid register machine program");
+        exit(EXIT_FAILURE);
+    }
+    report_time(show_time, "assemble", start);
+
+    status = regvm_run(vm);
+    fflush(stdout);
+    if (status == VM_ERROR) {
+        fprintf(stderr, "ERROR: %s\n", regvm_error(vm));
+    }
+    regvm_print_stack(vm, stdout);
+    fflush(stdout);
+    report_time(show_time, "run", start);
+    if (show_time) {
+        fprintf(stderr, "%-10s %10lu\n",
+                "executed", regvm_instruction_count(vm));
+    }
+    regvm_destroy(vm);
+    return status == VM_ERROR ? EXIT_FAILURE : 0;
+}
+
+
 int main(int argc, char **argv) {
     char *output_filename = NULL;
     char *source_filename = NULL;
+    char *socket_path = NULL;
     FILE *output;
     FILE *source_file;
     int exit_code;
     int len = 0;
+    int i;
+    bool run = false;
+    bool registers = false;
+    bool show_time = false;
+    bool optimize = false;
+    double start = get_time();
     ASTNode *tree = NULL;
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s FILENAME\n", argv[0]);
-        return 1;
-    } else {
-        source_filename = argv[1];
-        len = strlen(source_filename) - 1;
-        if (!is_c_src_file(source_filename, len)) {
-            fprintf(stderr, "not a C source file: %s\n", source_filename);
-            exit(EXIT_FAILURE);
-        }
-        source_file = fopen(source_filename, "r");
-        if (source_file == NULL) {
-            fprintf(stderr, "no such file:%s\n", source_filename);
-            exit(EXIT_FAILURE);
-        }
-        tree = parse(source_file);
-        fclose(source_file);
 
-        if (tree == NULL) {
-            fprintf(stderr, "%s\n", "failed to parse input");
-            exit(EXIT_FAILURE);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--profile-use") == 0 && i + 1 < argc) {
+            profile_load(argv[++i]);
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = true;
+        } else if (strcmp(argv[i], "-O") == 0) {
+            optimize = true;
+        } else if (strcmp(argv[i], "--registers") == 0) {
+            registers = true;
+        } else if (strcmp(argv[i], "--time") == 0) {
+            show_time = true;
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (source_filename == NULL && argv[i][0] != '-') {
+            source_filename = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
         }
+    }
+    if (socket_path != NULL && source_filename == NULL) {
+        exit_code = compile_server(socket_path);
+        profile_free();
+        return exit_code;
+    }
+    if (source_filename == NULL) {
+        print_usage(argv[0]);
+        return 1;
+    }
 
-        output_filename = make_str(source_filename);
-        output_filename[len] = 's';
-        output = fopen(output_filename, "w");
-        free(output_filename);
+    len = strlen(source_filename) - 1;
+    if (!is_c_src_file(source_filename, len)) {
+        fprintf(stderr, "not a C source file: %s\n", source_filename);
+        exit(EXIT_FAILURE);
+    }
+    source_file = fopen(source_filename, "r");
+    if (source_file == NULL) {
+        fprintf(stderr, "no such file:%s\n", source_filename);
+        exit(EXIT_FAILURE);
+    }
+    tree = parse(source_file);
+    fclose(source_file);
 
-        if (output == NULL) {
-            fprintf(stderr, "%s\n", "failed to open output file");
-            exit(EXIT_FAILURE);
-        }
+    if (tree == NULL) {
+        fprintf(stderr, "%s\n", "failed to parse input");
+        exit(EXIT_FAILURE);
+    }
+    report_time(show_time, "parse", &start);
+    if (optimize) {
+        optimize_loops(tree);
+        report_time(show_time, "loops", &start);
+    }
 
-        exit_code = emit(output, tree);
-        if (fclose(output) != 0) {
-            fprintf(stderr, "%s\n", "failed to close output file");
-            exit(EXIT_FAILURE);
-        }
-        /*destroy_ast_node(tree);*/
+    if (run) {
+        exit_code = registers
+            ? compile_and_run_registers(tree, source_filename, show_time,
+                                        &start)
+            : compile_and_run(tree, source_filename, show_time, &start);
+        profile_free();
         return exit_code;
     }
+
+    /* FILE.rs for the register machine, one longer than FILE.c */
+    output_filename = minic_malloc(len + 3);
+    strcpy(output_filename, source_filename);
+    strcpy(output_filename + len, registers ? "rs" : "s");
+    output = fopen(output_filename, "w");
+    free(output_filename);
+
+    if (output == NULL) {
+        fprintf(stderr, "%s\n", "failed to open output file");
+        exit(EXIT_FAILURE);
+    }
+
+    exit_code = registers ? emit_registers(output, tree) : emit(output, tree);
+    if (fclose(output) != 0) {
+        fprintf(stderr, "%s\n", "failed to close output file");
+        exit(EXIT_FAILURE);
+    }
+    report_time(show_time, "codegen", &start);
+    /*destroy_ast_node(tree);*/
+    profile_free();
+    return exit_code;
 }
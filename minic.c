@@ -24,6 +24,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <setjmp.h>
 
 
 #include "minic.h"
@@ -32,15 +34,28 @@
 #include "instructions.h"
 #include "bst.h"
 #include "util.h"
-
-
-#define MAX(A, B) ((A) > (B) ? (A) : (B))
+#include "profile.h"
+#include "liveness.h"
+#include "growstring.h"
 
 
 char token_string[MAX_TOKEN_SIZE+1];
 int LARGEST_LABEL = 0;
 int VAR_INDEX = 0;
 struct BST *id_map = NULL;
+struct BST *array_sizes = NULL; /* number of slots of each array */
+
+#define FNV_OFFSET 0xcbf29ce484222325UL
+#define FNV_PRIME  0x100000001b3UL
+
+/* when set, declarations and lookups are logged for codegen_unit */
+static growstring *declared_log = NULL;
+static growstring *uses_log = NULL;
+static int unit_first_slot = 0;
+
+/* when set, semantic errors longjmp here instead of exiting */
+static jmp_buf *error_handler = NULL;
+static char error_message[256];
 
 /* constructors */
 MinicObject *make_number_obj(char *n) {
@@ -100,6 +115,10 @@ ASTNode *make_ast_node(ASTkind kind,
     node->left = left;
     node->condition = condition;
     node->right = right;
+    node->tail = false;
+    node->calls = false;
+    node->need = 0;
+    node->invariant = false;
     return node;
 }
 
@@ -143,6 +162,35 @@ ASTNode *make_declare_node(ASTNode *leaf_obj) {
 }
 
 
+/* int a[size]; the size is a NUMBER leaf on the left */
+ASTNode *make_array_declare_node(ASTNode *leaf_obj, ASTNode *size) {
+    MinicObject *obj = leaf_obj->obj;
+    ASTNode *node = make_ast_node(DECLARE_STMT, obj, OP_NIL, size, NULL, NULL);
+    return node;
+}
+
+
+ASTNode *make_index_node(ASTNode *leaf_obj, ASTNode *index) {
+    MinicObject *obj = leaf_obj->obj;
+    ASTNode *node = make_ast_node(INDEX_LOAD, obj, OP_NIL, index, NULL, NULL);
+    return node;
+}
+
+
+ASTNode *make_index_assign_node(ASTNode *leaf_obj,
+                                ASTNode *index,
+                                ASTNode *right) {
+    MinicObject *obj = leaf_obj->obj;
+    ASTNode *node = make_ast_node(INDEX_ASSIGN,
+                                  obj,
+                                  OP_NIL,
+                                  index,
+                                  NULL,
+                                  right);
+    return node;
+}
+
+
 ASTNode *make_load_node(ASTNode *leaf_obj) {
     MinicObject *obj = leaf_obj->obj;
     ASTNode *node = make_ast_node(LOAD_STMT, obj, OP_NIL, NULL, NULL, NULL);
@@ -150,6 +198,13 @@ ASTNode *make_load_node(ASTNode *leaf_obj) {
 }
 
 
+ASTNode *make_print_node(ASTNode *leaf_obj) {
+    MinicObject *obj = leaf_obj->obj;
+    ASTNode *node = make_ast_node(PRINT_STMT, obj, OP_NIL, NULL, NULL, NULL);
+    return node;
+}
+
+
 ASTNode *make_function_node(ASTNode *leaf_obj, ASTNode *right) {
     MinicObject *obj = leaf_obj->obj;
     ASTNode *node = make_ast_node(FUNC_DEF, obj, OP_NIL, NULL, NULL, right);
@@ -164,6 +219,96 @@ ASTNode *make_func_call_node(ASTNode *leaf_obj, ASTNode *args) {
 }
 
 
+ASTNode *make_switch_node(ASTNode *condition, ASTNode *arms) {
+    ASTNode *node = make_ast_node(SWITCH_STMT,
+                                  NULL,
+                                  OP_NIL,
+                                  NULL,
+                                  condition,
+                                  arms);
+    return node;
+}
+
+
+/* values is NULL for the default arm */
+ASTNode *make_case_node(ASTNode *values, ASTNode *stmts) {
+    ASTNode *node = make_ast_node(CASE_ARM, NULL, OP_NIL, values, NULL, stmts);
+    return node;
+}
+
+
+/* a statement list built newest first, in source order */
+ASTNode *reverse_siblings(ASTNode *list) {
+    ASTNode *reversed = NULL;
+    while (list != NULL) {
+        ASTNode *next = list->sibling;
+        list->sibling = reversed;
+        reversed = list;
+        list = next;
+    }
+    return reversed;
+}
+
+
+/* walking the AST with a stack on the heap, see ast_postorder */
+struct ast_walk {
+    ASTNode *node;
+    bool expanded; /* its children are already on the stack */
+};
+
+
+ASTNode **ast_postorder(ASTNode *node, bool with_siblings, size_t *count) {
+    size_t capacity = 64;
+    size_t depth = 0;
+    size_t len = 0;
+    size_t out_capacity = 64;
+    struct ast_walk *stack = minic_malloc(capacity * sizeof(*stack));
+    ASTNode **out = minic_malloc(out_capacity * sizeof(*out));
+    ASTNode *root = node;
+
+    if (node != NULL) {
+        stack[depth].node = node;
+        stack[depth++].expanded = false;
+    }
+    while (depth > 0) {
+        struct ast_walk top = stack[--depth];
+        ASTNode *children[3];
+        int i;
+        if (top.expanded) {
+            if (len == out_capacity) {
+                out_capacity *= 2;
+                out = minic_realloc(out, out_capacity * sizeof(*out));
+            }
+            out[len++] = top.node;
+            continue;
+        }
+        /* the next statement, then this node after its children */
+        if (depth + 5 > capacity) {
+            capacity *= 2;
+            stack = minic_realloc(stack, capacity * sizeof(*stack));
+        }
+        if (top.node->sibling != NULL && (with_siblings || top.node != root)) {
+            stack[depth].node = top.node->sibling;
+            stack[depth++].expanded = false;
+        }
+        stack[depth].node = top.node;
+        stack[depth++].expanded = true;
+        children[0] = top.node->right;
+        children[1] = top.node->left;
+        children[2] = top.node->condition;
+        for (i = 0; i < 3; i++) {
+            if (children[i] != NULL) {
+                stack[depth].node = children[i];
+                stack[depth++].expanded = false;
+            }
+        }
+    }
+    free(stack);
+    *count = len;
+    return out;
+}
+
+
 /* destructors */
 void destroy_obj(MinicObject *obj) {
     free(obj->value.number_value);
@@ -172,38 +317,23 @@ void destroy_obj(MinicObject *obj) {
 
 
 void destroy_ast_node(ASTNode *node) {
-    if (node) {
-        if (node->obj) {
-            destroy_obj(node->obj);
-            node->obj = NULL;
-        }
-
-        /* recursive call */
-        if (node->condition) {
-            destroy_ast_node(node->condition);
-            node->condition = NULL;
-        }
-
-        /* recursive call */
-        if (node->left) {
-            destroy_ast_node(node->left);
-            node->left = NULL;
+    size_t count;
+    size_t i;
+    ASTNode **nodes = ast_postorder(node, true, &count);
+
+    /* int x = ...; shares the identifier with its assignment */
+    for (i = 0; i < count; i++) {
+        if (nodes[i]->right && nodes[i]->right->obj == nodes[i]->obj) {
+            nodes[i]->right->obj = NULL;
         }
-
-        /* recursive call */
-        if (node->right) {
-            destroy_ast_node(node->right);
-            node->right = NULL;
-        }
-
-        if (node->sibling) {
-            destroy_ast_node(node->sibling);
-            node->sibling = NULL;
+    }
+    for (i = 0; i < count; i++) {
+        if (nodes[i]->obj) {
+            destroy_obj(nodes[i]->obj);
         }
-
-        free(node);
-        node = NULL;
+        free(nodes[i]);
     }
+    free(nodes);
 }
 
 
@@ -274,6 +404,13 @@ static Ir *get_op_ir(Operator op) {
             ir->repr = "\tNOT";
             ir->value.op = NOT;
             break;
+
+        /* these are jumps, see codegen_logical */
+        case OP_AND:
+        case OP_OR:
+            ir->repr = "\tNOP";
+            ir->value.op = NOP;
+            break;
     }
     return ir;
 }
@@ -319,103 +456,807 @@ static Ir *get_ir_node(ASTNode *ast) {
 
 
 /* code generation */
-static linkedlist *rec_codegen_stack_machine(ASTNode *ast,
-                                             int current_label) {
-    linkedlist *program = NULL;
-    linkedlist *cursor = NULL;
-    if (ast == NULL) {
-        return NULL;
+static unsigned long hash_bytes(unsigned long hash,
+                                const void *data,
+                                size_t len) {
+    const unsigned char *bytes = data;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
     }
-    switch (ast->kind) {
+    return hash;
+}
+
+
+/* report the error in error_message */
+static void fail_codegen(void) {
+    if (error_handler != NULL) {
+        longjmp(*error_handler, 1);
+    }
+    fprintf(stderr, "%s\n", error_message);
+    exit(EXIT_FAILURE);
+}
+
+
+static void fail_undeclared(char *id) {
+    sprintf(error_message,
+            "identifier: '%.200s' has not been declared", id);
+    fail_codegen();
+}
+
+
+/* number of slots of array id, 0 if id is not an array */
+static int array_size(char *id) {
+    struct BST *size_node = bst_find(array_sizes, id);
+    return size_node == NULL ? 0 : size_node->value;
+}
+
+
+/*
+ * give id the next storage slot, or the next size slots for an array,
+ * size is 0 for an int
+ */
+static int declare_sized(char *id, int size) {
+    int location = VAR_INDEX;
+    VAR_INDEX += size > 0 ? size : 1;
+    id_map = bst_insert(id_map, make_str(id), location);
+    if (size > 0 || array_size(id) > 0) {
+        array_sizes = bst_insert(array_sizes, make_str(id), size);
+    }
+    if (declared_log != NULL) {
+        char size_str[32];
+        sprintf(size_str, " %d\n", size);
+        gs_append_str(declared_log, id);
+        gs_append_str(declared_log, size_str);
+    }
+    return location;
+}
+
+
+static int declare(char *id) {
+    return declare_sized(id, 0);
+}
+
+
+/* storage slot of id, which must already be declared */
+static int lookup(char *id) {
+    struct BST *location_node = bst_find(id_map, id);
+    if (location_node == NULL) {
+        fail_undeclared(id);
+    }
+    if (uses_log != NULL && location_node->value < unit_first_slot) {
+        char slot[64];
+        sprintf(slot, " %d %d\n", location_node->value, array_size(id));
+        gs_append_str(uses_log, id);
+        gs_append_str(uses_log, slot);
+    }
+    return location_node->value;
+}
+
+
+/* first slot of array id, which must be an array */
+static int lookup_array(char *id) {
+    int location = lookup(id);
+    if (array_size(id) == 0) {
+        sprintf(error_message, "'%.200s' is not an array", id);
+        fail_codegen();
+    }
+    return location;
+}
+
+
+static bool is_array_load(ASTNode *ast) {
+    return ast != NULL && ast->kind == LOAD_STMT &&
+           array_size(ast->obj->value.symbol) > 0;
+}
+
+
+/*
+ * Code generation walks the AST with a stack of tasks on the heap rather
+ * than recursing, so neither a long statement list nor a deeply nested
+ * expression can overflow the C stack. A task is a node and the step it is
+ * at: step 0 emits what comes before the node's children and pushes them
+ * above a task for the next step, which emits what goes after them.
+ */
+#define STEP_LIST -1 /* the task is a list, the node then its siblings */
+#define STEP_BRANCH -2 /* the node is a condition, value is its branch */
+#define STEP_TEST -3   /* jump on the value the node left, to its branch */
+#define STEP_JOIN -4   /* the label between the operands of && or || */
+
+struct codegen_task {
+    ASTNode *node;
+    int step;
+    int value; /* label or storage slot, found by step 0 */
+};
+
+static struct codegen_task *tasks = NULL;
+static size_t num_tasks = 0;
+static size_t tasks_capacity = 0;
+
+/*
+ * A condition jumps to one of two labels rather than leaving 0 or 1, or
+ * falls through to the one right after its code. Either way the last value
+ * it tested is left on the stack, for the code at the label to drop.
+ */
+struct branch {
+    char on_true[32];
+    char on_false[32];
+    bool falls_true; /* the code right after it is on_true */
+};
+
+static struct branch *branches = NULL;
+static size_t num_branches = 0;
+static size_t branches_capacity = 0;
+
+/* the IR so far, appended at the tail */
+struct ir_output {
+    linkedlist *head;
+    linkedlist *tail;
+};
+
+
+static void push_task(ASTNode *node, int step, int value) {
+    if (node == NULL) {
+        return;
+    }
+    if (num_tasks == tasks_capacity) {
+        tasks_capacity = tasks_capacity == 0 ? 64 : tasks_capacity * 2;
+        tasks = minic_realloc(tasks, tasks_capacity * sizeof(*tasks));
+    }
+    tasks[num_tasks].node = node;
+    tasks[num_tasks].step = step;
+    tasks[num_tasks].value = value;
+    num_tasks++;
+}
+
+
+/* a new branch, as the value of a STEP_BRANCH task */
+static int push_branch(const char *on_true,
+                       const char *on_false,
+                       bool falls_true) {
+    if (num_branches == branches_capacity) {
+        branches_capacity = branches_capacity == 0 ? 64
+                                                   : branches_capacity * 2;
+        branches = minic_realloc(branches,
+                                 branches_capacity * sizeof(*branches));
+    }
+    strcpy(branches[num_branches].on_true, on_true);
+    strcpy(branches[num_branches].on_false, on_false);
+    branches[num_branches].falls_true = falls_true;
+    return (int)num_branches++;
+}
+
+
+static void put(struct ir_output *out, Ir *ir) {
+    if (out->head == NULL) {
+        out->head = ll_new(ir);
+        out->tail = out->head;
+    } else {
+        out->tail = ll_append(out->tail, ir);
+    }
+}
+
+
+/* a list of IR, walking only the new list */
+static void put_list(struct ir_output *out, linkedlist *list) {
+    if (list == NULL) {
+        return;
+    }
+    if (out->head == NULL) {
+        out->head = list;
+    } else {
+        out->tail->next = list;
+    }
+    while (list->next != NULL) {
+        list = list->next;
+    }
+    out->tail = list;
+}
+
+
+/* PUSH a PUSH b PUSH n with n the common size of arrays a and b */
+static void put_array_pair(struct ir_output *out, char *a, char *b,
+                           slot_access a_access) {
+    int size = array_size(a);
+    if (array_size(b) != size) {
+        sprintf(error_message,
+                "arrays '%.100s' and '%.100s' differ in size", a, b);
+        fail_codegen();
+    }
+    put(out, ir_new_push_slot(lookup_array(a), size, a_access));
+    put(out, ir_new_push_slot(lookup_array(b), size, SLOT_READ));
+    put(out, ir_new_push_immediate(size));
+}
+
+
+/*
+ * A call is in tail position when nothing but the RET of the enclosing
+ * function would run after it returns, i.e. it is the last statement of
+ * the function body, or the last statement of an if/else or switch arm
+ * that is itself in tail position.
+ */
+void mark_tail_calls(ASTNode *stmts) {
+    ASTNode *last = stmts;
+    if (last == NULL) {
+        return;
+    }
+    while (last->sibling) {
+        last = last->sibling;
+    }
+    switch (last->kind) {
+        case FUNC_CALL:
+            last->tail = true;
+            break;
+
         case CONDITIONAL:
-        {
-            /*
-             * evaluate condition
-             * if condition == 1
-             *     then do left sub-tree
-             * else
-             *     then do right sub-tree
-             *
-             * if (1 > 0) {
-             *     putchar('y');
-             * } else {
-             *     putchar('n');
-             * }
-             *
-             * PUSH 1         ; (1 > 0)
-             * PUSH 0
-             * GT             ; 1 if true, 0 if false
-             *
-             * JZ _else       ; jump if 0 (i.e. if false, goto else block)
-             * _if:           ; if block
-             *     PUSH 'y'
-             *     PRINTC
-             *     J _end_if  ; break out of if (skip over the else block)
-             *
-             * _else:
-             *     PUSH 'n'
-             *     PRINTC
-             * _end_if:       ; continue with program
-             * ...
-             */
-            char else_label[255];
-            char target_else_label[255];
-            char if_label[255];
-            char end_if_label[255];
-            char target_end_if[255];
-            sprintf(else_label, "_else_%d", current_label);
-            sprintf(target_else_label, "_else_%d:", current_label);
-            sprintf(if_label, "_if_%d:", current_label);
-            sprintf(end_if_label, "_end_if_%d", current_label);
-            sprintf(target_end_if, "_end_if_%d:", current_label);
-
-            /* eval condition */
-            program = rec_codegen_stack_machine(ast->condition,
-                                                current_label + 1);
-            cursor = program;
-
-            if (ast->right != NULL) {
-                /* append jump to else if 0 */
-                cursor = ll_append(cursor, ir_new_jump_inst(JZ, else_label));
+            mark_tail_calls(last->left);
+            mark_tail_calls(last->right);
+            break;
+
+        case SWITCH_STMT:
+            for (last = last->right; last != NULL; last = last->sibling) {
+                mark_tail_calls(last->right);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+bool ends_in_tail_call(ASTNode *stmts) {
+    if (stmts == NULL) {
+        return false;
+    }
+    while (stmts->sibling) {
+        stmts = stmts->sibling;
+    }
+    return stmts->kind == FUNC_CALL && stmts->tail;
+}
+
+
+/*
+ * evaluate condition
+ * if condition == 1
+ *     then do left sub-tree
+ * else
+ *     then do right sub-tree
+ *
+ * if (1 > 0) {
+ *     putchar('y');
+ * } else {
+ *     putchar('n');
+ * }
+ *
+ * PUSH 1         ; (1 > 0)
+ * PUSH 0
+ * GT             ; 1 if true, 0 if false
+ *
+ * JZ _else       ; jump if 0 (i.e. if false, goto else block)
+ * _if:           ; if block
+ *     POP        ; drop the condition
+ *     PUSH 'y'
+ *     PRINTC
+ *     J _end_if  ; break out of if (skip over the else block)
+ *
+ * _else:
+ *     POP        ; drop the condition
+ *     PUSH 'n'
+ *     PRINTC
+ * _end_if:       ; continue with program
+ * ...
+ *
+ * The else label is needed even without an else block so the condition is
+ * popped on both paths. When the profile says the else arm is hot it is
+ * made the fall through path instead:
+ *
+ * JNZ _if
+ * _else:
+ *     POP
+ *     ...
+ *     J _end_if
+ * _if:
+ *     POP
+ *     ...
+ * _end_if:
+ *
+ * A condition using && || or ! jumps straight to the arms, see
+ * codegen_branch, so the 0 or 1 they would give is never computed.
+ */
+static void codegen_conditional(struct ir_output *out, ASTNode *ast,
+                                int step, int label) {
+    bool else_first;
+    char else_label[255];
+    char target_else_label[255];
+    char if_label[255];
+    char target_if_label[255];
+    char end_if_label[255];
+    char target_end_if[255];
+    sprintf(else_label, "_else_%d", label);
+    sprintf(target_else_label, "_else_%d:", label);
+    sprintf(if_label, "_if_%d:", label);
+    sprintf(target_if_label, "_if_%d", label);
+    sprintf(end_if_label, "_end_if_%d", label);
+    sprintf(target_end_if, "_end_if_%d:", label);
+
+    if (step == 0) {
+        /* eval condition, jumping to else if 0 */
+        label = LARGEST_LABEL++;
+        sprintf(else_label, "_else_%d", label);
+        sprintf(target_if_label, "_if_%d", label);
+        push_task(ast, 1, label);
+        push_task(ast->condition, STEP_BRANCH,
+                  push_branch(target_if_label, else_label,
+                              !profile_prefers_else(label)));
+        return;
+    }
+    else_first = profile_prefers_else(label);
+    switch (step) {
+        case 1:
+            put(out, ir_new_label(else_first ? target_else_label : if_label));
+            put(out, ir_new_pop());
+            push_task(ast, 2, label);
+            push_task(else_first ? ast->right : ast->left, STEP_LIST, 0);
+            break;
+
+        case 2:
+            /* break out of the first arm */
+            put(out, ir_new_jump_inst(J, end_if_label));
+            put(out, ir_new_label(else_first ? if_label : target_else_label));
+            put(out, ir_new_pop());
+            push_task(ast, 3, label);
+            push_task(else_first ? ast->left : ast->right, STEP_LIST, 0);
+            break;
+
+        default:
+            put(out, ir_new_label(target_end_if));
+            break;
+    }
+}
+
+
+/*
+ * The condition of an if, jumping to the on_true or on_false label of its
+ * branch. a && b tests a, falling through to b when it is true:
+ *
+ *     <a>
+ *     JZ _else_N     ; a is false, so is a && b
+ * _and_M:
+ *     POP
+ *     <b>
+ *     JZ _else_N
+ * _if_N:
+ *
+ * a || b is the same with a jumping to on_true when it is true, and !a
+ * tests a with the labels swapped. Anything else is computed and tested
+ * with a JZ to on_false or, when the code after it is on_false, a JNZ to
+ * on_true. _and_M is a label since a may jump to it, if a is an ||.
+ */
+static void codegen_branch(ASTNode *ast, int index) {
+    struct branch branch = branches[index];
+    char join[32];
+    int label;
+
+    if (ast->kind == OPERATOR && ast->op == OP_NOT) {
+        push_task(ast->left, STEP_BRANCH,
+                  push_branch(branch.on_false, branch.on_true,
+                              !branch.falls_true));
+    } else if (ast->kind == OPERATOR &&
+               (ast->op == OP_AND || ast->op == OP_OR)) {
+        label = LARGEST_LABEL++;
+        sprintf(join, ast->op == OP_AND ? "_and_%d" : "_or_%d", label);
+        push_task(ast->right, STEP_BRANCH, index);
+        push_task(ast, STEP_JOIN, label);
+        if (ast->op == OP_AND) {
+            push_task(ast->left, STEP_BRANCH,
+                      push_branch(join, branch.on_false, true));
+        } else {
+            push_task(ast->left, STEP_BRANCH,
+                      push_branch(branch.on_true, join, false));
+        }
+    } else {
+        push_task(ast, STEP_TEST, index);
+        push_task(ast, 0, 0);
+    }
+}
+
+
+static void codegen_test(struct ir_output *out, int index) {
+    struct branch *branch = &branches[index];
+    if (branch->falls_true) {
+        put(out, ir_new_jump_inst(JZ, branch->on_false));
+    } else {
+        put(out, ir_new_jump_inst(JNZ, branch->on_true));
+    }
+}
+
+
+static void codegen_join(struct ir_output *out, ASTNode *ast, int label) {
+    char join[32];
+    sprintf(join, ast->op == OP_AND ? "_and_%d:" : "_or_%d:", label);
+    put(out, ir_new_label(join));
+    put(out, ir_new_pop());
+}
+
+
+/*
+ * a && b and a || b as a value, 0 or 1, without computing b when a
+ * decides it:
+ *
+ *     <a>                    <a>
+ *     JZ _end_and_M          JNZ _or_M
+ *     POP                    POP
+ *     <b>                    <b>
+ *     JZ _end_and_M          JZ _end_or_M
+ *     POP                _or_M:
+ *     PUSH 1                 POP
+ * _end_and_M:                PUSH 1
+ *                        _end_or_M:
+ *
+ * The 0 left by a JZ is the value when it jumps.
+ */
+static void codegen_logical(struct ir_output *out, ASTNode *ast,
+                            int step, int label) {
+    bool is_and = ast->op == OP_AND;
+    char end_label[32];
+    char true_label[32];
+    sprintf(end_label, is_and ? "_end_and_%d" : "_end_or_%d", label);
+    sprintf(true_label, "_or_%d", label);
+
+    switch (step) {
+        case 0:
+            label = LARGEST_LABEL++;
+            push_task(ast, 2, label);
+            push_task(ast->right, 0, 0);
+            push_task(ast, 1, label);
+            push_task(ast->left, 0, 0);
+            break;
+
+        case 1:
+            put(out, ir_new_jump_inst(is_and ? JZ : JNZ,
+                                      is_and ? end_label : true_label));
+            put(out, ir_new_pop());
+            break;
+
+        default:
+            put(out, ir_new_jump_inst(JZ, end_label));
+            if (is_and) {
+                put(out, ir_new_pop());
             } else {
-                /* if no else, then jump to endif if false */
-                cursor = ll_append(cursor, ir_new_jump_inst(JZ, end_if_label));
+                strcat(true_label, ":");
+                put(out, ir_new_label(true_label));
+                put(out, ir_new_pop());
             }
+            put(out, ir_new_push_immediate(1));
+            strcat(end_label, ":");
+            put(out, ir_new_label(end_label));
+            break;
+    }
+}
 
-            /* append if label (not needed but helps for clarity in ASM) */
-            cursor = ll_append(cursor, ir_new_label(if_label));
 
-            /* concat eval left */
-            ll_concat(cursor, rec_codegen_stack_machine(ast->left,
-                                                        current_label + 1));
+/*
+ * switch (x) {
+ *     case 1: case 5: ...
+ *     case 2: case 3: ...
+ *     default: ...
+ * }
+ *
+ * There is no fall through, each arm leaves the switch when it is done.
+ * The dispatch leaves y = x - c on the stack, for some c known here, so
+ * every arm starts by dropping it, and a switch without a default gets one
+ * that only does that:
+ *
+ *     <x>
+ *     ...            ; dispatch to an arm, or to _default_N
+ * _case_N_1:
+ *     POP
+ *     ...
+ *     J _end_switch_N
+ * _case_N_2:
+ *     POP
+ *     ...
+ *     J _end_switch_N
+ * _default_N:
+ *     POP
+ *     ...
+ * _end_switch_N:
+ *
+ * At least SWITCH_TABLE_MIN values spanning no more than SWITCH_TABLE_SPREAD
+ * times as many numbers go through a jump table, in constant time:
+ *
+ *     PUSH -1        ; y = x - 1, 1 being the smallest value
+ *     ADD
+ *     JTAB 5         ; to the y-th jump, or the last when y is not in 0..4
+ *     J _case_N_1
+ *     J _case_N_2
+ *     J _case_N_2
+ *     J _default_N   ; 4 is not a value
+ *     J _case_N_1
+ *     J _default_N
+ *
+ * Other values are found by a binary search, a JLEZ on y = x - (v - 1)
+ * takes the ones below v, down to a few that are tested in turn:
+ *
+ *     PUSH -4        ; y = x - 5 from y = x - 1
+ *     ADD
+ *     JZ _case_N_1
+ *     ...
+ *     J _default_N
+ */
+#define SWITCH_TABLE_MIN 4
+#define SWITCH_TABLE_SPREAD 3
+
+static int compare_switch_cases(const void *a, const void *b) {
+    int x = ((const SwitchCase *)a)->value;
+    int y = ((const SwitchCase *)b)->value;
+    return (x > y) - (x < y);
+}
 
-            /* if there is no else */
-            if (ast->right != NULL) {
-                /* append jump to end if */
-                cursor = ll_append(cursor, ir_new_jump_inst(J, end_if_label));
 
-                /* append else label */
-                cursor = ll_append(cursor, ir_new_label(target_else_label));
+/* the label of arm of switch number label, NULL for the default */
+void switch_arm_label(char *buffer, ASTNode *arm, int label) {
+    if (arm == NULL || arm->left == NULL) {
+        sprintf(buffer, "_default_%d", label);
+    } else {
+        sprintf(buffer, "_case_%d_%.40s",
+                label, arm->left->obj->value.number_value);
+    }
+}
+
 
-                /* concat eval right */
-                ll_concat(cursor,
-                          rec_codegen_stack_machine(ast->right,
-                                                    current_label + 1));
+SwitchCase *switch_cases(ASTNode *ast, int *count) {
+    SwitchCase *cases;
+    ASTNode *arm;
+    ASTNode *value;
+    int defaults = 0;
+    int n = 0;
+    int i;
+
+    for (arm = ast->right; arm != NULL; arm = arm->sibling) {
+        defaults += arm->left == NULL;
+        for (value = arm->left; value != NULL; value = value->sibling) {
+            n++;
+        }
+    }
+    if (defaults > 1) {
+        sprintf(error_message, "switch with more than one default");
+        fail_codegen();
+    }
+    cases = minic_malloc((n + 1) * sizeof(*cases));
+    n = 0;
+    for (arm = ast->right; arm != NULL; arm = arm->sibling) {
+        for (value = arm->left; value != NULL; value = value->sibling) {
+            char *number = value->obj->value.number_value;
+            if (strtol(number, NULL, 10) > INT_MAX) {
+                free(cases);
+                sprintf(error_message,
+                        "case value %.200s is too large", number);
+                fail_codegen();
             }
+            cases[n].value = atoi(number);
+            cases[n].arm = arm;
+            n++;
+        }
+    }
+    qsort(cases, n, sizeof(*cases), compare_switch_cases);
+    for (i = 1; i < n; i++) {
+        if (cases[i].value == cases[i-1].value) {
+            sprintf(error_message,
+                    "duplicate case value %d in switch", cases[i].value);
+            free(cases);
+            fail_codegen();
+        }
+    }
+    *count = n;
+    return cases;
+}
+
+
+static bool has_default(ASTNode *ast) {
+    ASTNode *arm;
+    for (arm = ast->right; arm != NULL; arm = arm->sibling) {
+        if (arm->left == NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool switch_is_dense(const SwitchCase *cases, int count) {
+    return count >= SWITCH_TABLE_MIN &&
+           (long)cases[count-1].value - cases[0].value <
+           (long)count * SWITCH_TABLE_SPREAD;
+}
 
-            /* append end if label */
-            cursor = ll_append(cursor, ir_new_label(target_end_if));
 
-            current_label++;
+/* y = x - to from y = x - from */
+static void put_switch_offset(struct ir_output *out, int from, int to) {
+    if (from != to) {
+        put(out, ir_new_push_immediate(from - to));
+        put(out, get_op_ir(OP_PLUS));
+    }
+}
+
+
+static void put_jump_table(struct ir_output *out,
+                           SwitchCase *cases,
+                           int n,
+                           int label) {
+    int entries = cases[n-1].value - cases[0].value + 1;
+    char target[64];
+    int i;
+    int k = 0;
+
+    put_switch_offset(out, 0, cases[0].value);
+    put(out, ir_new_jump_table(entries));
+    for (i = 0; i <= entries; i++) {
+        bool is_case = i < entries && cases[k].value - cases[0].value == i;
+        switch_arm_label(target, is_case ? cases[k++].arm : NULL, label);
+        put(out, ir_new_jump_inst(J, target));
+    }
+}
+
+
+/* find x among cases[lo..hi-1] with y = x - offset on the stack */
+static void put_compare_tree(struct ir_output *out,
+                             SwitchCase *cases,
+                             int lo,
+                             int hi,
+                             int offset,
+                             int label) {
+    char target[64];
+    int i;
+
+    if (hi - lo <= SWITCH_LINEAR_MAX) {
+        for (i = lo; i < hi; i++) {
+            put_switch_offset(out, offset, cases[i].value);
+            offset = cases[i].value;
+            switch_arm_label(target, cases[i].arm, label);
+            put(out, ir_new_jump_inst(JZ, target));
+        }
+        switch_arm_label(target, NULL, label);
+        put(out, ir_new_jump_inst(J, target));
+    } else {
+        /* values are never negative, so the middle one less 1 is not either */
+        int mid = lo + (hi - lo) / 2;
+        char below[64];
+        sprintf(below, "_below_%d_%d", label, mid);
+        put_switch_offset(out, offset, cases[mid].value - 1);
+        put(out, ir_new_jump_inst(JLEZ, below));
+        put_compare_tree(out, cases, mid, hi, cases[mid].value - 1, label);
+        strcat(below, ":");
+        put(out, ir_new_label(below));
+        put_compare_tree(out, cases, lo, mid, cases[mid].value - 1, label);
+    }
+}
+
+
+static void codegen_switch(struct ir_output *out, ASTNode *ast,
+                           int step, int label) {
+    char end_label[64];
+
+    switch (step) {
+        case 0:
+            push_task(ast, 1, LARGEST_LABEL++);
+            push_task(ast->condition, 0, 0);
+            break;
+
+        case 1:
+        {
+            int n;
+            SwitchCase *cases = switch_cases(ast, &n);
+            if (switch_is_dense(cases, n)) {
+                put_jump_table(out, cases, n, label);
+            } else {
+                put_compare_tree(out, cases, 0, n, 0, label);
+            }
+            free(cases);
+            push_task(ast, 2, label);
+            push_task(ast->right, STEP_LIST, label);
             break;
         }
 
+        default:
+            if (!has_default(ast)) {
+                sprintf(end_label, "_default_%d:", label);
+                put(out, ir_new_label(end_label));
+                put(out, ir_new_pop());
+            }
+            sprintf(end_label, "_end_switch_%d:", label);
+            put(out, ir_new_label(end_label));
+            break;
+    }
+}
+
+
+/* an arm of switch number label, the last one may fall out of the switch */
+static void codegen_case_arm(struct ir_output *out, ASTNode *ast,
+                             int step, int label) {
+    char arm_label[64];
+
+    if (step == 0) {
+        switch_arm_label(arm_label, ast, label);
+        strcat(arm_label, ":");
+        put(out, ir_new_label(arm_label));
+        put(out, ir_new_pop());
+        push_task(ast, 1, label);
+        push_task(ast->right, STEP_LIST, 0);
+    } else if (ast->sibling != NULL || ast->left != NULL) {
+        sprintf(arm_label, "_end_switch_%d", label);
+        put(out, ir_new_jump_inst(J, arm_label));
+    }
+}
+
+
+/* the IR for one step of the task on top of the stack */
+static void codegen_step(struct ir_output *out) {
+    struct codegen_task task = tasks[--num_tasks];
+    ASTNode *ast = task.node;
+
+    if (task.step == STEP_LIST) {
+        push_task(ast->sibling, STEP_LIST, task.value);
+        push_task(ast, 0, task.value);
+        return;
+    }
+    if (task.step == STEP_BRANCH) {
+        codegen_branch(ast, task.value);
+        return;
+    }
+    if (task.step == STEP_TEST) {
+        codegen_test(out, task.value);
+        return;
+    }
+    if (task.step == STEP_JOIN) {
+        codegen_join(out, ast, task.value);
+        return;
+    }
+    switch (ast->kind) {
+        case CONDITIONAL:
+            codegen_conditional(out, ast, task.step, task.value);
+            break;
+
+        case SWITCH_STMT:
+            codegen_switch(out, ast, task.step, task.value);
+            break;
+
+        case CASE_ARM:
+            codegen_case_arm(out, ast, task.step, task.value);
+            break;
+
         case OPERATOR:
-            program = rec_codegen_stack_machine(ast->right,
-                                                current_label);
-            ll_concat(program, rec_codegen_stack_machine(ast->left,
-                                                         current_label));
-            ll_append(program, get_op_ir(ast->op));
+            if (ast->op == OP_AND || ast->op == OP_OR) {
+                codegen_logical(out, ast, task.step, task.value);
+                break;
+            }
+            if (task.step == 1) {
+                put(out, get_op_ir(ast->op));
+                break;
+            }
+            if ((ast->op == OP_EQ || ast->op == OP_NE) &&
+                is_array_load(ast->left) && is_array_load(ast->right)) {
+                /*
+                 * a == b on arrays compares every element:
+                 *
+                 * PUSH a PUSH b PUSH n
+                 * BCMP           ; 0 when equal
+                 * PUSH 0
+                 * EQ
+                 */
+                put_array_pair(out, ast->left->obj->value.symbol,
+                               ast->right->obj->value.symbol, SLOT_READ);
+                put(out, ir_new_inst(BCMP));
+                put(out, ir_new_push_immediate(0));
+                put(out, get_op_ir(ast->op));
+                break;
+            }
+            /* right, then left, then the operator */
+            push_task(ast, 1, 0);
+            push_task(ast->left, 0, 0);
+            push_task(ast->right, 0, 0);
             break;
 
         case LEAF:
@@ -424,18 +1265,37 @@ static linkedlist *rec_codegen_stack_machine(ASTNode *ast,
             ir->repr = "\tPUSH";
             ir->kind = IR_OP;
             ir->value.op = PUSH;
-            program = ll_new(ir);
-            ll_append(program, get_ir_node(ast));
+            put(out, ir);
+            put(out, get_ir_node(ast));
             break;
         }
 
         case DECLARE_STMT:
         {
-            char *id = ast->obj->value.symbol;
-            int location = VAR_INDEX++;
-
-            id_map = bst_insert(id_map, id, location);
-            program = rec_codegen_stack_machine(ast->right, current_label);
+            /*
+             * arrays start out zeroed, every time the declaration runs:
+             *
+             * PUSH 0 PUSH a PUSH n
+             * BFILL
+             */
+            if (ast->left != NULL) {
+                char *id = ast->obj->value.symbol;
+                int size = atoi(ast->left->obj->value.number_value);
+                int location;
+                if (size <= 0 || size > 1000000) {
+                    sprintf(error_message,
+                            "array '%.200s' needs a positive size", id);
+                    fail_codegen();
+                }
+                location = declare_sized(id, size);
+                put(out, ir_new_push_immediate(0));
+                put(out, ir_new_push_slot(location, size, SLOT_WRITE));
+                put(out, ir_new_push_immediate(size));
+                put(out, ir_new_inst(BFILL));
+                break;
+            }
+            declare(ast->obj->value.symbol);
+            push_task(ast->right, 0, 0);
             break;
         }
 
@@ -447,35 +1307,77 @@ static linkedlist *rec_codegen_stack_machine(ASTNode *ast,
              * save to var's location
              */
             char *id = ast->obj->value.symbol;
-            int location = -1;
-            struct BST *location_node = bst_find(id_map, id);
-            if (location_node == NULL) {
-                fprintf(stderr, "identifier: '%s' has not been declared\n", id);
-                exit(EXIT_FAILURE);
+            int location;
+            if (task.step == 1) {
+                put(out, ir_new_push_slot(task.value, 1, SLOT_WRITE));
+                put(out, ir_new_save());
+                break;
+            }
+            location = lookup(id);
+            if (array_size(id) > 0) {
+                /*
+                 * a = b copies the whole array:
+                 *
+                 * PUSH a PUSH b PUSH n
+                 * BCOPY
+                 */
+                if (!is_array_load(ast->right)) {
+                    sprintf(error_message,
+                            "cannot assign a value to array '%.200s'", id);
+                    fail_codegen();
+                }
+                put_array_pair(out, id, ast->right->obj->value.symbol,
+                               SLOT_WRITE);
+                put(out, ir_new_inst(BCOPY));
+                break;
             }
-            location = location_node->value;
-            program = rec_codegen_stack_machine(ast->right,
-                                                current_label);
-            ll_append(program, ir_new_push_immediate(location));
-            ll_append(program, ir_new_save());
+            push_task(ast, 1, location);
+            push_task(ast->right, 0, 0);
             break;
         }
 
         case LOAD_STMT:
         {
             char *id = ast->obj->value.symbol;
-            int location = -1;
-            struct BST *location_node = bst_find(id_map, id);
-            if (location_node == NULL) {
-                fprintf(stderr, "identifier: '%s' has not been declared\n", id);
-                exit(EXIT_FAILURE);
+            int location = lookup(id);
+            if (array_size(id) > 0) {
+                sprintf(error_message,
+                        "array '%.200s' used as a value", id);
+                fail_codegen();
             }
-            location = location_node->value;
-            program = ll_new(ir_new_push_immediate(location));
-            ll_append(program, ir_new_load());
+            put(out, ir_new_push_slot(location, 1, SLOT_READ));
+            put(out, ir_new_load());
             break;
         }
 
+        /* the element address is the array's first slot plus the index */
+        case INDEX_LOAD:
+            if (task.step == 1) {
+                put(out, ir_new_push_slot(task.value,
+                                          array_size(ast->obj->value.symbol),
+                                          SLOT_READ));
+                put(out, get_op_ir(OP_PLUS));
+                put(out, ir_new_load());
+                break;
+            }
+            push_task(ast, 1, lookup_array(ast->obj->value.symbol));
+            push_task(ast->left, 0, 0);
+            break;
+
+        case INDEX_ASSIGN:
+            if (task.step == 1) {
+                put(out, ir_new_push_slot(task.value,
+                                          array_size(ast->obj->value.symbol),
+                                          SLOT_UPDATE));
+                put(out, get_op_ir(OP_PLUS));
+                put(out, ir_new_save());
+                break;
+            }
+            push_task(ast, 1, lookup_array(ast->obj->value.symbol));
+            push_task(ast->left, 0, 0);
+            push_task(ast->right, 0, 0);
+            break;
+
         case FUNC_DEF:
         {
             /*
@@ -484,57 +1386,371 @@ static linkedlist *rec_codegen_stack_machine(ASTNode *ast,
              * put ret
              */
             char *id = ast->obj->value.symbol;
-            int location = VAR_INDEX++;
             ASTNode *func_body = ast->right;
             char func_label[255];
-            linkedlist *func_code = NULL;
-            ASTNode *cursor;
 
+            if (task.step == 1) {
+                /* a trailing TCALL never falls through to here */
+                if (!ends_in_tail_call(func_body)) {
+                    put(out, ir_new_ret());
+                }
+                break;
+            }
             sprintf(func_label, "%s:", id);
-            id_map = bst_insert(id_map, id, location);
-            program = ll_new(ir_new_label(func_label));
+            declare(id);
+            put(out, ir_new_global(id));
+            put(out, ir_new_label(func_label));
 
-            for (cursor = func_body; cursor != NULL; cursor = cursor->sibling) {
-                func_code = rec_codegen_stack_machine(cursor, current_label);
-                ll_concat(program, func_code);
-            }
-            ll_append(program, ir_new_ret());
+            mark_tail_calls(func_body);
+            push_task(ast, 1, 0);
+            push_task(func_body, STEP_LIST, 0);
             break;
         }
 
         case FUNC_CALL:
+            /*
+             * push args, then CALL the function's label
+             *
+             * in tail position the callee can return straight to our
+             * caller, so jump with TCALL instead of growing the call stack
+             */
+            if (task.step == 1) {
+                put(out, ir_new_jump_inst(ast->tail ? TCALL : CALL,
+                                          ast->obj->value.symbol));
+                break;
+            }
+            push_task(ast, 1, 0);
+            push_task(ast->right, STEP_LIST, 0);
+            break;
+
+        case PRINT_STMT:
         {
             /*
+             * the literal goes to the data section, right where it is
+             * used, and is written out by a single instruction:
              *
+             * PRINTS _str_0
+             * .data
+             * _str_0:
+             *     .string "hello\n"
+             * .text
              */
+            char *literal = ast->obj->value.string_value;
+            size_t len = strlen(literal);
+            char str_label[64];
+            if (len < 2 || literal[len-1] != '"') {
+                sprintf(error_message,
+                        "string literal longer than %d characters",
+                        MAX_TOKEN_SIZE - 2);
+                fail_codegen();
+            }
+            sprintf(str_label, "_str_%d", LARGEST_LABEL++);
+            put(out, ir_new_jump_inst(PRINTS, str_label));
+            put(out, ir_new_string(str_label, literal));
             break;
         }
     }
-    LARGEST_LABEL = MAX(LARGEST_LABEL, current_label);
-    return program;
 }
 
 
+/* the IR for one statement, without its siblings */
+static linkedlist *codegen_statement(ASTNode *ast) {
+    struct ir_output out;
+    out.head = NULL;
+    out.tail = NULL;
+    /* an error may have left tasks behind */
+    num_tasks = 0;
+    num_branches = 0;
+    push_task(ast, 0, 0);
+    while (num_tasks > 0) {
+        codegen_step(&out);
+    }
+    return out.head;
+}
+
+
+struct function_code {
+    linkedlist *code;
+    char *text;
+    unsigned long calls;
+};
+
+
+/*
+ * with a profile loaded, order function bodies hottest first so the code
+ * that runs the most is packed together, functions that never ran go last
+ */
+static void order_functions(struct function_code *functions, int n) {
+    int i;
+    int j;
+    for (i = 1; i < n; i++) {
+        struct function_code tmp = functions[i];
+        for (j = i; j > 0 && functions[j-1].calls < tmp.calls; j--) {
+            functions[j] = functions[j-1];
+        }
+        functions[j] = tmp;
+    }
+}
+
+
+/*
+ * top level statements run first, then main is called if it exists, the
+ * function bodies are placed after the HALT so they only run when called
+ */
 static linkedlist *codegen_stack_machine(ASTNode *ast) {
-    linkedlist *program = NULL;
-    linkedlist *cursor = NULL;
-    for (;ast != NULL; ast = ast->sibling) {
-        if (program == NULL) {
-            program = rec_codegen_stack_machine(ast, LARGEST_LABEL);
-            cursor = program;
+    struct ir_output program = {NULL, NULL};
+    struct function_code *functions = NULL;
+    int num_functions = 0;
+    int i;
+    bool has_main = false;
+    ASTNode *node;
+
+    for (node = ast; node != NULL; node = node->sibling) {
+        if (node->kind == FUNC_DEF) {
+            num_functions++;
+        }
+    }
+    functions = minic_malloc((num_functions + 1) * sizeof(*functions));
+    num_functions = 0;
+
+    for (node = ast; node != NULL; node = node->sibling) {
+        linkedlist *code = codegen_statement(node);
+        if (node->kind == FUNC_DEF) {
+            char *id = node->obj->value.symbol;
+            if (strcmp(id, "main") == 0) {
+                has_main = true;
+            }
+            functions[num_functions].code = code;
+            functions[num_functions].calls = profile_call_count(id);
+            num_functions++;
         } else {
-            cursor = rec_codegen_stack_machine(ast, LARGEST_LABEL);
-            cursor = ll_concat(program, cursor);
+            put_list(&program, code);
         }
     }
-    return program;
+    if (has_main) {
+        put(&program, ir_call_main());
+    }
+    put_list(&program, ir_halt_program(NULL));
+    order_functions(functions, num_functions);
+    for (i = 0; i < num_functions; i++) {
+        put_list(&program, functions[i].code);
+    }
+    /* variables that are never live together share slots */
+    put(&program, ir_new_storage(allocate_slots(program.head)));
+    free(functions);
+    return program.head;
 }
 
 
 int emit(FILE *output, ASTNode *ast) {
     linkedlist *program = codegen_stack_machine(ast);
-    program = ir_halt_program(program);
     ir_print_program(output, program);
     /*ir_free_list(program);*/
     return 0;
 }
+
+
+char *emit_string(ASTNode *ast) {
+    linkedlist *program = codegen_stack_machine(ast);
+    growstring *output = gs_new();
+    char *str;
+    ir_render_program(output, program);
+    str = output->data;
+    free(output);
+    return str;
+}
+
+
+/* incremental code generation */
+void codegen_reset(void) {
+    LARGEST_LABEL = 0;
+    VAR_INDEX = 0;
+    bst_destroy(id_map);
+    bst_destroy(array_sizes);
+    id_map = NULL;
+    array_sizes = NULL;
+}
+
+
+static unsigned long hash_list_length(unsigned long hash,
+                                      const ASTNode *list) {
+    unsigned long len = 0;
+    for (; list != NULL; list = list->sibling) {
+        len++;
+    }
+    return hash_bytes(hash, &len, sizeof(len));
+}
+
+
+/*
+ * every node in post-order with the length of each of its child lists,
+ * which is enough to tell two trees apart
+ */
+unsigned long ast_hash(const ASTNode *node) {
+    unsigned long hash = FNV_OFFSET;
+    size_t count;
+    size_t i;
+    ASTNode **nodes = ast_postorder((ASTNode *)node, false, &count);
+
+    for (i = 0; i < count; i++) {
+        const ASTNode *n = nodes[i];
+        hash = hash_bytes(hash, &n->kind, sizeof(n->kind));
+        hash = hash_bytes(hash, &n->op, sizeof(n->op));
+        if (n->obj != NULL) {
+            const char *str = n->obj->value.symbol;
+            hash = hash_bytes(hash, &n->obj->type, sizeof(n->obj->type));
+            hash = hash_bytes(hash, str, strlen(str) + 1);
+        }
+        hash = hash_list_length(hash, n->condition);
+        hash = hash_list_length(hash, n->left);
+        hash = hash_list_length(hash, n->right);
+    }
+    free(nodes);
+    return hash;
+}
+
+
+static void stop_logging(void) {
+    error_handler = NULL;
+    free(declared_log);
+    free(uses_log);
+    declared_log = NULL;
+    uses_log = NULL;
+}
+
+
+bool codegen_unit(ASTNode *node, CodegenUnit *unit) {
+    jmp_buf handler;
+    linkedlist *code;
+    growstring *output = gs_new();
+
+    unit->first_label = LARGEST_LABEL;
+    unit->first_slot = VAR_INDEX;
+    unit_first_slot = VAR_INDEX;
+    declared_log = gs_new();
+    uses_log = gs_new();
+    error_handler = &handler;
+    if (setjmp(handler) != 0) {
+        free(declared_log->data);
+        free(uses_log->data);
+        stop_logging();
+        free(output->data);
+        free(output);
+        return false;
+    }
+
+    code = codegen_statement(node);
+    ir_render_program(output, code);
+    ir_free_list(code);
+
+    unit->code = output->data;
+    unit->declared = declared_log->data;
+    unit->uses = uses_log->data;
+    unit->labels = LARGEST_LABEL - unit->first_label;
+    stop_logging();
+    free(output);
+    return true;
+}
+
+
+/*
+ * A unit only depends on the label counter if it used labels, on the next
+ * storage slot if it declared anything, and on the slots of the earlier
+ * identifiers it read or wrote.
+ */
+bool codegen_unit_valid(const CodegenUnit *unit) {
+    const char *uses = unit->uses;
+    char id[MAX_TOKEN_SIZE+1];
+    int slot;
+    int size;
+    int len;
+
+    if (unit->labels > 0 && unit->first_label != LARGEST_LABEL) {
+        return false;
+    }
+    if (unit->declared[0] != '\0' && unit->first_slot != VAR_INDEX) {
+        return false;
+    }
+    while (sscanf(uses, "%100s %d %d\n%n", id, &slot, &size, &len) == 3) {
+        struct BST *location_node = bst_find(id_map, id);
+        if (location_node == NULL || location_node->value != slot ||
+            array_size(id) != size) {
+            return false;
+        }
+        uses += len;
+    }
+    return true;
+}
+
+
+void codegen_replay(const CodegenUnit *unit) {
+    const char *declared = unit->declared;
+    char id[MAX_TOKEN_SIZE+1];
+    int size;
+    int len;
+    while (sscanf(declared, "%100s %d\n%n", id, &size, &len) == 2) {
+        declare_sized(id, size);
+        declared += len;
+    }
+    LARGEST_LABEL += unit->labels;
+}
+
+
+void codegen_unit_free(CodegenUnit *unit) {
+    free(unit->code);
+    free(unit->declared);
+    free(unit->uses);
+    unit->code = NULL;
+    unit->declared = NULL;
+    unit->uses = NULL;
+}
+
+
+const char *codegen_error(void) {
+    return error_message;
+}
+
+
+char *codegen_link(char **statements,
+                   int num_statements,
+                   char **functions,
+                   char **names,
+                   int num_functions) {
+    struct function_code *ordered;
+    growstring *output = gs_new();
+    linkedlist *tail = NULL;
+    bool has_main = false;
+    char *str;
+    int i;
+
+    ordered = minic_malloc((num_functions + 1) * sizeof(*ordered));
+    for (i = 0; i < num_statements; i++) {
+        gs_append_str(output, statements[i]);
+    }
+    for (i = 0; i < num_functions; i++) {
+        if (strcmp(names[i], "main") == 0) {
+            has_main = true;
+        }
+        ordered[i].code = NULL;
+        ordered[i].text = functions[i];
+        ordered[i].calls = profile_call_count(names[i]);
+    }
+    if (has_main) {
+        tail = ll_new(ir_call_main());
+    }
+    tail = ir_halt_program(tail);
+    ir_render_program(output, tail);
+    ir_free_list(tail);
+
+    order_functions(ordered, num_functions);
+    for (i = 0; i < num_functions; i++) {
+        gs_append_str(output, ordered[i].text);
+    }
+    tail = ll_new(ir_new_storage(VAR_INDEX));
+    ir_render_program(output, tail);
+    ir_free_list(tail);
+    free(ordered);
+    str = output->data;
+    free(output);
+    return str;
+}
@@ -59,7 +59,12 @@ typedef enum {
     DECLARE_STMT,
     LOAD_STMT,
     FUNC_DEF,
-    FUNC_CALL
+    FUNC_CALL,
+    INDEX_LOAD,   /* a[left] */
+    INDEX_ASSIGN, /* a[left] = right */
+    PRINT_STMT,   /* print "..." with the literal as obj */
+    SWITCH_STMT,  /* switch (condition) with its CASE_ARMs on the right */
+    CASE_ARM      /* NUMBER leaves on the left, none for default */
 } ASTkind;
 
 
@@ -75,7 +80,9 @@ typedef enum {
     OP_GT,
     OP_GE,
     OP_NE,
-    OP_NOT
+    OP_NOT, /* !left */
+    OP_AND, /* && and ||, which only evaluate right when they need it */
+    OP_OR
 } Operator;
 
 
@@ -100,6 +107,10 @@ typedef struct ASTNode {
     struct ASTNode *condition;
     struct ASTNode *right;
     struct ASTNode *sibling;
+    bool tail; /* FUNC_CALL in tail position of its function */
+    bool calls; /* a FUNC_CALL in it, set by regcodegen.c */
+    int need;   /* registers to compute it, set by regcodegen.c */
+    bool invariant; /* same on every pass of its loop, see loops.c */
 } ASTNode;
 
 
@@ -129,9 +140,27 @@ ASTNode *make_conditional_node(ASTNode *left,
 
 ASTNode *make_assign_node(ASTNode *leaf_obj, ASTNode *right);
 ASTNode *make_declare_node(ASTNode *leaf_obj);
+ASTNode *make_array_declare_node(ASTNode *leaf_obj, ASTNode *size);
+ASTNode *make_index_node(ASTNode *leaf_obj, ASTNode *index);
+ASTNode *make_index_assign_node(ASTNode *leaf_obj,
+                                ASTNode *index,
+                                ASTNode *right);
 ASTNode *make_load_node(ASTNode *leaf_obj);
+ASTNode *make_print_node(ASTNode *leaf_obj);
 ASTNode *make_function_node(ASTNode *leaf_obj, ASTNode *right);
 ASTNode *make_func_call_node(ASTNode *leaf_obj, ASTNode *args);
+ASTNode *make_switch_node(ASTNode *condition, ASTNode *arms);
+ASTNode *make_case_node(ASTNode *values, ASTNode *stmts);
+
+/* the parser builds statement lists newest first, this puts them in order */
+ASTNode *reverse_siblings(ASTNode *list);
+
+/*
+ * node and everything under it, children before their parents, as a newly
+ * allocated array of *count nodes, with node's siblings too if asked. The
+ * walk keeps its stack on the heap, so any depth of tree is fine.
+ */
+ASTNode **ast_postorder(ASTNode *node, bool with_siblings, size_t *count);
 
 /* destructors */
 void destroy_obj(MinicObject *);
@@ -140,6 +169,7 @@ void destroy_ast_node(ASTNode *);
 
 /* lexer */
 int get_token(FILE *source_file);
+void lexer_reset(FILE *source_file); /* start over on a new file */
 
 
 /* parser */
@@ -151,5 +181,68 @@ char *get_op_str(Operator op);
 char *get_op_val(char *str, MinicObject *obj);
 int emit(FILE *, ASTNode *);
 
+/* the assembly emit() would write, as a newly allocated string */
+char *emit_string(ASTNode *);
+
+/* mark FUNC_CALLs in tail position of a function body, see TCALL */
+void mark_tail_calls(ASTNode *stmts);
+bool ends_in_tail_call(ASTNode *stmts);
+
+/* the values of a switch with their arms, see codegen_switch in minic.c */
+typedef struct SwitchCase {
+    int value;
+    ASTNode *arm;
+} SwitchCase;
+
+enum { SWITCH_LINEAR_MAX=3 }; /* values tested in turn rather than split */
+
+/* sorted by value, a newly allocated array of *count */
+SwitchCase *switch_cases(ASTNode *switch_stmt, int *count);
+bool switch_is_dense(const SwitchCase *cases, int count); /* use a table */
+void switch_arm_label(char *buffer, ASTNode *arm, int label); /* 64 bytes */
+
+/* register machine assembly for the program, see regcodegen.c */
+int emit_registers(FILE *, ASTNode *);
+char *emit_registers_string(ASTNode *);
+
+
+/*
+ * incremental code generation, used by the compile server
+ *
+ * The code for a top level statement or function depends only on its AST
+ * and on part of the code generator state before it: the next label and
+ * storage slot, and the slots of identifiers declared earlier. A unit
+ * cached under ast_hash(node) can be reused as is while
+ * codegen_unit_valid() holds, after codegen_replay() advances the state
+ * the way generating it again would have. Slots stay in declaration order
+ * here, unlike emit(), which shares them between variables that are never
+ * live together, since no unit sees the code of the others.
+ */
+typedef struct CodegenUnit {
+    char *code;      /* rendered assembly */
+    char *declared;  /* "identifier size" lines, size 0 for scalars */
+    char *uses;      /* "identifier slot size" lines, for earlier ones */
+    int first_label;
+    int labels;      /* number of labels it used */
+    int first_slot;
+} CodegenUnit;
+
+void codegen_reset(void);
+unsigned long ast_hash(const ASTNode *node); /* ignores node's siblings */
+
+/* false on a semantic error, see codegen_error() */
+bool codegen_unit(ASTNode *node, CodegenUnit *unit);
+bool codegen_unit_valid(const CodegenUnit *unit);
+void codegen_replay(const CodegenUnit *unit);
+void codegen_unit_free(CodegenUnit *unit);
+const char *codegen_error(void);
+
+/* lay out units like emit_string: statements, CALL main, HALT, functions */
+char *codegen_link(char **statements,
+                   int num_statements,
+                   char **functions,
+                   char **names,
+                   int num_functions);
+
 
 #endif /* STUTTER_H */
@@ -0,0 +1,765 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: minild.c
+ */
+
+/*
+ * minild: link relocatable objects from minias -c into an image that
+ * stackmachine loads
+ *
+ * The first object is the entry point, its code before the first global
+ * label runs first. The code before the first global label of every other
+ * object sets its variables to their initial values and ends with a HALT,
+ * those run before it, one after the other with the HALTs made NOPs.
+ * Code is cut into pieces at global labels and only the
+ * pieces reachable from the entry, through label operands or by falling
+ * through, are kept, so functions nothing calls are stripped. .data is cut
+ * at every label and only what kept code refers to is kept, so the strings
+ * of stripped functions go too. The storage slots of each object are moved
+ * past those of the objects before it, and the data goes after the code
+ * behind a single DATA instruction. The image asks the VM for the total
+ * slot count when every linked object gave its own with .storage.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "object.h"
+#include "instructions.h"
+#include "bst.h"
+#include "util.h"
+#include "vm.h"
+#include "encoding.h"
+
+static char *PROGRAM_NAME = NULL;
+
+static void print_usage() {
+    fprintf(stderr,
+            "usage: %s [-o OUTPUT.o] [-m] [-v] [--no-strip] [--compact] "
+            "OBJECT.ro...\n"
+            "  -o OUTPUT.o  image to write, default the first object with .o\n"
+            "  -m           also write a label map to OUTPUT.map\n"
+            "  -v           list the functions that were stripped\n"
+            "  --no-strip   keep unreachable functions\n"
+            "  --compact    write a compact image, see encoding.h\n",
+            PROGRAM_NAME);
+}
+
+/* a run of code from one global label up to the next */
+struct piece {
+    int input;
+    int start;
+    int end;
+    bool falls_through; /* into the next piece, its last instruction */
+    bool initializer;   /* top level code of an object but the first */
+    int last;           /* offset of its last instruction */
+    bool kept;
+    int address;
+};
+
+struct input {
+    const char *filename;
+    struct object *object;
+    struct BST *symbols;  /* name -> index into object->symbols */
+    int first_piece;
+    int num_pieces;
+    bool used;            /* some piece was kept */
+    int storage_base;
+    /* .data cut at its labels, data_cuts[num_data_pieces] is the end */
+    int *data_cuts;
+    int num_data_pieces;
+    bool *data_kept;
+    int *data_address;
+};
+
+/* where a global is defined, the value of a node in the globals BST */
+struct definition {
+    int input;
+    int symbol;
+};
+
+struct link {
+    struct input *inputs;
+    int num_inputs;
+    struct piece *pieces;
+    int num_pieces;
+    int *order;           /* indices of the kept pieces, in image order */
+    int num_kept;
+    struct BST *globals;  /* name -> index into definitions */
+    struct definition *definitions;
+    int num_definitions;
+};
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_relocations(const void *a, const void *b) {
+    return compare_ints(&((const struct object_relocation *)a)->offset,
+                        &((const struct object_relocation *)b)->offset);
+}
+
+static void read_inputs(struct link *link, char **filenames, int n) {
+    int i;
+    size_t j;
+
+    link->inputs = minic_malloc(n * sizeof(struct input));
+    link->num_inputs = n;
+    link->globals = NULL;
+    link->num_definitions = 0;
+    for (i = 0; i < n; i++) {
+        struct input *input = &link->inputs[i];
+        char *text = read_file(filenames[i]);
+        input->filename = filenames[i];
+        input->object = object_read(text, filenames[i]);
+        input->symbols = NULL;
+        input->used = false;
+        free(text);
+        qsort(input->object->relocations, input->object->num_relocations,
+              sizeof(struct object_relocation), compare_relocations);
+        for (j = 0; j < input->object->num_symbols; j++) {
+            input->symbols = bst_insert(input->symbols,
+                make_str(input->object->symbols[j].name), (int)j);
+            link->num_definitions += input->object->symbols[j].global;
+        }
+    }
+
+    link->definitions = minic_malloc((link->num_definitions + 1) *
+                                     sizeof(struct definition));
+    link->num_definitions = 0;
+    for (i = 0; i < n; i++) {
+        const struct object *object = link->inputs[i].object;
+        for (j = 0; j < object->num_symbols; j++) {
+            const struct object_symbol *symbol = &object->symbols[j];
+            struct BST *found;
+            if (!symbol->global) {
+                continue;
+            }
+            found = bst_find(link->globals, symbol->name);
+            if (found != NULL) {
+                fprintf(stderr, "%s: %s is already defined in %s\n",
+                        filenames[i], symbol->name,
+                        link->inputs[link->definitions[found->value].input]
+                            .filename);
+                exit(EXIT_FAILURE);
+            }
+            link->definitions[link->num_definitions].input = i;
+            link->definitions[link->num_definitions].symbol = (int)j;
+            link->globals = bst_insert(link->globals,
+                                       make_str(symbol->name),
+                                       link->num_definitions++);
+        }
+    }
+}
+
+static bool ends_control(inst_t inst) {
+    return inst == J || inst == RET || inst == HALT || inst == TCALL;
+}
+
+static void make_data_pieces(struct input *input) {
+    const struct object *object = input->object;
+    int *cuts = minic_malloc((object->num_symbols + 2) * sizeof(int));
+    int num_cuts = 0;
+    int c;
+    size_t j;
+
+    for (j = 0; j < object->num_symbols; j++) {
+        const struct object_symbol *symbol = &object->symbols[j];
+        if (symbol->section == OBJECT_DATA &&
+            (size_t)symbol->offset < object->data_len) {
+            cuts[num_cuts++] = symbol->offset;
+        }
+    }
+    qsort(cuts, num_cuts, sizeof(int), compare_ints);
+    input->data_cuts = minic_malloc((num_cuts + 2) * sizeof(int));
+    input->num_data_pieces = 0;
+    /* words before the first label can't be referred to */
+    for (c = 0; c < num_cuts; c++) {
+        if (c == 0 || cuts[c] != cuts[c - 1]) {
+            input->data_cuts[input->num_data_pieces++] = cuts[c];
+        }
+    }
+    input->data_cuts[input->num_data_pieces] = (int)object->data_len;
+    input->data_kept = minic_malloc((input->num_data_pieces + 1) *
+                                    sizeof(bool));
+    input->data_address = minic_malloc((input->num_data_pieces + 1) *
+                                       sizeof(int));
+    for (c = 0; c < input->num_data_pieces; c++) {
+        input->data_kept[c] = false;
+    }
+    free(cuts);
+}
+
+/* data piece of input holding offset, -1 for a label at the very end */
+static int data_piece_at(const struct input *input, int offset) {
+    int lo = 0;
+    int hi = input->num_data_pieces - 1;
+    if (hi < 0 || offset >= input->data_cuts[input->num_data_pieces]) {
+        return -1;
+    }
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (input->data_cuts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/* the global label a piece starts at, NULL for top level code */
+static const char *piece_name(struct link *link, const struct piece *piece) {
+    const struct object *object = link->inputs[piece->input].object;
+    size_t j;
+    for (j = 0; j < object->num_symbols; j++) {
+        const struct object_symbol *symbol = &object->symbols[j];
+        if (symbol->global && symbol->section == OBJECT_CODE &&
+            symbol->offset == piece->start) {
+            return symbol->name;
+        }
+    }
+    return NULL;
+}
+
+/* top level code that does more than HALT, of an object but the first */
+static bool is_initializer(struct link *link, const struct piece *piece) {
+    const struct object *object = link->inputs[piece->input].object;
+    return piece->input > 0 && piece->start == 0 &&
+           piece->end > 0 && piece_name(link, piece) == NULL &&
+           !(piece->end == 1 && object->code[0] == HALT);
+}
+
+/* cut each object's code at its global code labels */
+static void make_pieces(struct link *link) {
+    int total = 0;
+    int i;
+
+    for (i = 0; i < link->num_inputs; i++) {
+        total += (int)link->inputs[i].object->num_symbols + 1;
+    }
+    link->pieces = minic_malloc(total * sizeof(struct piece));
+    link->num_pieces = 0;
+
+    for (i = 0; i < link->num_inputs; i++) {
+        struct input *input = &link->inputs[i];
+        const struct object *object = input->object;
+        int *cuts = minic_malloc((object->num_symbols + 2) * sizeof(int));
+        int num_cuts = 0;
+        int pc = 0;
+        int c;
+        size_t j;
+
+        cuts[num_cuts++] = 0;
+        for (j = 0; j < object->num_symbols; j++) {
+            const struct object_symbol *symbol = &object->symbols[j];
+            if (symbol->global && symbol->section == OBJECT_CODE &&
+                symbol->offset > 0 &&
+                (size_t)symbol->offset < object->code_len) {
+                cuts[num_cuts++] = symbol->offset;
+            }
+        }
+        qsort(cuts, num_cuts, sizeof(int), compare_ints);
+        cuts[num_cuts] = (int)object->code_len;
+
+        input->first_piece = link->num_pieces;
+        input->num_pieces = 0;
+        for (c = 0; c < num_cuts; c++) {
+            struct piece *piece;
+            int last = NOP;
+            if (c > 0 && cuts[c] == cuts[c - 1]) {
+                continue;
+            }
+            piece = &link->pieces[link->num_pieces++];
+            piece->input = i;
+            piece->start = cuts[c];
+            piece->end = cuts[c + 1];
+            piece->kept = false;
+            piece->last = pc;
+            while (pc < piece->end) {
+                piece->last = pc;
+                last = object->code[pc];
+                if (last < 0 || last >= num_opcodes) {
+                    fprintf(stderr, "%s: unknown instruction %d at %d\n",
+                            input->filename, last, pc);
+                    exit(EXIT_FAILURE);
+                }
+                pc += requires_immediate((inst_t)last) ? 2 : 1;
+            }
+            if (pc != piece->end) {
+                fprintf(stderr, "%s: label %d inside an instruction\n",
+                        input->filename, piece->end);
+                exit(EXIT_FAILURE);
+            }
+            piece->falls_through = piece->start == piece->end ||
+                                   !ends_control((inst_t)last);
+            piece->initializer = is_initializer(link, piece);
+            if (piece->initializer && last != HALT) {
+                fprintf(stderr, "%s: top level code must end with HALT\n",
+                        input->filename);
+                exit(EXIT_FAILURE);
+            }
+            input->num_pieces++;
+        }
+        free(cuts);
+        make_data_pieces(input);
+    }
+}
+
+/* piece of input holding code offset, a label at the very end counts */
+static struct piece *piece_at(struct link *link, int input, int offset) {
+    struct piece *pieces = &link->pieces[link->inputs[input].first_piece];
+    int lo = 0;
+    int hi = link->inputs[input].num_pieces - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (pieces[mid].start <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return &pieces[lo];
+}
+
+/* the symbol a relocation in input refers to, its own labels first */
+static struct definition resolve(struct link *link, int input,
+                                 char *name) {
+    struct definition definition;
+    struct BST *found = bst_find(link->inputs[input].symbols, name);
+    if (found != NULL) {
+        definition.input = input;
+        definition.symbol = found->value;
+        return definition;
+    }
+    found = bst_find(link->globals, name);
+    if (found == NULL) {
+        fprintf(stderr, "%s: undefined symbol: %s\n",
+                link->inputs[input].filename, name);
+        exit(EXIT_FAILURE);
+    }
+    return link->definitions[found->value];
+}
+
+static const struct object_symbol *symbol_of(struct link *link,
+                                             struct definition definition) {
+    return &link->inputs[definition.input].object->symbols[definition.symbol];
+}
+
+/* index of the first relocation at or after offset */
+static size_t first_relocation(const struct object *object, int offset) {
+    size_t lo = 0;
+    size_t hi = object->num_relocations;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (object->relocations[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void keep(struct piece *piece, struct piece **work, int *num_work) {
+    if (!piece->kept) {
+        piece->kept = true;
+        work[(*num_work)++] = piece;
+    }
+}
+
+/* the initializers of the objects that are used */
+static void keep_initializers(struct link *link,
+                              struct piece **work,
+                              int *num_work) {
+    int i;
+    for (i = 1; i < link->num_inputs; i++) {
+        struct input *input = &link->inputs[i];
+        struct piece *top = &link->pieces[input->first_piece];
+        if (input->used && top->initializer) {
+            keep(top, work, num_work);
+        }
+    }
+}
+
+/*
+ * mark what the entry can reach, or everything with strip false, and the
+ * initializers of the objects that are used with what they reach
+ */
+static void mark_reachable(struct link *link, bool strip) {
+    struct piece **work = minic_malloc((link->num_pieces + 1) *
+                                       sizeof(struct piece *));
+    int num_work = 0;
+    int i;
+
+    if (!strip) {
+        for (i = 0; i < link->num_pieces; i++) {
+            keep(&link->pieces[i], work, &num_work);
+        }
+    } else if (link->num_pieces > 0) {
+        keep(&link->pieces[0], work, &num_work);
+    }
+    while (num_work > 0) {
+        struct piece *piece = work[--num_work];
+        struct input *input = &link->inputs[piece->input];
+        const struct object *object = input->object;
+        size_t r;
+
+        input->used = true;
+        for (r = first_relocation(object, piece->start);
+             r < object->num_relocations &&
+             object->relocations[r].offset < piece->end; r++) {
+            struct definition target = resolve(link, piece->input,
+                                               object->relocations[r].symbol);
+            const struct object_symbol *symbol = symbol_of(link, target);
+            if (symbol->section == OBJECT_CODE) {
+                keep(piece_at(link, target.input, symbol->offset),
+                     work, &num_work);
+            } else {
+                struct input *owner = &link->inputs[target.input];
+                int data_piece = data_piece_at(owner, symbol->offset);
+                if (data_piece >= 0) {
+                    owner->data_kept[data_piece] = true;
+                }
+            }
+        }
+        if (piece->falls_through &&
+            piece - link->pieces + 1 < input->first_piece +
+                                       input->num_pieces) {
+            keep(piece + 1, work, &num_work);
+        }
+        if (num_work == 0) {
+            keep_initializers(link, work, &num_work);
+        }
+    }
+    free(work);
+}
+
+/*
+ * the order of the kept pieces, initializers first so the code at address
+ * 1 runs them before the entry, then everything else as it came in
+ */
+static void order_pieces(struct link *link) {
+    int n = 0;
+    int i;
+    link->order = minic_malloc((link->num_pieces + 1) * sizeof(int));
+    for (i = 0; i < link->num_pieces; i++) {
+        if (link->pieces[i].kept && link->pieces[i].initializer) {
+            link->order[n++] = i;
+        }
+    }
+    for (i = 0; i < link->num_pieces; i++) {
+        if (link->pieces[i].kept && !link->pieces[i].initializer) {
+            link->order[n++] = i;
+        }
+    }
+    link->num_kept = n;
+}
+
+/* true if every used object gave its slot count with .storage */
+static bool declares_storage(const struct link *link) {
+    int i;
+    for (i = 0; i < link->num_inputs; i++) {
+        if (link->inputs[i].used && link->inputs[i].object->storage < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* addresses for kept code, then slot and data bases, returns code words */
+static int lay_out(struct link *link, int *data_len, int *storage) {
+    int address = 1; /* address 0 holds HALT */
+    int data_offset = 0;
+    int code_len;
+    int i;
+
+    order_pieces(link);
+    *storage = 0;
+    for (i = 0; i < link->num_kept; i++) {
+        struct piece *piece = &link->pieces[link->order[i]];
+        piece->address = address;
+        address += piece->end - piece->start;
+    }
+    code_len = address - 1;
+    for (i = 0; i < link->num_inputs; i++) {
+        struct input *input = &link->inputs[i];
+        int d;
+        if (input->used) {
+            input->storage_base = *storage;
+            *storage += object_storage(input->object);
+        }
+        for (d = 0; d < input->num_data_pieces; d++) {
+            if (input->data_kept[d]) {
+                /* past the DATA instruction and its operand */
+                input->data_address[d] = code_len + 3 + data_offset;
+                data_offset += input->data_cuts[d + 1] - input->data_cuts[d];
+            }
+        }
+    }
+    *data_len = data_offset;
+    return code_len;
+}
+
+/* address of a symbol, -1 if its code was stripped */
+static int address_of(struct link *link, struct definition definition) {
+    const struct object_symbol *symbol = symbol_of(link, definition);
+    const struct input *input = &link->inputs[definition.input];
+    struct piece *piece;
+    if (symbol->section == OBJECT_DATA) {
+        int d = data_piece_at(input, symbol->offset);
+        if (d < 0 || !input->data_kept[d]) {
+            return -1;
+        }
+        return input->data_address[d] + symbol->offset -
+               input->data_cuts[d];
+    }
+    piece = piece_at(link, definition.input, symbol->offset);
+    if (!piece->kept) {
+        return -1;
+    }
+    return piece->address + symbol->offset - piece->start;
+}
+
+static int *make_image(struct link *link, int code_len, int data_len,
+                       size_t *len) {
+    int *image;
+    int n = 0;
+    int i;
+
+    *len = code_len + (data_len > 0 ? 2 + data_len : 0);
+    image = minic_malloc((*len + 1) * sizeof(int));
+    for (i = 0; i < link->num_kept; i++) {
+        const struct piece *piece = &link->pieces[link->order[i]];
+        const struct object *object = link->inputs[piece->input].object;
+        size_t r;
+        memcpy(image + n, object->code + piece->start,
+               (piece->end - piece->start) * sizeof(int));
+        if (piece->initializer) {
+            /* go on to the next initializer or the entry */
+            image[n + piece->last - piece->start] = NOP;
+        }
+        for (r = first_relocation(object, piece->start);
+             r < object->num_relocations &&
+             object->relocations[r].offset < piece->end; r++) {
+            const struct object_relocation *relocation =
+                &object->relocations[r];
+            image[n + relocation->offset - piece->start] = address_of(link,
+                resolve(link, piece->input, relocation->symbol));
+        }
+        n += piece->end - piece->start;
+    }
+    for (i = 0; i < link->num_inputs; i++) {
+        const struct input *input = &link->inputs[i];
+        size_t s;
+        if (!input->used) {
+            continue;
+        }
+        for (s = 0; s < input->object->num_slots; s++) {
+            int offset = input->object->slots[s];
+            struct piece *piece = piece_at(link, i, offset);
+            if (piece->kept) {
+                image[piece->address - 1 + offset - piece->start] +=
+                    input->storage_base;
+            }
+        }
+    }
+    if (data_len > 0) {
+        image[n++] = DATA;
+        image[n++] = data_len;
+        for (i = 0; i < link->num_inputs; i++) {
+            const struct input *input = &link->inputs[i];
+            int d;
+            for (d = 0; d < input->num_data_pieces; d++) {
+                int words = input->data_cuts[d + 1] - input->data_cuts[d];
+                if (input->data_kept[d]) {
+                    memcpy(image + n, input->object->data +
+                           input->data_cuts[d], words * sizeof(int));
+                    n += words;
+                }
+            }
+        }
+    }
+    return image;
+}
+
+static void report_stripped(struct link *link, const char *output_filename,
+                            bool verbose) {
+    int functions = 0;
+    int words = 0;
+    int i;
+    for (i = 0; i < link->num_pieces; i++) {
+        const struct piece *piece = &link->pieces[i];
+        const char *name;
+        if (piece->kept) {
+            continue;
+        }
+        name = piece_name(link, piece);
+        functions += name != NULL;
+        words += piece->end - piece->start;
+        if (verbose) {
+            fprintf(stderr, "stripped %s from %s, %d words\n",
+                    name != NULL ? name : "top level code",
+                    link->inputs[piece->input].filename,
+                    piece->end - piece->start);
+        }
+    }
+    for (i = 0; i < link->num_inputs; i++) {
+        const struct input *input = &link->inputs[i];
+        int d;
+        for (d = 0; d < input->num_data_pieces; d++) {
+            if (!input->data_kept[d]) {
+                words += input->data_cuts[d + 1] - input->data_cuts[d];
+            }
+        }
+        words += input->object->data_len > 0 ? input->data_cuts[0] : 0;
+    }
+    if (words > 0) {
+        fprintf(stderr, "%s: stripped %d unreachable functions, %d words\n",
+                output_filename, functions, words);
+    }
+}
+
+static void write_image(const char *filename, const int *image, size_t len,
+                        int storage, bool compact) {
+    FILE *output = fopen(filename, "wb");
+    if (output == NULL) {
+        fprintf(stderr, "could not open for writing: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    write_program(output, image, len, storage, compact);
+    fclose(output);
+}
+
+/* every label that made it into the image, in the format of minias -m */
+static void write_map(struct link *link, const char *filename) {
+    FILE *output = fopen(filename, "w");
+    int i;
+    if (output == NULL) {
+        fprintf(stderr, "could not open for writing: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < link->num_inputs; i++) {
+        size_t j;
+        if (!link->inputs[i].used) {
+            continue;
+        }
+        for (j = 0; j < link->inputs[i].object->num_symbols; j++) {
+            struct definition definition;
+            int address;
+            definition.input = i;
+            definition.symbol = (int)j;
+            address = address_of(link, definition);
+            if (address >= 0) {
+                fprintf(output, "%s %d\n", symbol_of(link, definition)->name,
+                        address);
+            }
+        }
+    }
+    fclose(output);
+}
+
+static void free_link(struct link *link) {
+    int i;
+    for (i = 0; i < link->num_inputs; i++) {
+        object_free(link->inputs[i].object);
+        bst_destroy(link->inputs[i].symbols);
+        free(link->inputs[i].data_cuts);
+        free(link->inputs[i].data_kept);
+        free(link->inputs[i].data_address);
+    }
+    bst_destroy(link->globals);
+    free(link->inputs);
+    free(link->pieces);
+    free(link->order);
+    free(link->definitions);
+}
+
+int main(int argc, char **argv) {
+    struct link link;
+    char *output_filename = NULL;
+    bool write_labels = false;
+    bool verbose = false;
+    bool strip = true;
+    bool compact = false;
+    int first_input = 0;
+    int code_len;
+    int data_len;
+    int storage;
+    size_t len;
+    int *image;
+    int i;
+    PROGRAM_NAME = argv[0];
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_filename = make_str(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            write_labels = true;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "--no-strip") == 0) {
+            strip = false;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact = true;
+        } else if (argv[i][0] != '-') {
+            first_input = i;
+            break;
+        } else {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (first_input == 0) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    if (output_filename == NULL) {
+        output_filename = replace_extension(argv[first_input], ".o");
+    }
+
+    read_inputs(&link, argv + first_input, argc - first_input);
+    make_pieces(&link);
+    mark_reachable(&link, strip);
+    code_len = lay_out(&link, &data_len, &storage);
+    if (storage > VM_STORAGE_SIZE) {
+        fprintf(stderr, "%s: needs %d storage slots, the VM has %d\n",
+                output_filename, storage, VM_STORAGE_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    image = make_image(&link, code_len, data_len, &len);
+    write_image(output_filename, image, len,
+                declares_storage(&link) ? storage : ENCODING_NO_STORAGE,
+                compact);
+    if (write_labels) {
+        char *map_filename = replace_extension(output_filename, ".map");
+        write_map(&link, map_filename);
+        free(map_filename);
+    }
+    report_stripped(&link, output_filename, verbose);
+
+    free(image);
+    free_link(&link);
+    free(output_filename);
+    return 0;
+}
@@ -0,0 +1,514 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: minitrace.c
+ */
+
+/*
+ * minitrace: decode, filter and summarize a trace written by
+ * stackmachine --trace (the format is described in vm.h)
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vm.h"
+#include "instructions.h"
+#include "util.h"
+
+/* deeper calls are counted against the node at this depth */
+#define MAX_CALL_DEPTH 64
+
+/* rows in each summary table */
+#define TOP_N 10
+
+static char *PROGRAM_NAME = NULL;
+
+static void print_usage() {
+    fprintf(stderr,
+            "usage: %s [-m PROGRAM.map] [--pc FROM-TO] [--op NAME] "
+            "[--limit N] dump TRACE\n"
+            "       %s [-m PROGRAM.map] summary TRACE\n"
+            "  -m PROGRAM.map  name addresses by the labels from minias -m\n"
+            "  --pc FROM-TO    only records with pc in FROM..TO\n"
+            "  --op NAME       only records of instruction NAME\n"
+            "  --limit N       stop after N records\n",
+            PROGRAM_NAME, PROGRAM_NAME);
+}
+
+struct trace {
+    const struct vm_trace_header *header;
+    const struct vm_trace_record *records;
+    unsigned long first; /* number of the oldest record kept */
+    unsigned long end;   /* one past the newest */
+};
+
+static const struct vm_trace_record *record_at(const struct trace *trace,
+                                               unsigned long n) {
+    return &trace->records[n % trace->header->capacity];
+}
+
+static void open_trace(const char *filename, struct trace *trace) {
+    struct stat info;
+    const struct vm_trace_header *header;
+    void *map;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "no such file: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)info.st_size < sizeof(struct vm_trace_header)) {
+        fprintf(stderr, "not a trace: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "could not map trace: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    header = map;
+    if (header->magic != VM_TRACE_MAGIC ||
+        header->version != VM_TRACE_VERSION ||
+        header->record_size != (int)sizeof(struct vm_trace_record) ||
+        (size_t)info.st_size < sizeof(struct vm_trace_header) +
+            header->capacity * sizeof(struct vm_trace_record)) {
+        fprintf(stderr, "not a trace: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    trace->header = header;
+    trace->records = (const struct vm_trace_record *)(header + 1);
+    trace->end = header->head;
+    trace->first = 0;
+    if (trace->end > header->capacity) {
+        trace->first = trace->end - header->capacity;
+    }
+}
+
+/* labels from a minias -m map, sorted by address */
+struct symbol {
+    char *name;
+    int address;
+};
+
+static struct symbol *symbols = NULL;
+static int num_symbols = 0;
+
+static int compare_symbols(const void *a, const void *b) {
+    const struct symbol *x = a;
+    const struct symbol *y = b;
+    if (x->address != y->address) {
+        return x->address - y->address;
+    }
+    return strcmp(x->name, y->name);
+}
+
+static void load_symbols(const char *map_filename) {
+    FILE *fp = fopen(map_filename, "r");
+    char name[256];
+    int address;
+    int capacity = 16;
+
+    if (fp == NULL) {
+        fprintf(stderr, "no such file: %s\n", map_filename);
+        exit(EXIT_FAILURE);
+    }
+    symbols = minic_malloc(capacity * sizeof(struct symbol));
+    while (fscanf(fp, "%255s %d", name, &address) == 2) {
+        if (num_symbols == capacity) {
+            capacity *= 2;
+            symbols = realloc(symbols, capacity * sizeof(struct symbol));
+            if (symbols == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        symbols[num_symbols].name = make_str(name);
+        symbols[num_symbols].address = address;
+        num_symbols++;
+    }
+    fclose(fp);
+    qsort(symbols, num_symbols, sizeof(struct symbol), compare_symbols);
+}
+
+/* LABEL, LABEL+OFFSET from the closest label before, or @ADDRESS */
+static void format_location(char *buff, int address) {
+    int i;
+    struct symbol *closest = NULL;
+    for (i = 0; i < num_symbols && symbols[i].address <= address; i++) {
+        if (closest == NULL || symbols[i].address != closest->address) {
+            closest = &symbols[i];
+        }
+    }
+    if (closest == NULL) {
+        sprintf(buff, "@%d", address);
+    } else if (closest->address == address) {
+        sprintf(buff, "%s", closest->name);
+    } else {
+        sprintf(buff, "%s+%d", closest->name, address - closest->address);
+    }
+}
+
+static const char *opcode_name(int opcode) {
+    return opcode >= 0 && opcode < num_opcodes ? inst_names[opcode] : "?";
+}
+
+static int lookup_opcode(const char *name) {
+    int i;
+    for (i = 0; i < num_opcodes; i++) {
+        if (strcmp(inst_names[i], name) == 0) {
+            return i;
+        }
+    }
+    fprintf(stderr, "not an instruction: %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/* filters for dump, unset ones are -1 */
+struct filter {
+    int pc_from;
+    int pc_to;
+    int opcode;
+    long limit;
+};
+
+static void dump(const struct trace *trace, const struct filter *filter) {
+    unsigned long n;
+    long printed = 0;
+    char location[300];
+
+    for (n = trace->first; n < trace->end; n++) {
+        const struct vm_trace_record *record = record_at(trace, n);
+        if ((filter->pc_from >= 0 &&
+             (record->pc < filter->pc_from || record->pc > filter->pc_to)) ||
+            (filter->opcode >= 0 && record->opcode != filter->opcode)) {
+            continue;
+        }
+        if (filter->limit >= 0 && printed == filter->limit) {
+            break;
+        }
+        format_location(location, record->pc);
+        printf("%lu %d %s %s top %d sp %d\n", n, record->pc, location,
+               opcode_name(record->opcode), record->top, record->sp);
+        printed++;
+    }
+}
+
+/*
+ * Call tree, built from CALL, TCALL and RET: the record after a CALL is
+ * the first instruction of the callee. A TCALL replaces the current
+ * function with its callee. Direct recursion stays in one node, so a
+ * recursive function does not make the tree as deep as its recursion.
+ */
+struct call_node {
+    int function;
+    unsigned long calls;
+    unsigned long self;      /* instructions executed in the function */
+    unsigned long inclusive; /* self plus every callee, filled in later */
+    int parent;
+    int first_child;
+    int next_sibling;
+};
+
+static struct call_node *nodes = NULL;
+static int num_nodes = 0;
+static int nodes_capacity = 0;
+
+static int new_node(int parent, int function) {
+    if (num_nodes == nodes_capacity) {
+        nodes_capacity = nodes_capacity ? nodes_capacity * 2 : 64;
+        nodes = realloc(nodes, nodes_capacity * sizeof(struct call_node));
+        if (nodes == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    nodes[num_nodes].function = function;
+    nodes[num_nodes].calls = 0;
+    nodes[num_nodes].self = 0;
+    nodes[num_nodes].inclusive = 0;
+    nodes[num_nodes].parent = parent;
+    nodes[num_nodes].first_child = -1;
+    nodes[num_nodes].next_sibling = -1;
+    if (parent >= 0) {
+        nodes[num_nodes].next_sibling = nodes[parent].first_child;
+        nodes[parent].first_child = num_nodes;
+    }
+    return num_nodes++;
+}
+
+static int child_node(int parent, int function) {
+    int child;
+    if (nodes[parent].function == function) {
+        return parent;
+    }
+    for (child = nodes[parent].first_child;
+         child >= 0;
+         child = nodes[child].next_sibling) {
+        if (nodes[child].function == function) {
+            return child;
+        }
+    }
+    return new_node(parent, function);
+}
+
+static unsigned long sum_inclusive(int node) {
+    int child;
+    unsigned long total = nodes[node].self;
+    for (child = nodes[node].first_child;
+         child >= 0;
+         child = nodes[child].next_sibling) {
+        total += sum_inclusive(child);
+    }
+    nodes[node].inclusive = total;
+    return total;
+}
+
+static void print_call_tree(int node, int depth, unsigned long total) {
+    int child;
+    char name[300];
+    if (nodes[node].inclusive * 1000 < total) {
+        return; /* under 0.1% */
+    }
+    if (nodes[node].function < 0) {
+        strcpy(name, "(start of trace)");
+    } else {
+        format_location(name, nodes[node].function);
+    }
+    printf("  %*s%-*s calls %-10lu %6.2f%% incl %6.2f%% self\n",
+           depth * 2, "", 30 - depth * 2 > 0 ? 30 - depth * 2 : 0, name,
+           nodes[node].calls,
+           100.0 * nodes[node].inclusive / total,
+           100.0 * nodes[node].self / total);
+    for (child = nodes[node].first_child;
+         child >= 0;
+         child = nodes[child].next_sibling) {
+        print_call_tree(child, depth + 1, total);
+    }
+}
+
+static void build_call_tree(const struct trace *trace) {
+    int stack[MAX_CALL_DEPTH];
+    int depth = 0;
+    int pending = NOP;
+    unsigned long n;
+
+    num_nodes = 0;
+    stack[0] = new_node(-1, -1);
+    for (n = trace->first; n < trace->end; n++) {
+        const struct vm_trace_record *record = record_at(trace, n);
+        int node = stack[depth];
+        if (pending == CALL) {
+            node = child_node(node, record->pc);
+            nodes[node].calls++;
+            if (depth + 1 < MAX_CALL_DEPTH) {
+                stack[++depth] = node;
+            }
+        } else if (pending == TCALL && depth > 0) {
+            node = child_node(stack[depth - 1], record->pc);
+            nodes[node].calls++;
+            stack[depth] = node;
+        } else if (pending == RET && depth > 0) {
+            depth--;
+        }
+        nodes[stack[depth]].self++;
+        pending = record->opcode;
+    }
+}
+
+struct count {
+    int pc;
+    unsigned long n;
+    unsigned long extra; /* back edges: records between iterations */
+    int target;
+};
+
+static int compare_counts(const void *a, const void *b) {
+    const struct count *x = a;
+    const struct count *y = b;
+    if (x->n != y->n) {
+        return x->n < y->n ? 1 : -1;
+    }
+    return x->pc - y->pc;
+}
+
+static void summary(const struct trace *trace) {
+    unsigned long kept = trace->end - trace->first;
+    unsigned long opcodes[256];
+    struct count by_opcode[256];
+    struct count *pcs;
+    struct count *loops;
+    unsigned long *last_seen;
+    int max_pc = 0;
+    char location[300];
+    char target[300];
+    unsigned long n;
+    int i;
+
+    printf("records written %lu, kept %lu", trace->end, kept);
+    if (trace->first > 0) {
+        printf(" (the oldest %lu were overwritten)", trace->first);
+    }
+    printf("\n");
+    if (kept == 0) {
+        return;
+    }
+
+    for (n = trace->first; n < trace->end; n++) {
+        if (record_at(trace, n)->pc > max_pc) {
+            max_pc = record_at(trace, n)->pc;
+        }
+    }
+    pcs = calloc(max_pc + 1, sizeof(struct count));
+    loops = calloc(max_pc + 1, sizeof(struct count));
+    last_seen = calloc(max_pc + 1, sizeof(unsigned long));
+    if (pcs == NULL || loops == NULL || last_seen == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(opcodes, 0, sizeof(opcodes));
+
+    /*
+     * a jump to an address at or before itself closes a loop, minic's
+     * loops are tail calls so TCALL counts too
+     */
+    for (n = trace->first; n < trace->end; n++) {
+        const struct vm_trace_record *record = record_at(trace, n);
+        if (record->pc >= 0) {
+            pcs[record->pc].n++;
+        }
+        if (record->opcode >= 0 && record->opcode < 256) {
+            opcodes[record->opcode]++;
+        }
+        if (n + 1 < trace->end && record->pc >= 0 &&
+            (record->opcode == J || record->opcode == JZ ||
+             record->opcode == JNZ || record->opcode == JLEZ ||
+             record->opcode == TCALL) &&
+            record_at(trace, n + 1)->pc <= record->pc) {
+            struct count *loop = &loops[record->pc];
+            if (loop->n > 0) {
+                loop->extra += n - last_seen[record->pc];
+            }
+            loop->n++;
+            loop->target = record_at(trace, n + 1)->pc;
+            last_seen[record->pc] = n;
+        }
+    }
+
+    printf("\ninstructions:\n");
+    for (i = 0; i < num_opcodes; i++) {
+        by_opcode[i].pc = i;
+        by_opcode[i].n = opcodes[i];
+    }
+    qsort(by_opcode, num_opcodes, sizeof(struct count), compare_counts);
+    for (i = 0; i < num_opcodes && by_opcode[i].n > 0; i++) {
+        printf("  %-10s %12lu %6.2f%%\n", inst_names[by_opcode[i].pc],
+               by_opcode[i].n, 100.0 * by_opcode[i].n / kept);
+    }
+
+    for (i = 0; i <= max_pc; i++) {
+        pcs[i].pc = i;
+        loops[i].pc = i;
+    }
+    qsort(pcs, max_pc + 1, sizeof(struct count), compare_counts);
+    printf("\nhot addresses:\n");
+    for (i = 0; i <= max_pc && i < TOP_N && pcs[i].n > 0; i++) {
+        format_location(location, pcs[i].pc);
+        printf("  %-30s %12lu %6.2f%%\n", location, pcs[i].n,
+               100.0 * pcs[i].n / kept);
+    }
+
+    qsort(loops, max_pc + 1, sizeof(struct count), compare_counts);
+    printf("\nhot loops:\n");
+    for (i = 0; i <= max_pc && i < TOP_N && loops[i].n > 1; i++) {
+        format_location(target, loops[i].target);
+        format_location(location, loops[i].pc);
+        printf("  %-30s <- %-20s %10lu iterations, %.1f instructions each\n",
+               target, location, loops[i].n,
+               (double)loops[i].extra / (loops[i].n - 1));
+    }
+
+    build_call_tree(trace);
+    sum_inclusive(0);
+    printf("\ncall tree (at least 0.1%% of instructions):\n");
+    print_call_tree(0, 0, kept);
+
+    free(pcs);
+    free(loops);
+    free(last_seen);
+    free(nodes);
+}
+
+int main(int argc, char **argv) {
+    struct filter filter = {-1, -1, -1, -1};
+    struct trace trace;
+    char *command = NULL;
+    char *trace_filename = NULL;
+    int i;
+    PROGRAM_NAME = argv[0];
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            load_symbols(argv[++i]);
+        } else if (strcmp(argv[i], "--pc") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d-%d", &filter.pc_from,
+                       &filter.pc_to) != 2 || filter.pc_from < 0) {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--op") == 0 && i + 1 < argc) {
+            filter.opcode = lookup_opcode(argv[++i]);
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            filter.limit = atol(argv[++i]);
+        } else if (command == NULL && argv[i][0] != '-') {
+            command = argv[i];
+        } else if (trace_filename == NULL && argv[i][0] != '-') {
+            trace_filename = argv[i];
+        } else {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (command == NULL || trace_filename == NULL) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    open_trace(trace_filename, &trace);
+    if (strcmp(command, "dump") == 0) {
+        dump(&trace, &filter);
+    } else if (strcmp(command, "summary") == 0) {
+        summary(&trace);
+    } else {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_symbols; i++) {
+        free(symbols[i].name);
+    }
+    free(symbols);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: object.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+#include "util.h"
+
+void object_write(FILE *output, const struct object *object) {
+    size_t i;
+
+    fprintf(output, "%s %d\n", OBJECT_MAGIC, OBJECT_VERSION);
+    fprintf(output, "code %lu\n", (unsigned long)object->code_len);
+    for (i = 0; i < object->code_len; i++) {
+        fprintf(output, "%d\n", object->code[i]);
+    }
+    fprintf(output, "data %lu\n", (unsigned long)object->data_len);
+    for (i = 0; i < object->data_len; i++) {
+        fprintf(output, "%d\n", object->data[i]);
+    }
+    fprintf(output, "storage %d\n", object->storage);
+    fprintf(output, "symbols %lu\n", (unsigned long)object->num_symbols);
+    for (i = 0; i < object->num_symbols; i++) {
+        const struct object_symbol *symbol = &object->symbols[i];
+        fprintf(output, "%s %s %d %s\n", symbol->name,
+                symbol->section == OBJECT_CODE ? "code" : "data",
+                symbol->offset, symbol->global ? "global" : "local");
+    }
+    fprintf(output, "relocations %lu\n",
+            (unsigned long)object->num_relocations);
+    for (i = 0; i < object->num_relocations; i++) {
+        fprintf(output, "%d %s\n", object->relocations[i].offset,
+                object->relocations[i].symbol);
+    }
+    fprintf(output, "slots %lu\n", (unsigned long)object->num_slots);
+    for (i = 0; i < object->num_slots; i++) {
+        fprintf(output, "%d\n", object->slots[i]);
+    }
+}
+
+struct reader {
+    const char *text;
+    const char *filename;
+};
+
+static void malformed(const struct reader *reader, const char *what) {
+    fprintf(stderr, "%s: malformed object, expected %s\n",
+            reader->filename, what);
+    exit(EXIT_FAILURE);
+}
+
+/* the next whitespace separated token, at most size - 1 characters */
+static void read_token(struct reader *reader, char *token, size_t size,
+                       const char *what) {
+    size_t n = 0;
+    while (*reader->text == ' ' || *reader->text == '\n') {
+        reader->text++;
+    }
+    while (*reader->text != '\0' && *reader->text != ' ' &&
+           *reader->text != '\n') {
+        if (n + 1 == size) {
+            malformed(reader, what);
+        }
+        token[n++] = *reader->text++;
+    }
+    if (n == 0) {
+        malformed(reader, what);
+    }
+    token[n] = '\0';
+}
+
+static int read_int(struct reader *reader, const char *what) {
+    char token[32];
+    char *end;
+    long value;
+    read_token(reader, token, sizeof(token), what);
+    value = strtol(token, &end, 10);
+    if (*end != '\0') {
+        malformed(reader, what);
+    }
+    return (int)value;
+}
+
+/* "name N", returns N */
+static size_t read_count(struct reader *reader, const char *name) {
+    char token[32];
+    int count;
+    read_token(reader, token, sizeof(token), name);
+    if (strcmp(token, name) != 0) {
+        malformed(reader, name);
+    }
+    count = read_int(reader, name);
+    if (count < 0) {
+        malformed(reader, name);
+    }
+    return (size_t)count;
+}
+
+static int *read_words(struct reader *reader, size_t n, const char *what) {
+    int *words = minic_malloc((n + 1) * sizeof(int));
+    size_t i;
+    for (i = 0; i < n; i++) {
+        words[i] = read_int(reader, what);
+    }
+    return words;
+}
+
+struct object *object_read(const char *text, const char *filename) {
+    struct object *object = minic_malloc(sizeof(struct object));
+    struct reader reader;
+    char token[256];
+    size_t i;
+
+    reader.text = text;
+    reader.filename = filename;
+    read_token(&reader, token, sizeof(token), OBJECT_MAGIC);
+    if (strcmp(token, OBJECT_MAGIC) != 0 ||
+        read_int(&reader, "version") != OBJECT_VERSION) {
+        fprintf(stderr, "%s: not a relocatable object\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    object->code_len = read_count(&reader, "code");
+    object->code = read_words(&reader, object->code_len, "code word");
+    object->data_len = read_count(&reader, "data");
+    object->data = read_words(&reader, object->data_len, "data word");
+    read_token(&reader, token, sizeof(token), "storage");
+    if (strcmp(token, "storage") != 0) {
+        malformed(&reader, "storage");
+    }
+    object->storage = read_int(&reader, "storage");
+    if (object->storage < -1) {
+        malformed(&reader, "storage");
+    }
+
+    object->num_symbols = read_count(&reader, "symbols");
+    object->symbols = minic_malloc((object->num_symbols + 1) *
+                                   sizeof(struct object_symbol));
+    for (i = 0; i < object->num_symbols; i++) {
+        struct object_symbol *symbol = &object->symbols[i];
+        size_t limit = 0;
+        read_token(&reader, token, sizeof(token), "symbol name");
+        symbol->name = make_str(token);
+        read_token(&reader, token, sizeof(token), "code or data");
+        if (strcmp(token, "code") == 0) {
+            symbol->section = OBJECT_CODE;
+            limit = object->code_len;
+        } else if (strcmp(token, "data") == 0) {
+            symbol->section = OBJECT_DATA;
+            limit = object->data_len;
+        } else {
+            malformed(&reader, "code or data");
+        }
+        symbol->offset = read_int(&reader, "symbol offset");
+        if (symbol->offset < 0 || (size_t)symbol->offset > limit) {
+            malformed(&reader, "symbol offset in its section");
+        }
+        read_token(&reader, token, sizeof(token), "global or local");
+        symbol->global = strcmp(token, "global") == 0;
+        if (!symbol->global && strcmp(token, "local") != 0) {
+            malformed(&reader, "global or local");
+        }
+    }
+
+    object->num_relocations = read_count(&reader, "relocations");
+    object->relocations = minic_malloc((object->num_relocations + 1) *
+                                       sizeof(struct object_relocation));
+    for (i = 0; i < object->num_relocations; i++) {
+        struct object_relocation *relocation = &object->relocations[i];
+        relocation->offset = read_int(&reader, "relocation offset");
+        if (relocation->offset < 0 ||
+            (size_t)relocation->offset >= object->code_len) {
+            malformed(&reader, "relocation offset in code");
+        }
+        read_token(&reader, token, sizeof(token), "relocation symbol");
+        relocation->symbol = make_str(token);
+    }
+
+    object->num_slots = read_count(&reader, "slots");
+    object->slots = read_words(&reader, object->num_slots, "slot offset");
+    for (i = 0; i < object->num_slots; i++) {
+        if (object->slots[i] < 0 ||
+            (size_t)object->slots[i] >= object->code_len) {
+            malformed(&reader, "slot offset in code");
+        }
+    }
+    return object;
+}
+
+int object_storage(const struct object *object) {
+    int storage = 0;
+    size_t i;
+    if (object->storage >= 0) {
+        return object->storage;
+    }
+    for (i = 0; i < object->num_slots; i++) {
+        if (object->code[object->slots[i]] >= storage) {
+            storage = object->code[object->slots[i]] + 1;
+        }
+    }
+    return storage;
+}
+
+void object_free(struct object *object) {
+    size_t i;
+    if (object == NULL) {
+        return;
+    }
+    for (i = 0; i < object->num_symbols; i++) {
+        free(object->symbols[i].name);
+    }
+    for (i = 0; i < object->num_relocations; i++) {
+        free(object->relocations[i].symbol);
+    }
+    free(object->code);
+    free(object->data);
+    free(object->symbols);
+    free(object->relocations);
+    free(object->slots);
+    free(object);
+}
@@ -0,0 +1,88 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: object.h
+ */
+
+/*
+ * Relocatable objects, written by minias -c and linked by minild
+ *
+ * The format is text like the .o images, one item per line:
+ *
+ *     MINIOBJ 1
+ *     code N          N words, label operands are 0 until linked
+ *     data N          N words of .data
+ *     storage N       storage slots used, numbered from 0, -1 if the source
+ *                     had no .storage
+ *     symbols N       NAME code|data OFFSET global|local
+ *     relocations N   OFFSET NAME, the code word at OFFSET is NAME's address
+ *     slots N         OFFSET, the code word at OFFSET is a storage slot
+ */
+
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define OBJECT_MAGIC "MINIOBJ"
+#define OBJECT_VERSION 1
+
+typedef enum {
+    OBJECT_CODE,
+    OBJECT_DATA
+} object_section;
+
+struct object_symbol {
+    char *name;
+    object_section section;
+    int offset;
+    bool global;  /* named by .global, visible to other objects */
+};
+
+struct object_relocation {
+    int offset;   /* of the operand word in code */
+    char *symbol;
+};
+
+struct object {
+    int *code;
+    size_t code_len;
+    int *data;
+    size_t data_len;
+    int storage;  /* -1 if not given, see object_storage */
+    struct object_symbol *symbols;
+    size_t num_symbols;
+    struct object_relocation *relocations;
+    size_t num_relocations;
+    int *slots;
+    size_t num_slots;
+};
+
+void object_write(FILE *output, const struct object *object);
+
+/* parse an object, exits with a message naming filename if malformed */
+struct object *object_read(const char *text, const char *filename);
+
+/* slots the object uses, from .storage or else its highest PUSH @N */
+int object_storage(const struct object *object);
+
+void object_free(struct object *object);
+
+#endif /* OBJECT_H */
@@ -0,0 +1,494 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: perf.c
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "perf.h"
+#include "instructions.h"
+#include "util.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCHES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_L1I_MISSES,
+    COUNTER_TASK_CLOCK,
+    NUM_COUNTERS
+};
+
+static const char *counter_names[NUM_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "branches",
+    "branch-misses",
+    "L1d-read-misses",
+    "L1i-read-misses",
+    "task-clock-ns"
+};
+
+/* where the samples of each opcode go, opcodes not listed are "other" */
+static const char *class_names[] = {
+    "stack",
+    "arithmetic",
+    "storage",
+    "control",
+    "io",
+    "tasks",
+    "other"
+};
+
+enum { NUM_CLASSES = sizeof(class_names) / sizeof(class_names[0]) };
+
+static int opcode_class(int inst) {
+    switch (inst) {
+        case NOP: case PUSH: case POP: case PICK: case PUT:
+            return 0;
+        case ADD: case SUB: case MUL: case DIV: case MOD: case EQ: case NE:
+        case LT: case GT: case LE: case GE: case NOT:
+            return 1;
+        case LOAD: case SAVE: case ALOAD: case ASTORE: case AADD:
+        case BCOPY: case BFILL: case BCMP:
+            return 2;
+        case J: case JZ: case JLEZ: case JNZ: case CALL: case RET:
+        case POPC: case TCALL: case HALT: case DATA: case JTAB:
+            return 3;
+        case PRINTI: case PRINTC: case PRINTS: case READC:
+            return 4;
+        case SNAPSHOT: case COCREATE: case YIELD: case RESUME: case SPAWN:
+        case JOIN:
+            return 5;
+        default:
+            return NUM_CLASSES - 1;
+    }
+}
+
+struct perf_session {
+    const struct minivm *vm;
+    int fds[NUM_COUNTERS];
+    int errors[NUM_COUNTERS]; /* errno from opening the counter */
+    double values[NUM_COUNTERS];
+    unsigned long vm_instructions;
+    long sample_period;
+    int sample_fd;
+    int sample_error;
+    const char *sample_unit;
+    unsigned long *samples; /* per pc */
+    unsigned long num_samples;
+    unsigned long lost_samples;
+};
+
+#ifdef __linux__
+
+/* the sampling signal handler only has globals to go on */
+static struct perf_session *sampled_session = NULL;
+
+static int open_counter(unsigned int type,
+                        unsigned long config,
+                        long sample_period) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if (sample_period > 0) {
+        attr.sample_period = sample_period;
+        attr.wakeup_events = 1;
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static unsigned long cache_miss(unsigned long cache) {
+    return cache |
+           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+/*
+ * each overflow disables the event and raises SIGIO, take the sample and
+ * arm the event for one more overflow
+ */
+static void take_sample(int signal) {
+    struct perf_session *session = sampled_session;
+    int pc;
+    (void)signal;
+    if (session == NULL) {
+        return;
+    }
+    pc = vm_pc(session->vm);
+    if (pc >= 0 && (size_t)pc <= vm_program_len(session->vm)) {
+        session->samples[pc]++;
+        session->num_samples++;
+    } else {
+        session->lost_samples++;
+    }
+    ioctl(session->sample_fd, PERF_EVENT_IOC_REFRESH, 1);
+}
+
+static void open_sampler(struct perf_session *session) {
+    struct sigaction action;
+    int fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+                          session->sample_period);
+    session->sample_unit = "cycles";
+    if (fd < 0) {
+        fd = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK,
+                          session->sample_period);
+        session->sample_unit = "ns of CPU time";
+    }
+    if (fd < 0) {
+        session->sample_error = errno;
+        return;
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = take_sample;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGIO, &action, NULL) != 0 ||
+        fcntl(fd, F_SETFL, O_ASYNC) != 0 ||
+        fcntl(fd, F_SETOWN, getpid()) != 0) {
+        session->sample_error = errno;
+        close(fd);
+        return;
+    }
+    session->samples = minic_malloc((vm_program_len(session->vm) + 1) *
+                                    sizeof(unsigned long));
+    memset(session->samples, 0,
+           (vm_program_len(session->vm) + 1) * sizeof(unsigned long));
+    session->sample_fd = fd;
+    sampled_session = session;
+}
+
+struct perf_session *perf_open(const struct minivm *vm, long sample_period) {
+    static const struct {
+        unsigned int type;
+        unsigned long config;
+    } events[NUM_COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+    };
+    struct perf_session *session = minic_malloc(sizeof(struct perf_session));
+    int i;
+
+    memset(session, 0, sizeof(*session));
+    session->vm = vm;
+    session->sample_fd = -1;
+    session->sample_period = sample_period;
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        unsigned long config = events[i].config;
+        if (events[i].type == PERF_TYPE_HW_CACHE) {
+            config = cache_miss(config);
+        }
+        session->fds[i] = open_counter(events[i].type, config, 0);
+        session->errors[i] = session->fds[i] < 0 ? errno : 0;
+    }
+    if (sample_period > 0) {
+        open_sampler(session);
+    }
+    return session;
+}
+
+void perf_enable(struct perf_session *session) {
+    int i;
+    session->vm_instructions = vm_instruction_count(session->vm);
+    if (session->sample_fd >= 0) {
+        ioctl(session->sample_fd, PERF_EVENT_IOC_REFRESH, 1);
+    }
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (session->fds[i] >= 0) {
+            ioctl(session->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perf_disable(struct perf_session *session) {
+    int i;
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (session->fds[i] >= 0) {
+            ioctl(session->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    if (session->sample_fd >= 0) {
+        ioctl(session->sample_fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    session->vm_instructions =
+        vm_instruction_count(session->vm) - session->vm_instructions;
+
+    /* counters multiplexed onto the hardware are scaled up */
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        __u64 counts[3];
+        if (session->fds[i] < 0) {
+            continue;
+        }
+        if (read(session->fds[i], counts, sizeof(counts)) !=
+            (ssize_t)sizeof(counts)) {
+            session->errors[i] = errno ? errno : EIO;
+            close(session->fds[i]);
+            session->fds[i] = -1;
+        } else if (counts[2] > 0) {
+            session->values[i] = (double)counts[0] * counts[1] / counts[2];
+        }
+    }
+}
+
+void perf_close(struct perf_session *session) {
+    int i;
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (session->fds[i] >= 0) {
+            close(session->fds[i]);
+        }
+    }
+    if (session->sample_fd >= 0) {
+        sampled_session = NULL;
+        signal(SIGIO, SIG_DFL);
+        close(session->sample_fd);
+    }
+    free(session->samples);
+    free(session);
+}
+
+#else /* no perf_event_open */
+
+struct perf_session *perf_open(const struct minivm *vm, long sample_period) {
+    struct perf_session *session = minic_malloc(sizeof(struct perf_session));
+    int i;
+    memset(session, 0, sizeof(*session));
+    session->vm = vm;
+    session->sample_period = sample_period;
+    session->sample_fd = -1;
+    session->sample_error = sample_period > 0 ? ENOSYS : 0;
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        session->fds[i] = -1;
+        session->errors[i] = ENOSYS;
+    }
+    return session;
+}
+
+void perf_enable(struct perf_session *session) {
+    session->vm_instructions = vm_instruction_count(session->vm);
+}
+
+void perf_disable(struct perf_session *session) {
+    session->vm_instructions =
+        vm_instruction_count(session->vm) - session->vm_instructions;
+}
+
+void perf_close(struct perf_session *session) {
+    free(session);
+}
+
+#endif
+
+static int available(const struct perf_session *session, int counter) {
+    return session->fds[counter] >= 0;
+}
+
+static void report_ratio(FILE *out,
+                         const struct perf_session *session,
+                         const char *name,
+                         int numerator,
+                         int denominator,
+                         double scale) {
+    if (available(session, numerator) && available(session, denominator) &&
+        session->values[denominator] > 0) {
+        fprintf(out, "%-28s %.3f\n", name,
+                scale * session->values[numerator] /
+                session->values[denominator]);
+    }
+}
+
+struct range {
+    char name[300];
+    int first;
+    int last;
+    unsigned long samples;
+};
+
+static int compare_ranges(const void *a, const void *b) {
+    const struct range *x = a;
+    const struct range *y = b;
+    if (x->samples != y->samples) {
+        return x->samples < y->samples ? 1 : -1;
+    }
+    return x->first - y->first;
+}
+
+/*
+ * samples by opcode class, then by code range: an address belongs to the
+ * range of the label before it
+ */
+static void report_samples(struct perf_session *session,
+                           FILE *out,
+                           void (*name_location)(char *buff, int address)) {
+    const int *program = vm_program(session->vm);
+    int len = (int)vm_program_len(session->vm);
+    unsigned long classes[NUM_CLASSES];
+    struct range *ranges = minic_malloc((len + 1) * sizeof(struct range));
+    int num_ranges = 0;
+    int width;
+    int pc;
+    int i;
+
+    fprintf(out, "samples every %ld %s: %lu", session->sample_period,
+            session->sample_unit, session->num_samples);
+    if (session->lost_samples > 0) {
+        fprintf(out, " (%lu outside the program)", session->lost_samples);
+    }
+    fprintf(out, "\n");
+    if (session->num_samples == 0) {
+        free(ranges);
+        return;
+    }
+
+    /*
+     * the VM moves pc past an immediate in two steps, a sample can see it
+     * pointing at the immediate, count that for the instruction
+     */
+    memset(classes, 0, sizeof(classes));
+    for (pc = 1; pc <= len; pc += width) {
+        unsigned long samples = session->samples[pc];
+        char name[300];
+        char *offset;
+        width = 1;
+        if (program[pc] >= 0 && program[pc] < num_opcodes &&
+            requires_immediate(program[pc]) && pc < len) {
+            width = program[pc] == DATA && program[pc+1] >= 0 &&
+                    program[pc+1] <= len - pc - 1 ? program[pc+1] + 2 : 2;
+            samples += session->samples[pc+1];
+        }
+        if (samples == 0) {
+            continue;
+        }
+        classes[opcode_class(program[pc])] += samples;
+        name_location(name, pc);
+        if ((offset = strchr(name, '+')) != NULL) {
+            *offset = '\0';
+        }
+        if (num_ranges == 0 || strcmp(ranges[num_ranges-1].name, name) != 0) {
+            strcpy(ranges[num_ranges].name, name);
+            ranges[num_ranges].first = pc;
+            ranges[num_ranges].samples = 0;
+            num_ranges++;
+        }
+        ranges[num_ranges-1].last = pc;
+        ranges[num_ranges-1].samples += samples;
+    }
+
+    fprintf(out, "by opcode class:\n");
+    for (i = 0; i < NUM_CLASSES; i++) {
+        if (classes[i] > 0) {
+            fprintf(out, "  %-22s %6.2f%%\n", class_names[i],
+                    100.0 * classes[i] / session->num_samples);
+        }
+    }
+    qsort(ranges, num_ranges, sizeof(struct range), compare_ranges);
+    fprintf(out, "by code range:\n");
+    for (i = 0; i < num_ranges && i < 10; i++) {
+        char span[32];
+        sprintf(span, "%d-%d", ranges[i].first, ranges[i].last);
+        fprintf(out, "  %-22s %6.2f%%  pc %s\n", ranges[i].name,
+                100.0 * ranges[i].samples / session->num_samples, span);
+    }
+    free(ranges);
+}
+
+void perf_report(struct perf_session *session,
+                 FILE *out,
+                 void (*name_location)(char *buff, int address)) {
+    int unavailable = 0;
+    int i;
+
+    fprintf(out, "### PERF COUNTERS ###\n");
+    fprintf(out, "%-28s %lu\n", "vm-instructions", session->vm_instructions);
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (available(session, i)) {
+            fprintf(out, "%-28s %.0f\n", counter_names[i], session->values[i]);
+        }
+    }
+    report_ratio(out, session, "IPC",
+                 COUNTER_INSTRUCTIONS, COUNTER_CYCLES, 1.0);
+    report_ratio(out, session, "branch-miss-%",
+                 COUNTER_BRANCH_MISSES, COUNTER_BRANCHES, 100.0);
+    if (session->vm_instructions > 0) {
+        double n = (double)session->vm_instructions;
+        static const int per_dispatch[] = {
+            COUNTER_CYCLES,
+            COUNTER_INSTRUCTIONS,
+            COUNTER_BRANCH_MISSES,
+            COUNTER_TASK_CLOCK
+        };
+        for (i = 0; i < (int)(sizeof(per_dispatch) / sizeof(int)); i++) {
+            int counter = per_dispatch[i];
+            if (available(session, counter)) {
+                char name[64];
+                sprintf(name, "%s/vm-instruction", counter_names[counter]);
+                fprintf(out, "%-28s %.3f\n", name,
+                        session->values[counter] / n);
+            }
+        }
+    }
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (!available(session, i)) {
+            if (!unavailable) {
+                fprintf(out, "not available:");
+                unavailable = 1;
+            }
+            fprintf(out, " %s (%s)", counter_names[i],
+                    strerror(session->errors[i]));
+        }
+    }
+    if (unavailable) {
+        fprintf(out, "\n");
+    }
+    if (session->sample_period > 0) {
+        if (session->samples == NULL) {
+            fprintf(out, "sampling not available (%s)\n",
+                    strerror(session->sample_error));
+        } else {
+            report_samples(session, out, name_location);
+        }
+    }
+    fprintf(out, "### DONE PERF COUNTERS ###\n");
+}
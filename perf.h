@@ -0,0 +1,58 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: perf.h
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdio.h>
+
+#include "vm.h"
+
+/*
+ * Hardware performance counters around a VM run, for stackmachine
+ * --perf-counters. Uses Linux perf_event_open: counters the kernel, the
+ * CPU or the container does not provide are reported as unavailable and
+ * the program runs as usual.
+ *
+ * With a sample period, the VM pc is also sampled every period cycles,
+ * or every period nanoseconds of CPU time where there is no cycle
+ * counter, and the samples are attributed to opcode classes and to code
+ * ranges. Only the thread calling vm_run is counted and sampled.
+ */
+struct perf_session;
+
+/* never NULL, sample_period 0 turns sampling off */
+struct perf_session *perf_open(const struct minivm *vm, long sample_period);
+
+void perf_enable(struct perf_session *session);
+void perf_disable(struct perf_session *session);
+
+/*
+ * totals, IPC, branch miss rate and cost per VM instruction, then the
+ * samples, name_location names the code range an address belongs to
+ */
+void perf_report(struct perf_session *session,
+                 FILE *out,
+                 void (*name_location)(char *buff, int address));
+
+void perf_close(struct perf_session *session);
+
+#endif /* PERF_H */
@@ -0,0 +1,155 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: profile.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "bst.h"
+#include "util.h"
+
+/*
+ * counts are keyed by label, the BST only holds int values so counts are
+ * clamped to INT_MAX, which is plenty to compare arms against each other
+ */
+static bool loaded = false;
+static struct BST *if_counts = NULL;   /* _if_N -> times the if arm ran */
+static struct BST *else_counts = NULL; /* _if_N -> times the else arm ran */
+static struct BST *call_counts = NULL; /* function -> times called */
+
+static int clamp(unsigned long n) {
+    return n > 0x7fffffffUL ? 0x7fffffff : (int)n;
+}
+
+static struct BST *add_count(struct BST *bst, char *key, unsigned long n) {
+    struct BST *node = bst_find(bst, key);
+    if (node != NULL) {
+        node->value = clamp((unsigned long)node->value + n);
+        return bst;
+    }
+    return bst_insert(bst, make_str(key), clamp(n));
+}
+
+/* n more entries into location, if it is the first instruction of an arm */
+static void add_entries(char *location, unsigned long n) {
+    int label;
+    char extra;
+    char if_key[64];
+    if (sscanf(location, "_if_%d%c", &label, &extra) == 1) {
+        sprintf(if_key, "_if_%d", label);
+        if_counts = add_count(if_counts, if_key, n);
+    } else if (sscanf(location, "_else_%d%c", &label, &extra) == 1) {
+        sprintf(if_key, "_if_%d", label);
+        else_counts = add_count(else_counts, if_key, n);
+    }
+}
+
+/*
+ * A branch goes to its target when taken and to its fall through label
+ * otherwise, so each arm is counted by the branches that enter it. A plain
+ * condition is one branch between _if_N and _else_N, but with && and ||
+ * the earlier tests jump straight to an arm and fall through to an _and_M
+ * or _or_M label, and only the last one falls into an arm. A profile
+ * without targets only has the fall through label, which is enough for
+ * the plain case: the other arm is the target.
+ */
+static void add_branch(char *key,
+                       char *target,
+                       unsigned long taken,
+                       unsigned long fallthrough) {
+    int label;
+    char extra;
+    char other_arm[64];
+    add_entries(key, fallthrough);
+    if (target != NULL) {
+        add_entries(target, taken);
+    } else if (sscanf(key, "_if_%d%c", &label, &extra) == 1) {
+        sprintf(other_arm, "_else_%d", label);
+        add_entries(other_arm, taken);
+    } else if (sscanf(key, "_else_%d%c", &label, &extra) == 1) {
+        sprintf(other_arm, "_if_%d", label);
+        add_entries(other_arm, taken);
+    }
+}
+
+void profile_load(const char *filename) {
+    char line[1024];
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "could not open profile: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        char key[300];
+        char target[300];
+        unsigned long taken;
+        unsigned long fallthrough;
+        unsigned long count;
+        int fields = sscanf(line,
+                            "branch %299s taken %lu fallthrough %lu to %299s",
+                            key, &taken, &fallthrough, target);
+        if (fields == 4) {
+            add_branch(key, target, taken, fallthrough);
+        } else if (fields == 3) {
+            add_branch(key, NULL, taken, fallthrough);
+        } else if (sscanf(line, "call %299s %299s %lu",
+                          key, target, &count) == 3) {
+            call_counts = add_count(call_counts, target, count);
+        } else {
+            fprintf(stderr, "ignoring malformed profile line: %s", line);
+        }
+    }
+    fclose(fp);
+    loaded = true;
+}
+
+bool profile_loaded(void) {
+    return loaded;
+}
+
+bool profile_prefers_else(int label) {
+    char key[64];
+    struct BST *if_node;
+    struct BST *else_node;
+    sprintf(key, "_if_%d", label);
+    if_node = bst_find(if_counts, key);
+    else_node = bst_find(else_counts, key);
+    if (if_node == NULL || else_node == NULL) {
+        return false;
+    }
+    return else_node->value > if_node->value;
+}
+
+unsigned long profile_call_count(const char *function) {
+    struct BST *node = bst_find(call_counts, (char *)function);
+    return node ? (unsigned long)node->value : 0;
+}
+
+void profile_free(void) {
+    bst_destroy(if_counts);
+    bst_destroy(else_counts);
+    bst_destroy(call_counts);
+    if_counts = NULL;
+    else_counts = NULL;
+    call_counts = NULL;
+    loaded = false;
+}
@@ -0,0 +1,40 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: profile.h
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+/* read a profile written by stackmachine --profile */
+void profile_load(const char *filename);
+
+bool profile_loaded(void);
+
+/* true if the else arm of conditional _if_N ran more often than the if arm */
+bool profile_prefers_else(int label);
+
+/* number of times function was called or tail called */
+unsigned long profile_call_count(const char *function);
+
+void profile_free(void);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,1027 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: regcodegen.c
+ */
+
+/*
+ * minic --registers: code generation for the register machine, regvm.h
+ *
+ * miniC variables are global, so each int variable simply keeps one
+ * register for the whole program, r0 up to REG_VARIABLES - 1. Arrays, and
+ * ints declared after those run out, live in storage slots. Expressions
+ * are computed in the registers above REG_VARIABLES, deepest operand
+ * first when that does not reorder calls, and the last instruction of an
+ * assignment writes the variable's register directly:
+ *
+ *     total = total + n * 2;        LI r224, 2
+ *                                   MUL r224, r1, r224
+ *                                   ADD r0, r0, r224
+ *
+ * Conditions that compare two values branch on them directly. Values the
+ * stack machine would leave on the stack, from expression statements and
+ * call arguments, are still pushed so both targets end with the same
+ * stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "minic.h"
+#include "regvm.h"
+#include "bst.h"
+#include "growstring.h"
+#include "util.h"
+
+#define REG_VARIABLES 224
+#define FIRST_TEMP REG_VARIABLES
+
+/* where a variable lives: below REGVM_REGISTERS a register, else a slot */
+#define SLOT_LOCATION(slot) (REGVM_REGISTERS + (slot))
+#define IS_REGISTER(location) ((location) < REGVM_REGISTERS)
+
+static growstring *output = NULL;
+static struct BST *locations = NULL;
+static struct BST *array_sizes = NULL;
+static int next_register = 0;
+static int next_slot = 0;
+static int next_label = 0;
+
+static void emit_line(const char *format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    vsprintf(line, format, args);
+    va_end(args);
+    gs_append_str(output, line);
+}
+
+static void fail(const char *format, const char *id) {
+    fprintf(stderr, format, id);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+static int array_size(char *id) {
+    struct BST *node = bst_find(array_sizes, id);
+    return node == NULL ? 0 : node->value;
+}
+
+static void bind(struct BST **tree, char *id, int value) {
+    struct BST *node = bst_find(*tree, id);
+    if (node != NULL) {
+        node->value = value;
+    } else {
+        *tree = bst_insert(*tree, make_str(id), value);
+    }
+}
+
+/* like the stack machine, declaring a name again gives it a new place */
+static int declare(char *id, int size, bool in_storage) {
+    int location;
+    if (size == 0 && !in_storage && next_register < REG_VARIABLES) {
+        location = next_register++;
+    } else {
+        location = SLOT_LOCATION(next_slot);
+        next_slot += size > 0 ? size : 1;
+        if (next_slot > VM_STORAGE_SIZE) {
+            fail("'%.200s' does not fit in storage", id);
+        }
+    }
+    bind(&locations, id, location);
+    if (size > 0 || array_size(id) > 0) {
+        bind(&array_sizes, id, size);
+    }
+    return location;
+}
+
+static int lookup(char *id) {
+    struct BST *node = bst_find(locations, id);
+    if (node == NULL) {
+        fail("identifier: '%.200s' has not been declared", id);
+    }
+    return node->value;
+}
+
+static int lookup_array(char *id) {
+    int location = lookup(id);
+    if (array_size(id) == 0) {
+        fail("'%.200s' is not an array", id);
+    }
+    return location - REGVM_REGISTERS;
+}
+
+static bool is_array_load(ASTNode *ast) {
+    return ast != NULL && ast->kind == LOAD_STMT &&
+           array_size(ast->obj->value.symbol) > 0;
+}
+
+static bool is_array_compare(ASTNode *ast) {
+    return (ast->op == OP_EQ || ast->op == OP_NE) &&
+           is_array_load(ast->left) && is_array_load(ast->right);
+}
+
+static bool is_comparison(Operator op) {
+    return op == OP_EQ || op == OP_NE || op == OP_LT || op == OP_GT ||
+           op == OP_LE || op == OP_GE;
+}
+
+static const char *op_name(Operator op) {
+    switch (op) {
+        case OP_PLUS: return "ADD";
+        case OP_MINUS: return "SUB";
+        case OP_TIMES: return "MUL";
+        case OP_DIVIDE: return "DIV";
+        case OP_EQ: return "EQ";
+        case OP_NE: return "NE";
+        case OP_LT: return "LT";
+        case OP_GT: return "GT";
+        case OP_LE: return "LE";
+        case OP_GE: return "GE";
+        default: return "NOP";
+    }
+}
+
+/* the branch taken when the comparison op is false */
+static const char *inverse_branch(Operator op) {
+    switch (op) {
+        case OP_EQ: return "BNE";
+        case OP_NE: return "BEQ";
+        case OP_LT: return "BGE";
+        case OP_GT: return "BLE";
+        case OP_LE: return "BGT";
+        default: return "BLT";
+    }
+}
+
+/* the branch taken when the comparison op is true */
+static const char *direct_branch(Operator op) {
+    switch (op) {
+        case OP_EQ: return "BEQ";
+        case OP_NE: return "BNE";
+        case OP_LT: return "BLT";
+        case OP_GT: return "BGT";
+        case OP_LE: return "BLE";
+        default: return "BGE";
+    }
+}
+
+static bool is_logical(Operator op) {
+    return op == OP_AND || op == OP_OR;
+}
+
+/*
+ * For each node of the expression, children first: the temporaries
+ * needed to compute it and whether it calls a function. These decide the
+ * order operands are computed in.
+ */
+static void annotate(ASTNode *expr) {
+    size_t count;
+    size_t i;
+    ASTNode **nodes = ast_postorder(expr, false, &count);
+
+    for (i = 0; i < count; i++) {
+        ASTNode *ast = nodes[i];
+        int left = ast->left != NULL ? ast->left->need : 0;
+        int right = ast->right != NULL ? ast->right->need : 0;
+        ast->calls = ast->kind == FUNC_CALL ||
+                     (ast->left != NULL && ast->left->calls) ||
+                     (ast->right != NULL && ast->right->calls);
+        switch (ast->kind) {
+            case LOAD_STMT:
+                ast->need = IS_REGISTER(lookup(ast->obj->value.symbol))
+                            ? 0 : 1;
+                break;
+
+            case INDEX_LOAD:
+                ast->need = left > 1 ? left : 1;
+                break;
+
+            case OPERATOR:
+                if (is_array_compare(ast)) {
+                    ast->need = 2;
+                } else if (is_logical(ast->op) || ast->op == OP_NOT) {
+                    /* one operand at a time, into the same register */
+                    ast->need = left > right ? left : right;
+                    ast->need = ast->need > 1 ? ast->need : 1;
+                } else if (left == right) {
+                    ast->need = left + 1;
+                } else {
+                    ast->need = left > right ? left : right;
+                }
+                break;
+
+            default:
+                ast->need = 1;
+                break;
+        }
+    }
+    free(nodes);
+}
+
+static int check_temp(int temp) {
+    if (temp >= REGVM_REGISTERS) {
+        fprintf(stderr, "expression too deep for %d registers\n",
+                REGVM_REGISTERS - FIRST_TEMP);
+        exit(EXIT_FAILURE);
+    }
+    return temp;
+}
+
+/*
+ * Like minic.c this walks the AST with a stack of tasks on the heap, so
+ * long statement lists and deep expressions cannot overflow the C stack.
+ * A task is a node, what to do with it, and the step it is at. A VALUE
+ * task computes an expression, using temporaries from temp up, into dest
+ * if dest >= 0, and leaves the register holding it on a second stack for
+ * the task that pushed it.
+ */
+enum task_kind {
+    TASK_STMTS,    /* node and its siblings */
+    TASK_STMT,
+    TASK_VALUE,
+    TASK_OPERANDS, /* both operands of node, then the operator or branch */
+    TASK_CALL,     /* arguments left on the stack, then CALL */
+    TASK_BRANCH    /* node as a condition, jumping to the labels of branch */
+};
+
+struct task {
+    ASTNode *node;
+    enum task_kind kind;
+    int step;
+    int temp;
+    int dest;
+    int saved;  /* a register or label kept between steps */
+    int branch; /* TASK_OPERANDS and TASK_BRANCH: where to jump, or -1 */
+};
+
+/*
+ * Where a condition jumps, to on_true or on_false, unless the one it
+ * would jump to is the code right after it, like minic.c.
+ */
+struct branch {
+    char on_true[32];
+    char on_false[32];
+    bool falls_true; /* the code right after it is on_true */
+};
+
+static struct task *tasks = NULL;
+static size_t num_tasks = 0;
+static size_t tasks_capacity = 0;
+static int *results = NULL;
+static size_t num_results = 0;
+static size_t results_capacity = 0;
+static struct branch *branches = NULL;
+static size_t num_branches = 0;
+static size_t branches_capacity = 0;
+
+static void push_task(ASTNode *node, enum task_kind kind, int step,
+                      int temp, int dest) {
+    if (node == NULL) {
+        return;
+    }
+    if (num_tasks == tasks_capacity) {
+        tasks_capacity = tasks_capacity == 0 ? 64 : tasks_capacity * 2;
+        tasks = minic_realloc(tasks, tasks_capacity * sizeof(*tasks));
+    }
+    tasks[num_tasks].node = node;
+    tasks[num_tasks].kind = kind;
+    tasks[num_tasks].step = step;
+    tasks[num_tasks].temp = temp;
+    tasks[num_tasks].dest = dest;
+    tasks[num_tasks].saved = -1;
+    tasks[num_tasks].branch = -1;
+    num_tasks++;
+}
+
+/* push the task again at its next step */
+static struct task *resume(const struct task *task, int saved) {
+    push_task(task->node, task->kind, task->step + 1, task->temp,
+              task->dest);
+    tasks[num_tasks - 1].saved = saved;
+    tasks[num_tasks - 1].branch = task->branch;
+    return &tasks[num_tasks - 1];
+}
+
+static int push_branch(const char *on_true, const char *on_false,
+                       bool falls_true) {
+    if (num_branches == branches_capacity) {
+        branches_capacity = branches_capacity == 0 ? 64
+                                                   : branches_capacity * 2;
+        branches = minic_realloc(branches,
+                                 branches_capacity * sizeof(*branches));
+    }
+    strcpy(branches[num_branches].on_true, on_true);
+    strcpy(branches[num_branches].on_false, on_false);
+    branches[num_branches].falls_true = falls_true;
+    return (int)num_branches++;
+}
+
+static void push_result(int reg) {
+    if (num_results == results_capacity) {
+        results_capacity = results_capacity == 0 ? 64 : results_capacity * 2;
+        results = minic_realloc(results, results_capacity * sizeof(*results));
+    }
+    results[num_results++] = reg;
+}
+
+static int pop_result(void) {
+    return results[--num_results];
+}
+
+/* an expression a statement needs, computed from the first temporary */
+static void push_expression(ASTNode *expr, int dest) {
+    annotate(expr);
+    push_task(expr, TASK_VALUE, 0, FIRST_TEMP, dest);
+}
+
+static bool branches_on_compare(ASTNode *condition) {
+    return condition->kind == OPERATOR && is_comparison(condition->op) &&
+           !is_array_compare(condition);
+}
+
+/*
+ * both operands of a binary operator into registers, right first like the
+ * stack machine unless neither has calls and the left needs more temps,
+ * then the operator into the result, or the branch
+ */
+static void step_operands(const struct task *task) {
+    ASTNode *ast = task->node;
+    int temp = task->temp;
+    bool right_first = ast->calls || ast->right->need >= ast->left->need;
+    ASTNode *first = right_first ? ast->right : ast->left;
+    ASTNode *second = right_first ? ast->left : ast->right;
+    int a;
+    int b;
+
+    switch (task->step) {
+        case 0:
+            resume(task, -1);
+            push_task(first, TASK_VALUE, 0, temp, -1);
+            break;
+
+        case 1:
+            a = pop_result();
+            if (right_first && a != temp && ast->left->calls) {
+                /* the call could change the variable */
+                emit_line("\tMOV r%d, r%d\n", temp, a);
+                a = temp;
+            }
+            resume(task, a);
+            push_task(second, TASK_VALUE, 0, a == temp ? temp + 1 : temp, -1);
+            break;
+
+        default:
+            a = right_first ? pop_result() : task->saved;
+            b = right_first ? task->saved : pop_result();
+            if (task->branch >= 0) {
+                const struct branch *branch = &branches[task->branch];
+                if (branch->falls_true) {
+                    emit_line("\t%s r%d, r%d, %s\n", inverse_branch(ast->op),
+                              a, b, branch->on_false);
+                } else {
+                    emit_line("\t%s r%d, r%d, %s\n", direct_branch(ast->op),
+                              a, b, branch->on_true);
+                }
+            } else {
+                int result = task->dest >= 0 ? task->dest
+                                             : check_temp(temp);
+                emit_line("\t%s r%d, r%d, r%d\n", op_name(ast->op), result,
+                          a, b);
+                push_result(result);
+            }
+            break;
+    }
+}
+
+/*
+ * a && b and a || b as 0 or 1, both operands into the same temporary, b
+ * only when a does not decide it:
+ *
+ *     <a into t>                 <a into t>
+ *     BZ t, _end_and_M           BNZ t, _or_M
+ *     <b into t>                 <b into t>
+ *     BZ t, _end_and_M           BZ t, _end_or_M
+ *     LI t, 1                _or_M:
+ * _end_and_M:                    LI t, 1
+ *                            _end_or_M:
+ */
+static void step_logical(const struct task *task) {
+    ASTNode *ast = task->node;
+    const char *name = ast->op == OP_AND ? "and" : "or";
+    int t = check_temp(task->temp);
+    int label = task->saved;
+
+    switch (task->step) {
+        case 0:
+            resume(task, next_label++);
+            push_task(ast->left, TASK_VALUE, 0, task->temp, t);
+            break;
+
+        case 1:
+            pop_result();
+            if (ast->op == OP_AND) {
+                emit_line("\tBZ r%d, _end_and_%d\n", t, label);
+            } else {
+                emit_line("\tBNZ r%d, _or_%d\n", t, label);
+            }
+            resume(task, label);
+            push_task(ast->right, TASK_VALUE, 0, task->temp, t);
+            break;
+
+        default:
+            pop_result();
+            emit_line("\tBZ r%d, _end_%s_%d\n", t, name, label);
+            if (ast->op == OP_OR) {
+                emit_line("_or_%d:\n", label);
+            }
+            emit_line("\tLI r%d, 1\n", t);
+            emit_line("_end_%s_%d:\n", name, label);
+            if (task->dest >= 0 && task->dest != t) {
+                emit_line("\tMOV r%d, r%d\n", task->dest, t);
+                t = task->dest;
+            }
+            push_result(t);
+            break;
+    }
+}
+
+static void step_value(const struct task *task) {
+    ASTNode *ast = task->node;
+    int temp = task->temp;
+    int dest = task->dest;
+    int result = dest >= 0 ? dest : check_temp(temp);
+    int t;
+
+    switch (ast->kind) {
+        case LEAF:
+            emit_line("\tLI r%d, %s\n", result, ast->obj->value.number_value);
+            push_result(result);
+            break;
+
+        case LOAD_STMT:
+        {
+            char *id = ast->obj->value.symbol;
+            int location = lookup(id);
+            if (array_size(id) > 0) {
+                fail("array '%.200s' used as a value", id);
+            }
+            if (!IS_REGISTER(location)) {
+                emit_line("\tLD r%d, %d\n", result,
+                          location - REGVM_REGISTERS);
+            } else if (dest >= 0 && dest != location) {
+                emit_line("\tMOV r%d, r%d\n", dest, location);
+            } else {
+                result = location;
+            }
+            push_result(result);
+            break;
+        }
+
+        case INDEX_LOAD:
+            if (task->step == 0) {
+                resume(task, -1);
+                push_task(ast->left, TASK_VALUE, 0, temp, -1);
+                break;
+            }
+            emit_line("\tLDX r%d, r%d, %d\n", result, pop_result(),
+                      lookup_array(ast->obj->value.symbol));
+            push_result(result);
+            break;
+
+        case OPERATOR:
+            if (is_array_compare(ast)) {
+                char *left = ast->left->obj->value.symbol;
+                char *right = ast->right->obj->value.symbol;
+                if (array_size(left) != array_size(right)) {
+                    fprintf(stderr,
+                            "arrays '%.100s' and '%.100s' differ in size\n",
+                            left, right);
+                    exit(EXIT_FAILURE);
+                }
+                check_temp(temp + 1);
+                emit_line("\tACMP r%d, %d, %d, %d\n", temp,
+                          lookup_array(left), lookup_array(right),
+                          array_size(left));
+                emit_line("\tLI r%d, 0\n", temp + 1);
+                emit_line("\t%s r%d, r%d, r%d\n", op_name(ast->op), result,
+                          temp, temp + 1);
+                push_result(result);
+                break;
+            }
+            if (ast->op == OP_NOT) {
+                if (task->step == 0) {
+                    resume(task, -1);
+                    push_task(ast->left, TASK_VALUE, 0, temp, -1);
+                    break;
+                }
+                emit_line("\tNOT r%d, r%d\n", result, pop_result());
+                push_result(result);
+                break;
+            }
+            if (is_logical(ast->op)) {
+                step_logical(task);
+                break;
+            }
+            push_task(ast, TASK_OPERANDS, 0, temp, dest);
+            break;
+
+        case FUNC_CALL:
+            /*
+             * the value is whatever the callee leaves on the stack, and
+             * the temporaries in use have to survive the call
+             */
+            if (task->step == 0) {
+                if (temp > FIRST_TEMP && ast->right != NULL) {
+                    fprintf(stderr, "call to %.200s with arguments inside an "
+                            "expression is not supported with --registers\n",
+                            ast->obj->value.symbol);
+                    exit(EXIT_FAILURE);
+                }
+                for (t = FIRST_TEMP; t < temp; t++) {
+                    emit_line("\tPUSH r%d\n", t);
+                }
+                resume(task, -1);
+                push_task(ast, TASK_CALL, 0, 0, -1);
+                break;
+            }
+            emit_line("\tPOP r%d\n", result);
+            for (t = temp - 1; t >= FIRST_TEMP; t--) {
+                emit_line("\tPOP r%d\n", t);
+            }
+            push_result(result);
+            break;
+
+        default:
+            fprintf(stderr, "not an expression: %d\n", ast->kind);
+            exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * a condition, jumping to where its branch says like codegen_branch in
+ * minic.c does, && || and ! only decide which labels their operands use
+ */
+static void step_branch(const struct task *task) {
+    ASTNode *ast = task->node;
+    struct branch branch = branches[task->branch];
+    char join[32];
+
+    if (ast->kind == OPERATOR && ast->op == OP_NOT) {
+        push_task(ast->left, TASK_BRANCH, 0, 0, -1);
+        tasks[num_tasks - 1].branch = push_branch(branch.on_false,
+                                                  branch.on_true,
+                                                  !branch.falls_true);
+    } else if (ast->kind == OPERATOR && is_logical(ast->op)) {
+        if (task->step == 1) {
+            emit_line("_%s_%d:\n", ast->op == OP_AND ? "and" : "or",
+                      task->saved);
+            return;
+        }
+        sprintf(join, "_%s_%d", ast->op == OP_AND ? "and" : "or",
+                next_label);
+        push_task(ast->right, TASK_BRANCH, 0, 0, -1);
+        tasks[num_tasks - 1].branch = task->branch;
+        resume(task, next_label++);
+        push_task(ast->left, TASK_BRANCH, 0, 0, -1);
+        if (ast->op == OP_AND) {
+            tasks[num_tasks - 1].branch = push_branch(join, branch.on_false,
+                                                      true);
+        } else {
+            tasks[num_tasks - 1].branch = push_branch(branch.on_true, join,
+                                                      false);
+        }
+    } else if (branches_on_compare(ast)) {
+        annotate(ast);
+        push_task(ast, TASK_OPERANDS, 0, FIRST_TEMP, -1);
+        tasks[num_tasks - 1].branch = task->branch;
+    } else if (task->step == 0) {
+        resume(task, -1);
+        push_expression(ast, -1);
+    } else if (branch.falls_true) {
+        emit_line("\tBZ r%d, %s\n", pop_result(), branch.on_false);
+    } else {
+        emit_line("\tBNZ r%d, %s\n", pop_result(), branch.on_true);
+    }
+}
+
+static void step_conditional(const struct task *task) {
+    ASTNode *ast = task->node;
+    int label = task->saved;
+    char if_label[32];
+    char else_label[32];
+
+    switch (task->step) {
+        case 0:
+            label = next_label++;
+            resume(task, label);
+            sprintf(if_label, "_if_%d", label);
+            sprintf(else_label, "_else_%d", label);
+            push_task(ast->condition, TASK_BRANCH, 0, 0, -1);
+            tasks[num_tasks - 1].branch = push_branch(if_label, else_label,
+                                                      true);
+            break;
+
+        case 1:
+            emit_line("_if_%d:\n", label);
+            resume(task, label);
+            push_task(ast->left, TASK_STMTS, 0, 0, -1);
+            break;
+
+        case 2:
+            if (ast->right != NULL) {
+                emit_line("\tJ _end_if_%d\n", label);
+            }
+            emit_line("_else_%d:\n", label);
+            if (ast->right != NULL) {
+                resume(task, label);
+                push_task(ast->right, TASK_STMTS, 0, 0, -1);
+            }
+            break;
+
+        default:
+            emit_line("_end_if_%d:\n", label);
+            break;
+    }
+}
+
+/*
+ * switch dispatches like minic.c does, on x in a register rather than on
+ * the stack, so no arm has anything to drop
+ */
+static void put_switch_tree(const SwitchCase *cases, int lo, int hi,
+                            int x, int temp, int label) {
+    char target[64];
+    int i;
+
+    if (hi - lo <= SWITCH_LINEAR_MAX) {
+        for (i = lo; i < hi; i++) {
+            switch_arm_label(target, cases[i].arm, label);
+            emit_line("\tLI r%d, %d\n", temp, cases[i].value);
+            emit_line("\tBEQ r%d, r%d, %s\n", x, temp, target);
+        }
+        switch_arm_label(target, NULL, label);
+        emit_line("\tJ %s\n", target);
+    } else {
+        int mid = lo + (hi - lo) / 2;
+        emit_line("\tLI r%d, %d\n", temp, cases[mid].value);
+        emit_line("\tBLT r%d, r%d, _below_%d_%d\n", x, temp, label, mid);
+        put_switch_tree(cases, mid, hi, x, temp, label);
+        emit_line("_below_%d_%d:\n", label, mid);
+        put_switch_tree(cases, lo, mid, x, temp, label);
+    }
+}
+
+static void put_switch_table(const SwitchCase *cases, int n, int x,
+                             int label) {
+    int entries = cases[n-1].value - cases[0].value + 1;
+    char target[64];
+    int i;
+    int k = 0;
+
+    if (cases[0].value != 0) {
+        emit_line("\tLI r%d, %d\n", FIRST_TEMP + 1, cases[0].value);
+        emit_line("\tSUB r%d, r%d, r%d\n", FIRST_TEMP, x, FIRST_TEMP + 1);
+        x = FIRST_TEMP;
+    }
+    emit_line("\tJTAB r%d, %d\n", x, entries);
+    for (i = 0; i <= entries; i++) {
+        bool is_case = i < entries && cases[k].value - cases[0].value == i;
+        switch_arm_label(target, is_case ? cases[k++].arm : NULL, label);
+        emit_line("\tJ %s\n", target);
+    }
+}
+
+static void step_switch(const struct task *task) {
+    ASTNode *ast = task->node;
+    int label = task->saved;
+    ASTNode *arm;
+
+    switch (task->step) {
+        case 0:
+            resume(task, next_label++);
+            push_expression(ast->condition, -1);
+            break;
+
+        case 1:
+        {
+            int x = pop_result();
+            int n;
+            SwitchCase *cases = switch_cases(ast, &n);
+            ASTNode **arms;
+            int num_arms = 0;
+            int i;
+            if (switch_is_dense(cases, n)) {
+                put_switch_table(cases, n, x, label);
+            } else {
+                put_switch_tree(cases, 0, n, x,
+                                x == FIRST_TEMP ? FIRST_TEMP + 1 : FIRST_TEMP,
+                                label);
+            }
+            free(cases);
+            resume(task, label);
+            /* the arms in source order, each knowing its switch */
+            for (arm = ast->right; arm != NULL; arm = arm->sibling) {
+                num_arms++;
+            }
+            arms = minic_malloc(num_arms * sizeof(*arms));
+            for (arm = ast->right, i = 0; arm != NULL; arm = arm->sibling) {
+                arms[i++] = arm;
+            }
+            for (i = num_arms - 1; i >= 0; i--) {
+                push_task(arms[i], TASK_STMT, 0, 0, -1);
+                tasks[num_tasks - 1].saved = label;
+            }
+            free(arms);
+            break;
+        }
+
+        default:
+            for (arm = ast->right; arm != NULL; arm = arm->sibling) {
+                if (arm->left == NULL) {
+                    break;
+                }
+            }
+            if (arm == NULL) {
+                emit_line("_default_%d:\n", label);
+            }
+            emit_line("_end_switch_%d:\n", label);
+            break;
+    }
+}
+
+static void step_case_arm(const struct task *task) {
+    ASTNode *ast = task->node;
+    char arm_label[64];
+
+    if (task->step == 0) {
+        switch_arm_label(arm_label, ast, task->saved);
+        emit_line("%s:\n", arm_label);
+        resume(task, task->saved);
+        push_task(ast->right, TASK_STMTS, 0, 0, -1);
+    } else if (ast->sibling != NULL || ast->left != NULL) {
+        emit_line("\tJ _end_switch_%d\n", task->saved);
+    }
+}
+
+static void step_stmt(const struct task *task) {
+    ASTNode *ast = task->node;
+
+    switch (ast->kind) {
+        case CONDITIONAL:
+            step_conditional(task);
+            break;
+
+        case SWITCH_STMT:
+            step_switch(task);
+            break;
+
+        case CASE_ARM:
+            step_case_arm(task);
+            break;
+
+        case OPERATOR:
+        case LEAF:
+        case LOAD_STMT:
+        case INDEX_LOAD:
+            if (task->step == 0) {
+                resume(task, -1);
+                push_expression(ast, -1);
+            } else {
+                emit_line("\tPUSH r%d\n", pop_result());
+            }
+            break;
+
+        case FUNC_CALL:
+            push_task(ast, TASK_CALL, 0, 0, -1);
+            break;
+
+        case DECLARE_STMT:
+        {
+            char *id = ast->obj->value.symbol;
+            if (ast->left != NULL) {
+                int size = atoi(ast->left->obj->value.number_value);
+                if (size <= 0 || size > 1000000) {
+                    fail("array '%.200s' needs a positive size", id);
+                }
+                emit_line("\tFILL %d, %d\n",
+                          declare(id, size, true) - REGVM_REGISTERS, size);
+                break;
+            }
+            declare(id, 0, false);
+            push_task(ast->right, TASK_STMT, 0, 0, -1);
+            break;
+        }
+
+        case ASSIGN_EXPR:
+        {
+            char *id = ast->obj->value.symbol;
+            int location = lookup(id);
+            if (task->step == 1) {
+                int value = pop_result();
+                if (!IS_REGISTER(location)) {
+                    emit_line("\tST r%d, %d\n", value,
+                              location - REGVM_REGISTERS);
+                }
+                break;
+            }
+            if (array_size(id) > 0) {
+                char *source;
+                if (!is_array_load(ast->right)) {
+                    fail("cannot assign a value to array '%.200s'", id);
+                }
+                source = ast->right->obj->value.symbol;
+                if (array_size(source) != array_size(id)) {
+                    fprintf(stderr,
+                            "arrays '%.100s' and '%.100s' differ in size\n",
+                            id, source);
+                    exit(EXIT_FAILURE);
+                }
+                emit_line("\tCOPY %d, %d, %d\n", lookup_array(id),
+                          lookup_array(source), array_size(id));
+                break;
+            }
+            resume(task, -1);
+            push_expression(ast->right,
+                            IS_REGISTER(location) ? location : -1);
+            break;
+        }
+
+        case INDEX_ASSIGN:
+        {
+            int value;
+            if (task->step == 0) {
+                resume(task, -1);
+                push_expression(ast->right, -1);
+                break;
+            }
+            if (task->step == 1) {
+                value = pop_result();
+                annotate(ast->left);
+                if (value != FIRST_TEMP && ast->left->calls) {
+                    emit_line("\tMOV r%d, r%d\n", FIRST_TEMP, value);
+                    value = FIRST_TEMP;
+                }
+                resume(task, value);
+                push_task(ast->left, TASK_VALUE, 0,
+                          value == FIRST_TEMP ? FIRST_TEMP + 1 : FIRST_TEMP,
+                          -1);
+                break;
+            }
+            emit_line("\tSTX r%d, r%d, %d\n", task->saved, pop_result(),
+                      lookup_array(ast->obj->value.symbol));
+            break;
+        }
+
+        case FUNC_DEF:
+        {
+            char *id = ast->obj->value.symbol;
+            if (task->step == 1) {
+                if (!ends_in_tail_call(ast->right)) {
+                    emit_line("\tRET\n");
+                }
+                break;
+            }
+            declare(id, 0, true);
+            emit_line("%s:\n", id);
+            mark_tail_calls(ast->right);
+            resume(task, -1);
+            push_task(ast->right, TASK_STMTS, 0, 0, -1);
+            break;
+        }
+
+        case PRINT_STMT:
+        {
+            int label = next_label++;
+            emit_line("\tPRINTS _str_%d\n", label);
+            emit_line(".data\n_str_%d:\n", label);
+            gs_append_str(output, "\t.string ");
+            gs_append_str(output, ast->obj->value.string_value);
+            gs_append_str(output, "\n.text\n");
+            break;
+        }
+    }
+}
+
+/* one step of the task on top of the stack */
+static void step(void) {
+    struct task task = tasks[--num_tasks];
+
+    switch (task.kind) {
+        case TASK_STMTS:
+            push_task(task.node->sibling, TASK_STMTS, 0, 0, -1);
+            push_task(task.node, TASK_STMT, 0, 0, -1);
+            break;
+
+        case TASK_STMT:
+            step_stmt(&task);
+            break;
+
+        case TASK_VALUE:
+            step_value(&task);
+            break;
+
+        case TASK_OPERANDS:
+            step_operands(&task);
+            break;
+
+        case TASK_BRANCH:
+            step_branch(&task);
+            break;
+
+        case TASK_CALL:
+            /* arguments are left on the stack, as the stack machine does */
+            if (task.step == 0) {
+                resume(&task, -1);
+                push_task(task.node->right, TASK_STMTS, 0, 0, -1);
+            } else {
+                emit_line("\t%s %s\n", task.node->tail ? "TCALL" : "CALL",
+                          task.node->obj->value.symbol);
+            }
+            break;
+    }
+}
+
+static void gen_stmt(ASTNode *ast) {
+    num_branches = 0;
+    push_task(ast, TASK_STMT, 0, 0, -1);
+    while (num_tasks > 0) {
+        step();
+    }
+}
+
+
+/* like the stack machine: statements, CALL main, HALT, then functions */
+char *emit_registers_string(ASTNode *ast) {
+    growstring *functions = gs_new();
+    growstring *top_level;
+    ASTNode *node;
+    bool has_main = false;
+    char *str;
+
+    output = gs_new();
+    top_level = output;
+    for (node = ast; node != NULL; node = node->sibling) {
+        if (node->kind == FUNC_DEF) {
+            output = functions;
+            if (strcmp(node->obj->value.symbol, "main") == 0) {
+                has_main = true;
+            }
+        } else {
+            output = top_level;
+        }
+        gen_stmt(node);
+    }
+    output = top_level;
+    if (has_main) {
+        emit_line("\tCALL main\n");
+    }
+    emit_line("\tHALT\n");
+    gs_concat(top_level, functions);
+    gs_free(functions);
+
+    str = top_level->data;
+    free(top_level);
+    output = NULL;
+    bst_destroy(locations);
+    bst_destroy(array_sizes);
+    locations = NULL;
+    array_sizes = NULL;
+    next_register = 0;
+    next_slot = 0;
+    next_label = 0;
+    free(tasks);
+    free(results);
+    free(branches);
+    tasks = NULL;
+    results = NULL;
+    branches = NULL;
+    tasks_capacity = 0;
+    results_capacity = 0;
+    branches_capacity = 0;
+    return str;
+}
+
+int emit_registers(FILE *out, ASTNode *ast) {
+    char *code = emit_registers_string(ast);
+    fputs(code, out);
+    free(code);
+    return 0;
+}
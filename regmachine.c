@@ -0,0 +1,94 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: regmachine.c
+ */
+
+/*
+ * regmachine: runs register machine assembly, minic --registers output,
+ * with the output of stackmachine
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regvm.h"
+#include "util.h"
+
+static void print_usage(char *program_name) {
+    fprintf(stderr,
+            "usage: %s [--count] PROGRAM.rs\n"
+            "  --count  report the instructions executed\n",
+            program_name);
+}
+
+int main(int argc, char **argv) {
+    char *program_filename = NULL;
+    char *source;
+    int *code;
+    size_t len;
+    int count = 0;
+    struct regvm *vm;
+    vm_status status;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--count") == 0) {
+            count = 1;
+        } else if (program_filename == NULL && argv[i][0] != '-') {
+            program_filename = argv[i];
+        } else {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (program_filename == NULL) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("*** LOADING ***\n");
+    printf("Reading from: %s\n", program_filename);
+    source = read_file(program_filename);
+    code = regvm_assemble(source, program_filename, &len);
+    free(source);
+    vm = regvm_new(code, len);
+    free(code);
+    if (vm == NULL) {
+        fprintf(stderr, "not a valid program: %s\n", program_filename);
+        exit(EXIT_FAILURE);
+    }
+    printf("*** DONE LOADING ***\n");
+    printf("### RUNNING ###\n");
+
+    status = regvm_run(vm);
+    fflush(stdout);
+    if (status == VM_ERROR) {
+        fprintf(stderr, "ERROR: %s\n", regvm_error(vm));
+    } else {
+        printf("### HALTING ###\n");
+    }
+    regvm_print_stack(vm, stdout);
+    if (count) {
+        fflush(stdout);
+        fprintf(stderr, "executed %lu\n", regvm_instruction_count(vm));
+    }
+    regvm_destroy(vm);
+    return status == VM_ERROR ? EXIT_FAILURE : 0;
+}
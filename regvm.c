@@ -0,0 +1,810 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: regvm.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "regvm.h"
+#include "bst.h"
+#include "util.h"
+
+#define MAX_LINE 1024
+
+#define R OPERAND_REGISTER
+#define N OPERAND_NUMBER
+#define S OPERAND_SLOT
+#define L OPERAND_LABEL
+
+const struct reg_inst_info reg_inst_info[] = {
+    {"HALT",   0, {R}},
+    {"NOP",    0, {R}},
+    {"LI",     2, {R, N}},
+    {"MOV",    2, {R, R}},
+    {"ADD",    3, {R, R, R}},
+    {"SUB",    3, {R, R, R}},
+    {"MUL",    3, {R, R, R}},
+    {"DIV",    3, {R, R, R}},
+    {"EQ",     3, {R, R, R}},
+    {"NE",     3, {R, R, R}},
+    {"LT",     3, {R, R, R}},
+    {"GT",     3, {R, R, R}},
+    {"LE",     3, {R, R, R}},
+    {"GE",     3, {R, R, R}},
+    {"NOT",    2, {R, R}},
+    {"LD",     2, {R, S}},
+    {"ST",     2, {R, S}},
+    {"LDX",    3, {R, R, S}},
+    {"STX",    3, {R, R, S}},
+    {"FILL",   2, {S, N}},
+    {"COPY",   3, {S, S, N}},
+    {"ACMP",   4, {R, S, S, N}},
+    {"J",      1, {L}},
+    {"BZ",     2, {R, L}},
+    {"BNZ",    2, {R, L}},
+    {"BEQ",    3, {R, R, L}},
+    {"BNE",    3, {R, R, L}},
+    {"BLT",    3, {R, R, L}},
+    {"BGT",    3, {R, R, L}},
+    {"BLE",    3, {R, R, L}},
+    {"BGE",    3, {R, R, L}},
+    {"CALL",   1, {L}},
+    {"TCALL",  1, {L}},
+    {"RET",    0, {R}},
+    {"PUSH",   1, {R}},
+    {"POP",    1, {R}},
+    {"PRINTS", 1, {L}},
+    {"DATA",   1, {N}},
+    {"JTAB",   2, {R, N}}
+};
+
+#undef R
+#undef N
+#undef S
+#undef L
+
+const int num_reg_opcodes = sizeof(reg_inst_info) / sizeof(reg_inst_info[0]);
+
+struct regvm {
+    /* program[0] is RHALT, code is loaded at address 1 */
+    int *program;
+    size_t program_len;
+
+    int registers[REGVM_REGISTERS];
+
+    /* values left behind by the program, stack[0] is never pushed */
+    int *stack;
+    int *call_stack;
+    int *storage;
+
+    int pc;
+    int sp;
+    int cp;
+
+    unsigned long instruction_count;
+    const char *error;
+};
+
+/* assembler */
+
+struct words {
+    int *words;
+    size_t len;
+    size_t capacity;
+};
+
+struct fixup {
+    size_t at;     /* index of the operand word in code */
+    char *label;
+    int line;
+};
+
+struct assembler {
+    struct words code;
+    struct words data;
+    struct BST *code_labels;  /* label -> address */
+    struct BST *data_labels;  /* label -> offset into data */
+    struct fixup *fixups;
+    size_t num_fixups;
+    size_t fixups_capacity;
+    const char *source_name;
+    int line;
+    int in_data;
+};
+
+static void append(struct words *words, int word) {
+    if (words->len == words->capacity) {
+        words->capacity = words->capacity ? words->capacity * 2 : 64;
+        words->words = realloc(words->words, words->capacity * sizeof(int));
+        if (words->words == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    words->words[words->len++] = word;
+}
+
+static void syntax_error(const struct assembler *as, const char *message,
+                         const char *token) {
+    fprintf(stderr, "%s:%d: %s%s%s\n", as->source_name, as->line, message,
+            token != NULL ? ": " : "", token != NULL ? token : "");
+    exit(EXIT_FAILURE);
+}
+
+static void define_label(struct assembler *as, char *name) {
+    if (bst_find(as->code_labels, name) != NULL ||
+        bst_find(as->data_labels, name) != NULL) {
+        syntax_error(as, "label defined twice", name);
+    }
+    if (as->in_data) {
+        as->data_labels = bst_insert(as->data_labels, make_str(name),
+                                     (int)as->data.len);
+    } else {
+        as->code_labels = bst_insert(as->code_labels, make_str(name),
+                                     (int)as->code.len + 1);
+    }
+}
+
+static void add_fixup(struct assembler *as, const char *label) {
+    if (as->num_fixups == as->fixups_capacity) {
+        as->fixups_capacity = as->fixups_capacity ?
+                              as->fixups_capacity * 2 : 64;
+        as->fixups = realloc(as->fixups,
+                             as->fixups_capacity * sizeof(struct fixup));
+        if (as->fixups == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    as->fixups[as->num_fixups].at = as->code.len;
+    as->fixups[as->num_fixups].label = make_str(label);
+    as->fixups[as->num_fixups].line = as->line;
+    as->num_fixups++;
+}
+
+static long parse_number(const struct assembler *as, const char *token) {
+    char *end;
+    long value = strtol(token, &end, 10);
+    if (end == token || *end != '\0' || value < INT_MIN || value > INT_MAX) {
+        syntax_error(as, "expected a number", token);
+    }
+    return value;
+}
+
+static void parse_operand(struct assembler *as, reg_operand kind,
+                          const char *token) {
+    long value;
+    switch (kind) {
+        case OPERAND_REGISTER:
+            if (token[0] != 'r') {
+                syntax_error(as, "expected a register", token);
+            }
+            value = parse_number(as, token + 1);
+            if (value < 0 || value >= REGVM_REGISTERS) {
+                syntax_error(as, "no such register", token);
+            }
+            break;
+
+        case OPERAND_SLOT:
+            value = parse_number(as, token);
+            if (value < 0 || value >= VM_STORAGE_SIZE) {
+                syntax_error(as, "storage slot out of range", token);
+            }
+            break;
+
+        case OPERAND_LABEL:
+            add_fixup(as, token);
+            value = 0;
+            break;
+
+        default:
+            value = parse_number(as, token);
+            break;
+    }
+    append(&as->code, (int)value);
+}
+
+/* same escapes as minias, str points at the opening quote */
+static void parse_string(struct assembler *as, const char *str) {
+    size_t length_at = as->data.len;
+    int len = 0;
+    if (*str != '"') {
+        syntax_error(as, ".string expects a quoted string", NULL);
+    }
+    append(&as->data, 0);
+    for (str++; *str != '"'; str++) {
+        int c = *str;
+        if (c == '\n' || c == '\0') {
+            syntax_error(as, "unterminated string", NULL);
+        }
+        if (c == '\\') {
+            str++;
+            switch (*str) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case '0': c = '\0'; break;
+                case '\\': c = '\\'; break;
+                case '"': c = '"'; break;
+                default:
+                    syntax_error(as, "unknown escape in string", NULL);
+            }
+        }
+        append(&as->data, c);
+        len++;
+    }
+    as->data.words[length_at] = len;
+}
+
+static int find_opcode(const char *name) {
+    int i;
+    for (i = 0; i < num_reg_opcodes; i++) {
+        if (strcmp(reg_inst_info[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void parse_line(struct assembler *as, char *line) {
+    const char *separators = " \t,\r";
+    char *token;
+    char *comment;
+    int opcode;
+    int i;
+
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (strncmp(line, ".string", 7) == 0) {
+        if (!as->in_data) {
+            syntax_error(as, ".string outside of .data", NULL);
+        }
+        line += 7;
+        while (*line == ' ' || *line == '\t') {
+            line++;
+        }
+        parse_string(as, line);
+        return;
+    }
+    comment = strchr(line, ';');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+
+    token = strtok(line, separators);
+    if (token != NULL && token[strlen(token) - 1] == ':') {
+        token[strlen(token) - 1] = '\0';
+        define_label(as, token);
+        token = strtok(NULL, separators);
+    }
+    if (token == NULL) {
+        return;
+    }
+    if (strcmp(token, ".data") == 0 || strcmp(token, ".text") == 0) {
+        as->in_data = token[1] == 'd';
+        return;
+    }
+    opcode = find_opcode(token);
+    if (opcode < 0 || opcode == RDATA) {
+        syntax_error(as, "unknown instruction", token);
+    }
+    if (as->in_data) {
+        syntax_error(as, "instruction in .data", token);
+    }
+    append(&as->code, opcode);
+    for (i = 0; i < reg_inst_info[opcode].num_operands; i++) {
+        char *operand = strtok(NULL, separators);
+        if (operand == NULL) {
+            syntax_error(as, "missing operand for", token);
+        }
+        parse_operand(as, reg_inst_info[opcode].operands[i], operand);
+    }
+    if (strtok(NULL, separators) != NULL) {
+        syntax_error(as, "too many operands for", token);
+    }
+}
+
+/*
+ * the data goes after the code, behind a DATA instruction that steps over
+ * it should control ever fall through
+ */
+static void resolve_labels(struct assembler *as) {
+    int data_start = (int)as->code.len + 3;
+    size_t i;
+
+    if (as->data.len > 0) {
+        append(&as->code, RDATA);
+        append(&as->code, (int)as->data.len);
+        for (i = 0; i < as->data.len; i++) {
+            append(&as->code, as->data.words[i]);
+        }
+    }
+    for (i = 0; i < as->num_fixups; i++) {
+        struct fixup *fixup = &as->fixups[i];
+        struct BST *node = bst_find(as->code_labels, fixup->label);
+        int address;
+        if (node != NULL) {
+            address = node->value;
+        } else if ((node = bst_find(as->data_labels, fixup->label)) != NULL) {
+            address = data_start + node->value;
+        } else {
+            as->line = fixup->line;
+            syntax_error(as, "undefined label", fixup->label);
+            address = 0;
+        }
+        as->code.words[fixup->at] = address;
+        free(fixup->label);
+    }
+}
+
+int *regvm_assemble(const char *source, const char *source_name,
+                    size_t *len) {
+    struct assembler as;
+    char line[MAX_LINE];
+
+    memset(&as, 0, sizeof(as));
+    as.source_name = source_name;
+    while (*source != '\0') {
+        size_t n = strcspn(source, "\n");
+        as.line++;
+        if (n >= MAX_LINE) {
+            syntax_error(&as, "line too long", NULL);
+        }
+        memcpy(line, source, n);
+        line[n] = '\0';
+        parse_line(&as, line);
+        source += n;
+        if (*source == '\n') {
+            source++;
+        }
+    }
+    resolve_labels(&as);
+
+    bst_destroy(as.code_labels);
+    bst_destroy(as.data_labels);
+    free(as.fixups);
+    free(as.data.words);
+    *len = as.code.len;
+    if (as.code.words == NULL) {
+        as.code.words = minic_malloc(sizeof(int));
+    }
+    return as.code.words;
+}
+
+/* interpreter */
+
+/*
+ * Check every instruction once so execution does not have to: operands
+ * are in bounds, registers and slots exist and jumps land on instructions.
+ */
+static int validate(const int *program, size_t len) {
+    char *is_start = calloc(len + 2, 1);
+    size_t pc = 1;
+    int valid = 1;
+
+    if (is_start == NULL) {
+        return 0;
+    }
+    is_start[0] = 1;
+    while (valid && pc <= len) {
+        int inst = program[pc];
+        const struct reg_inst_info *info;
+        int i;
+        if (inst < 0 || inst >= num_reg_opcodes ||
+            pc + reg_inst_info[inst].num_operands > len) {
+            valid = 0;
+            break;
+        }
+        is_start[pc] = 1;
+        info = &reg_inst_info[inst];
+        for (i = 0; i < info->num_operands; i++) {
+            int value = program[pc + 1 + i];
+            if ((info->operands[i] == OPERAND_REGISTER &&
+                 (value < 0 || value >= REGVM_REGISTERS)) ||
+                (info->operands[i] == OPERAND_SLOT &&
+                 (value < 0 || value >= VM_STORAGE_SIZE)) ||
+                (info->operands[i] == OPERAND_LABEL &&
+                 (value < 0 || (size_t)value > len))) {
+                valid = 0;
+            }
+        }
+        if (inst == FILL || inst == COPY || inst == ACMP) {
+            int n = program[pc + info->num_operands];
+            int first = program[pc + info->num_operands - 1];
+            int second = program[pc + info->num_operands - 2];
+            if (n < 0 || first > VM_STORAGE_SIZE - n ||
+                (inst != FILL && second > VM_STORAGE_SIZE - n)) {
+                valid = 0;
+            }
+        }
+        if (inst == RPRINTS) {
+            int address = program[pc + 1];
+            if (address < 1 || program[address] < 0 ||
+                (size_t)program[address] > len - address) {
+                valid = 0;
+            }
+        }
+        if (inst == RDATA) {
+            int n = program[pc + 1];
+            if (n < 0 || (size_t)n > len - pc - 1) {
+                valid = 0;
+                break;
+            }
+            pc += n;
+        }
+        pc += info->num_operands + 1;
+    }
+    /* the targets of jumps and calls, PRINTS points at data instead */
+    for (pc = 1; valid && pc <= len; pc++) {
+        int inst = program[pc];
+        const struct reg_inst_info *info;
+        if (!is_start[pc]) {
+            continue;
+        }
+        info = &reg_inst_info[inst];
+        if (inst != RPRINTS &&
+            info->num_operands > 0 &&
+            info->operands[info->num_operands - 1] == OPERAND_LABEL &&
+            !is_start[program[pc + info->num_operands]]) {
+            valid = 0;
+        }
+        /* a table is followed by its jumps */
+        if (inst == RJTAB) {
+            int n = program[pc + 2];
+            int k;
+            if (n < 0 || (size_t)n > (len - pc) / 2) {
+                valid = 0;
+            }
+            for (k = 0; valid && k <= n; k++) {
+                size_t entry = pc + 3 + 2 * k;
+                if (entry > len || !is_start[entry] || program[entry] != RJ) {
+                    valid = 0;
+                }
+            }
+        }
+    }
+    free(is_start);
+    return valid;
+}
+
+struct regvm *regvm_new(const int *code, size_t len) {
+    struct regvm *vm = calloc(1, sizeof(struct regvm));
+    if (vm == NULL) {
+        return NULL;
+    }
+    vm->program = malloc((len + 1) * sizeof(int));
+    vm->stack = malloc(VM_STACK_SIZE * sizeof(int));
+    vm->call_stack = malloc(VM_CALL_STACK_SIZE * sizeof(int));
+    vm->storage = malloc(VM_STORAGE_SIZE * sizeof(int));
+    if (vm->program == NULL || vm->stack == NULL || vm->call_stack == NULL ||
+        vm->storage == NULL) {
+        regvm_destroy(vm);
+        return NULL;
+    }
+    vm->program[0] = RHALT;
+    if (len > 0) {
+        memcpy(vm->program + 1, code, len * sizeof(int));
+    }
+    vm->program_len = len;
+    if (!validate(vm->program, len)) {
+        regvm_destroy(vm);
+        return NULL;
+    }
+    regvm_reset(vm);
+    return vm;
+}
+
+void regvm_destroy(struct regvm *vm) {
+    if (vm == NULL) {
+        return;
+    }
+    free(vm->program);
+    free(vm->stack);
+    free(vm->call_stack);
+    free(vm->storage);
+    free(vm);
+}
+
+void regvm_reset(struct regvm *vm) {
+    memset(vm->registers, 0, sizeof(vm->registers));
+    memset(vm->stack, 0, VM_STACK_SIZE * sizeof(int));
+    memset(vm->storage, 0, VM_STORAGE_SIZE * sizeof(int));
+    vm->pc = 1;
+    vm->sp = 0;
+
+    /* returning from the outermost call goes to address 0, RHALT */
+    vm->call_stack[0] = 0;
+    vm->cp = 1;
+
+    vm->instruction_count = 0;
+    vm->error = NULL;
+}
+
+static int fail(struct regvm *vm, const char *message) {
+    vm->error = message;
+    return -1;
+}
+
+/* 1 to go on, 0 on RHALT, -1 on an error */
+static int execute(struct regvm *vm) {
+    int *program = vm->program;
+    int *r = vm->registers;
+    int *op;
+    int inst;
+
+    if ((size_t)vm->pc > vm->program_len) {
+        return fail(vm, "PC out of bounds");
+    }
+    inst = program[vm->pc];
+    op = program + vm->pc + 1;
+
+    switch (inst) {
+
+        case RHALT:
+            return 0;
+
+        case RNOP:
+            break;
+
+        case LI:
+            r[op[0]] = op[1];
+            break;
+
+        case MOV:
+            r[op[0]] = r[op[1]];
+            break;
+
+        case RADD:
+            r[op[0]] = r[op[1]] + r[op[2]];
+            break;
+
+        case RSUB:
+            r[op[0]] = r[op[1]] - r[op[2]];
+            break;
+
+        case RMUL:
+            r[op[0]] = r[op[1]] * r[op[2]];
+            break;
+
+        case RDIV:
+            if (r[op[2]] == 0) {
+                return fail(vm, "division by zero");
+            }
+            r[op[0]] = r[op[1]] / r[op[2]];
+            break;
+
+        case REQ:
+            r[op[0]] = r[op[1]] == r[op[2]];
+            break;
+
+        case RNE:
+            r[op[0]] = r[op[1]] != r[op[2]];
+            break;
+
+        case RLT:
+            r[op[0]] = r[op[1]] < r[op[2]];
+            break;
+
+        case RGT:
+            r[op[0]] = r[op[1]] > r[op[2]];
+            break;
+
+        case RLE:
+            r[op[0]] = r[op[1]] <= r[op[2]];
+            break;
+
+        case RGE:
+            r[op[0]] = r[op[1]] >= r[op[2]];
+            break;
+
+        case RNOT:
+            r[op[0]] = !r[op[1]];
+            break;
+
+        case LD:
+            r[op[0]] = vm->storage[op[1]];
+            break;
+
+        case ST:
+            vm->storage[op[1]] = r[op[0]];
+            break;
+
+        case LDX:
+        case STX:
+            {
+            int address = op[2] + r[op[1]];
+            if (r[op[1]] < 0 || r[op[1]] >= VM_STORAGE_SIZE - op[2]) {
+                return fail(vm, "storage address out of bounds");
+            }
+            if (inst == LDX) {
+                r[op[0]] = vm->storage[address];
+            } else {
+                vm->storage[address] = r[op[0]];
+            }
+            }
+            break;
+
+        case FILL:
+            memset(vm->storage + op[0], 0, op[1] * sizeof(int));
+            break;
+
+        case COPY:
+            memmove(vm->storage + op[0], vm->storage + op[1],
+                    op[2] * sizeof(int));
+            break;
+
+        /* 0 when equal, else the sign of the first difference, like BCMP */
+        case ACMP:
+            {
+            const int *a = vm->storage + op[1];
+            const int *b = vm->storage + op[2];
+            int i;
+            for (i = 0; i < op[3] && a[i] == b[i]; i++) {
+            }
+            r[op[0]] = i == op[3] ? 0 : a[i] < b[i] ? -1 : 1;
+            }
+            break;
+
+        case RJ:
+            vm->pc = op[0];
+            return 1;
+
+        case RJTAB:
+            {
+            int i = r[op[0]];
+            vm->pc += 3 + 2 * (i >= 0 && i < op[1] ? i : op[1]);
+            }
+            return 1;
+
+        case BZ:
+            vm->pc = r[op[0]] == 0 ? op[1] : vm->pc + 3;
+            return 1;
+
+        case BNZ:
+            vm->pc = r[op[0]] != 0 ? op[1] : vm->pc + 3;
+            return 1;
+
+        case BEQ:
+            vm->pc = r[op[0]] == r[op[1]] ? op[2] : vm->pc + 4;
+            return 1;
+
+        case BNE:
+            vm->pc = r[op[0]] != r[op[1]] ? op[2] : vm->pc + 4;
+            return 1;
+
+        case BLT:
+            vm->pc = r[op[0]] < r[op[1]] ? op[2] : vm->pc + 4;
+            return 1;
+
+        case BGT:
+            vm->pc = r[op[0]] > r[op[1]] ? op[2] : vm->pc + 4;
+            return 1;
+
+        case BLE:
+            vm->pc = r[op[0]] <= r[op[1]] ? op[2] : vm->pc + 4;
+            return 1;
+
+        case BGE:
+            vm->pc = r[op[0]] >= r[op[1]] ? op[2] : vm->pc + 4;
+            return 1;
+
+        case RCALL:
+            if (vm->cp >= VM_CALL_STACK_SIZE) {
+                return fail(vm, "call stack overflow");
+            }
+            vm->call_stack[vm->cp++] = vm->pc + 2;
+            vm->pc = op[0];
+            return 1;
+
+        /* the callee returns directly to our caller */
+        case RTCALL:
+            vm->pc = op[0];
+            return 1;
+
+        case RRET:
+            if (vm->cp <= 0) {
+                return fail(vm, "call stack underflow");
+            }
+            vm->pc = vm->call_stack[--vm->cp];
+            return 1;
+
+        case RPUSH:
+            if (vm->sp + 1 >= VM_STACK_SIZE) {
+                return fail(vm, "SP out of bounds");
+            }
+            vm->stack[++vm->sp] = r[op[0]];
+            break;
+
+        case RPOP:
+            if (vm->sp <= 0) {
+                return fail(vm, "SP less than zero");
+            }
+            r[op[0]] = vm->stack[vm->sp--];
+            break;
+
+        /* a length and then one character per word, checked when loaded */
+        case RPRINTS:
+            {
+            const int *str = program + op[0];
+            int i;
+            for (i = 1; i <= str[0]; i++) {
+                putchar(str[i]);
+            }
+            }
+            break;
+
+        /* only reached by falling off the code, step over the data */
+        case RDATA:
+            vm->pc += op[0] + 2;
+            return 1;
+
+        default:
+            return fail(vm, "unknown instruction");
+    }
+    vm->pc += reg_inst_info[inst].num_operands + 1;
+    return 1;
+}
+
+vm_status regvm_run(struct regvm *vm) {
+    for (;;) {
+        int result = execute(vm);
+        if (result <= 0) {
+            return result == 0 ? VM_HALTED : VM_ERROR;
+        }
+        vm->instruction_count++;
+    }
+}
+
+const char *regvm_error(const struct regvm *vm) {
+    return vm->error;
+}
+
+unsigned long regvm_instruction_count(const struct regvm *vm) {
+    return vm->instruction_count;
+}
+
+int regvm_register(const struct regvm *vm, int reg) {
+    return reg >= 0 && reg < REGVM_REGISTERS ? vm->registers[reg] : 0;
+}
+
+int regvm_sp(const struct regvm *vm) {
+    return vm->sp;
+}
+
+int regvm_stack_at(const struct regvm *vm, int index) {
+    return index >= 0 && index < VM_STACK_SIZE ? vm->stack[index] : 0;
+}
+
+void regvm_print_stack(const struct regvm *vm, FILE *out) {
+    int i;
+    fprintf(out, "*** PRINTING STACK ***\n");
+    fprintf(out, "SP: %d\n", vm->sp);
+    fprintf(out, "PC: %d\n", vm->pc);
+    for (i = 0; i <= vm->sp; ++i) {
+        if (i == vm->sp) {
+            fprintf(out, "%2d: %d*\n", i, vm->stack[i]);
+        } else {
+            fprintf(out, "%2d: %d\n", i, vm->stack[i]);
+        }
+    }
+    fprintf(out, "*** DONE PRINTING ***\n");
+}
@@ -0,0 +1,163 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: regvm.h
+ */
+
+/*
+ * The register machine, a second target for minic --registers
+ *
+ * Instructions name their operands instead of finding them on the stack,
+ * ADD r1, r2, r3 is r1 = r2 + r3. Operands are registers r0 to r255,
+ * numbers, storage slots and labels. A program is words like a stack
+ * machine image, the opcode then one word per operand, loaded at address
+ * 1 with RHALT at address 0.
+ *
+ * The stack is still there for values a program leaves behind, PUSH and
+ * POP move them between it and the registers, and it is printed when the
+ * machine halts just like stackmachine does. Storage holds arrays and
+ * whatever does not fit in registers.
+ *
+ *     LI rd, N            rd = N
+ *     MOV rd, ra          rd = ra
+ *     ADD rd, ra, rb      rd = ra + rb, and SUB MUL DIV
+ *     EQ rd, ra, rb       rd = ra == rb ? 1 : 0, and NE LT GT LE GE
+ *     NOT rd, ra          rd = !ra
+ *     LD rd, SLOT         rd = storage[SLOT]
+ *     ST ra, SLOT         storage[SLOT] = ra
+ *     LDX rd, ri, SLOT    rd = storage[SLOT + ri]
+ *     STX ra, ri, SLOT    storage[SLOT + ri] = ra
+ *     FILL SLOT, N        zero N slots
+ *     COPY DST, SRC, N    copy N slots
+ *     ACMP rd, A, B, N    rd = 0 if N slots at A and B are equal, like BCMP
+ *     J LABEL
+ *     BZ ra, LABEL        branch if ra == 0, BNZ if not
+ *     BEQ ra, rb, LABEL   branch if ra == rb, and BNE BLT BGT BLE BGE
+ *     JTAB ri, N          to the ri-th of the N + 1 J that follow, the last
+ *                         one when ri is not in 0..N-1
+ *     CALL LABEL, TCALL LABEL, RET
+ *     PUSH ra, POP rd
+ *     PRINTS LABEL        print a .string
+ *     RHALT
+ *
+ * The assembly syntax is the same as minias otherwise: labels end in a
+ * colon, ';' starts a comment, strings go in .data with .string.
+ */
+
+#ifndef REGVM_H
+#define REGVM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+#define REGVM_REGISTERS 256
+
+typedef enum {
+    RHALT,
+    RNOP,
+    LI,
+    MOV,
+    RADD,
+    RSUB,
+    RMUL,
+    RDIV,
+    REQ,
+    RNE,
+    RLT,
+    RGT,
+    RLE,
+    RGE,
+    RNOT,
+    LD,
+    ST,
+    LDX,
+    STX,
+    FILL,
+    COPY,
+    ACMP,
+    RJ,
+    BZ,
+    BNZ,
+    BEQ,
+    BNE,
+    BLT,
+    BGT,
+    BLE,
+    BGE,
+    RCALL,
+    RTCALL,
+    RRET,
+    RPUSH,
+    RPOP,
+    RPRINTS,
+    RDATA,
+    RJTAB
+} reg_inst_t;
+
+/* what each operand of an instruction is */
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_NUMBER,
+    OPERAND_SLOT,
+    OPERAND_LABEL
+} reg_operand;
+
+#define REGVM_MAX_OPERANDS 4
+
+struct reg_inst_info {
+    const char *name;
+    int num_operands;
+    reg_operand operands[REGVM_MAX_OPERANDS];
+};
+
+extern const struct reg_inst_info reg_inst_info[];
+extern const int num_reg_opcodes;
+
+struct regvm;
+
+/*
+ * Assemble register machine source into a newly allocated image of *len
+ * words, exits with a message naming source_name on errors.
+ */
+int *regvm_assemble(const char *source, const char *source_name, size_t *len);
+
+/*
+ * copies len words of code, code[0] is loaded at address 1, NULL if the
+ * code is malformed: unknown opcodes, registers, slots or jump targets
+ */
+struct regvm *regvm_new(const int *code, size_t len);
+void regvm_destroy(struct regvm *vm);
+
+/* clear registers, stack and storage, keeping the program */
+void regvm_reset(struct regvm *vm);
+
+/* run until RHALT or an error, VM_HALTED or VM_ERROR */
+vm_status regvm_run(struct regvm *vm);
+
+const char *regvm_error(const struct regvm *vm);
+unsigned long regvm_instruction_count(const struct regvm *vm);
+int regvm_register(const struct regvm *vm, int reg);
+int regvm_sp(const struct regvm *vm);
+int regvm_stack_at(const struct regvm *vm, int index);
+
+/* the stack dump, in the format of vm_print_stack */
+void regvm_print_stack(const struct regvm *vm, FILE *out);
+
+#endif /* REGVM_H */
@@ -0,0 +1,487 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: server.c
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "minic.h"
+#include "bst.h"
+#include "util.h"
+#include "server.h"
+
+#define MAX_REQUEST_LINE  (PATH_MAX + 16)
+#define LATENCY_SAMPLES   4096
+
+/* the code for one top level statement or function */
+struct cached_unit {
+    unsigned long key;  /* ast_hash of the statement or function */
+    char *name;         /* function name, NULL for a top level statement */
+    CodegenUnit code;
+    bool reused;        /* taken by the compile in progress */
+};
+
+struct cached_file {
+    char *path;
+    unsigned long source_hash;
+    size_t source_len;
+    ASTNode *tree;
+    char *output;
+    struct cached_unit *units;
+    int num_units;
+};
+
+struct request_stats {
+    int reused;
+    int regenerated;
+    double parse_time;
+    double codegen_time;
+};
+
+static struct BST *file_index = NULL; /* path -> index into files */
+static struct cached_file *files = NULL;
+static int num_files = 0;
+
+static unsigned long latencies[LATENCY_SAMPLES]; /* microseconds */
+static unsigned long num_requests = 0;
+static unsigned long num_cached = 0;
+static char error_line[PATH_MAX + 128];
+
+
+static unsigned long hash_source(const char *source, size_t len) {
+    unsigned long hash = 0xcbf29ce484222325UL;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)source[i];
+        hash *= 0x100000001b3UL;
+    }
+    return hash;
+}
+
+
+/* like read_file, but a missing file fails the request, not the server */
+static char *load_source(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    char *source;
+    long size;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0) {
+        fclose(file);
+        return NULL;
+    }
+    rewind(file);
+    source = minic_malloc(size + 1);
+    *len = fread(source, 1, size, file);
+    source[*len] = '\0';
+    fclose(file);
+    return source;
+}
+
+
+static struct cached_file *find_file(char *path) {
+    struct BST *node = bst_find(file_index, path);
+    struct cached_file *file;
+    if (node != NULL) {
+        return &files[node->value];
+    }
+
+    files = realloc(files, (num_files + 1) * sizeof(*files));
+    if (files == NULL) {
+        fprintf(stderr, "%s\n", "failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+    file = &files[num_files];
+    memset(file, 0, sizeof(*file));
+    file->path = make_str(path);
+    file_index = bst_insert(file_index, make_str(path), num_files);
+    num_files++;
+    return file;
+}
+
+
+static void free_unit(struct cached_unit *unit) {
+    free(unit->name);
+    codegen_unit_free(&unit->code);
+}
+
+
+static bool reusable(const struct cached_unit *unit, unsigned long key) {
+    return unit->key == key &&
+           !unit->reused &&
+           codegen_unit_valid(&unit->code);
+}
+
+
+/* old code for the same AST that is still valid in the current state */
+static struct cached_unit *find_unit(struct cached_file *file,
+                                     int hint,
+                                     unsigned long key) {
+    int i;
+    if (hint < file->num_units && reusable(&file->units[hint], key)) {
+        return &file->units[hint];
+    }
+    for (i = 0; i < file->num_units; i++) {
+        if (reusable(&file->units[i], key)) {
+            return &file->units[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * regenerate the units of tree that changed and link the program, the
+ * cache is only replaced when the whole file compiles
+ */
+static char *codegen_file(struct cached_file *file,
+                          ASTNode *tree,
+                          struct request_stats *stats) {
+    struct cached_unit *units;
+    char **statements;
+    char **functions;
+    char **names;
+    int num_statements = 0;
+    int num_functions = 0;
+    int num_units = 0;
+    int i;
+    char *output;
+    ASTNode *node;
+
+    for (node = tree; node != NULL; node = node->sibling) {
+        num_units++;
+    }
+    units = minic_malloc((num_units + 1) * sizeof(*units));
+    statements = minic_malloc((num_units + 1) * sizeof(char *));
+    functions = minic_malloc((num_units + 1) * sizeof(char *));
+    names = minic_malloc((num_units + 1) * sizeof(char *));
+
+    codegen_reset();
+    for (i = 0, node = tree; node != NULL; i++, node = node->sibling) {
+        struct cached_unit *unit = &units[i];
+        struct cached_unit *old;
+
+        unit->key = ast_hash(node);
+        old = find_unit(file, i, unit->key);
+        if (old != NULL) {
+            /* shared with the old cache until the compile succeeds */
+            *unit = *old;
+            unit->reused = true;
+            old->reused = true;
+            codegen_replay(&unit->code);
+            stats->reused++;
+        } else {
+            if (!codegen_unit(node, &unit->code)) {
+                sprintf(error_line, "error %s\n", codegen_error());
+                break;
+            }
+            unit->name = node->kind == FUNC_DEF ?
+                make_str(node->obj->value.symbol) : NULL;
+            unit->reused = false;
+            stats->regenerated++;
+        }
+
+        if (unit->name != NULL) {
+            functions[num_functions] = unit->code.code;
+            names[num_functions] = unit->name;
+            num_functions++;
+        } else {
+            statements[num_statements++] = unit->code.code;
+        }
+    }
+
+    if (node != NULL) {
+        /* failed, keep the old cache as it was */
+        int failed = i;
+        for (i = 0; i < failed; i++) {
+            if (!units[i].reused) {
+                free_unit(&units[i]);
+            }
+        }
+        for (i = 0; i < file->num_units; i++) {
+            file->units[i].reused = false;
+        }
+        output = NULL;
+    } else {
+        output = codegen_link(statements, num_statements,
+                              functions, names, num_functions);
+        for (i = 0; i < file->num_units; i++) {
+            if (!file->units[i].reused) {
+                free_unit(&file->units[i]);
+            }
+        }
+        for (i = 0; i < num_units; i++) {
+            units[i].reused = false;
+        }
+        free(file->units);
+        file->units = units;
+        file->num_units = num_units;
+        units = NULL;
+    }
+    free(units);
+    free(statements);
+    free(functions);
+    free(names);
+    return output;
+}
+
+
+/* returns the assembly for path, or NULL with error_line set */
+static const char *compile(char *path, struct request_stats *stats) {
+    char resolved[PATH_MAX];
+    struct cached_file *file;
+    char *source;
+    char *output;
+    size_t len = 0;
+    unsigned long hash;
+    double start;
+    FILE *in;
+    ASTNode *tree;
+
+    if (realpath(path, resolved) == NULL ||
+        (source = load_source(resolved, &len)) == NULL) {
+        sprintf(error_line, "error no such file: %.*s\n", PATH_MAX, path);
+        return NULL;
+    }
+
+    file = find_file(resolved);
+    hash = hash_source(source, len);
+    if (file->output != NULL &&
+        file->source_hash == hash &&
+        file->source_len == len) {
+        free(source);
+        num_cached++;
+        stats->reused = file->num_units;
+        return file->output;
+    }
+
+    start = get_time();
+    in = fmemopen(source, len, "r");
+    if (in == NULL) {
+        free(source);
+        sprintf(error_line, "error %s\n", "failed to open source");
+        return NULL;
+    }
+    tree = parse(in);
+    fclose(in);
+    free(source);
+    stats->parse_time = get_time() - start;
+    if (tree == NULL) {
+        sprintf(error_line, "error failed to parse %.*s\n", PATH_MAX, path);
+        return NULL;
+    }
+
+    start = get_time();
+    output = codegen_file(file, tree, stats);
+    stats->codegen_time = get_time() - start;
+    if (output == NULL) {
+        destroy_ast_node(tree);
+        return NULL;
+    }
+
+    destroy_ast_node(file->tree);
+    free(file->output);
+    file->tree = tree;
+    file->output = output;
+    file->source_hash = hash;
+    file->source_len = len;
+    return output;
+}
+
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = write(fd, data, len);
+        if (sent <= 0) {
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+
+static unsigned long to_us(double seconds) {
+    return (unsigned long)(seconds * 1e6 + 0.5);
+}
+
+
+static void record_latency(double seconds) {
+    latencies[num_requests % LATENCY_SAMPLES] = to_us(seconds);
+    num_requests++;
+}
+
+
+static int compare_ulong(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a;
+    unsigned long y = *(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* percentiles over the last LATENCY_SAMPLES compile requests */
+static void format_stats(char *line) {
+    static unsigned long sorted[LATENCY_SAMPLES];
+    size_t n = num_requests < LATENCY_SAMPLES ?
+        num_requests : LATENCY_SAMPLES;
+    unsigned long p50 = 0;
+    unsigned long p95 = 0;
+    unsigned long max = 0;
+
+    if (n > 0) {
+        memcpy(sorted, latencies, n * sizeof(*sorted));
+        qsort(sorted, n, sizeof(*sorted), compare_ulong);
+        p50 = sorted[(n - 1) / 2];
+        p95 = sorted[(n - 1) * 95 / 100];
+        max = sorted[n - 1];
+    }
+    sprintf(line, "ok requests %lu cached %lu p50_us %lu p95_us %lu "
+            "max_us %lu\n", num_requests, num_cached, p50, p95, max);
+}
+
+
+/* returns false once a shutdown was requested */
+static bool serve_connection(int fd) {
+    char request[MAX_REQUEST_LINE];
+    char header[256];
+    FILE *in = fdopen(fd, "r");
+
+    if (in == NULL) {
+        close(fd);
+        return true;
+    }
+    while (fgets(request, sizeof(request), in) != NULL) {
+        request[strcspn(request, "\r\n")] = '\0';
+
+        if (strncmp(request, "compile ", 8) == 0) {
+            struct request_stats stats = {0, 0, 0.0, 0.0};
+            double start = get_time();
+            const char *output = compile(request + 8, &stats);
+            double total = get_time() - start;
+
+            record_latency(total);
+            if (output == NULL) {
+                send_all(fd, error_line, strlen(error_line));
+                continue;
+            }
+            sprintf(header, "ok %lu reused %d regenerated %d parse_us %lu "
+                    "codegen_us %lu total_us %lu\n",
+                    (unsigned long)strlen(output),
+                    stats.reused,
+                    stats.regenerated,
+                    to_us(stats.parse_time),
+                    to_us(stats.codegen_time),
+                    to_us(total));
+            if (send_all(fd, header, strlen(header)) != 0 ||
+                send_all(fd, output, strlen(output)) != 0) {
+                break;
+            }
+        } else if (strcmp(request, "stats") == 0) {
+            format_stats(header);
+            send_all(fd, header, strlen(header));
+        } else if (strcmp(request, "shutdown") == 0) {
+            send_all(fd, "ok\n", 3);
+            fclose(in);
+            return false;
+        } else {
+            const char *message = "error unknown request\n";
+            send_all(fd, message, strlen(message));
+        }
+    }
+    fclose(in);
+    return true;
+}
+
+
+static void free_cache(void) {
+    int i;
+    int j;
+    for (i = 0; i < num_files; i++) {
+        for (j = 0; j < files[i].num_units; j++) {
+            free_unit(&files[i].units[j]);
+        }
+        free(files[i].units);
+        free(files[i].output);
+        free(files[i].path);
+        destroy_ast_node(files[i].tree);
+    }
+    free(files);
+    bst_destroy(file_index);
+    files = NULL;
+    file_index = NULL;
+    num_files = 0;
+}
+
+
+int compile_server(const char *socket_path) {
+    struct sockaddr_un address;
+    bool running = true;
+    int listener;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+
+    /* a client hanging up must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, 16) != 0) {
+        perror(socket_path);
+        close(listener);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "minic: serving on %s\n", socket_path);
+
+    while (running) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            perror("accept");
+            continue;
+        }
+        running = serve_connection(fd);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    free_cache();
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: server.h
+ */
+
+/*
+ * minic --server: a compile server on a Unix socket.
+ *
+ * Parsed trees and the code for every top level statement and function are
+ * kept per file. A request only re-parses a file whose contents changed,
+ * and only regenerates the units whose AST or code generator state changed,
+ * splicing them into the cached output.
+ *
+ * The protocol is line based, a connection may send any number of requests:
+ *
+ *     compile PATH
+ *         ok BYTES reused N regenerated N parse_us N codegen_us N total_us N
+ *         followed by BYTES bytes of assembly, the same emit() writes
+ *     stats
+ *         ok requests N cached N p50_us N p95_us N max_us N
+ *     shutdown
+ *         ok
+ *
+ * Failures are answered with a single "error MESSAGE" line.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/* serve until a shutdown request, returns the exit code for main */
+int compile_server(const char *socket_path);
+
+#endif /* SERVER_H */
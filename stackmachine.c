@@ -19,114 +19,146 @@
  * File: stackmachine.c
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-
-#include "instructions.h"
-
-#define STACK_SIZE                 2000
-#define PROG_SIZE                  2000
-#define CALL_STACK_SIZE             500
-#define STORAGE_SIZE                500
-
-/* Code section */
-static int *program;
-
-/* execution stack */
-static int stack[STACK_SIZE];
-
-/* accessed with instructions SAVE and LOAD */
-static int storage[STORAGE_SIZE];
-
-/* Save return address here */
-static int call_stack[CALL_STACK_SIZE];
-
-/* Registers */
-static int pc = 1; /* Program Counter */
+/*
+ * stackmachine: command line front end for libminivm (vm.c)
+ */
 
-static int sp = 0; /* Stack Pointer */
+#define _POSIX_C_SOURCE 200112L
 
-static int cp = 0; /* Call Pointer
-               Return address returns address after jump instructions */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/* Stack Register Save Register used for saving data to the stack */
+#include "vm.h"
+#include "perf.h"
+#include "util.h"
+#include "encoding.h"
 
-#ifdef DEBUG
-static void print_call_stack() {
-    int i;
-    printf("CP = %d\n", cp);
-    for (i = 0; i <= cp; ++i) {
-        printf("CALL STACK[%d] = %d\n", i, call_stack[i]);
+/*
+ * Profiling, enabled with --profile. The VM counts per instruction address,
+ * here the counts are written out keyed by label (from the map written by
+ * minias -m) so that minic can read them back.
+ */
+struct symbol {
+    char *name;
+    int address;
+};
+
+static struct symbol *symbols = NULL;
+static int num_symbols = 0;
+
+static int compare_symbols(const void *a, const void *b) {
+    const struct symbol *x = a;
+    const struct symbol *y = b;
+    if (x->address != y->address) {
+        return x->address - y->address;
     }
+    return strcmp(x->name, y->name);
 }
-#endif
 
-static void set_call_stack() {
-    call_stack[cp] = pc + 2;
-    cp++;
+static void load_symbols(char *map_filename) {
+    FILE *fp;
+    char name[256];
+    int address;
+    int capacity = 16;
+
+    fp = fopen(map_filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr,
+                "warning: no label map %s, profile is keyed by address\n",
+                map_filename);
+        return;
+    }
+    symbols = malloc(capacity * sizeof(struct symbol));
+    while (fscanf(fp, "%255s %d", name, &address) == 2) {
+        if (num_symbols == capacity) {
+            capacity *= 2;
+            symbols = realloc(symbols, capacity * sizeof(struct symbol));
+        }
+        symbols[num_symbols].name = malloc(strlen(name) + 1);
+        strcpy(symbols[num_symbols].name, name);
+        symbols[num_symbols].address = address;
+        num_symbols++;
+    }
+    fclose(fp);
+    qsort(symbols, num_symbols, sizeof(struct symbol), compare_symbols);
 }
 
-static void print_stack() {
+/*
+ * name an address as LABEL if a label is there, or LABEL+OFFSET from the
+ * closest label before it, so keys survive code being added elsewhere
+ */
+static void format_location(char *buff, int address) {
     int i;
-    printf("*** PRINTING STACK ***\n");
-    printf("SP: %d\n", sp);
-    printf("PC: %d\n", pc);
-    for (i = 0; i <= sp; ++i) {
-        if (i == sp) {
-            printf("%2d: %d*\n", i, stack[i]);
-        } else {
-            printf("%2d: %d\n", i, stack[i]);
+    struct symbol *closest = NULL;
+    for (i = 0; i < num_symbols && symbols[i].address <= address; i++) {
+        if (closest == NULL || symbols[i].address != closest->address) {
+            closest = &symbols[i];
         }
     }
-    printf("*** DONE PRINTING ***\n");
+    if (closest == NULL) {
+        sprintf(buff, "@%d", address);
+    } else if (closest->address == address) {
+        sprintf(buff, "%s", closest->name);
+    } else {
+        sprintf(buff, "%s+%d", closest->name, address - closest->address);
+    }
 }
 
-static int get_num_lines(char* filename) {
+/*
+ * branch KEY taken N fallthrough N to TARGET
+ *     KEY is the fall through address of the branch and TARGET where it
+ *     jumps, for minic's conditionals these are _if_N, _else_N or the
+ *     _and_M and _or_M labels between the tests of && and ||
+ * call SITE TARGET N
+ */
+static void write_profile(struct minivm *vm, char *filename) {
     FILE *fp;
-    int count = 0;
-    int c;
-    fp = fopen(filename, "r");
+    int i;
+    int num_lines = (int)vm_program_len(vm);
+    const int *program = vm_program(vm);
+    char key[300];
+    char target[300];
+
+    fp = fopen(filename, "w");
     if (fp == NULL) {
-        fprintf(stderr, "not a file: %s\n", filename);
+        fprintf(stderr, "could not open for writing: %s\n", filename);
         exit(EXIT_FAILURE);
     }
-    while ((c = fgetc(fp)) != EOF) {
-        if (c == '\n') {
-            count++;
+    for (i = 1; i <= num_lines; i++) {
+        unsigned long taken;
+        unsigned long fallthrough;
+        unsigned long calls;
+        vm_profile_counts(vm, i, &taken, &fallthrough, &calls);
+        if (taken || fallthrough) {
+            format_location(key, i + 2);
+            format_location(target, program[i+1]);
+            fprintf(fp, "branch %s taken %lu fallthrough %lu to %s\n",
+                    key, taken, fallthrough, target);
+        }
+        if (calls) {
+            format_location(key, i);
+            format_location(target, program[i+1]);
+            fprintf(fp, "call %s %s %lu\n", key, target, calls);
         }
     }
     fclose(fp);
-    return count;
 }
 
-static void load_code_from_file(int *code, char *filename) {
-    FILE *fp;
-    char buff[255];
-    int c;
-    int count = 0;
-    int i = 1;
-
-    fp = fopen(filename, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "not a file: %s\n", filename);
-    }
-
-    printf("Reading from: %s\n", filename);
-    while ((c = fgetc(fp)) != EOF) {
-        if (c == '\n') {
-            buff[count] = '\0';
-            count = 0;
-            code[i] = atoi(buff);
-            i++;
-        }
-        buff[count] = (char)c;
-        count++;
+static void free_symbols() {
+    int i;
+    for (i = 0; i < num_symbols; i++) {
+        free(symbols[i].name);
     }
-    fclose(fp);
+    free(symbols);
 }
 
 #ifdef DEBUG
-static void print_array(int* arr, int size) {
+static void print_array(const int* arr, int size) {
     int i;
     printf("[");
     for (i = 0; i < size - 1; ++i) {
@@ -136,291 +168,380 @@ static void print_array(int* arr, int size) {
 }
 #endif
 
-static int execute(int inst) {
+/* a label from the map, or a plain address */
+static int resolve_address(const char *location) {
+    char *end;
+    long address = strtol(location, &end, 10);
+    int i;
+    if (*location != '\0' && *end == '\0') {
+        return (int)address;
+    }
+    for (i = 0; i < num_symbols; i++) {
+        if (strcmp(symbols[i].name, location) == 0) {
+            return symbols[i].address;
+        }
+    }
+    fprintf(stderr, "no such label: %s\n", location);
+    exit(EXIT_FAILURE);
+}
 
-    if (pc > PROG_SIZE) {
-        fprintf(stderr, "ERROR: PC out of bounds\n");
-        print_stack();
+static void write_snapshot(struct minivm *vm, char *filename) {
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL || vm_snapshot_write(vm, fp) != 0 || fclose(fp) != 0) {
+        fprintf(stderr, "could not write snapshot: %s\n", filename);
         exit(EXIT_FAILURE);
     }
+    printf("### SNAPSHOT %s AT PC %d ###\n", filename, vm_pc(vm));
+}
 
-    if (sp > STACK_SIZE) {
-        fprintf(stderr, "ERROR: SP out of bounds\n");
-        print_stack();
+/* map the snapshot instead of reading it, restoring is then one copy */
+static struct minivm *restore_snapshot(char *filename) {
+    struct stat info;
+    struct minivm *vm;
+    void *image;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "no such file: %s\n", filename);
         exit(EXIT_FAILURE);
     }
-
-    if (sp < 0) {
-        fprintf(stderr, "ERROR: SP less than zero\n");
+    image = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "could not map snapshot: %s\n", filename);
         exit(EXIT_FAILURE);
     }
+    vm = vm_restore(image, info.st_size);
+    munmap(image, info.st_size);
+    if (vm == NULL) {
+        fprintf(stderr, "not a valid snapshot: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    return vm;
+}
 
-#ifdef DEBUG
-    printf("\nINST: %s:%d, PC: %d, SP: %d, TOP: %d\n",
-           inst_names[inst], inst, pc, sp, stack[sp]);
-#endif
-
-    switch (inst) {
+static void print_usage(char *program_name) {
+    fprintf(stderr,
+            "usage: %s [--profile OUTPUT] [--snapshot FILE] "
+            "[--snapshot-at LABEL] [--threads N] [--perf-counters] "
+            "PROGRAM.o\n"
+            "       %s [--snapshot FILE] [--threads N] --restore FILE\n"
+            "       %s --lockstep INPUTS PROGRAM.o\n"
+            "  --profile OUTPUT    write branch and call counts\n"
+            "  --snapshot FILE     where SNAPSHOT saves the VM state, "
+            "default PROGRAM.snap\n"
+            "  --snapshot-at LABEL also snapshot when LABEL (or an address) "
+            "is reached\n"
+            "  --restore FILE      resume from a snapshot\n",
+            program_name, program_name, program_name);
+    fprintf(stderr,
+            "  --threads N         threads running SPAWNed tasks, "
+            "default one per CPU\n"
+            "  --lockstep INPUTS   run once per instance in INPUTS, "
+            "many at a time\n"
+            "  --perf-counters     report hardware counters for the run\n"
+            "  --perf-sample N     also sample the pc every N cycles\n"
+            "  --trace FILE        record every instruction, see minitrace\n"
+            "  --trace-last N      keep only the last N million records\n");
+}
 
-        case NOP:
-            break;
+/*
+ * text or compact, either way the VM gets the words, which it encodes
+ * again to run, and the storage slots from the image's header or else
+ * VM_STORAGE_SIZE
+ */
+static int *read_program(char *program_filename, size_t *len, int *storage) {
+    char *text;
+    size_t size;
+    int *code;
 
-        case PUSH:
-            sp++;
-            stack[sp] = program[++pc];
-            break;
+    printf("*** LOADING ***\n");
+    printf("Reading from: %s\n", program_filename);
+    text = read_file_size(program_filename, &size);
+    code = parse_program(text, size, len, storage);
+    free(text);
+    if (code == NULL) {
+        fprintf(stderr, "not a valid program: %s\n", program_filename);
+        exit(EXIT_FAILURE);
+    }
+    if (*storage == ENCODING_NO_STORAGE) {
+        *storage = VM_STORAGE_SIZE;
+    } else if (*storage > VM_STORAGE_SIZE) {
+        fprintf(stderr, "%s: needs %d storage slots, the VM has %d\n",
+                program_filename, *storage, VM_STORAGE_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    return code;
+}
 
-        case SAVE:
-        {
-            int address = stack[sp--];
-            int value = stack[sp--];
-            storage[address] = value;
-        }
-            break;
+static struct minivm *load_program(char *program_filename) {
+    int *code;
+    size_t len;
+    int storage;
+    struct minivm *vm;
+
+    code = read_program(program_filename, &len, &storage);
+    vm = vm_new_storage(code, len, storage);
+    free(code);
+    if (vm == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return vm;
+}
 
-        case LOAD:
-        {
-            int address = stack[sp];
-            stack[sp] = storage[address];
+/*
+ * Inputs for --lockstep: the number of instances N, then columns of N
+ * numbers each, whitespace separated. The first column holds what the
+ * first READC returns in each instance, the second column the second, and
+ * so on. -1 is EOF.
+ */
+static int *read_columns(const char *filename, int *count, int *num_columns) {
+    char *text = read_file(filename);
+    char *p = text;
+    char *end;
+    int *values = NULL;
+    size_t len = 0;
+    size_t capacity = 0;
+    long value;
+
+    for (;;) {
+        value = strtol(p, &end, 10);
+        if (end == p) {
             break;
         }
-
-        case J:
-            pc = program[pc+1];
-            return 1;
-            break;
-
-        case CALL:
-            set_call_stack();
-            pc = program[pc+1];
-#ifdef DEBUG
-            printf("J target: %d\n", pc);
-#endif
-            return 1;
-            break;
-
-        case JZ:
-            if (stack[sp] == 0) {
-                pc = program[pc+1];
-#ifdef DEBUG
-                printf("JZ target: %d\n", pc);
-#endif
-                return 1;
-            } else {
-                pc++;
-            }
-#ifdef DEBUG
-            printf("JZ target: %d\n", pc);
-#endif
-            break;
-
-        case JLEZ:
-            if (stack[sp] <= 0) {
-                pc = program[pc+1];
-#ifdef DEBUG
-                printf("JLEZ target: %d\n", pc);
-                print_call_stack();
-#endif
-                return 1;
-            } else {
-                pc++;
-            }
-#ifdef DEBUG
-            printf("JLEZ target: %d\n", pc);
-#endif
-            break;
-
-
-        /* Jump if Not Zero */
-        case JNZ:
-            if (stack[sp] != 0) {
-                pc = program[pc+1];
-#ifdef DEBUG
-                printf("JNZ target: %d\n", pc);
-#endif
-                return 1;
-            } else {
-                pc++;
-            }
-#ifdef DEBUG
-            printf("JZ target: %d\n", pc);
-#endif
-            break;
-
-
-        /* Return from subroutine,
-         * Sets PC to the top address from call_stack[]
-         */
-        case RET:
-            cp--;
-            pc = call_stack[cp];
-#ifdef DEBUG
-            print_call_stack();
-            printf("PC = %d, RETURNING TO: %d\n", pc, program[pc]);
-#endif
-            return 1;
-            break;
-
-        case POPC:
-            cp--;
-            break;
-
-        case ADD:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a + b;
-            }
-            break;
-
-        case SUB:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a - b;
-            }
-            break;
-
-        case MUL:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a * b;
-            }
-            break;
-
-        case DIV:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a / b;
-            }
-            break;
-
-        case MOD:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a % b;
+        if (len == capacity) {
+            capacity = capacity * 2 + 1024;
+            values = realloc(values, capacity * sizeof(int));
+            if (values == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(EXIT_FAILURE);
             }
-            break;
-
-        case EQ:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a == b;
-            }
-            break;
+        }
+        values[len++] = (int)value;
+        p = end;
+    }
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+        p++;
+    }
+    if (*p != '\0' || len == 0 || values[0] <= 0 ||
+        (len - 1) % values[0] != 0) {
+        fprintf(stderr, "not a valid columnar input file: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    free(text);
+    *count = values[0];
+    *num_columns = (int)((len - 1) / values[0]);
+    memmove(values, values + 1, (len - 1) * sizeof(int));
+    return values;
+}
 
-        case NE:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a != b;
-            }
-            break;
+/* run every instance in lockstep, then print each one's results */
+static int run_lockstep(char *program_filename, const char *inputs_filename) {
+    struct minivm_batch *batch;
+    int *code;
+    int *columns;
+    size_t len;
+    int storage;
+    int count;
+    int num_columns;
+    int failed = 0;
+    int i;
 
-        case LT:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a < b;
-            }
-            break;
+    code = read_program(program_filename, &len, &storage);
+    columns = read_columns(inputs_filename, &count, &num_columns);
+    batch = vm_batch_new_storage(code, len, count, storage);
+    free(code);
+    if (batch == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    vm_batch_set_input(batch, columns, num_columns);
+    printf("*** DONE LOADING ***\n");
+    printf("### RUNNING %d INSTANCES ###\n", count);
+    if (vm_batch_run(batch) != 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < count; i++) {
+        size_t output_len;
+        const char *output = vm_batch_output(batch, i, &output_len);
+        printf("### INSTANCE %d ###\n", i);
+        fwrite(output, 1, output_len, stdout);
+        if (vm_batch_status(batch, i) == VM_ERROR) {
+            printf("ERROR: %s\n", vm_batch_error(batch, i));
+            failed = 1;
+        } else {
+            printf("### HALTING ###\n");
+        }
+        vm_batch_print_stack(batch, i, stdout);
+    }
+    vm_batch_destroy(batch);
+    free(columns);
+    return failed ? EXIT_FAILURE : 0;
+}
 
-        case LE:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a <= b;
-            }
-            break;
+int main(int argc, char** argv) {
+    char *program_filename = NULL;
+    char *profile_filename = NULL;
+    char *snapshot_filename = NULL;
+    char *snapshot_location = NULL;
+    char *restore_filename = NULL;
+    char *lockstep_filename = NULL;
+    int threads = 0;
+    int perf_counters = 0;
+    long perf_sample = 0;
+    struct perf_session *perf = NULL;
+    char *trace_filename = NULL;
+    unsigned long trace_last = 0;
+    struct minivm *vm;
+    vm_status status;
+    int i;
 
-        case GT:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a > b;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_filename = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_filename = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot-at") == 0 && i + 1 < argc) {
+            snapshot_location = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_filename = argv[++i];
+        } else if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) {
+            lockstep_filename = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads <= 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
             }
-            break;
-
-        case GE:
-            {
-            int a = stack[sp--];
-            int b = stack[sp];
-            stack[sp] = a >= b;
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            perf_counters = 1;
+        } else if (strcmp(argv[i], "--perf-sample") == 0 && i + 1 < argc) {
+            perf_counters = 1;
+            perf_sample = atol(argv[++i]);
+            if (perf_sample <= 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
             }
-            break;
-
-        case PRINTI:
-            printf("%d", stack[sp]);
-            break;
-
-        case PRINTC:
-            printf("%c", stack[sp]);
-            break;
-
-        case READC:
-            sp++;
-            stack[sp] = getchar();
-            /* String is done being read once RETURN is pressed */
-            if (stack[sp] == '\n') {
-                stack[sp] = '\0';
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_filename = argv[++i];
+        } else if (strcmp(argv[i], "--trace-last") == 0 && i + 1 < argc) {
+            long millions = atol(argv[++i]);
+            if (millions <= 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
             }
-            break;
-
-        case POP:
-            sp--;
-            break;
-
-        case HALT:
-            printf("### HALTING ###\n");
-            return 0;
-            break;
-
-        default:
-            fprintf(stderr, "ERROR: unknown instruction: %d\n", inst);
-            print_stack();
+            trace_last = (unsigned long)millions * 1000000UL;
+        } else if (program_filename == NULL && argv[i][0] != '-') {
+            program_filename = argv[i];
+        } else {
+            print_usage(argv[0]);
             exit(EXIT_FAILURE);
+        }
+    }
+    if ((program_filename == NULL) == (restore_filename == NULL) ||
+        (restore_filename != NULL &&
+         (profile_filename != NULL || snapshot_location != NULL))) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (lockstep_filename != NULL) {
+        if (restore_filename != NULL || profile_filename != NULL ||
+            snapshot_location != NULL || perf_counters ||
+            trace_filename != NULL) {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        return run_lockstep(program_filename, lockstep_filename);
     }
-    ++pc;
-    return 1;
-}
 
-static void loop() {
-    for (pc = 1; execute(program[pc]); ) {
+    if (restore_filename != NULL) {
+        printf("*** RESTORING ***\n");
+        printf("Restoring from: %s\n", restore_filename);
+        vm = restore_snapshot(restore_filename);
+        if (snapshot_filename == NULL) {
+            snapshot_filename = restore_filename;
+        }
+    } else {
+        vm = load_program(program_filename);
+        if (snapshot_filename == NULL) {
+            snapshot_filename = replace_extension(program_filename, ".snap");
+        } else {
+            snapshot_filename = make_str(snapshot_filename);
+        }
+    }
 #ifdef DEBUG
-        print_stack();
+    fprintf(stderr, "DEBUG MODE\n");
+    print_array(vm_program(vm), (int)vm_program_len(vm) + 1);
 #endif
-    }
-}
-
-int main(int argc, char** argv) {
 
-    int num_lines;
-    if (argc < 2) {
-        fprintf(stderr, "error: specify the file name\n");
+    if (program_filename != NULL &&
+        (profile_filename != NULL || snapshot_location != NULL ||
+         perf_sample > 0)) {
+        char *map_filename = replace_extension(program_filename, ".map");
+        load_symbols(map_filename);
+        free(map_filename);
+    }
+    vm_set_threads(vm, threads);
+    if (profile_filename != NULL && vm_profile_enable(vm) != 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (snapshot_location != NULL &&
+        vm_snapshot_at(vm, resolve_address(snapshot_location)) != 0) {
+        fprintf(stderr, "cannot snapshot at: %s\n", snapshot_location);
         exit(EXIT_FAILURE);
     }
 
-    call_stack[cp++] = 0;
-    printf("*** LOADING ***\n");
-    num_lines = get_num_lines(argv[1]);
-    program = malloc(num_lines * sizeof(int) + 1);
-    program[0] = HALT;
-
-    load_code_from_file(program, argv[1]);
-#ifdef DEBUG
-    fprintf(stderr, "DEBUG MODE\n");
-    print_array(program, num_lines);
-#endif
+    if (trace_last > 0 && trace_filename == NULL) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (trace_filename != NULL &&
+        vm_trace_open(vm, trace_filename, trace_last) != 0) {
+        fprintf(stderr, "could not open trace: %s\n", trace_filename);
+        exit(EXIT_FAILURE);
+    }
 
     printf("*** DONE LOADING ***\n");
     printf("### RUNNING ###\n");
 
-    loop();
-    print_stack();
-    free(program);
+    if (perf_counters) {
+        perf = perf_open(vm, perf_sample);
+        perf_enable(perf);
+    }
+    while ((status = vm_run(vm, 0)) == VM_SNAPSHOT) {
+        fflush(stdout);
+        write_snapshot(vm, snapshot_filename);
+    }
+    if (perf != NULL) {
+        perf_disable(perf);
+    }
+    if (status == VM_ERROR) {
+        fflush(stdout);
+        fprintf(stderr, "ERROR: %s\n", vm_error(vm));
+        vm_print_stack(vm, stdout);
+        if (perf != NULL) {
+            perf_report(perf, stdout, format_location);
+            perf_close(perf);
+        }
+        vm_destroy(vm);
+        exit(EXIT_FAILURE);
+    }
+    printf("### HALTING ###\n");
+    vm_print_stack(vm, stdout);
+    if (perf != NULL) {
+        perf_report(perf, stdout, format_location);
+        perf_close(perf);
+    }
+    if (profile_filename != NULL) {
+        write_profile(vm, profile_filename);
+    }
+    free_symbols();
+    if (restore_filename == NULL) {
+        free(snapshot_filename);
+    }
+    vm_destroy(vm);
     return 0;
 }
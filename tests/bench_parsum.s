@@ -0,0 +1,68 @@
+; parallel recursive sum of i % 7 for i in [0, 2^24), prints 50331645
+;
+;     stackmachine --threads 1 tests/bench_parsum.o
+;     stackmachine --threads 4 tests/bench_parsum.o
+
+    PUSH 0
+    PUSH 16777216
+    PUSH 2
+    SPAWN _sum
+    JOIN
+    PRINTI
+    PUSH 10
+    PRINTC
+    HALT
+
+; lo hi -> sum of [lo, hi), the left half runs as a task
+_sum:
+    PUSH 4096
+    PICK 2
+    PICK 2
+    SUB                 ; hi - lo
+    GT
+    JZ _leaf
+    POP
+    PUSH 2
+    PICK 2
+    PICK 2
+    ADD
+    DIV                 ; lo hi mid
+    PICK 2
+    PICK 1
+    PUSH 2
+    SPAWN _sum          ; lo hi mid handle
+    PICK 1
+    PICK 3
+    CALL _sum           ; lo hi mid handle right
+    PICK 1
+    JOIN
+    ADD
+    PUT 3
+    POP
+    POP
+    POP
+    RET
+
+_leaf:
+    POP
+    PUSH 0              ; lo hi sum
+_loop:
+    PICK 1
+    PICK 3
+    LT
+    JZ _done
+    POP
+    PUSH 7
+    PICK 3
+    MOD
+    ADD
+    PUSH 1
+    PICK 3
+    ADD
+    PUT 2               ; lo + 1
+    J _loop
+_done:
+    POP
+    PUT 1
+    POP
+    RET
@@ -0,0 +1,11 @@
+PRINTS _newline
+PRINTS _hello
+PRINTS _newline
+PRINTS _newline
+HALT
+
+.data
+_hello:
+    .string "hello world"  ; one PRINTS writes the whole string
+_newline:
+    .string "\n"
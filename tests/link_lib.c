@@ -0,0 +1,15 @@
+int count = 10;
+
+int bump() {
+    count = count + 1;
+    count;
+}
+
+int answer() {
+    print "the answer is\n";
+    6 * 7;
+}
+
+int unused() {
+    print "never called, minild strips this\n";
+}
@@ -0,0 +1,8 @@
+int x = 5;
+
+int main() {
+    bump();
+    bump();
+    answer();
+    x;
+}
@@ -0,0 +1,97 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: profile_test.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../profile.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+                __FILE__, __LINE__, #cond); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+#define PROFILE "tests/profile_test.prof"
+
+static void write_profile(const char *contents) {
+    FILE *fp = fopen(PROFILE, "w");
+    CHECK(fp != NULL);
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+/*
+ * stackmachine --profile for n from 0 to 99 in
+ *
+ *     if (n > 10 || n == 3) { ... } else { ... }
+ *
+ * n > 10 jumps to the if arm 89 times, the other 11 times n == 3 is
+ * tested and falls into the if arm once. The if arm ran 90 times.
+ */
+static void test_or() {
+    puts("testing arms entered from the tests of ||");
+    write_profile("call @16 main 1\n"
+                  "branch _if_0 taken 1 fallthrough 100 to _else_0\n"
+                  "branch _or_2 taken 89 fallthrough 11 to _if_1\n"
+                  "branch _if_1 taken 10 fallthrough 1 to _else_1\n"
+                  "call _end_if_1+9 step 100\n"
+                  "call main step 1\n");
+    profile_load(PROFILE);
+    CHECK(profile_loaded());
+    CHECK(!profile_prefers_else(0));
+    CHECK(!profile_prefers_else(1));
+    CHECK(profile_call_count("step") == 101);
+    profile_free();
+}
+
+/* a flipped layout, JNZ _if_N falling into _else_N, and && */
+static void test_and_flipped() {
+    puts("testing arms entered from the tests of && when flipped");
+    write_profile("branch _and_5 taken 70 fallthrough 30 to _else_4\n"
+                  "branch _else_4 taken 10 fallthrough 20 to _if_4\n");
+    profile_load(PROFILE);
+    CHECK(profile_prefers_else(4));
+    profile_free();
+}
+
+/* profiles written before branches had a target */
+static void test_no_target() {
+    puts("testing profiles without branch targets");
+    write_profile("branch _if_7 taken 8 fallthrough 2\n"
+                  "branch _else_8 taken 8 fallthrough 2\n"
+                  "branch _if_9+3 taken 8 fallthrough 2\n");
+    profile_load(PROFILE);
+    CHECK(profile_prefers_else(7));
+    CHECK(!profile_prefers_else(8));
+    CHECK(!profile_prefers_else(9));
+    profile_free();
+}
+
+int main() {
+    test_or();
+    test_and_flipped();
+    test_no_target();
+    remove(PROFILE);
+    return 0;
+}
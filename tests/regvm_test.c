@@ -0,0 +1,199 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: regvm_test.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../regvm.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+                __FILE__, __LINE__, #cond); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static struct regvm *load(const char *source) {
+    size_t len;
+    int *code = regvm_assemble(source, "regvm_test", &len);
+    struct regvm *vm = regvm_new(code, len);
+    free(code);
+    CHECK(vm != NULL);
+    return vm;
+}
+
+/* sum 1..10 with a compare-and-branch loop, then 55 * 2 through storage */
+static const char loop[] =
+    "\tLI r0, 0\n"
+    "\tLI r1, 1\n"
+    "\tLI r2, 10\n"
+    "top:\n"
+    "\tBGT r1, r2, done ; exit when the counter passes 10\n"
+    "\tADD r0, r0, r1\n"
+    "\tLI r3, 1\n"
+    "\tADD r1, r1, r3\n"
+    "\tJ top\n"
+    "done:\n"
+    "\tST r0, 7\n"
+    "\tLI r4, 2\n"
+    "\tLD r5, 7\n"
+    "\tMUL r5, r5, r4\n"
+    "\tPUSH r5\n"
+    "\tHALT\n";
+
+static void test_loop() {
+    struct regvm *vm = load(loop);
+
+    puts("testing arithmetic, branches and storage");
+    CHECK(regvm_run(vm) == VM_HALTED);
+    CHECK(regvm_register(vm, 0) == 55);
+    CHECK(regvm_sp(vm) == 1 && regvm_stack_at(vm, 1) == 110);
+    /* 3 + 10 * 5 + 1 + 5 (the final BGT and the storage block) */
+    CHECK(regvm_instruction_count(vm) == 3 + 10 * 5 + 1 + 5);
+
+    puts("testing reset and re-run");
+    regvm_reset(vm);
+    CHECK(regvm_register(vm, 0) == 0 && regvm_sp(vm) == 0);
+    CHECK(regvm_run(vm) == VM_HALTED);
+    CHECK(regvm_register(vm, 0) == 55);
+    regvm_destroy(vm);
+}
+
+/* arrays live in storage */
+static const char arrays[] =
+    "\tFILL 0, 4\n"
+    "\tLI r0, 2\n"
+    "\tLI r1, 9\n"
+    "\tSTX r1, r0, 0\n"
+    "\tCOPY 4, 0, 4\n"
+    "\tACMP r2, 0, 4, 4\n"
+    "\tLDX r3, r0, 4\n"
+    "\tLI r0, 4\n"
+    "\tLDX r4, r0, 4\n"
+    "\tHALT\n";
+
+static void test_arrays() {
+    struct regvm *vm = load(arrays);
+
+    puts("testing indexed storage, COPY and ACMP");
+    CHECK(regvm_run(vm) == VM_HALTED);
+    CHECK(regvm_register(vm, 2) == 0);
+    CHECK(regvm_register(vm, 3) == 9);
+    CHECK(regvm_register(vm, 4) == 0);
+    regvm_destroy(vm);
+}
+
+/* a tail call does not grow the call stack, RET from main halts */
+static const char calls[] =
+    "\tLI r0, 100000\n"
+    "\tCALL count\n"
+    "\tHALT\n"
+    "count:\n"
+    "\tBZ r0, out\n"
+    "\tLI r1, 1\n"
+    "\tSUB r0, r0, r1\n"
+    "\tTCALL count\n"
+    "out:\n"
+    "\tRET\n";
+
+static void test_calls() {
+    struct regvm *vm = load(calls);
+
+    puts("testing CALL, TCALL and RET");
+    CHECK(regvm_run(vm) == VM_HALTED);
+    CHECK(regvm_register(vm, 0) == 0);
+    regvm_destroy(vm);
+}
+
+/* r1 counts 0, 1, 2, 3 through a table of 3 entries, 3 takes the last J */
+static const char table[] =
+    "\tLI r0, 0\n"
+    "\tLI r1, 0\n"
+    "\tLI r2, 1\n"
+    "top:\n"
+    "\tJTAB r1, 3\n"
+    "\tJ one\n"
+    "\tJ ten\n"
+    "\tJ ten\n"
+    "\tJ done\n"
+    "one:\n"
+    "\tADD r0, r0, r2\n"
+    "\tADD r1, r1, r2\n"
+    "\tJ top\n"
+    "ten:\n"
+    "\tLI r3, 10\n"
+    "\tADD r0, r0, r3\n"
+    "\tADD r1, r1, r2\n"
+    "\tJ top\n"
+    "done:\n"
+    "\tHALT\n";
+
+static void test_jump_table() {
+    static const int short_table[] = { RJTAB, 0, 1, RJ, 6, RHALT };
+    static const int not_a_jump[] = { RJTAB, 0, 0, RHALT };
+    struct regvm *vm = load(table);
+
+    puts("testing JTAB");
+    CHECK(regvm_run(vm) == VM_HALTED);
+    CHECK(regvm_register(vm, 0) == 21);
+    regvm_destroy(vm);
+
+    CHECK(regvm_new(short_table, 6) == NULL);
+    CHECK(regvm_new(not_a_jump, 4) == NULL);
+}
+
+static void test_errors() {
+    static const int bad_register[] = { LI, REGVM_REGISTERS, 1, RHALT };
+    static const int bad_target[] = { RJ, 2, LI, 0, 1, RHALT };
+    static const int truncated[] = { RADD, 0, 1 };
+    struct regvm *vm;
+
+    puts("testing validation");
+    CHECK(regvm_new(bad_register, 4) == NULL);
+    CHECK(regvm_new(bad_target, 6) == NULL);
+    CHECK(regvm_new(truncated, 3) == NULL);
+
+    puts("testing run time errors");
+    vm = load("\tLI r0, 1\n\tLI r1, 0\n\tDIV r2, r0, r1\n\tHALT\n");
+    CHECK(regvm_run(vm) == VM_ERROR);
+    CHECK(strcmp(regvm_error(vm), "division by zero") == 0);
+    regvm_destroy(vm);
+
+    vm = load("\tLI r0, 5000\n\tLDX r1, r0, 0\n\tHALT\n");
+    CHECK(regvm_run(vm) == VM_ERROR);
+    regvm_destroy(vm);
+
+    vm = load("\tPOP r0\n\tHALT\n");
+    CHECK(regvm_run(vm) == VM_ERROR);
+    regvm_destroy(vm);
+}
+
+int main(void) {
+    test_loop();
+    test_arrays();
+    test_calls();
+    test_jump_table();
+    test_errors();
+    puts("done testing regvm");
+    return 0;
+}
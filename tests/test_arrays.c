@@ -0,0 +1,22 @@
+int a[8];
+int b[8];
+int i = 0;
+int same = 0;
+
+int fill() {
+    if (i < 8) {
+        a[i] = i * i;
+        i = i + 1;
+        fill();
+    }
+}
+
+int main() {
+    fill();
+    b = a;
+    same = b == a;
+    b[3] = 0;
+    same = same + (b != a);
+    b[7] + a[2];
+    same;
+}
@@ -0,0 +1,41 @@
+; three tasks print their letter three times each, round robin: ABCABCABC
+
+    PUSH 3
+    PUSH 0
+    SAVE                ; storage[0] = tasks still running
+    PUSH 65
+    COCREATE _worker    ; the task starts with 'A' on its stack
+    PUSH 66
+    COCREATE _worker
+    PUSH 67
+    COCREATE _worker
+
+_wait:
+    YIELD
+    PUSH 0
+    LOAD
+    JNZ _running
+    POP
+    J _done
+_running:
+    POP
+    J _wait
+
+_done:
+    PUSH 10
+    PRINTC
+    HALT
+
+_worker:
+    PRINTC
+    YIELD
+    PRINTC
+    YIELD
+    PRINTC
+    PUSH 1
+    PUSH 0
+    LOAD
+    SUB                 ; one task less
+    PUSH 0
+    SAVE
+    RET                 ; from the outermost call ends the task
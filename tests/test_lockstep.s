@@ -0,0 +1,58 @@
+; reads a number and prints how many Collatz steps take it to 1
+;
+;     stackmachine tests/test_lockstep.o <<< 27
+;     stackmachine --lockstep tests/test_lockstep.cols tests/test_lockstep.o
+
+    PUSH 0
+_read:
+    READC               ; up to newline (0) or EOF (-1)
+    JLEZ _steps
+    PUSH 48
+    PICK 1
+    SUB
+    PUT 0               ; digit
+    PICK 1
+    PUSH 10
+    MUL
+    ADD
+    PUT 0               ; n * 10 + digit
+    J _read
+
+_steps:
+    POP
+    PUSH 0              ; n steps
+_loop:
+    PUSH 1
+    PICK 2
+    GT
+    JZ _done            ; n <= 1
+    POP
+    PUSH 2
+    PICK 2
+    MOD
+    JZ _even
+    POP
+    PUSH 1
+    PUSH 3
+    PICK 3
+    MUL
+    ADD
+    PUT 1               ; n = 3n + 1
+    J _next
+_even:
+    POP
+    PUSH 2
+    PICK 2
+    DIV
+    PUT 1               ; n = n / 2
+_next:
+    PUSH 1
+    ADD
+    J _loop
+
+_done:
+    POP
+    PRINTI
+    PUSH 10
+    PRINTC
+    HALT
@@ -0,0 +1,37 @@
+int calls = 0;
+int t = 1;
+int f = 0;
+
+int expensive() {
+    calls = calls + 1;
+    1;
+}
+
+int main() {
+    f && expensive();
+    t || expensive();
+    t && expensive();
+    f || expensive();
+    !t;
+    !f;
+    !(t && f) || expensive();
+    if (f && expensive()) {
+        print "no\n";
+    } else {
+        print "yes\n";
+    }
+    if (t || expensive()) {
+        print "yes\n";
+    }
+    if (!(f || t && f) && !f) {
+        print "yes\n";
+    }
+    if (t && (f || t) && !(t && !t)) {
+        print "yes\n";
+    } else {
+        print "no\n";
+    }
+    1 < 2 && 2 < 3;
+    3 + 4 == 7 || f;
+    calls;
+}
@@ -0,0 +1,85 @@
+int n = 100;
+int w = 7;
+int i = 0;
+int j = 50;
+int hits = 0;
+int total = 0;
+int fuel = 40;
+int a[40];
+
+int bump() {
+    hits = hits + 1;
+}
+
+int fill() {
+    if (i < n) {
+        a[i * 4 - i * 4 / 40 * 40] = w * 3 + 2 * 5;
+        total = total + i * 4 + (w + 1) * (w - 1) + a[i * 4 / 40];
+        if (total > w * 1000) {
+            total = total - w * 1000;
+            bump();
+        }
+        total = total + i * 4;
+        i = i + 1;
+        fill();
+    }
+}
+
+int walk() {
+    total = total + i * 3 + j * 2;
+    if (i * 3 > 40) {
+        i = i - 7;
+        total = total - i * 3;
+    } else {
+        i = i + 2;
+        total = total + i * 3 + 3 * i;
+    }
+    switch (i * 3 - i * 3 / 4 * 4) {
+        case 0:
+            j = j - 1;
+        case 1:
+            j = j + 5;
+        default:
+            bump();
+    }
+    total = total + hits * 2 + j * 2 + i * 3;
+    fuel = fuel - 1;
+    if (fuel > 0) {
+        walk();
+    }
+}
+
+int inner() {
+    if (j < w) {
+        total = total + j * 4 + (w + 1) * 2 + j * 4 + j * 4 + j * 4;
+        j = j + 1;
+        inner();
+    }
+}
+
+int outer() {
+    if (i < n) {
+        j = 0;
+        inner();
+        total = total + (n - 1) * 3;
+        i = i + 1;
+        outer();
+    }
+}
+
+int main() {
+    fill();
+    total;
+    hits;
+    total = 0;
+    i = 3;
+    walk();
+    total;
+    i;
+    j;
+    hits;
+    total = 0;
+    i = 90;
+    outer();
+    total;
+}
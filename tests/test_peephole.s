@@ -0,0 +1,49 @@
+; minias -O peephole rules, the output is 7 42 3 1 2 with or without -O
+; and -O removes 13 instructions
+
+    PUSH 7
+    PUSH 0
+    ADD                 ; add-zero
+    PUSH 1
+    MUL                 ; multiply-one
+    PUSH 99
+    POP                 ; push-pop
+    PRINTI
+    POP
+    J _next             ; jump-to-next
+_next:
+    PUSH 42
+    JZ _skip            ; thread-jump to _print
+    J _print
+_skip:
+    J _print
+_print:
+    PRINTI
+    POP
+    CALL _three         ; thread-jump to _body
+    PRINTI
+    POP
+    PUSH 0
+    NOT                 ; not-branch, JZ becomes JNZ
+    JZ _false
+    POP
+    PUSH 1
+    PRINTI
+    PUSH 5
+    NOT                 ; not-branch, JNZ becomes JZ
+    JNZ _false
+    POP
+    PUSH 2
+    J _done
+_false:
+    POP
+    PUSH 0
+_done:
+    PRINTI
+    HALT
+
+_three:
+    J _body             ; jump-to-next
+_body:
+    PUSH 3
+    RET
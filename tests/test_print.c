@@ -0,0 +1,15 @@
+int n = 3;
+
+int greet() {
+    if (n > 0) {
+        print "hello, \"world\"\n";
+        n = n - 1;
+        greet();
+    }
+}
+
+int main() {
+    print "start\n";
+    greet();
+    print "done\n";
+}
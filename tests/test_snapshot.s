@@ -0,0 +1,42 @@
+; fill storage[i] = i * i, snapshot, then use the table
+; stackmachine --restore test_snapshot.snap skips the fill loop
+
+    PUSH 99
+    PUSH 499
+    SAVE            ; i = 99 (slot 499)
+
+_fill:
+    PUSH 499
+    LOAD
+    PUSH 499
+    LOAD
+    MUL             ; i * i
+    PUSH 499
+    LOAD
+    SAVE            ; storage[i] = i * i
+    PUSH 1
+    PUSH 499
+    LOAD
+    SUB             ; i - 1
+    PUSH 499
+    SAVE
+    PUSH 499
+    LOAD
+    JNZ _next
+    POP
+    J _done
+_next:
+    POP
+    J _fill
+
+_done:
+    SNAPSHOT
+    PUSH 7
+    LOAD
+    PUSH 9
+    LOAD
+    ADD             ; 49 + 81
+    PRINTI
+    PUSH 10
+    PRINTC
+    HALT
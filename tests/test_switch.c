@@ -0,0 +1,58 @@
+int state = 0;
+int steps = 0;
+int dense = 0;
+int sparse = 0;
+int small = 0;
+
+int classify() {
+    switch (steps * 37) {
+        case 0: case 37:
+            sparse = sparse + 1;
+        case 111:
+            sparse = sparse + 10;
+        case 1000: case 2000:
+            sparse = sparse + 100;
+        case 185:
+            sparse = sparse + 1000;
+        default:
+            sparse = sparse + 10000;
+    }
+    switch (steps) {
+        case 2:
+            small = small + 1;
+        case 4:
+            small = small + 10;
+    }
+}
+
+int run() {
+    steps = steps + 1;
+    classify();
+    switch (state) {
+        case 0:
+            dense = dense + 1;
+            state = 2;
+        case 1:
+            dense = dense + 10;
+            state = 3;
+        case 2: case 5:
+            dense = dense + 100;
+            state = 1;
+        case 3:
+            dense = dense + 1000;
+            state = 7;
+        default:
+            state = 0;
+    }
+    if (steps < 12) {
+        run();
+    }
+}
+
+int main() {
+    run();
+    dense;
+    sparse;
+    small;
+    state;
+}
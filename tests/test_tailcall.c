@@ -0,0 +1,15 @@
+int n = 100000;
+int total = 0;
+
+int count() {
+    if (n > 0) {
+        total = total + 1;
+        n = n - 1;
+        count();
+    }
+}
+
+int main() {
+    count();
+    total;
+}
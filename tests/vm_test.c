@@ -0,0 +1,693 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: vm_test.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../vm.h"
+#include "../instructions.h"
+#include "../encoding.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+                __FILE__, __LINE__, #cond); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+/*
+ * storage[1] = storage[0] * 2, print it, halt
+ */
+static const int program[] = {
+    PUSH, 0,
+    LOAD,
+    PUSH, 2,
+    MUL,
+    PRINTI,
+    PUSH, 1,
+    SAVE,
+    HALT
+};
+
+static void test_run_and_rerun() {
+    char output[32];
+    int value;
+    struct minivm *vm = vm_new(program, sizeof(program) / sizeof(int));
+    CHECK(vm != NULL);
+    vm_set_output(vm, output, sizeof(output));
+
+    puts("testing run, storage and output capture");
+    CHECK(vm_storage_set(vm, 0, 21) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_storage_get(vm, 1, &value) == 0 && value == 42);
+    CHECK(vm_output_len(vm) == 2 && memcmp(output, "42", 2) == 0);
+
+    puts("testing reset and re-run");
+    vm_reset(vm);
+    CHECK(vm_storage_get(vm, 1, &value) == 0 && value == 0);
+    CHECK(vm_storage_set(vm, 0, 5) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_output_len(vm) == 2 && memcmp(output, "10", 2) == 0);
+
+    CHECK(vm_storage_set(vm, VM_STORAGE_SIZE, 1) != 0);
+    vm_destroy(vm);
+}
+
+static void test_budget() {
+    static const int spin[] = { J, 1 };
+    struct minivm *vm = vm_new(spin, 2);
+    CHECK(vm != NULL);
+
+    puts("testing instruction budget");
+    CHECK(vm_run(vm, 1000) == VM_BUDGET_EXHAUSTED);
+    CHECK(vm_instruction_count(vm) == 1000);
+    CHECK(vm_run(vm, 10) == VM_BUDGET_EXHAUSTED);
+    CHECK(vm_instruction_count(vm) == 1010);
+    vm_destroy(vm);
+}
+
+static void test_errors() {
+    static const int bad[] = { PUSH, 1, 9999 };
+    size_t len;
+    int *code;
+    struct minivm *vm = vm_new(bad, 3);
+    CHECK(vm != NULL);
+
+    puts("testing errors");
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    CHECK(strcmp(vm_error(vm), "unknown instruction: 9999") == 0);
+    vm_destroy(vm);
+
+    code = vm_parse_program("1\n7\n27\n", &len);
+    CHECK(code != NULL && len == 3 && code[1] == 7);
+    free(code);
+    CHECK(vm_parse_program("1\nPUSH\n", &len) == NULL);
+}
+
+static void test_storage_size() {
+    static const char image[] = "storage 2\n1\n0\n3\n1\n2\n";
+    size_t len = sizeof(program) / sizeof(int);
+    unsigned char *compact;
+    size_t size;
+    int value;
+    struct minivm *vm = vm_new_storage(program, len, 1);
+    CHECK(vm != NULL);
+
+    puts("testing storage sized by the program");
+    CHECK(vm_storage_set(vm, 0, 21) == 0);
+    CHECK(vm_storage_set(vm, 1, 21) != 0);
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    CHECK(strcmp(vm_error(vm), "storage address out of bounds") == 0);
+    vm_destroy(vm);
+    CHECK(vm_new_storage(program, len, VM_STORAGE_SIZE + 1) == NULL);
+
+    /* five words, not run */
+    vm = vm_load(image, strlen(image));
+    CHECK(vm != NULL && vm_program_len(vm) == 5);
+    CHECK(vm_storage_set(vm, 1, 7) == 0);
+    CHECK(vm_storage_set(vm, 2, 7) != 0);
+    vm_destroy(vm);
+
+    compact = encode_program(program, len, 1, &size);
+    CHECK(compact != NULL);
+    vm = vm_load((const char *)compact, size);
+    free(compact);
+    CHECK(vm != NULL && vm_program_len(vm) == len);
+    CHECK(vm_storage_set(vm, 0, 21) == 0);
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    vm_destroy(vm);
+
+    /* no header, the default */
+    vm = vm_load("1\n0\n", 4);
+    CHECK(vm != NULL);
+    CHECK(vm_storage_get(vm, VM_STORAGE_SIZE - 1, &value) == 0);
+    vm_destroy(vm);
+    CHECK(vm_load("storage x\n1\n", 12) == NULL);
+}
+
+/*
+ * immediates of every size, and straight line code carrying on after an
+ * empty DATA block, 100 - 1000 + 100000 is 99100
+ */
+static void test_immediates() {
+    static const int sizes[] = {
+        PUSH, 100,
+        PUSH, -1000,
+        ADD,
+        J, 9,
+        HALT,
+        PUSH, 100000,
+        ADD,
+        DATA, 0,
+        HALT
+    };
+    struct minivm *vm = vm_new(sizes, sizeof(sizes) / sizeof(int));
+    CHECK(vm != NULL);
+
+    puts("testing immediate sizes");
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_sp(vm) == 1 && vm_stack_at(vm, 1) == 99100);
+    CHECK(vm_pc(vm) == 14);
+    vm_destroy(vm);
+}
+
+/*
+ * storage[1..4] = 1 2 3 4, shift it up by one with an overlapping BCOPY,
+ * clear storage[1], compare storage[1..4] with storage[2..5]
+ */
+static void test_block_ops() {
+    static const int blocks[] = {
+        PUSH, 2,
+        PUSH, 1,
+        PUSH, 4,
+        BCOPY,
+        PUSH, 0,
+        PUSH, 1,
+        PUSH, 1,
+        BFILL,
+        PUSH, 1,
+        PUSH, 2,
+        PUSH, 4,
+        BCMP,
+        HALT
+    };
+    static const int out_of_bounds[] = {
+        PUSH, 0,
+        PUSH, VM_STORAGE_SIZE - 2,
+        PUSH, 3,
+        BFILL,
+        HALT
+    };
+    static const int short_stack[] = { PUSH, 3, BCOPY, HALT };
+    struct minivm *vm = vm_new(blocks, sizeof(blocks) / sizeof(int));
+    struct minivm_batch *batch;
+    int slot;
+    int value;
+    CHECK(vm != NULL);
+
+    puts("testing BCOPY, BFILL and BCMP");
+    for (slot = 1; slot <= 4; slot++) {
+        CHECK(vm_storage_set(vm, slot, slot) == 0);
+    }
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_sp(vm) == 1 && vm_stack_at(vm, 1) < 0);
+    for (slot = 1; slot <= 5; slot++) {
+        CHECK(vm_storage_get(vm, slot, &value) == 0);
+        CHECK(value == (slot == 1 ? 0 : slot - 1));
+    }
+    vm_destroy(vm);
+
+    vm = vm_new(out_of_bounds, sizeof(out_of_bounds) / sizeof(int));
+    CHECK(vm != NULL);
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    CHECK(strcmp(vm_error(vm), "storage address out of bounds") == 0);
+    vm_destroy(vm);
+
+    /* the operands are checked before they are read */
+    vm = vm_new(short_stack, sizeof(short_stack) / sizeof(int));
+    CHECK(vm != NULL);
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    CHECK(strcmp(vm_error(vm), "SP less than zero") == 0);
+    vm_destroy(vm);
+
+    batch = vm_batch_new(short_stack, sizeof(short_stack) / sizeof(int), 2);
+    CHECK(batch != NULL);
+    CHECK(vm_batch_run(batch) == 0);
+    CHECK(vm_batch_status(batch, 0) == VM_ERROR);
+    CHECK(strcmp(vm_batch_error(batch, 0), "SP less than zero") == 0);
+    vm_batch_destroy(batch);
+}
+
+/*
+ * print the string at address 5, then fall into the DATA block, which
+ * steps over it to the PUSH after
+ */
+static void test_strings() {
+    static const int strings[] = {
+        PRINTS, 5,
+        DATA, 3,
+        2, 'h', 'i',
+        PUSH, 5,
+        HALT
+    };
+    static const int out_of_bounds[] = {
+        PRINTS, 3,
+        9, 'x'
+    };
+    char output[16];
+    struct minivm *vm = vm_new(strings, sizeof(strings) / sizeof(int));
+    CHECK(vm != NULL);
+    vm_set_output(vm, output, sizeof(output));
+
+    puts("testing PRINTS and DATA");
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_output_len(vm) == 2 && memcmp(output, "hi", 2) == 0);
+    CHECK(vm_sp(vm) == 1 && vm_stack_at(vm, 1) == 5);
+    vm_destroy(vm);
+
+    vm = vm_new(out_of_bounds, sizeof(out_of_bounds) / sizeof(int));
+    CHECK(vm != NULL);
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    CHECK(strcmp(vm_error(vm), "PRINTS address out of bounds") == 0);
+    vm_destroy(vm);
+}
+
+/*
+ * JTAB on storage[0], to the PUSH 10 or PUSH 20 for 0 and 1 and to the
+ * PUSH 30 for anything else, leaving the index on the stack
+ */
+static void test_jump_table() {
+    static const int table[] = {
+        PUSH, 0,
+        LOAD,
+        JTAB, 2,
+        J, 12,
+        J, 15,
+        J, 18,
+        PUSH, 10,
+        HALT,
+        PUSH, 20,
+        HALT,
+        PUSH, 30,
+        HALT
+    };
+    static const int bad_size[] = { PUSH, 0, JTAB, -1, HALT };
+    static const int index[] = { 0, 1, 2, -1 };
+    static const int target[] = { 10, 20, 30, 30 };
+    struct minivm *vm = vm_new(table, sizeof(table) / sizeof(int));
+    int i;
+    CHECK(vm != NULL);
+
+    puts("testing JTAB");
+    for (i = 0; i < 4; i++) {
+        vm_reset(vm);
+        CHECK(vm_storage_set(vm, 0, index[i]) == 0);
+        CHECK(vm_run(vm, 0) == VM_HALTED);
+        CHECK(vm_sp(vm) == 2 && vm_stack_at(vm, 1) == index[i]);
+        CHECK(vm_stack_at(vm, 2) == target[i]);
+        CHECK(vm_instruction_count(vm) == 5);
+    }
+    vm_destroy(vm);
+
+    vm = vm_new(bad_size, sizeof(bad_size) / sizeof(int));
+    CHECK(vm != NULL);
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    CHECK(strcmp(vm_error(vm), "JTAB size out of bounds") == 0);
+    vm_destroy(vm);
+}
+
+static void test_not() {
+    static const int negate[] = { PUSH, 0, LOAD, NOT, HALT };
+    static const int value[] = { 0, 1, -3 };
+    static const int expected[] = { 1, 0, 0 };
+    struct minivm *vm = vm_new(negate, sizeof(negate) / sizeof(int));
+    int i;
+    CHECK(vm != NULL);
+
+    puts("testing NOT");
+    for (i = 0; i < 3; i++) {
+        vm_reset(vm);
+        CHECK(vm_storage_set(vm, 0, value[i]) == 0);
+        CHECK(vm_run(vm, 0) == VM_HALTED);
+        CHECK(vm_sp(vm) == 1 && vm_stack_at(vm, 1) == expected[i]);
+    }
+    vm_destroy(vm);
+}
+
+/*
+ * trace the program at the top of this file into a ring of 4 records,
+ * then into a growing trace
+ */
+static void test_trace() {
+    static const char *filename = "vm_test.trace";
+    struct vm_trace_header header;
+    struct vm_trace_record records[4];
+    struct minivm *vm = vm_new(program, sizeof(program) / sizeof(int));
+    char output[8];
+    FILE *fp;
+    CHECK(vm != NULL);
+    vm_set_output(vm, output, sizeof(output));
+
+    puts("testing tracing");
+    CHECK(vm_trace_open(vm, filename, 4) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_trace_close(vm) == 0);
+    fp = fopen(filename, "rb");
+    CHECK(fp != NULL);
+    CHECK(fread(&header, sizeof(header), 1, fp) == 1);
+    CHECK(header.magic == VM_TRACE_MAGIC && header.wraps);
+    CHECK(header.capacity == 4 && header.head == 8);
+    CHECK(fread(records, sizeof(records[0]), 4, fp) == 4);
+    fclose(fp);
+
+    /* records 4 to 7: PRINTI, PUSH 1, SAVE, HALT */
+    CHECK(records[0].pc == 7 && records[0].opcode == PRINTI);
+    CHECK(records[0].top == 0 && records[0].sp == 1);
+    CHECK(records[3].pc == 11 && records[3].opcode == HALT);
+
+    vm_reset(vm);
+    CHECK(vm_trace_open(vm, filename, 0) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    vm_destroy(vm);
+    fp = fopen(filename, "rb");
+    CHECK(fp != NULL);
+    CHECK(fread(&header, sizeof(header), 1, fp) == 1);
+    CHECK(!header.wraps && header.capacity == 8 && header.head == 8);
+    CHECK(fread(records, sizeof(records[0]), 1, fp) == 1);
+    CHECK(records[0].pc == 1 && records[0].opcode == PUSH);
+    fclose(fp);
+    remove(filename);
+}
+
+/*
+ * storage[3] = 7, snapshot, push storage[3] + 1
+ */
+static void test_snapshot() {
+    static const int init[] = {
+        PUSH, 7,
+        PUSH, 3,
+        SAVE,
+        SNAPSHOT,
+        PUSH, 3,
+        LOAD,
+        PUSH, 1,
+        ADD,
+        HALT
+    };
+    struct minivm *vm = vm_new(init, sizeof(init) / sizeof(int));
+    struct minivm *restored;
+    FILE *fp = tmpfile();
+    char *image;
+    long size;
+    int value;
+    CHECK(vm != NULL && fp != NULL);
+
+    puts("testing snapshot and restore");
+    CHECK(vm_run(vm, 0) == VM_SNAPSHOT);
+    CHECK(vm_pc(vm) == 7);
+    CHECK(vm_snapshot_write(vm, fp) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_stack_at(vm, vm_sp(vm)) == 8);
+
+    size = ftell(fp);
+    image = malloc(size);
+    rewind(fp);
+    CHECK(image != NULL && fread(image, 1, size, fp) == (size_t)size);
+    fclose(fp);
+    restored = vm_restore(image, size);
+    CHECK(restored != NULL);
+    CHECK(vm_pc(restored) == 7);
+    CHECK(vm_storage_get(restored, 3, &value) == 0 && value == 7);
+    CHECK(vm_run(restored, 0) == VM_HALTED);
+    CHECK(vm_stack_at(restored, vm_sp(restored)) == 8);
+    CHECK(vm_restore(image, size - sizeof(int)) == NULL);
+    vm_destroy(restored);
+    free(image);
+
+    puts("testing snapshot at an address");
+    vm_reset(vm);
+    CHECK(vm_snapshot_at(vm, 9) == 0);
+    CHECK(vm_run(vm, 0) == VM_SNAPSHOT); /* the SNAPSHOT instruction */
+    CHECK(vm_run(vm, 0) == VM_SNAPSHOT); /* reaching address 9 */
+    CHECK(vm_pc(vm) == 9 && vm_program(vm)[9] == LOAD);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_snapshot_at(vm, 0) != 0);
+    vm_destroy(vm);
+}
+
+static void test_coroutines() {
+    static const int resume[] = {
+        PUSH, 0,
+        COCREATE, 17,
+        PUSH, 0,
+        SAVE,           /* storage[0] = task id */
+        PUSH, 0,
+        LOAD,
+        RESUME,         /* 1, runs the task, which ends */
+        PUSH, 0,
+        LOAD,
+        RESUME,         /* 0, the task is gone */
+        HALT,
+        RET             /* 17: the task */
+    };
+    static const int many[] = {
+        PUSH, 1,
+        PUSH, 0,
+        LOAD,
+        SUB,
+        PUSH, 0,
+        SAVE,           /* storage[0] -= 1 */
+        PUSH, 0,
+        COCREATE, 26,
+        POP,
+        PUSH, 0,
+        LOAD,
+        JNZ, 23,
+        POP,
+        YIELD,          /* every task runs once */
+        HALT,
+        POP,            /* 23 */
+        J, 1,
+        PUSH, 1,        /* 26: storage[1] += 1 */
+        PUSH, 1,
+        LOAD,
+        ADD,
+        PUSH, 1,
+        SAVE,
+        RET
+    };
+    struct minivm *vm = vm_new(resume, sizeof(resume) / sizeof(int));
+    int value;
+    CHECK(vm != NULL);
+
+    puts("testing coroutines");
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_storage_get(vm, 0, &value) == 0 && value != 0);
+    CHECK(vm_sp(vm) == 2);
+    CHECK(vm_stack_at(vm, 1) == 1 && vm_stack_at(vm, 2) == 0);
+    CHECK(vm_task_count(vm) == 0 && vm_current_task(vm) == 0);
+    vm_destroy(vm);
+
+    puts("testing thousands of coroutines");
+    vm = vm_new(many, sizeof(many) / sizeof(int));
+    CHECK(vm != NULL);
+    CHECK(vm_storage_set(vm, 0, 5000) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_storage_get(vm, 1, &value) == 0 && value == 5000);
+    CHECK(vm_task_count(vm) == 0);
+
+    puts("testing coroutines after reset");
+    vm_reset(vm);
+    CHECK(vm_storage_set(vm, 0, 3000) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_storage_get(vm, 1, &value) == 0 && value == 3000);
+    vm_destroy(vm);
+}
+
+static void test_parallel() {
+    static const int join[] = {
+        PUSH, 20,
+        PUSH, 22,
+        PUSH, 2,
+        SPAWN, 11,
+        JOIN,           /* 42 */
+        HALT,
+        ADD,            /* 11: the task */
+        RET
+    };
+    static const int detached[] = {
+        PUSH, 1,
+        LOAD,
+        JZ, 21,
+        PUSH, 1,
+        PICK, 1,
+        SUB,
+        PUSH, 1,
+        SAVE,           /* storage[1] -= 1 */
+        PUSH, 1,
+        SPAWN, 22,      /* with the old storage[1] */
+        POP,
+        J, 1,
+        HALT,           /* 21: waits for the tasks */
+        PUSH, 0,        /* 22: storage[0] += argument */
+        AADD,
+        RET
+    };
+    static const int failing[] = {
+        PUSH, 0,
+        SPAWN, 7,
+        JOIN,
+        HALT,
+        RESUME          /* 7: not allowed in a parallel task */
+    };
+    struct minivm *vm = vm_new(join, sizeof(join) / sizeof(int));
+    int threads;
+    int value;
+    CHECK(vm != NULL);
+
+    puts("testing SPAWN and JOIN");
+    CHECK(vm_set_threads(vm, 2) == 0);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_sp(vm) == 1 && vm_stack_at(vm, 1) == 42);
+    CHECK(vm_set_threads(vm, 4) != 0);
+    vm_reset(vm);
+    CHECK(vm_run(vm, 0) == VM_HALTED);
+    CHECK(vm_stack_at(vm, 1) == 42);
+    vm_destroy(vm);
+
+    for (threads = 1; threads <= 4; threads *= 4) {
+        printf("testing thousands of tasks on %d threads\n", threads);
+        vm = vm_new(detached, sizeof(detached) / sizeof(int));
+        CHECK(vm != NULL);
+        CHECK(vm_set_threads(vm, threads) == 0);
+        CHECK(vm_storage_set(vm, 1, 5000) == 0);
+        CHECK(vm_run(vm, 0) == VM_HALTED);
+        CHECK(vm_storage_get(vm, 0, &value) == 0 && value == 12502500);
+        vm_reset(vm);
+        CHECK(vm_storage_set(vm, 1, 100) == 0);
+        CHECK(vm_run(vm, 0) == VM_HALTED);
+        CHECK(vm_storage_get(vm, 0, &value) == 0 && value == 5050);
+        vm_destroy(vm);
+    }
+
+    puts("testing errors in parallel tasks");
+    vm = vm_new(failing, sizeof(failing) / sizeof(int));
+    CHECK(vm != NULL);
+    CHECK(vm_run(vm, 0) == VM_ERROR);
+    CHECK(strcmp(vm_error(vm), "coroutines inside a parallel task") == 0);
+    vm_destroy(vm);
+}
+
+static void test_lockstep() {
+    static const int program[] = {
+        PUSH, 0,
+        READC,          /* 3: read a number up to newline or EOF */
+        JLEZ, 23,
+        PUSH, 48,
+        PICK, 1,
+        SUB,
+        PUT, 0,
+        PICK, 1,
+        PUSH, 10,
+        MUL,
+        ADD,
+        PUT, 0,
+        J, 3,
+        POP,            /* 23 */
+        PUSH, 0,
+        SAVE,
+        PUSH, 0,
+        LOAD,
+        CALL, 42,
+        PUSH, 5,
+        PICK, 1,
+        MOD,
+        PUSH, 100,
+        DIV,            /* fails for multiples of 5 */
+        PRINTI,
+        HALT,
+        PRINTI,         /* 42: print it and n % 4 stars */
+        PUSH, 4,
+        PICK, 1,
+        MOD,
+        CALL, 52,
+        POP,
+        RET,
+        JLEZ, 63,       /* 52 */
+        PUSH, 42,
+        PRINTC,
+        POP,
+        PUSH, -1,
+        ADD,
+        CALL, 52,
+        RET             /* 63 */
+    };
+    enum { COUNT = 37, WIDTH = 8 };
+    int columns[WIDTH * COUNT];
+    char inputs[COUNT][WIDTH + 1];
+    size_t len = sizeof(program) / sizeof(int);
+    struct minivm_batch *batch = vm_batch_new(program, len, COUNT);
+    struct minivm *vm = vm_new(program, len);
+    int i;
+    int k;
+    CHECK(batch != NULL && vm != NULL);
+
+    puts("testing lockstep against single runs");
+    for (i = 0; i < COUNT; i++) {
+        /* numbers of different lengths, every other one without newline */
+        sprintf(inputs[i], i % 2 ? "%d" : "%d\n", i * i * 13);
+        for (k = 0; k < WIDTH; k++) {
+            columns[k * COUNT + i] = k < (int)strlen(inputs[i]) ?
+                inputs[i][k] : EOF;
+        }
+    }
+    vm_batch_set_input(batch, columns, WIDTH);
+    CHECK(vm_batch_run(batch) == 0);
+    for (i = 0; i < COUNT; i++) {
+        char output[64];
+        const char *lanes_output;
+        size_t lanes_len;
+        vm_status status;
+        vm_reset(vm);
+        vm_set_output(vm, output, sizeof(output));
+        vm_set_input(vm, inputs[i], strlen(inputs[i]));
+        status = vm_run(vm, 0);
+        CHECK(vm_batch_status(batch, i) == status);
+        CHECK(status == VM_HALTED ||
+              strcmp(vm_batch_error(batch, i), vm_error(vm)) == 0);
+        lanes_output = vm_batch_output(batch, i, &lanes_len);
+        CHECK(lanes_len == vm_output_len(vm));
+        CHECK(lanes_len == 0 || memcmp(lanes_output, output, lanes_len) == 0);
+        CHECK(vm_batch_sp(batch, i) == vm_sp(vm));
+        for (k = 0; k <= vm_sp(vm); k++) {
+            CHECK(vm_batch_stack_at(batch, i, k) == vm_stack_at(vm, k));
+        }
+    }
+    CHECK(vm_batch_status(batch, 0) == VM_ERROR);
+    CHECK(vm_batch_status(batch, 1) == VM_HALTED);
+
+    puts("testing lockstep rerun");
+    CHECK(vm_batch_run(batch) == 0);
+    CHECK(vm_batch_status(batch, 1) == VM_HALTED);
+    vm_batch_destroy(batch);
+    vm_destroy(vm);
+}
+
+int main(void) {
+    test_run_and_rerun();
+    test_budget();
+    test_errors();
+    test_storage_size();
+    test_immediates();
+    test_block_ops();
+    test_strings();
+    test_jump_table();
+    test_not();
+    test_trace();
+    test_snapshot();
+    test_coroutines();
+    test_parallel();
+    test_lockstep();
+    puts("done testing vm");
+    return 0;
+}
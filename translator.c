@@ -0,0 +1,660 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: translator.c
+ */
+
+/*
+ * mini2c: translate an assembled program (the .o read by stackmachine)
+ * into a self contained C file.
+ *
+ * Every instruction becomes straight line C over a local stack array,
+ * jump targets become labels and jumps become gotos. CALL pushes the
+ * return address like the VM does, and RET goes through a switch over
+ * every address that follows a CALL. The output matches what stackmachine
+ * prints for the same program, errors included: the checks the VM makes
+ * are made here too, with the same messages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "instructions.h"
+#include "util.h"
+#include "encoding.h"
+
+/* must match stackmachine.c, STORAGE_SIZE is for images without a count */
+#define STACK_SIZE                 2000
+#define CALL_STACK_SIZE             500
+#define STORAGE_SIZE                500
+
+static char *PROGRAM_NAME = NULL;
+
+static void print_usage() {
+    fprintf(stderr, "usage: %s PROGRAM.o [OUTPUT.c]\n", PROGRAM_NAME);
+}
+
+/* the image's words after a HALT at address 0, and its storage slots */
+static int *load_program(const char *filename, int *len, int *storage) {
+    size_t size;
+    size_t words;
+    char *text = read_file_size(filename, &size);
+    int *code = parse_program(text, size, &words, storage);
+    int *program;
+
+    if (code == NULL) {
+        fprintf(stderr, "not a valid program: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (*storage == ENCODING_NO_STORAGE) {
+        *storage = STORAGE_SIZE;
+    }
+    /* code is loaded at address 1, address 0 holds HALT */
+    program = minic_malloc((words + 1) * sizeof(int));
+    program[0] = HALT;
+    memcpy(program + 1, code, words * sizeof(int));
+    *len = (int)words + 1;
+    free(code);
+    free(text);
+    return program;
+}
+
+static bool is_known(int inst) {
+    return inst >= 0 && inst < num_opcodes;
+}
+
+/* words taken by the instruction at pc, a DATA block counts as one */
+static int inst_width(const int *program, int pc, int len) {
+    int inst = program[pc];
+    if (inst == DATA && pc + 1 < len &&
+        program[pc+1] >= 0 && program[pc+1] < len - pc - 1) {
+        return program[pc+1] + 2;
+    }
+    return is_known(inst) && requires_immediate(inst) ? 2 : 1;
+}
+
+/* address of entry of the JTAB at pc, len for one past the end */
+static int table_entry(int pc, int entry, int len) {
+    return pc + 2 + 2 * entry < len ? pc + 2 + 2 * entry : len;
+}
+
+static bool has_return(const int *program, int len) {
+    int pc;
+    for (pc = 1; pc < len; pc += inst_width(program, pc, len)) {
+        if (program[pc] == RET) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* false if control never goes on to the next instruction */
+static bool falls_through(int inst) {
+    return inst != J && inst != TCALL && inst != RET && inst != HALT &&
+           inst != JTAB;
+}
+
+/*
+ * mark every address control can reach other than by falling through:
+ * jump and call targets, and the return addresses pushed by CALL when
+ * there is a RET to go back to them. Only those get a label, so the
+ * generated C has no unused ones.
+ */
+static void find_targets(const int *program,
+                         int len,
+                         bool returns,
+                         char *is_target) {
+    int pc;
+    is_target[0] = returns;
+    for (pc = 1; pc < len; pc += inst_width(program, pc, len)) {
+        int inst = program[pc];
+        if (pc + 1 >= len) {
+            break;
+        }
+        if (is_known(inst) && is_jump(inst)) {
+            int target = program[pc+1];
+            if (target < 0 || target >= len) {
+                fprintf(stderr,
+                        "%s: jump target out of range at %d: %d\n",
+                        PROGRAM_NAME, pc, target);
+                exit(EXIT_FAILURE);
+            }
+            /* coroutines and tasks are not translated, see below */
+            if (inst != COCREATE && inst != SPAWN) {
+                is_target[target] = 1;
+            }
+        }
+        if (inst == CALL && returns && pc + 2 < len) {
+            is_target[pc+2] = 1;
+        }
+        if (inst == JTAB) {
+            int entry;
+            for (entry = 0; entry <= program[pc+1]; entry++) {
+                int target = table_entry(pc, entry, len);
+                is_target[target] = 1;
+                if (target == len) {
+                    break;
+                }
+            }
+        }
+        if (inst == DATA) {
+            is_target[pc + inst_width(program, pc, len)] = 1;
+        }
+    }
+    /* the HALT at 0 is jumped over to start at 1 */
+    if (is_target[0]) {
+        is_target[1] = 1;
+    }
+}
+
+/* generated code that does not depend on the program being translated */
+static const char *runtime[] = {
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "",
+    "static void print_stack(const int *stack, int sp, int pc) {",
+    "    int i;",
+    "    printf(\"*** PRINTING STACK ***\\n\");",
+    "    printf(\"SP: %d\\n\", sp);",
+    "    printf(\"PC: %d\\n\", pc);",
+    "    for (i = 0; i <= sp; ++i) {",
+    "        if (i == sp) {",
+    "            printf(\"%2d: %d*\\n\", i, stack[i]);",
+    "        } else {",
+    "            printf(\"%2d: %d\\n\", i, stack[i]);",
+    "        }",
+    "    }",
+    "    printf(\"*** DONE PRINTING ***\\n\");",
+    "}",
+    "",
+    "#define FAIL(pc, msg) do { \\",
+    "    fflush(stdout); \\",
+    "    fprintf(stderr, \"ERROR: %s\\n\", msg); \\",
+    "    print_stack(stack, sp, pc); \\",
+    "    exit(EXIT_FAILURE); \\",
+    "} while (0)",
+    "",
+    "#define GROW(pc) if (sp >= STACK_SIZE - 1) FAIL(pc, \"SP out of bounds\")",
+    "#define SHRINK(pc, n) if (sp < (n)) FAIL(pc, \"SP less than zero\")",
+    "#define RANGE(pc, start, n) \\",
+    "    if ((n) < 0 || (start) < 0 || (start) > STORAGE_SIZE - (n)) \\",
+    "        FAIL(pc, \"storage address out of bounds\")",
+    "",
+    "int main(void) {",
+    "    int stack[STACK_SIZE] = {0};",
+    "    static int storage[STORAGE_SIZE + 1]; /* STORAGE_SIZE may be 0 */",
+    "    int call_stack[CALL_STACK_SIZE];",
+    "    int sp = 0;",
+    "    int cp = 0;",
+    "    int ret = 0;",
+    "",
+    "    /* not every program uses all of them */",
+    "    (void)storage;",
+    "    (void)call_stack;",
+    "    (void)ret;",
+    "    call_stack[cp++] = 0;",
+    NULL
+};
+
+static void emit_prelude(FILE *out,
+                         const char *program_filename,
+                         int storage,
+                         bool halt_label) {
+    int i;
+    fprintf(out, "/* generated by mini2c from %s */\n", program_filename);
+    fprintf(out,
+            "#define STACK_SIZE %d\n"
+            "#define CALL_STACK_SIZE %d\n"
+            "#define STORAGE_SIZE %d\n",
+            STACK_SIZE,
+            CALL_STACK_SIZE,
+            storage);
+    for (i = 0; runtime[i] != NULL; i++) {
+        fprintf(out, "%s\n", runtime[i]);
+    }
+    fprintf(out,
+            "    printf(\"*** LOADING ***\\n\");\n"
+            "    printf(\"Reading from: %s\\n\");\n"
+            "    printf(\"*** DONE LOADING ***\\n\");\n"
+            "    printf(\"### RUNNING ###\\n\");\n",
+            program_filename);
+    /* address 0 holds HALT, it is where the first RET goes back to */
+    if (halt_label) {
+        fprintf(out,
+                "    goto L1;\n"
+                "\n"
+                "L0:\n"
+                "    printf(\"### HALTING ###\\n\");\n"
+                "    print_stack(stack, sp, 0);\n"
+                "    return 0;\n");
+    }
+}
+
+static void emit_binary(FILE *out, int pc, const char *op) {
+    fprintf(out,
+            "    SHRINK(%d, 1);\n"
+            "    stack[sp-1] = stack[sp] %s stack[sp-1];\n"
+            "    sp--;\n",
+            pc, op);
+}
+
+/* like the VM, the divisor is popped before it is checked */
+static void emit_division(FILE *out, int pc, const char *op) {
+    fprintf(out,
+            "    SHRINK(%d, 1);\n"
+            "    sp--;\n"
+            "    if (stack[sp] == 0) FAIL(%d, \"division by zero\");\n"
+            "    stack[sp] = stack[sp+1] %s stack[sp];\n",
+            pc, pc, op);
+}
+
+static void emit_branch(FILE *out, const char *cond, int target) {
+    fprintf(out, "    if (stack[sp] %s) goto L%d;\n", cond, target);
+}
+
+static void emit_instruction(FILE *out, const int *program, int pc, int len) {
+    int inst = program[pc];
+    int immediate = pc + 1 < len ? program[pc+1] : 0;
+
+    switch (inst) {
+        case NOP:
+            break;
+
+        case SNAPSHOT:
+            /* compiled programs have no VM state to save, run on */
+            break;
+
+        case COCREATE:
+        case YIELD:
+        case RESUME:
+            fprintf(out,
+                    "    fprintf(stderr, "
+                    "\"ERROR: coroutines need the stackmachine\\n\");\n"
+                    "    print_stack(stack, sp, %d);\n"
+                    "    exit(EXIT_FAILURE);\n",
+                    pc);
+            break;
+
+        case SPAWN:
+        case JOIN:
+            fprintf(out,
+                    "    fprintf(stderr, "
+                    "\"ERROR: parallel tasks need the stackmachine\\n\");\n"
+                    "    print_stack(stack, sp, %d);\n"
+                    "    exit(EXIT_FAILURE);\n",
+                    pc);
+            break;
+
+        case PICK:
+            fprintf(out,
+                    "    SHRINK(%d, %d);\n"
+                    "    GROW(%d);\n"
+                    "    sp++;\n"
+                    "    stack[sp] = stack[sp-1-%d];\n",
+                    pc, immediate, pc, immediate);
+            break;
+
+        case PUT:
+            fprintf(out,
+                    "    SHRINK(%d, %d);\n"
+                    "    stack[sp-1-%d] = stack[sp];\n"
+                    "    sp--;\n",
+                    pc, immediate + 1, immediate);
+            break;
+
+        case PUSH:
+            fprintf(out, "    GROW(%d);\n    stack[++sp] = %d;\n",
+                    pc, immediate);
+            break;
+
+        case ADD:
+            emit_binary(out, pc, "+");
+            break;
+
+        case SUB:
+            emit_binary(out, pc, "-");
+            break;
+
+        case MUL:
+            emit_binary(out, pc, "*");
+            break;
+
+        case DIV:
+            emit_division(out, pc, "/");
+            break;
+
+        case MOD:
+            emit_division(out, pc, "%");
+            break;
+
+        case EQ:
+            emit_binary(out, pc, "==");
+            break;
+
+        case NE:
+            emit_binary(out, pc, "!=");
+            break;
+
+        case LT:
+            emit_binary(out, pc, "<");
+            break;
+
+        case GT:
+            emit_binary(out, pc, ">");
+            break;
+
+        case LE:
+            emit_binary(out, pc, "<=");
+            break;
+
+        case GE:
+            emit_binary(out, pc, ">=");
+            break;
+
+        case NOT:
+            fprintf(out, "    stack[sp] = !stack[sp];\n");
+            break;
+
+        case PRINTI:
+            fprintf(out, "    printf(\"%%d\", stack[sp]);\n");
+            break;
+
+        case PRINTC:
+            fprintf(out, "    putchar(stack[sp]);\n");
+            break;
+
+        case PRINTS:
+            if (immediate < 1 || immediate >= len || program[immediate] < 0 ||
+                program[immediate] >= len - immediate) {
+                fprintf(out,
+                        "    FAIL(%d, \"PRINTS address out of bounds\");\n",
+                        pc);
+            } else {
+                int i;
+                fprintf(out, "    fwrite(\"");
+                for (i = 1; i <= program[immediate]; i++) {
+                    fprintf(out, "\\%03o", program[immediate + i] & 0xff);
+                }
+                fprintf(out, "\", 1, %d, stdout);\n", program[immediate]);
+            }
+            break;
+
+        case DATA:
+            if (immediate < 0 || immediate >= len - pc - 1) {
+                fprintf(out, "    FAIL(%d, \"DATA size out of bounds\");\n",
+                        pc);
+            } else {
+                fprintf(out, "    goto L%d;\n", pc + 2 + immediate);
+            }
+            break;
+
+        case READC:
+            fprintf(out,
+                    "    GROW(%d);\n"
+                    "    stack[++sp] = getchar();\n"
+                    "    if (stack[sp] == '\\n') {\n"
+                    "        stack[sp] = '\\0';\n"
+                    "    }\n",
+                    pc);
+            break;
+
+        case POP:
+            fprintf(out, "    SHRINK(%d, 1);\n    sp--;\n", pc);
+            break;
+
+        case LOAD:
+        case ALOAD:
+            /* a translated program is a single thread */
+            fprintf(out,
+                    "    RANGE(%d, stack[sp], 1);\n"
+                    "    stack[sp] = storage[stack[sp]];\n",
+                    pc);
+            break;
+
+        case AADD:
+            fprintf(out,
+                    "    SHRINK(%d, 1);\n"
+                    "    sp--;\n"
+                    "    RANGE(%d, stack[sp+1], 1);\n"
+                    "    ret = storage[stack[sp+1]];\n"
+                    "    storage[stack[sp+1]] += stack[sp];\n"
+                    "    stack[sp] = ret;\n",
+                    pc, pc);
+            break;
+
+        case BCOPY:
+            fprintf(out,
+                    "    SHRINK(%d, 2);\n"
+                    "    RANGE(%d, stack[sp-2], stack[sp]);\n"
+                    "    RANGE(%d, stack[sp-1], stack[sp]);\n"
+                    "    memmove(storage + stack[sp-2], storage + stack[sp-1],\n"
+                    "            stack[sp] * sizeof(int));\n"
+                    "    sp -= 3;\n",
+                    pc, pc, pc);
+            break;
+
+        case BFILL:
+            fprintf(out,
+                    "    SHRINK(%d, 2);\n"
+                    "    RANGE(%d, stack[sp-1], stack[sp]);\n"
+                    "    for (ret = 0; ret < stack[sp]; ret++) {\n"
+                    "        storage[stack[sp-1] + ret] = stack[sp-2];\n"
+                    "    }\n"
+                    "    sp -= 3;\n",
+                    pc, pc);
+            break;
+
+        case BCMP:
+            fprintf(out,
+                    "    SHRINK(%d, 2);\n"
+                    "    RANGE(%d, stack[sp-2], stack[sp]);\n"
+                    "    RANGE(%d, stack[sp-1], stack[sp]);\n"
+                    "    for (ret = 0; ret < stack[sp] &&\n"
+                    "         storage[stack[sp-2] + ret] ==\n"
+                    "         storage[stack[sp-1] + ret]; ret++) {\n"
+                    "    }\n"
+                    "    sp -= 2;\n"
+                    "    stack[sp] = ret == stack[sp+2] ? 0 :\n"
+                    "        storage[stack[sp] + ret] < storage[stack[sp+1] + ret]"
+                    " ? -1 : 1;\n",
+                    pc, pc, pc);
+            break;
+
+        case SAVE:
+        case ASTORE:
+            fprintf(out,
+                    "    SHRINK(%d, 2);\n"
+                    "    sp -= 2;\n"
+                    "    RANGE(%d, stack[sp+2], 1);\n"
+                    "    storage[stack[sp+2]] = stack[sp+1];\n",
+                    pc, pc);
+            break;
+
+        case J:
+        case TCALL:
+            fprintf(out, "    goto L%d;\n", immediate);
+            break;
+
+        case JZ:
+            emit_branch(out, "== 0", immediate);
+            break;
+
+        case JLEZ:
+            emit_branch(out, "<= 0", immediate);
+            break;
+
+        case JNZ:
+            emit_branch(out, "!= 0", immediate);
+            break;
+
+        /* the table entries are J instructions, each one is a label */
+        case JTAB:
+            {
+            int entry;
+            if (immediate < 0) {
+                fprintf(out, "    FAIL(%d, \"JTAB size out of bounds\");\n",
+                        pc);
+                break;
+            }
+            fprintf(out, "    switch (stack[sp]) {\n");
+            /* entries past the end all go to L<len>, like the default */
+            for (entry = 0; entry < immediate && pc + 2 + 2 * entry < len;
+                 entry++) {
+                fprintf(out, "        case %d: goto L%d;\n",
+                        entry, table_entry(pc, entry, len));
+            }
+            fprintf(out, "        default: goto L%d;\n    }\n",
+                    table_entry(pc, immediate, len));
+            }
+            break;
+
+        case CALL:
+            fprintf(out,
+                    "    if (cp >= CALL_STACK_SIZE) "
+                    "FAIL(%d, \"call stack overflow\");\n"
+                    "    call_stack[cp++] = %d;\n"
+                    "    goto L%d;\n",
+                    pc, pc + 2, immediate);
+            break;
+
+        case RET:
+            fprintf(out,
+                    "    if (cp <= 0) FAIL(%d, \"call stack underflow\");\n"
+                    "    ret = call_stack[--cp];\n"
+                    "    goto dispatch_return;\n",
+                    pc);
+            break;
+
+        case POPC:
+            fprintf(out, "    cp--;\n");
+            break;
+
+        case HALT:
+            fprintf(out,
+                    "    printf(\"### HALTING ###\\n\");\n"
+                    "    print_stack(stack, sp, %d);\n"
+                    "    return 0;\n",
+                    pc);
+            break;
+
+        default:
+            fprintf(out,
+                    "    fprintf(stderr, "
+                    "\"ERROR: unknown instruction: %d\\n\");\n"
+                    "    print_stack(stack, sp, %d);\n"
+                    "    exit(EXIT_FAILURE);\n",
+                    inst, pc);
+            break;
+    }
+}
+
+static void emit_return_dispatch(FILE *out,
+                                 const int *program,
+                                 int len) {
+    int pc;
+    fprintf(out,
+            "\ndispatch_return:\n"
+            "    switch (ret) {\n"
+            "        case 0: goto L0;\n");
+    for (pc = 1; pc < len; pc += inst_width(program, pc, len)) {
+        if (program[pc] == CALL && pc + 2 < len) {
+            fprintf(out, "        case %d: goto L%d;\n", pc + 2, pc + 2);
+        }
+    }
+    fprintf(out,
+            "    }\n"
+            "    FAIL(ret, \"PC out of bounds\");\n"
+            "    return 1;\n"
+            "}\n");
+}
+
+static void translate(const char *program_filename, FILE *out) {
+    int len;
+    int storage;
+    int pc;
+    int last = 0;
+    bool returns;
+    int *program = load_program(program_filename, &len, &storage);
+    char *is_target = calloc(len + 1, sizeof(char));
+
+    if (is_target == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    returns = has_return(program, len);
+    find_targets(program, len, returns, is_target);
+    emit_prelude(out, program_filename, storage, is_target[0]);
+
+    for (pc = 1; pc < len; pc += inst_width(program, pc, len)) {
+        int inst = program[pc];
+        last = pc;
+        if (is_target[pc]) {
+            fprintf(out, "\nL%d:\n", pc);
+        }
+        if (is_known(inst) && requires_immediate(inst) && pc + 1 >= len) {
+            fprintf(stderr, "%s: missing immediate at %d\n",
+                    PROGRAM_NAME, pc);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(out, "    /* %d: %s */\n",
+                pc, is_known(inst) ? inst_names[inst] : "?");
+        emit_instruction(out, program, pc, len);
+    }
+
+    /* the VM runs off the end of the code section, report it the same */
+    if (is_target[len] || falls_through(program[last])) {
+        fprintf(out, "\nL%d:\n    FAIL(%d, \"PC out of bounds\");\n",
+                len, len);
+    }
+    if (returns) {
+        emit_return_dispatch(out, program, len);
+    } else {
+        fprintf(out, "    return 1;\n}\n");
+    }
+
+    free(is_target);
+    free(program);
+}
+
+int main(int argc, char **argv) {
+    FILE *out = stdout;
+    PROGRAM_NAME = argv[0];
+
+    if (argc != 2 && argc != 3) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc == 3) {
+        out = fopen(argv[2], "w");
+        if (out == NULL) {
+            fprintf(stderr, "could not open for writing: %s\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    translate(argv[1], out);
+
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "failed to close output file\n");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -1,6 +1,10 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include "util.h"
 
@@ -14,9 +18,85 @@ void *minic_malloc(const size_t size) {
     }
 }
 
+void *minic_realloc(void *ptr, const size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fprintf(stderr, "out of memory");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
 char *make_str(const char *str) {
     const size_t str_len = strlen(str);
     char *dst = minic_malloc(str_len + 1);
-    memcpy(dst, str, str_len);
+    memcpy(dst, str, str_len + 1);
     return dst;
 }
+
+char *read_file(const char *filename) {
+    size_t size;
+    return read_file_size(filename, &size);
+}
+
+char *read_file_size(const char *filename, size_t *size_read) {
+    FILE *fp;
+    long size;
+    char *text;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "not a file: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < 0) {
+        fprintf(stderr, "could not read: %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    text = minic_malloc(size + 1);
+    size = (long)fread(text, 1, size, fp);
+    text[size] = '\0';
+    *size_read = (size_t)size;
+    fclose(fp);
+    return text;
+}
+
+char *replace_extension(const char *filename, const char *ext) {
+    const char *dot = strrchr(filename, '.');
+    const char *slash = strrchr(filename, '/');
+    size_t base_len;
+    char *new_filename;
+    if (dot == NULL || (slash != NULL && dot < slash)) {
+        base_len = strlen(filename);
+    } else {
+        base_len = dot - filename;
+    }
+    new_filename = minic_malloc(base_len + strlen(ext) + 1);
+    memcpy(new_filename, filename, base_len);
+    strcpy(new_filename + base_len, ext);
+    return new_filename;
+}
+
+double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long peak_memory_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
+
+void report_stage(const char *stage, double *start) {
+    double now = get_time();
+    fprintf(stderr, "%-10s %10.3f ms %10ld KB peak\n",
+            stage, (now - *start) * 1e3, peak_memory_kb());
+    *start = now;
+}
@@ -4,6 +4,28 @@
 #include <stdlib.h>
 
 void *minic_malloc(const size_t size);
+void *minic_realloc(void *ptr, const size_t size);
 char *make_str(const char *str);
 
+/* whole file as a NUL terminated string, exits if it can't be read */
+char *read_file(const char *filename);
+
+/* the same, and its size, for files that may hold NUL bytes */
+char *read_file_size(const char *filename, size_t *size);
+
+/* copy of filename with its extension replaced by ext, e.g. ".o" */
+char *replace_extension(const char *filename, const char *ext);
+
+/* monotonic wall clock in seconds */
+double get_time(void);
+
+/* high-water mark of this process's resident memory in KB */
+long peak_memory_kb(void);
+
+/*
+ * print "stage  ms since *start  peak KB" to stderr and restart the clock,
+ * the format of minic --time and minias --time
+ */
+void report_stage(const char *stage, double *start);
+
 #endif
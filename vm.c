@@ -0,0 +1,1896 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: vm.c
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "vm.h"
+#include "instructions.h"
+#include "deque.h"
+#include "encoding.h"
+
+/*
+ * A coroutine or a parallel task. The main task uses the VM_STACK_SIZE
+ * stacks, the others get small fixed size stacks from a task pool.
+ */
+struct task {
+    int id;             /* coroutines: generation << 16 | slot, 0 for main
+                           parallel tasks: slot + 1 */
+    int pc;
+    int sp;
+    int cp;
+    int *stack;
+    int *call_stack;
+    int stack_size;
+    int call_stack_size;
+    int waiting_input;  /* switched out by a READC with no input ready */
+    struct task *prev;  /* run queue, or free list through next */
+    struct task *next;
+
+    /* parallel tasks, see SPAWN and JOIN */
+    int parallel;
+    int live;           /* between SPAWN and JOIN */
+    int done;           /* stored with release once result or error is set */
+    int result;
+    char error[64];
+};
+
+/* tasks are carved out of chunks, a chunk is one allocation */
+#define TASK_CHUNK        64
+#define TASK_SLOT_BITS    16
+#define TASK_SLOT_MASK    ((1 << TASK_SLOT_BITS) - 1)
+#define STDIN_BUFFER_SIZE 4096
+#define MAX_POOL_CHUNKS   1024
+
+/* a thread of the parallel pool, worker 0 is the thread calling vm_run */
+struct worker {
+    struct deque deque;
+    struct pool *pool;
+    struct minivm *vm;        /* shares program and storage with the root */
+    struct task *free_tasks;  /* only touched by this worker */
+    unsigned long seed;
+    pthread_t thread;
+};
+
+struct pool {
+    struct worker *workers;
+    int num_workers;
+    int num_started;         /* workers 1..num_started have a thread */
+
+    /* parallel tasks by handle, chunks are published with release */
+    struct task *chunks[MAX_POOL_CHUNKS];
+    int num_chunks;
+
+    pthread_mutex_t lock;    /* chunks, sleeping and the first error */
+    pthread_mutex_t io_lock; /* output and input of all workers */
+    pthread_cond_t wake;
+    int sleepers;
+    unsigned long pushed;    /* tasks ever pushed, to not miss a wake up */
+    int shutdown;
+    long pending;            /* spawned and not finished */
+    int failed;
+    char error[64];
+};
+
+struct minivm {
+    /* Code section, program[0] is HALT, code is loaded at address 1 */
+    int *program;
+    size_t program_len;
+
+    /*
+     * The program as a compact image (see encoding.h), which execute
+     * decodes instead of reading program, and code[offsets[pc]], the
+     * instruction at word address pc, -1 where it has to read program, as
+     * it does for ENCODING_RAW. next_ip is where the instruction after the
+     * last one is, at next_pc, so straight line code skips offsets.
+     */
+    unsigned char *code;
+    int *offsets;
+    int next_pc;
+    int next_ip;
+
+    /* bytes of immediate after each instruction byte, 0 for none */
+    unsigned char immediate_size[256];
+
+    /* execution stack, one spare slot so a PUSH at the top stays in bounds
+     * until the next bounds check catches it */
+    int *stack;
+
+    /* accessed with instructions SAVE and LOAD */
+    int *storage;
+    int storage_size;
+
+    /* Save return address here */
+    int *call_stack;
+
+    /* Registers */
+    int pc; /* Program Counter */
+    int sp; /* Stack Pointer */
+    int cp; /* Call Pointer */
+
+    /* limits of the current task's stack and call stack */
+    int stack_size;
+    int call_stack_size;
+
+    /* coroutines, current is not in the run queue */
+    struct task main_task;
+    struct task *current;
+    struct task *run_head;
+    struct task *run_tail;
+    struct task *free_tasks;
+    struct task **chunks;
+    int num_chunks;
+    int num_tasks;    /* coroutines alive, not counting the main task */
+    int num_waiting;  /* tasks, main included, switched out by READC */
+
+    /* parallel tasks, the pool is started by the first SPAWN */
+    struct pool *pool;
+    struct worker *worker;
+    struct minivm *root;  /* the VM that owns the pool, or this one */
+    int num_threads;      /* 0 for one per online CPU */
+
+    unsigned long instruction_count;
+
+    /* output buffer, NULL means stdout */
+    char *output;
+    size_t output_capacity;
+    size_t output_len;
+
+    /* input buffer, NULL means stdin */
+    const char *input;
+    size_t input_len;
+    size_t input_pos;
+
+    /* stdin is read here directly so readiness can be polled */
+    char stdin_buff[STDIN_BUFFER_SIZE];
+    size_t stdin_len;
+    size_t stdin_pos;
+
+    const char *error;
+    char error_buff[64];
+
+    /* address patched with SNAPSHOT by vm_snapshot_at, -1 for none */
+    int snapshot_pc;
+    int snapshot_inst;
+    unsigned char snapshot_byte;
+
+    /* profiling counters, indexed by the pc of the branch or call */
+    int profiling;
+    unsigned long *branch_taken;
+    unsigned long *branch_fallthrough;
+    unsigned long *call_count;
+
+    /* tracing, the records follow the header in the mapping */
+    struct vm_trace_header *trace;
+    struct vm_trace_record *trace_records;
+    unsigned long trace_slot;
+    int trace_fd;
+};
+
+int *vm_parse_program(const char *text, size_t *len) {
+    int storage;
+    return parse_program(text, strlen(text), len, &storage);
+}
+
+struct minivm *vm_new(const int *code, size_t len) {
+    return vm_new_storage(code, len, VM_STORAGE_SIZE);
+}
+
+struct minivm *vm_new_storage(const int *code, size_t len, int storage) {
+    struct minivm *vm;
+    size_t size;
+    int i;
+    if (storage < 0 || storage > VM_STORAGE_SIZE) {
+        return NULL;
+    }
+    vm = calloc(1, sizeof(struct minivm));
+    if (vm == NULL) {
+        return NULL;
+    }
+    vm->program = malloc((len + 1) * sizeof(int));
+    vm->main_task.stack = malloc((VM_STACK_SIZE + 1) * sizeof(int));
+    /* one spare so a program without storage still gets an allocation */
+    vm->storage = malloc((storage + 1) * sizeof(int));
+    vm->storage_size = storage;
+    vm->main_task.call_stack = malloc(VM_CALL_STACK_SIZE * sizeof(int));
+    vm->main_task.stack_size = VM_STACK_SIZE;
+    vm->main_task.call_stack_size = VM_CALL_STACK_SIZE;
+    vm->offsets = malloc((len + 1) * sizeof(int));
+    if (vm->program == NULL || vm->main_task.stack == NULL ||
+        vm->storage == NULL || vm->main_task.call_stack == NULL ||
+        vm->offsets == NULL) {
+        vm_destroy(vm);
+        return NULL;
+    }
+    vm->program[0] = HALT;
+    if (len > 0) {
+        memcpy(vm->program + 1, code, len * sizeof(int));
+    }
+    vm->program_len = len;
+    vm->code = encode_program_indexed(vm->program, len + 1, storage,
+                                      &size, vm->offsets);
+    if (vm->code == NULL) {
+        vm_destroy(vm);
+        return NULL;
+    }
+    vm->next_pc = -1;
+    for (i = 0; i < 256; i++) {
+        int inst = ENCODING_OPCODE(i);
+        if (inst < num_opcodes && requires_immediate(inst)) {
+            vm->immediate_size[i] = ENCODING_IMMEDIATE_SIZE(i);
+        }
+    }
+    vm->snapshot_pc = -1;
+    vm->root = vm;
+    vm_reset(vm);
+    return vm;
+}
+
+struct minivm *vm_load(const char *image, size_t size) {
+    struct minivm *vm;
+    size_t len;
+    int storage;
+    int *code = parse_program(image, size, &len, &storage);
+
+    if (code == NULL) {
+        return NULL;
+    }
+    if (storage == ENCODING_NO_STORAGE) {
+        storage = VM_STORAGE_SIZE;
+    }
+    vm = vm_new_storage(code, len, storage);
+    free(code);
+    return vm;
+}
+
+static void stop_pool(struct minivm *vm);
+
+void vm_destroy(struct minivm *vm) {
+    int i;
+    if (vm == NULL) {
+        return;
+    }
+    stop_pool(vm);
+    vm_trace_close(vm);
+    free(vm->program);
+    free(vm->code);
+    free(vm->offsets);
+    free(vm->main_task.stack);
+    free(vm->storage);
+    free(vm->main_task.call_stack);
+    for (i = 0; i < vm->num_chunks; i++) {
+        free(vm->chunks[i]);
+    }
+    free(vm->chunks);
+    free(vm->branch_taken);
+    free(vm->branch_fallthrough);
+    free(vm->call_count);
+    free(vm);
+}
+
+/* every pooled task back on the free list, the chunks are kept */
+static void reset_tasks(struct minivm *vm) {
+    int i;
+    int j;
+    vm->free_tasks = NULL;
+    for (i = vm->num_chunks - 1; i >= 0; i--) {
+        struct task *chunk = vm->chunks[i];
+        for (j = TASK_CHUNK - 1; j >= 0; j--) {
+            if (chunk[j].stack != NULL) {
+                chunk[j].next = vm->free_tasks;
+                vm->free_tasks = &chunk[j];
+            }
+        }
+    }
+    vm->main_task.id = 0;
+    vm->main_task.waiting_input = 0;
+    vm->current = &vm->main_task;
+    vm->run_head = NULL;
+    vm->run_tail = NULL;
+    vm->num_tasks = 0;
+    vm->num_waiting = 0;
+}
+
+static void reset_pool(struct minivm *vm);
+
+void vm_reset(struct minivm *vm) {
+    reset_pool(vm);
+    reset_tasks(vm);
+    vm->stack = vm->main_task.stack;
+    vm->call_stack = vm->main_task.call_stack;
+    vm->stack_size = VM_STACK_SIZE;
+    vm->call_stack_size = VM_CALL_STACK_SIZE;
+    memset(vm->stack, 0, (VM_STACK_SIZE + 1) * sizeof(int));
+    memset(vm->storage, 0, vm->storage_size * sizeof(int));
+    memset(vm->call_stack, 0, VM_CALL_STACK_SIZE * sizeof(int));
+    vm->pc = 1;
+    vm->sp = 0;
+
+    /* returning from the outermost call goes to address 0, HALT */
+    vm->call_stack[0] = 0;
+    vm->cp = 1;
+
+    vm->instruction_count = 0;
+    vm->output_len = 0;
+    vm->input_pos = 0;
+    vm->error = NULL;
+}
+
+void vm_set_output(struct minivm *vm, char *buf, size_t capacity) {
+    vm->output = buf;
+    vm->output_capacity = capacity;
+    vm->output_len = 0;
+}
+
+size_t vm_output_len(const struct minivm *vm) {
+    return vm->output_len;
+}
+
+void vm_set_input(struct minivm *vm, const char *buf, size_t len) {
+    vm->input = buf;
+    vm->input_len = len;
+    vm->input_pos = 0;
+}
+
+int vm_storage_get(const struct minivm *vm, int slot, int *value) {
+    if (slot < 0 || slot >= vm->storage_size) {
+        return -1;
+    }
+    *value = vm->storage[slot];
+    return 0;
+}
+
+int vm_storage_set(struct minivm *vm, int slot, int value) {
+    if (slot < 0 || slot >= vm->storage_size) {
+        return -1;
+    }
+    vm->storage[slot] = value;
+    return 0;
+}
+
+int vm_pc(const struct minivm *vm) {
+    return vm->pc;
+}
+
+int vm_sp(const struct minivm *vm) {
+    return vm->sp;
+}
+
+int vm_stack_at(const struct minivm *vm, int index) {
+    if (index < 0 || index > vm->stack_size) {
+        return 0;
+    }
+    return vm->stack[index];
+}
+
+unsigned long vm_instruction_count(const struct minivm *vm) {
+    return vm->instruction_count;
+}
+
+const char *vm_error(const struct minivm *vm) {
+    return vm->error;
+}
+
+int vm_set_threads(struct minivm *vm, int threads) {
+    if (vm->pool != NULL || threads < 0) {
+        return -1;
+    }
+    vm->num_threads = threads;
+    return 0;
+}
+
+int vm_task_count(const struct minivm *vm) {
+    return vm->num_tasks;
+}
+
+int vm_current_task(const struct minivm *vm) {
+    return vm->current->id;
+}
+
+size_t vm_program_len(const struct minivm *vm) {
+    return vm->program_len;
+}
+
+const int *vm_program(const struct minivm *vm) {
+    return vm->program;
+}
+
+void vm_print_stack(const struct minivm *vm, FILE *out) {
+    int i;
+    fprintf(out, "*** PRINTING STACK ***\n");
+    fprintf(out, "SP: %d\n", vm->sp);
+    fprintf(out, "PC: %d\n", vm->pc);
+    for (i = 0; i <= vm->sp && i <= vm->stack_size; ++i) {
+        if (i == vm->sp) {
+            fprintf(out, "%2d: %d*\n", i, vm->stack[i]);
+        } else {
+            fprintf(out, "%2d: %d\n", i, vm->stack[i]);
+        }
+    }
+    fprintf(out, "*** DONE PRINTING ***\n");
+}
+
+int vm_profile_enable(struct minivm *vm) {
+    size_t n = vm->program_len + 1;
+    if (vm->profiling) {
+        return 0;
+    }
+    vm->branch_taken = calloc(n, sizeof(unsigned long));
+    vm->branch_fallthrough = calloc(n, sizeof(unsigned long));
+    vm->call_count = calloc(n, sizeof(unsigned long));
+    if (vm->branch_taken == NULL || vm->branch_fallthrough == NULL ||
+        vm->call_count == NULL) {
+        return -1;
+    }
+    vm->profiling = 1;
+    return 0;
+}
+
+void vm_profile_counts(const struct minivm *vm,
+                       int pc,
+                       unsigned long *taken,
+                       unsigned long *fallthrough,
+                       unsigned long *calls) {
+    if (!vm->profiling || pc < 0 || (size_t)pc > vm->program_len) {
+        *taken = *fallthrough = *calls = 0;
+        return;
+    }
+    *taken = vm->branch_taken[pc];
+    *fallthrough = vm->branch_fallthrough[pc];
+    *calls = vm->call_count[pc];
+}
+
+static void write_output(struct minivm *vm, const char *str, size_t len) {
+    if (vm->output == NULL) {
+        fwrite(str, 1, len, stdout);
+        return;
+    }
+    if (vm->output_len < vm->output_capacity) {
+        size_t room = vm->output_capacity - vm->output_len;
+        memcpy(vm->output + vm->output_len, str, len < room ? len : room);
+    }
+    vm->output_len += len;
+}
+
+/* pool workers print through the root VM, one at a time */
+static void output_str(struct minivm *vm, const char *str, size_t len) {
+    struct pool *pool = vm->root->pool;
+    if (pool == NULL) {
+        write_output(vm, str, len);
+        return;
+    }
+    pthread_mutex_lock(&pool->io_lock);
+    write_output(vm->root, str, len);
+    pthread_mutex_unlock(&pool->io_lock);
+}
+
+/* would READC return without blocking */
+static int input_ready(struct minivm *vm) {
+    struct pollfd stdin_poll;
+    if (vm->input != NULL || vm->stdin_pos < vm->stdin_len) {
+        return 1;
+    }
+    stdin_poll.fd = STDIN_FILENO;
+    stdin_poll.events = POLLIN;
+    return poll(&stdin_poll, 1, 0) != 0;
+}
+
+static int read_input(struct minivm *vm) {
+    if (vm->input == NULL) {
+        if (vm->stdin_pos >= vm->stdin_len) {
+            ssize_t got;
+            fflush(stdout);
+            got = read(STDIN_FILENO, vm->stdin_buff, STDIN_BUFFER_SIZE);
+            if (got <= 0) {
+                return EOF;
+            }
+            vm->stdin_len = got;
+            vm->stdin_pos = 0;
+        }
+        return (unsigned char)vm->stdin_buff[vm->stdin_pos++];
+    }
+    if (vm->input_pos >= vm->input_len) {
+        return EOF;
+    }
+    return (unsigned char)vm->input[vm->input_pos++];
+}
+
+static int input_char(struct minivm *vm) {
+    struct pool *pool = vm->root->pool;
+    int c;
+    if (pool == NULL) {
+        return read_input(vm);
+    }
+    pthread_mutex_lock(&pool->io_lock);
+    c = read_input(vm->root);
+    pthread_mutex_unlock(&pool->io_lock);
+    return c;
+}
+
+static int fail(struct minivm *vm, const char *message) {
+    vm->error = message;
+    return -1;
+}
+
+static struct task *find_task(struct minivm *vm, int id) {
+    int slot = (id & TASK_SLOT_MASK) - 1;
+    struct task *task;
+    if (id == 0) {
+        return &vm->main_task;
+    }
+    if (slot < 0 || slot >= vm->num_chunks * TASK_CHUNK) {
+        return NULL;
+    }
+    task = &vm->chunks[slot / TASK_CHUNK][slot % TASK_CHUNK];
+    return task->id == id ? task : NULL;
+}
+
+/* TASK_CHUNK tasks and their stacks, linked onto *free_list */
+static struct task *new_task_chunk(int first_id,
+                                   int parallel,
+                                   struct task **free_list) {
+    size_t stack_words = VM_TASK_STACK_SIZE + 1 + VM_TASK_CALL_STACK_SIZE;
+    struct task *chunk;
+    int *words;
+    int i;
+
+    chunk = calloc(1, TASK_CHUNK * (sizeof(struct task) +
+                                    stack_words * sizeof(int)));
+    if (chunk == NULL) {
+        return NULL;
+    }
+    words = (int *)(chunk + TASK_CHUNK);
+    for (i = TASK_CHUNK - 1; i >= 0; i--) {
+        chunk[i].id = first_id + i;
+        chunk[i].stack = words + i * stack_words;
+        chunk[i].call_stack = chunk[i].stack + VM_TASK_STACK_SIZE + 1;
+        chunk[i].stack_size = VM_TASK_STACK_SIZE;
+        chunk[i].call_stack_size = VM_TASK_CALL_STACK_SIZE;
+        chunk[i].parallel = parallel;
+        chunk[i].next = *free_list;
+        *free_list = &chunk[i];
+    }
+    return chunk;
+}
+
+static int add_task_chunk(struct minivm *vm) {
+    struct task **chunks;
+    struct task *chunk;
+
+    if ((vm->num_chunks + 1) * TASK_CHUNK > TASK_SLOT_MASK) {
+        return -1;
+    }
+    chunks = realloc(vm->chunks, (vm->num_chunks + 1) * sizeof(*chunks));
+    if (chunks == NULL) {
+        return -1;
+    }
+    vm->chunks = chunks;
+    chunk = new_task_chunk(vm->num_chunks * TASK_CHUNK + 1, 0,
+                           &vm->free_tasks);
+    if (chunk == NULL) {
+        return -1;
+    }
+    vm->chunks[vm->num_chunks++] = chunk;
+    return 0;
+}
+
+static void enqueue(struct minivm *vm, struct task *task) {
+    task->next = NULL;
+    task->prev = vm->run_tail;
+    if (vm->run_tail != NULL) {
+        vm->run_tail->next = task;
+    } else {
+        vm->run_head = task;
+    }
+    vm->run_tail = task;
+}
+
+static void dequeue(struct minivm *vm, struct task *task) {
+    if (task->prev != NULL) {
+        task->prev->next = task->next;
+    } else {
+        vm->run_head = task->next;
+    }
+    if (task->next != NULL) {
+        task->next->prev = task->prev;
+    } else {
+        vm->run_tail = task->prev;
+    }
+}
+
+/* save the registers of the current task and load those of next */
+static void switch_to(struct minivm *vm, struct task *next) {
+    struct task *task = vm->current;
+    task->pc = vm->pc;
+    task->sp = vm->sp;
+    task->cp = vm->cp;
+    vm->current = next;
+    vm->pc = next->pc;
+    vm->sp = next->sp;
+    vm->cp = next->cp;
+    vm->stack = next->stack;
+    vm->call_stack = next->call_stack;
+    vm->stack_size = next->stack_size;
+    vm->call_stack_size = next->call_stack_size;
+}
+
+/* round robin: the current task goes to the back of the run queue */
+static void yield(struct minivm *vm) {
+    struct task *next = vm->run_head;
+    if (next == NULL) {
+        return;
+    }
+    dequeue(vm, next);
+    enqueue(vm, vm->current);
+    switch_to(vm, next);
+}
+
+/* a coroutine ran off its outermost call or halted */
+static void finish_task(struct minivm *vm) {
+    struct task *task = vm->current;
+    struct task *next = vm->run_head;
+    dequeue(vm, next);
+    switch_to(vm, next);
+
+    /* the next generation of this slot gets a new id */
+    task->id += 1 << TASK_SLOT_BITS;
+    task->id &= 0x7fffffff;
+    task->next = vm->free_tasks;
+    vm->free_tasks = task;
+    vm->num_tasks--;
+}
+
+static int create_task(struct minivm *vm, int start, int argument) {
+    struct task *task;
+    if (vm->free_tasks == NULL && add_task_chunk(vm) != 0) {
+        return -1;
+    }
+    task = vm->free_tasks;
+    vm->free_tasks = task->next;
+    task->pc = start;
+    task->sp = 0;
+    task->stack[0] = argument;
+    task->cp = 1;
+    task->call_stack[0] = 0; /* returns to HALT, which ends the task */
+    task->waiting_input = 0;
+    enqueue(vm, task);
+    vm->num_tasks++;
+    return task->id;
+}
+
+/*
+ * Parallel tasks
+ *
+ * Each worker owns a deque. SPAWN pushes onto the spawning worker's
+ * deque, idle workers steal from the top of a random victim. JOIN runs
+ * other tasks until the joined one is done, starting with the youngest
+ * of its own, which is usually the one being joined.
+ */
+static int execute(struct minivm *vm);
+
+static unsigned long next_random(struct worker *worker) {
+    worker->seed = worker->seed * 6364136223846793005UL + 1442695040888963407UL;
+    return worker->seed >> 33;
+}
+
+static struct task *find_work(struct worker *worker) {
+    struct pool *pool = worker->pool;
+    struct task *task = deque_pop(&worker->deque);
+    int tries;
+    if (task != NULL || pool->num_workers == 1) {
+        return task;
+    }
+    for (tries = 0; tries < 2 * pool->num_workers; tries++) {
+        struct worker *victim =
+            &pool->workers[next_random(worker) % pool->num_workers];
+        if (victim != worker &&
+            (task = deque_steal(&victim->deque)) != NULL) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void record_failure(struct pool *pool, const char *message) {
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->failed) {
+        pool->failed = 1;
+        strcpy(pool->error, message); /* a task's error, fits */
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* run task to completion on vm, the interrupted task continues after */
+static void run_task(struct minivm *vm, struct task *task) {
+    struct task *interrupted = vm->current;
+    struct pool *pool = vm->root->pool;
+    int status;
+    int result = 0;
+
+    switch_to(vm, task);
+    while ((status = execute(vm)) == 1) {
+        vm->instruction_count++;
+    }
+    task->error[0] = '\0';
+    if (status == 4) {
+        result = vm->stack[vm->sp];
+    } else {
+        const char *message = status < 0 ?
+            vm->error : "SNAPSHOT inside a parallel task";
+        sprintf(task->error, "%.63s", message);
+        record_failure(pool, task->error);
+        vm->error = NULL;
+    }
+    switch_to(vm, interrupted);
+
+    /* the joiner may free the task as soon as done is set */
+    task->result = result;
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+}
+
+/* run one task that is ready, if there is one */
+static void help(struct minivm *vm) {
+    struct task *task = find_work(vm->worker);
+    if (task != NULL) {
+        run_task(vm, task);
+    } else {
+        sched_yield();
+    }
+}
+
+/* idle workers sleep until a task is pushed or the pool stops */
+static struct task *wait_for_work(struct worker *worker) {
+    struct pool *pool = worker->pool;
+    for (;;) {
+        unsigned long pushed = __atomic_load_n(&pool->pushed,
+                                               __ATOMIC_SEQ_CST);
+        struct task *task = find_work(worker);
+        if (task != NULL) {
+            return task;
+        }
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (!pool->shutdown &&
+               __atomic_load_n(&pool->pushed, __ATOMIC_SEQ_CST) == pushed) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct task *task;
+    while ((task = wait_for_work(worker)) != NULL) {
+        run_task(worker->vm, task);
+    }
+    return NULL;
+}
+
+/* a VM for a pool thread, sharing program and storage with root */
+static struct minivm *new_worker_vm(struct minivm *root) {
+    struct minivm *vm = calloc(1, sizeof(struct minivm));
+    if (vm == NULL) {
+        return NULL;
+    }
+    vm->program = root->program;
+    vm->program_len = root->program_len;
+    vm->code = root->code;
+    vm->offsets = root->offsets;
+    vm->next_pc = -1;
+    memcpy(vm->immediate_size, root->immediate_size,
+           sizeof(vm->immediate_size));
+    vm->storage = root->storage;
+    vm->storage_size = root->storage_size;
+    vm->root = root;
+    vm->snapshot_pc = -1;
+    vm->current = &vm->main_task;
+    return vm;
+}
+
+static int start_pool(struct minivm *vm) {
+    struct pool *pool;
+    int n = vm->num_threads;
+    int i;
+
+    if (n <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 0 ? (int)cpus : 1;
+    }
+    pool = calloc(1, sizeof(struct pool));
+    if (pool == NULL) {
+        return -1;
+    }
+    pool->workers = calloc(n, sizeof(struct worker));
+    if (pool->workers == NULL) {
+        free(pool);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->io_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    for (i = 0; i < n; i++) {
+        struct worker *worker = &pool->workers[i];
+        deque_init(&worker->deque);
+        worker->pool = pool;
+        worker->seed = i + 1;
+        worker->vm = i == 0 ? vm : new_worker_vm(vm);
+        if (worker->vm == NULL) {
+            break;
+        }
+        worker->vm->worker = worker;
+    }
+    pool->num_workers = i;
+    vm->pool = pool;
+    /* a worker without a thread is never pushed to, stealing from it is
+     * harmless */
+    for (i = 1; i < pool->num_workers; i++) {
+        struct worker *worker = &pool->workers[i];
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            break;
+        }
+    }
+    pool->num_started = i - 1;
+    return 0;
+}
+
+/* help until every spawned task has finished */
+static void wait_for_tasks(struct minivm *vm) {
+    while (__atomic_load_n(&vm->pool->pending, __ATOMIC_ACQUIRE) > 0) {
+        help(vm);
+    }
+}
+
+static void stop_pool(struct minivm *vm) {
+    struct pool *pool = vm->pool;
+    int i;
+    if (pool == NULL || vm->root != vm) {
+        return;
+    }
+    wait_for_tasks(vm);
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->num_workers; i++) {
+        if (i <= pool->num_started) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+        free(pool->workers[i].vm);
+    }
+    for (i = 0; i < pool->num_chunks; i++) {
+        free(pool->chunks[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->io_lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->workers);
+    free(pool);
+    vm->pool = NULL;
+}
+
+/* every parallel task back on worker 0's free list, the chunks are kept */
+static void reset_pool(struct minivm *vm) {
+    struct pool *pool = vm->pool;
+    int i;
+    int j;
+    if (pool == NULL) {
+        return;
+    }
+    wait_for_tasks(vm);
+    for (i = 0; i < pool->num_workers; i++) {
+        pool->workers[i].free_tasks = NULL;
+        pool->workers[i].vm->instruction_count = 0;
+    }
+    for (i = pool->num_chunks - 1; i >= 0; i--) {
+        for (j = TASK_CHUNK - 1; j >= 0; j--) {
+            struct task *task = &pool->chunks[i][j];
+            task->live = 0;
+            task->next = pool->workers[0].free_tasks;
+            pool->workers[0].free_tasks = task;
+        }
+    }
+    pool->failed = 0;
+}
+
+static struct task *alloc_parallel_task(struct worker *worker) {
+    struct pool *pool = worker->pool;
+    struct task *task;
+    if (worker->free_tasks == NULL) {
+        struct task *chunk = NULL;
+        pthread_mutex_lock(&pool->lock);
+        if (pool->num_chunks < MAX_POOL_CHUNKS) {
+            chunk = new_task_chunk(pool->num_chunks * TASK_CHUNK + 1, 1,
+                                   &worker->free_tasks);
+        }
+        if (chunk != NULL) {
+            __atomic_store_n(&pool->chunks[pool->num_chunks], chunk,
+                             __ATOMIC_RELEASE);
+            pool->num_chunks++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+    task = worker->free_tasks;
+    worker->free_tasks = task->next;
+    return task;
+}
+
+static struct task *find_parallel_task(struct minivm *vm, int handle) {
+    struct pool *pool = vm->root->pool;
+    struct task *chunk;
+    int slot = handle - 1;
+    if (pool == NULL || slot < 0 || slot >= MAX_POOL_CHUNKS * TASK_CHUNK) {
+        return NULL;
+    }
+    chunk = __atomic_load_n(&pool->chunks[slot / TASK_CHUNK],
+                            __ATOMIC_ACQUIRE);
+    return chunk == NULL ? NULL : &chunk[slot % TASK_CHUNK];
+}
+
+/* returns the new task's handle, or -1 with vm->error set */
+static int spawn(struct minivm *vm, int start, const int *args, int argc) {
+    struct pool *pool;
+    struct task *task;
+    if (vm->root->pool == NULL && start_pool(vm) != 0) {
+        return fail(vm, "could not start the thread pool");
+    }
+    pool = vm->root->pool;
+    task = alloc_parallel_task(vm->worker);
+    if (task == NULL) {
+        return fail(vm, "too many parallel tasks");
+    }
+    task->pc = start;
+    task->sp = argc;
+    task->stack[0] = 0;
+    memcpy(task->stack + 1, args, argc * sizeof(int));
+    task->cp = 1;
+    task->call_stack[0] = 0; /* returns to HALT, which ends the task */
+    task->done = 0;
+    task->live = 1;
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+
+    if (deque_push(&vm->worker->deque, task) != 0) {
+        /* the deque is full, run it now instead */
+        run_task(vm, task);
+        return task->id;
+    }
+    __atomic_add_fetch(&pool->pushed, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return task->id;
+}
+
+/* returns 0 with the task's result in *result, or -1 with vm->error set */
+static int join(struct minivm *vm, int handle, int *result) {
+    struct task *task = find_parallel_task(vm, handle);
+    int live = 1;
+    if (task == NULL ||
+        !__atomic_compare_exchange_n(&task->live, &live, 0, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return fail(vm, "JOIN of an invalid task handle");
+    }
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        help(vm);
+    }
+    *result = task->result;
+    task->next = vm->worker->free_tasks;
+    vm->worker->free_tasks = task;
+    if (task->error[0] != '\0') {
+        strcpy(vm->error_buff, task->error);
+        return fail(vm, vm->error_buff);
+    }
+    return 0;
+}
+
+#ifdef DEBUG
+static void print_call_stack(struct minivm *vm) {
+    int i;
+    printf("CP = %d\n", vm->cp);
+    for (i = 0; i < vm->cp; ++i) {
+        printf("CALL STACK[%d] = %d\n", i, vm->call_stack[i]);
+    }
+}
+#endif
+
+/* a little endian, sign extended immediate of size bytes */
+static int read_immediate(const unsigned char *bytes, int size) {
+    switch (size) {
+        case 1:
+            return (signed char)bytes[0];
+        case 2:
+            return (signed char)bytes[1] * 256 + bytes[0];
+        default:
+            return (int)((((long)(signed char)bytes[3] * 256 + bytes[2]) *
+                          256 + bytes[1]) * 256 + bytes[0]);
+    }
+}
+
+/*
+ * Execute the instruction at pc.
+ * Returns 1 to keep running, 0 on HALT and -1 on error. A snapshot point
+ * returns 2 after a SNAPSHOT instruction and 3 at a vm_snapshot_at address,
+ * which has not executed yet. A parallel task returns 4 when it ends.
+ */
+static int execute(struct minivm *vm) {
+    int *program = vm->program;
+    int *stack = vm->stack;
+    int inst;
+    int immediate = 0;
+    int ip;
+
+    if (vm->pc < 0 || (size_t)vm->pc > vm->program_len) {
+        return fail(vm, "PC out of bounds");
+    }
+
+    if (vm->sp >= vm->stack_size) {
+        return fail(vm, "SP out of bounds");
+    }
+
+    if (vm->sp < 0) {
+        return fail(vm, "SP less than zero");
+    }
+
+    ip = vm->pc == vm->next_pc ? vm->next_ip : vm->offsets[vm->pc];
+    if (ip >= 0 && vm->code[ip] != ENCODING_RAW) {
+        const unsigned char *bytes = vm->code + ip;
+        int size = vm->immediate_size[bytes[0]];
+        inst = ENCODING_OPCODE(bytes[0]);
+        vm->next_pc = vm->pc + 1;
+        vm->next_ip = ip + 1;
+        if (size > 0) {
+            immediate = read_immediate(bytes + 1, size);
+            vm->next_pc++;
+            vm->next_ip += size;
+        }
+    } else {
+        inst = program[vm->pc];
+        if (inst >= 0 && inst < num_opcodes && requires_immediate(inst)) {
+            if ((size_t)vm->pc + 1 > vm->program_len) {
+                return fail(vm, "missing immediate");
+            }
+            immediate = program[vm->pc+1];
+        }
+    }
+
+#ifdef DEBUG
+    printf("\nINST: %s:%d, PC: %d, SP: %d, TOP: %d\n",
+           inst >= 0 && inst < num_opcodes ? inst_names[inst] : "?",
+           inst, vm->pc, vm->sp, stack[vm->sp]);
+#endif
+
+    switch (inst) {
+
+        case NOP:
+            break;
+
+        case PUSH:
+            vm->sp++;
+            stack[vm->sp] = immediate;
+            ++vm->pc;
+            break;
+
+        case SAVE:
+        {
+            int address = stack[vm->sp--];
+            int value = stack[vm->sp--];
+            if (address < 0 || address >= vm->storage_size) {
+                return fail(vm, "storage address out of bounds");
+            }
+            vm->storage[address] = value;
+        }
+            break;
+
+        case LOAD:
+        {
+            int address = stack[vm->sp];
+            if (address < 0 || address >= vm->storage_size) {
+                return fail(vm, "storage address out of bounds");
+            }
+            stack[vm->sp] = vm->storage[address];
+            break;
+        }
+
+        case J:
+            vm->pc = immediate;
+            return 1;
+
+        case CALL:
+            if (vm->profiling) {
+                vm->call_count[vm->pc]++;
+            }
+            if (vm->cp >= vm->call_stack_size) {
+                return fail(vm, "call stack overflow");
+            }
+            vm->call_stack[vm->cp++] = vm->pc + 2;
+            vm->pc = immediate;
+#ifdef DEBUG
+            printf("J target: %d\n", vm->pc);
+#endif
+            return 1;
+
+        /* Tail call, the callee returns directly to our caller,
+         * so the call stack does not grow
+         */
+        case TCALL:
+            if (vm->profiling) {
+                vm->call_count[vm->pc]++;
+            }
+            vm->pc = immediate;
+#ifdef DEBUG
+            printf("TCALL target: %d\n", vm->pc);
+#endif
+            return 1;
+
+        case JZ:
+            if (stack[vm->sp] == 0) {
+                if (vm->profiling) {
+                    vm->branch_taken[vm->pc]++;
+                }
+                vm->pc = immediate;
+                return 1;
+            }
+            if (vm->profiling) {
+                vm->branch_fallthrough[vm->pc]++;
+            }
+            vm->pc++;
+            break;
+
+        case JLEZ:
+            if (stack[vm->sp] <= 0) {
+                if (vm->profiling) {
+                    vm->branch_taken[vm->pc]++;
+                }
+                vm->pc = immediate;
+                return 1;
+            }
+            if (vm->profiling) {
+                vm->branch_fallthrough[vm->pc]++;
+            }
+            vm->pc++;
+            break;
+
+        /* Jump if Not Zero */
+        case JNZ:
+            if (stack[vm->sp] != 0) {
+                if (vm->profiling) {
+                    vm->branch_taken[vm->pc]++;
+                }
+                vm->pc = immediate;
+                return 1;
+            }
+            if (vm->profiling) {
+                vm->branch_fallthrough[vm->pc]++;
+            }
+            vm->pc++;
+            break;
+
+        /*
+         * Jump table, JTAB n is followed by n + 1 J instructions. Goes to
+         * the i-th of them for i on top of the stack, or to the last one
+         * when i is not in 0..n-1. Like JZ it leaves i on the stack.
+         */
+        case JTAB:
+            {
+            int n = immediate;
+            int i = stack[vm->sp];
+            if (n < 0) {
+                return fail(vm, "JTAB size out of bounds");
+            }
+            if (i < 0 || i >= n) {
+                i = n;
+            }
+            vm->pc += 2 + 2 * i;
+            }
+            return 1;
+
+        /* Return from subroutine,
+         * Sets PC to the top address from call_stack[]
+         */
+        case RET:
+            if (vm->cp <= 0) {
+                return fail(vm, "call stack underflow");
+            }
+            vm->cp--;
+            vm->pc = vm->call_stack[vm->cp];
+#ifdef DEBUG
+            print_call_stack(vm);
+            printf("PC = %d, RETURNING TO: %d\n", vm->pc, program[vm->pc]);
+#endif
+            return 1;
+
+        case POPC:
+            vm->cp--;
+            break;
+
+        case ADD:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a + b;
+            }
+            break;
+
+        case SUB:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a - b;
+            }
+            break;
+
+        case MUL:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a * b;
+            }
+            break;
+
+        case DIV:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            if (b == 0) {
+                return fail(vm, "division by zero");
+            }
+            stack[vm->sp] = a / b;
+            }
+            break;
+
+        case MOD:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            if (b == 0) {
+                return fail(vm, "division by zero");
+            }
+            stack[vm->sp] = a % b;
+            }
+            break;
+
+        case EQ:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a == b;
+            }
+            break;
+
+        case NE:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a != b;
+            }
+            break;
+
+        case LT:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a < b;
+            }
+            break;
+
+        case LE:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a <= b;
+            }
+            break;
+
+        case GT:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a > b;
+            }
+            break;
+
+        case GE:
+            {
+            int a = stack[vm->sp--];
+            int b = stack[vm->sp];
+            stack[vm->sp] = a >= b;
+            }
+            break;
+
+        case NOT:
+            stack[vm->sp] = !stack[vm->sp];
+            break;
+
+        case PRINTI:
+            {
+            char buff[16];
+            sprintf(buff, "%d", stack[vm->sp]);
+            output_str(vm, buff, strlen(buff));
+            }
+            break;
+
+        case PRINTC:
+            {
+            char c = (char)stack[vm->sp];
+            output_str(vm, &c, 1);
+            }
+            break;
+
+        /*
+         * strings live in the DATA block after the code, a length and
+         * then one character per word
+         */
+        case PRINTS:
+            {
+            char buff[256];
+            int chunk = (int)sizeof(buff);
+            int address = immediate;
+            int len;
+            int i;
+            if (address < 1 || (size_t)address > vm->program_len ||
+                (len = program[address]) < 0 ||
+                (size_t)len > vm->program_len - address) {
+                return fail(vm, "PRINTS address out of bounds");
+            }
+            for (i = 0; i < len; i += chunk) {
+                int n = len - i < chunk ? len - i : chunk;
+                int j;
+                for (j = 0; j < n; j++) {
+                    buff[j] = (char)program[address + 1 + i + j];
+                }
+                output_str(vm, buff, n);
+            }
+            vm->pc += 2;
+            }
+            return 1;
+
+        /* only reached by falling off the code, step over the data */
+        case DATA:
+            {
+            int n = immediate;
+            if (n < 0 || (size_t)n > vm->program_len - vm->pc - 1) {
+                return fail(vm, "DATA size out of bounds");
+            }
+            vm->pc += n + 2;
+            /* next_ip is the width byte of the words, not past them */
+            vm->next_pc = -1;
+            }
+            return 1;
+
+        case READC:
+            if (vm->run_head != NULL && !vm->current->parallel &&
+                !input_ready(vm)) {
+                /*
+                 * let another task run, unless every task is waiting for
+                 * input, then this one blocks in the read
+                 */
+                struct task *task = vm->current;
+                if (!task->waiting_input) {
+                    task->waiting_input = 1;
+                    vm->num_waiting++;
+                }
+                if (vm->num_waiting <= vm->num_tasks) {
+                    yield(vm);
+                    return 1;
+                }
+            }
+            if (vm->current->waiting_input) {
+                vm->current->waiting_input = 0;
+                vm->num_waiting--;
+            }
+            vm->sp++;
+            stack[vm->sp] = input_char(vm);
+            /* String is done being read once RETURN is pressed */
+            if (stack[vm->sp] == '\n') {
+                stack[vm->sp] = '\0';
+            }
+            break;
+
+        case POP:
+            vm->sp--;
+            break;
+
+        case HALT:
+            if (vm->current->parallel) {
+                return 4;
+            }
+            if (vm->current != &vm->main_task) {
+                finish_task(vm);
+                return 1;
+            }
+            if (vm->pool != NULL) {
+                /* spawned tasks that were never joined still finish */
+                wait_for_tasks(vm);
+                if (vm->pool->failed) {
+                    strcpy(vm->error_buff, vm->pool->error);
+                    return fail(vm, vm->error_buff);
+                }
+            }
+            return 0;
+
+        case COCREATE:
+            if (vm->current->parallel) {
+                return fail(vm, "coroutines inside a parallel task");
+            }
+            {
+            int id = create_task(vm, immediate, stack[vm->sp]);
+            if (id < 0) {
+                return fail(vm, "too many coroutines");
+            }
+            stack[vm->sp] = id;
+            vm->pc += 2;
+            }
+            return 1;
+
+        case YIELD:
+            ++vm->pc;
+            if (!vm->current->parallel) {
+                yield(vm);
+            }
+            return 1;
+
+        case RESUME:
+            if (vm->current->parallel) {
+                return fail(vm, "coroutines inside a parallel task");
+            }
+            {
+            struct task *task = find_task(vm, stack[vm->sp]);
+            ++vm->pc;
+            stack[vm->sp] = task != NULL;
+            if (task != NULL && task != vm->current) {
+                dequeue(vm, task);
+                enqueue(vm, vm->current);
+                switch_to(vm, task);
+            }
+            }
+            return 1;
+
+        case SPAWN:
+            {
+            int argc = stack[vm->sp];
+            int handle;
+            if (argc < 0 || argc > vm->sp ||
+                argc >= VM_TASK_STACK_SIZE) {
+                return fail(vm, "SPAWN argument count out of range");
+            }
+            handle = spawn(vm, immediate,
+                           stack + vm->sp - argc, argc);
+            if (handle < 0) {
+                return -1;
+            }
+            vm->sp -= argc;
+            stack[vm->sp] = handle;
+            vm->pc += 2;
+            }
+            return 1;
+
+        case JOIN:
+            {
+            int result;
+            if (join(vm, stack[vm->sp], &result) != 0) {
+                return -1;
+            }
+            stack[vm->sp] = result;
+            }
+            break;
+
+        case PICK:
+            {
+            int n = immediate;
+            if (n < 0 || n > vm->sp) {
+                return fail(vm, "PICK out of bounds");
+            }
+            vm->sp++;
+            stack[vm->sp] = stack[vm->sp - 1 - n];
+            vm->pc += 2;
+            }
+            return 1;
+
+        case PUT:
+            {
+            int n = immediate;
+            if (n < 0 || n >= vm->sp) {
+                return fail(vm, "PUT out of bounds");
+            }
+            stack[vm->sp - 1 - n] = stack[vm->sp];
+            vm->sp--;
+            vm->pc += 2;
+            }
+            return 1;
+
+        case ALOAD:
+            {
+            int address = stack[vm->sp];
+            if (address < 0 || address >= vm->storage_size) {
+                return fail(vm, "storage address out of bounds");
+            }
+            stack[vm->sp] = __atomic_load_n(&vm->storage[address],
+                                             __ATOMIC_SEQ_CST);
+            }
+            break;
+
+        case ASTORE:
+            {
+            int address = stack[vm->sp--];
+            int value = stack[vm->sp--];
+            if (address < 0 || address >= vm->storage_size) {
+                return fail(vm, "storage address out of bounds");
+            }
+            __atomic_store_n(&vm->storage[address], value, __ATOMIC_SEQ_CST);
+            }
+            break;
+
+        case AADD:
+            {
+            int address = stack[vm->sp--];
+            if (address < 0 || address >= vm->storage_size) {
+                return fail(vm, "storage address out of bounds");
+            }
+            stack[vm->sp] = __atomic_fetch_add(&vm->storage[address],
+                                               stack[vm->sp],
+                                               __ATOMIC_SEQ_CST);
+            }
+            break;
+
+        /*
+         * Block operations on storage, n is on top and the range is
+         * checked once for the whole block
+         *
+         * BCOPY: dst src n ->     storage[dst..] = storage[src..]
+         * BFILL: value dst n ->   storage[dst..] = value
+         * BCMP:  a b n -> result  <0, 0 or >0, like memcmp
+         */
+        case BCOPY:
+        case BFILL:
+        case BCMP:
+            {
+            int n;
+            int b;
+            int a;
+            int *storage = vm->storage;
+            int i;
+            if (vm->sp < 2) {
+                return fail(vm, "SP less than zero");
+            }
+            n = stack[vm->sp];
+            b = stack[vm->sp - 1];   /* src, dst, or second range */
+            a = stack[vm->sp - 2];   /* dst, value, or first range */
+            vm->sp -= 3;
+            if (n < 0 || n > vm->storage_size ||
+                b < 0 || b > vm->storage_size - n ||
+                (inst != BFILL && (a < 0 || a > vm->storage_size - n))) {
+                return fail(vm, "storage address out of bounds");
+            }
+            if (inst == BCOPY) {
+                memmove(storage + a, storage + b, n * sizeof(int));
+            } else if (inst == BFILL) {
+                int *cell = storage + b;
+                for (i = 0; i < n; i++) {
+                    cell[i] = a;
+                }
+            } else {
+                for (i = 0; i < n && storage[a + i] == storage[b + i]; i++) {
+                }
+                vm->sp++;
+                stack[vm->sp] = i == n ? 0 :
+                    storage[a + i] < storage[b + i] ? -1 : 1;
+            }
+            }
+            break;
+
+        case SNAPSHOT:
+            if (vm->pc == vm->snapshot_pc) {
+                program[vm->pc] = vm->snapshot_inst;
+                if (vm->offsets[vm->pc] >= 0) {
+                    vm->code[vm->offsets[vm->pc]] = vm->snapshot_byte;
+                }
+                /* decoded as SNAPSHOT, the next instruction is elsewhere */
+                vm->next_pc = -1;
+                vm->snapshot_pc = -1;
+                return 3;
+            }
+            ++vm->pc;
+            return 2;
+
+        default:
+            sprintf(vm->error_buff, "unknown instruction: %d", inst);
+            return fail(vm, vm->error_buff);
+    }
+    ++vm->pc;
+    return 1;
+}
+
+/* start with room for this many records when the trace can grow */
+#define TRACE_INITIAL_RECORDS (1UL << 20)
+
+static size_t trace_size(unsigned long capacity) {
+    return sizeof(struct vm_trace_header) +
+           capacity * sizeof(struct vm_trace_record);
+}
+
+static int map_trace(struct minivm *vm, unsigned long capacity) {
+    void *map;
+    if (ftruncate(vm->trace_fd, trace_size(capacity)) != 0) {
+        return -1;
+    }
+    map = mmap(NULL, trace_size(capacity), PROT_READ | PROT_WRITE,
+               MAP_SHARED, vm->trace_fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    vm->trace = map;
+    vm->trace_records = (struct vm_trace_record *)(vm->trace + 1);
+    return 0;
+}
+
+int vm_trace_open(struct minivm *vm, const char *filename,
+                  unsigned long last) {
+    unsigned long capacity = last > 0 ? last : TRACE_INITIAL_RECORDS;
+    if (vm->trace != NULL) {
+        return -1;
+    }
+    vm->trace_fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (vm->trace_fd < 0) {
+        return -1;
+    }
+    if (map_trace(vm, capacity) != 0) {
+        close(vm->trace_fd);
+        vm->trace = NULL;
+        return -1;
+    }
+    vm->trace->magic = VM_TRACE_MAGIC;
+    vm->trace->version = VM_TRACE_VERSION;
+    vm->trace->record_size = sizeof(struct vm_trace_record);
+    vm->trace->wraps = last > 0;
+    vm->trace->capacity = capacity;
+    vm->trace->head = 0;
+    vm->trace_slot = 0;
+    return 0;
+}
+
+int vm_trace_close(struct minivm *vm) {
+    struct vm_trace_header *trace = vm->trace;
+    unsigned long mapped;
+    unsigned long used;
+    int wraps;
+    int result = 0;
+    if (trace == NULL) {
+        return 0;
+    }
+    /* a trace that never wrapped is cut down to the records written */
+    mapped = trace->capacity;
+    used = trace->head < mapped ? trace->head : mapped;
+    wraps = trace->wraps;
+    if (!wraps) {
+        trace->capacity = used;
+    }
+    if (munmap(trace, trace_size(mapped)) != 0 ||
+        (!wraps && ftruncate(vm->trace_fd, trace_size(used)) != 0)) {
+        result = -1;
+    }
+    if (close(vm->trace_fd) != 0) {
+        result = -1;
+    }
+    vm->trace = NULL;
+    vm->trace_records = NULL;
+    return result;
+}
+
+/* double the file and map it again */
+static int grow_trace(struct minivm *vm) {
+    unsigned long capacity = vm->trace->capacity;
+    if (munmap(vm->trace, trace_size(capacity)) != 0 ||
+        map_trace(vm, capacity * 2) != 0) {
+        close(vm->trace_fd);
+        vm->trace = NULL;
+        return -1;
+    }
+    vm->trace->capacity = capacity * 2;
+    return 0;
+}
+
+static int trace_instruction(struct minivm *vm) {
+    struct vm_trace_header *trace = vm->trace;
+    struct vm_trace_record *record;
+    int pc = vm->pc;
+    int sp = vm->sp;
+
+    if (vm->trace_slot == trace->capacity) {
+        if (trace->wraps) {
+            vm->trace_slot = 0;
+        } else if (grow_trace(vm) != 0) {
+            return fail(vm, "could not grow the trace");
+        } else {
+            trace = vm->trace;
+        }
+    }
+    record = &vm->trace_records[vm->trace_slot++];
+    record->pc = pc;
+    record->opcode = -1;
+    if (pc >= 0 && (size_t)pc <= vm->program_len) {
+        record->opcode = pc == vm->snapshot_pc ? vm->snapshot_inst
+                                               : vm->program[pc];
+    }
+    record->top = sp >= 0 && sp <= vm->stack_size ? vm->stack[sp] : 0;
+    record->sp = sp;
+    __atomic_store_n(&trace->head, trace->head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+vm_status vm_run(struct minivm *vm, unsigned long budget) {
+    unsigned long executed;
+    for (executed = 0; budget == 0 || executed < budget; executed++) {
+        int result;
+        if (vm->trace != NULL && trace_instruction(vm) < 0) {
+            return VM_ERROR;
+        }
+        result = execute(vm);
+        if (result <= 0) {
+            return result == 0 ? VM_HALTED : VM_ERROR;
+        }
+        if (result == 3) {
+            return VM_SNAPSHOT;
+        }
+        vm->instruction_count++;
+        if (result == 2) {
+            return VM_SNAPSHOT;
+        }
+#ifdef DEBUG
+        vm_print_stack(vm, stdout);
+#endif
+    }
+    return VM_BUDGET_EXHAUSTED;
+}
+
+enum {
+    SNAPSHOT_MAGIC = 0x534d564d, /* "MVMS" */
+    SNAPSHOT_VERSION = 2,
+    SNAPSHOT_HEADER = 8
+};
+
+int vm_snapshot_at(struct minivm *vm, int pc) {
+    if (pc < 1 || (size_t)pc > vm->program_len || vm->snapshot_pc >= 0) {
+        return -1;
+    }
+    vm->snapshot_pc = pc;
+    vm->snapshot_inst = vm->program[pc];
+    vm->program[pc] = SNAPSHOT;
+    if (vm->offsets[pc] >= 0) {
+        vm->snapshot_byte = vm->code[vm->offsets[pc]];
+        vm->code[vm->offsets[pc]] = SNAPSHOT;
+    }
+    return 0;
+}
+
+static int write_words(const int *words, size_t n, FILE *out) {
+    return fwrite(words, sizeof(int), n, out) == n ? 0 : -1;
+}
+
+int vm_snapshot_write(const struct minivm *vm, FILE *out) {
+    int header[SNAPSHOT_HEADER];
+    int storage_len = vm->storage_size;
+    size_t len = vm->program_len;
+    const int *program = vm->program + 1;
+    size_t patched = len;
+
+    while (storage_len > 0 && vm->storage[storage_len - 1] == 0) {
+        storage_len--;
+    }
+    header[0] = SNAPSHOT_MAGIC;
+    header[1] = SNAPSHOT_VERSION;
+    header[2] = vm->pc;
+    header[3] = vm->sp;
+    header[4] = vm->cp;
+    header[5] = (int)len;
+    header[6] = storage_len;
+    header[7] = vm->storage_size;
+
+    /* only the main task's state is saved */
+    if (vm->num_tasks > 0 ||
+        (vm->pool != NULL && __atomic_load_n(&vm->pool->pending,
+                                             __ATOMIC_ACQUIRE) > 0)) {
+        return -1;
+    }
+
+    /* save the program as loaded, without a pending vm_snapshot_at patch */
+    if (vm->snapshot_pc >= 0) {
+        patched = vm->snapshot_pc - 1;
+    }
+    if (write_words(header, SNAPSHOT_HEADER, out) != 0 ||
+        write_words(program, patched, out) != 0 ||
+        (patched < len &&
+         (write_words(&vm->snapshot_inst, 1, out) != 0 ||
+          write_words(program + patched + 1, len - patched - 1, out) != 0)) ||
+        write_words(vm->stack, vm->sp + 1, out) != 0 ||
+        write_words(vm->call_stack, vm->cp, out) != 0 ||
+        write_words(vm->storage, storage_len, out) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+struct minivm *vm_restore(const void *snapshot, size_t size) {
+    const int *words = snapshot;
+    size_t num_words = size / sizeof(int);
+    const int *header = words;
+    struct minivm *vm;
+    size_t len;
+    int sp;
+    int cp;
+    int storage_len;
+    int storage_size;
+
+    if (size % sizeof(int) != 0 || num_words < SNAPSHOT_HEADER ||
+        header[0] != SNAPSHOT_MAGIC || header[1] != SNAPSHOT_VERSION) {
+        return NULL;
+    }
+    sp = header[3];
+    cp = header[4];
+    storage_len = header[6];
+    storage_size = header[7];
+    if (header[5] < 0 ||
+        sp < 0 || sp >= VM_STACK_SIZE ||
+        cp < 0 || cp > VM_CALL_STACK_SIZE ||
+        storage_len < 0 || storage_len > storage_size) {
+        return NULL;
+    }
+    len = (size_t)header[5];
+    if (num_words != SNAPSHOT_HEADER + len + sp + 1 + cp + storage_len) {
+        return NULL;
+    }
+
+    words += SNAPSHOT_HEADER;
+    /* vm_new_storage checks storage_size */
+    vm = vm_new_storage(words, len, storage_size);
+    if (vm == NULL) {
+        return NULL;
+    }
+    words += len;
+    memcpy(vm->stack, words, (sp + 1) * sizeof(int));
+    words += sp + 1;
+    memcpy(vm->call_stack, words, cp * sizeof(int));
+    words += cp;
+    memcpy(vm->storage, words, storage_len * sizeof(int));
+    vm->pc = header[2];
+    vm->sp = sp;
+    vm->cp = cp;
+    return vm;
+}
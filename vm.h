@@ -0,0 +1,275 @@
+/*
+ * Author: Kyle Kloberdanz
+ * Project Start Date: 27 Nov 2018
+ * License: GNU GPLv3 (see LICENSE.txt)
+ *     This file is part of minic.
+ *
+ *     minic is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     minic is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with minic.  If not, see <https://www.gnu.org/licenses/>.
+ * File: vm.h
+ */
+
+/*
+ * libminivm: the stack machine as an embeddable library.
+ *
+ * All memory is allocated by vm_new. Running, resetting and re-running a
+ * loaded program does not allocate, so one VM can serve many requests.
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define VM_STACK_SIZE              2000
+#define VM_CALL_STACK_SIZE          500
+/* storage slots of a program that does not give its own count, and the
+ * most a program can ask for */
+#define VM_STORAGE_SIZE             500
+
+/* per coroutine, plus 64 bytes or so of saved registers */
+#define VM_TASK_STACK_SIZE          128
+#define VM_TASK_CALL_STACK_SIZE      32
+
+typedef enum {
+    VM_HALTED,           /* HALT was executed, or main returned */
+    VM_BUDGET_EXHAUSTED, /* instruction budget ran out, vm_run resumes */
+    VM_SNAPSHOT,         /* reached a snapshot point, vm_run resumes */
+    VM_ERROR             /* see vm_error() */
+} vm_status;
+
+struct minivm;
+
+/*
+ * Parse the text object format written by minias (one integer per line)
+ * into a newly allocated array. Returns NULL on malformed input.
+ */
+int *vm_parse_program(const char *text, size_t *len);
+
+/* copies len words of code, code[0] is loaded at address 1 */
+struct minivm *vm_new(const int *code, size_t len);
+
+/* like vm_new with storage slots instead of VM_STORAGE_SIZE, which is the
+ * most it allows */
+struct minivm *vm_new_storage(const int *code, size_t len, int storage);
+
+/*
+ * A VM for a text or compact image of size bytes (see encoding.h), with
+ * the storage its header asks for or VM_STORAGE_SIZE. NULL if malformed.
+ */
+struct minivm *vm_load(const char *image, size_t size);
+void vm_destroy(struct minivm *vm);
+
+/* clear stack, storage, output and registers, keeping the program */
+void vm_reset(struct minivm *vm);
+
+/* execute up to budget instructions, 0 means no limit */
+vm_status vm_run(struct minivm *vm, unsigned long budget);
+
+/* storage slots accessed by SAVE and LOAD, return 0 on success */
+int vm_storage_get(const struct minivm *vm, int slot, int *value);
+int vm_storage_set(struct minivm *vm, int slot, int value);
+
+/*
+ * Send PRINTI, PRINTC and PRINTS output to buf instead of stdout. Output past
+ * capacity is dropped but still counted by vm_output_len. Pass NULL to go
+ * back to stdout.
+ */
+void vm_set_output(struct minivm *vm, char *buf, size_t capacity);
+size_t vm_output_len(const struct minivm *vm);
+
+/* read READC input from buf instead of stdin, NULL for stdin */
+void vm_set_input(struct minivm *vm, const char *buf, size_t len);
+
+/* registers and state */
+int vm_pc(const struct minivm *vm);
+int vm_sp(const struct minivm *vm);
+int vm_stack_at(const struct minivm *vm, int index);
+unsigned long vm_instruction_count(const struct minivm *vm);
+const char *vm_error(const struct minivm *vm);
+size_t vm_program_len(const struct minivm *vm);
+const int *vm_program(const struct minivm *vm);
+
+/*
+ * Snapshots
+ *
+ * vm_run returns VM_SNAPSHOT after executing a SNAPSHOT instruction, or
+ * before executing the instruction at the address given to vm_snapshot_at,
+ * which patches that address until it is reached. The host can then save
+ * the state with vm_snapshot_write and carry on with vm_run.
+ *
+ * A snapshot is a sequence of native ints:
+ *
+ *     magic version pc sp cp program_len storage_len storage_size
+ *     program[1..program_len] stack[0..sp] call_stack[0..cp-1]
+ *     storage[0..storage_len-1]
+ *
+ * storage_size is the VM's slot count, storage_len leaves out the trailing
+ * zero slots.
+ */
+int vm_snapshot_at(struct minivm *vm, int pc);        /* 0 on success */
+int vm_snapshot_write(const struct minivm *vm, FILE *out); /* 0 on success */
+
+/* a VM resuming where the snapshot was taken, NULL if it is malformed */
+struct minivm *vm_restore(const void *snapshot, size_t size);
+
+/*
+ * Tracing
+ *
+ * vm_trace_open records every instruction vm_run executes, before it
+ * runs, into a ring of fixed size records in a memory mapped file:
+ *
+ *     struct vm_trace_header, then capacity struct vm_trace_record
+ *
+ * Record n goes to slot n % capacity. With last > 0 the file holds last
+ * records and older ones are overwritten, otherwise it grows as needed.
+ * The writer stores head with release semantics after each record, so a
+ * reader mapping the file while the VM runs sees complete records up to
+ * head. Instructions of parallel tasks run by pool threads are not
+ * traced.
+ */
+#define VM_TRACE_MAGIC 0x544d564d /* "MVMT" */
+#define VM_TRACE_VERSION 1
+
+struct vm_trace_header {
+    int magic;
+    int version;
+    int record_size;
+    int wraps;               /* only the last capacity records are kept */
+    unsigned long capacity;  /* records the file has room for */
+    unsigned long head;      /* records written so far */
+};
+
+struct vm_trace_record {
+    int pc;
+    int opcode;
+    int top;                 /* stack[sp], 0 if sp is out of bounds */
+    int sp;
+};
+
+int vm_trace_open(struct minivm *vm, const char *filename,
+                  unsigned long last);                  /* 0 on success */
+int vm_trace_close(struct minivm *vm); /* also done by vm_destroy */
+
+/*
+ * Coroutines
+ *
+ * COCREATE LABEL starts a task at LABEL. The task's stack starts with a
+ * copy of the creator's top of stack, which COCREATE replaces with the new
+ * task's id. Tasks share storage and have their own stack and call stack.
+ * A task ends when it returns from its outermost call or halts, HALT in
+ * the main task (id 0) still stops the VM.
+ *
+ * YIELD moves the current task to the back of the run queue. RESUME
+ * switches to the task whose id is on top of the stack, replacing it with
+ * 1, or with 0 if that task has ended. READC yields when no input is ready
+ * and some other task is not waiting for input.
+ *
+ * Snapshots are refused while coroutines are alive.
+ */
+int vm_task_count(const struct minivm *vm);   /* live, besides main */
+int vm_current_task(const struct minivm *vm); /* id of the running task */
+
+/*
+ * Parallel tasks
+ *
+ * SPAWN LABEL pops an argument count n and n arguments and starts a task
+ * at LABEL whose stack holds those arguments, leaving a handle in their
+ * place. The task ends when it returns from its outermost call or halts,
+ * its top of stack is the result. JOIN replaces a handle with the result,
+ * each handle is joined at most once. Tasks run on a work stealing pool of
+ * threads, started by the first SPAWN. HALT in the main task waits for
+ * tasks that were never joined, their handles are only reused after
+ * vm_reset.
+ *
+ * PICK n pushes the value n slots below the top and PUT n pops a value
+ * into the slot n below the new top, for locals that should not live in
+ * shared storage.
+ *
+ * Memory model: SAVE and LOAD are plain accesses and race between tasks
+ * unless ordered by SPAWN or JOIN. Everything written before a SPAWN is
+ * visible to the task, everything the task wrote is visible after its
+ * JOIN. ALOAD, ASTORE and AADD (fetch and add, leaves the old value) are
+ * sequentially consistent atomics on storage. Output and input of
+ * different tasks interleave in no particular order.
+ *
+ * Coroutine instructions fail inside a parallel task, and snapshots are
+ * refused while parallel tasks are running.
+ */
+int vm_set_threads(struct minivm *vm, int threads); /* before the first SPAWN,
+                                                       0 for one per CPU */
+
+/*
+ * Lockstep execution
+ *
+ * Runs one program once for each of count instances, VM_LANES instances
+ * at a time in lockstep on vectors of lanes. Instances whose branches go
+ * different ways are masked off and rejoin where their paths meet again.
+ * Each instance's results are the same as running it alone on a new VM.
+ *
+ * READC in instance i returns columns[k * count + i] the k'th time, and
+ * EOF after num_columns. Instances have their own storage, output and
+ * stack. SNAPSHOT does nothing, coroutines and parallel tasks fail.
+ */
+#define VM_LANES 8
+
+struct minivm_batch;
+
+struct minivm_batch *vm_batch_new(const int *code, size_t len, int count);
+
+/* like vm_new_storage, each instance gets storage slots */
+struct minivm_batch *vm_batch_new_storage(const int *code,
+                                          size_t len,
+                                          int count,
+                                          int storage);
+void vm_batch_destroy(struct minivm_batch *batch);
+
+/* columns is not copied and must outlive vm_batch_run */
+void vm_batch_set_input(struct minivm_batch *batch,
+                        const int *columns,
+                        int num_columns);
+
+/* run every instance to HALT or an error, -1 if out of memory */
+int vm_batch_run(struct minivm_batch *batch);
+
+/* results of one instance after vm_batch_run, output is not terminated */
+int vm_batch_count(const struct minivm_batch *batch);
+vm_status vm_batch_status(const struct minivm_batch *batch, int instance);
+const char *vm_batch_error(const struct minivm_batch *batch, int instance);
+const char *vm_batch_output(const struct minivm_batch *batch,
+                            int instance,
+                            size_t *len);
+int vm_batch_sp(const struct minivm_batch *batch, int instance);
+int vm_batch_stack_at(const struct minivm_batch *batch,
+                      int instance,
+                      int index);
+void vm_batch_print_stack(const struct minivm_batch *batch,
+                          int instance,
+                          FILE *out);
+
+/* the stack dump stackmachine prints when it halts */
+void vm_print_stack(const struct minivm *vm, FILE *out);
+
+/*
+ * Count branches and calls per instruction address. Allocates counters
+ * once, returns 0 on success.
+ */
+int vm_profile_enable(struct minivm *vm);
+void vm_profile_counts(const struct minivm *vm,
+                       int pc,
+                       unsigned long *taken,
+                       unsigned long *fallthrough,
+                       unsigned long *calls);
+
+#endif /* VM_H */